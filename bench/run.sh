@@ -0,0 +1,71 @@
+#!/bin/sh
+# Copyright (c) 2018. TIG developer.
+#
+# Runs jupiter-bench once per worker count and prints bench/stats of each
+# run. Build it first with "make bench".
+#
+# Usage: bench/run.sh [tcp|udp] [WORKERS...]
+#   DURATION  seconds per run, 10 by default
+#   PAYLOAD   bytes of each request and response, 64 by default
+#   BACKENDS  real services behind the VIP, 4 by default
+
+set -e
+
+cd "$(dirname "$0")/.."
+
+TARGET=${RTE_TARGET:-x86_64-native-linuxapp-gcc}
+BENCH=core/$TARGET/bench/jupiter-bench
+CTL=cmd/$TARGET/jupiter-ctl
+SOCK=/var/run/jupiter-bench.sock
+LOG=/tmp/jupiter-bench.log
+
+PROTO=${1:-tcp}
+[ $# -gt 0 ] && shift
+WORKERS=${*:-1 2 4}
+DURATION=${DURATION:-10}
+PAYLOAD=${PAYLOAD:-64}
+BACKENDS=${BACKENDS:-4}
+VIP=10.0.0.1:80
+
+CFG=$(mktemp)
+trap 'rm -f $CFG' EXIT
+
+ctl() {
+    $CTL --unixsock=$SOCK "$@"
+}
+
+for n in $WORKERS; do
+    sed "s/^argv = -l [^ ]*/argv = -l 0-$n/" bench/bench.cfg > $CFG
+    $BENCH --conf=$CFG > $LOG 2>&1 &
+    pid=$!
+
+    i=0
+    until ctl version > /dev/null 2>&1; do
+        i=$((i + 1))
+        if [ $i -gt 30 ] || ! kill -0 $pid 2> /dev/null; then
+            echo "jupiter-bench did not start, see $LOG."
+            kill $pid 2> /dev/null || true
+            exit 1
+        fi
+        sleep 1
+    done
+
+    ctl vs/add $VIP $PROTO rr
+    b=1
+    while [ $b -le $BACKENDS ]; do
+        ctl rs/add $VIP $PROTO 192.168.1.$b:8080
+        b=$((b + 1))
+    done
+    if [ $PROTO = udp ]; then
+        ctl vs/ops $VIP udp 1
+    fi
+
+    ctl bench/start $VIP $PROTO $PAYLOAD
+    sleep $DURATION
+    ctl bench/stop
+
+    echo "== $PROTO, $n workers"
+    ctl bench/stats
+    ctl exit
+    wait $pid || true
+done
@@ -1,6 +1,7 @@
 /* Copyright (c) 2018. TIG developer. */
 
 #include <errno.h>
+#include <inttypes.h>
 
 #include <rte_arp.h>
 #include <rte_cycles.h>
@@ -12,6 +13,7 @@
 #include <rte_log.h>
 #include <rte_malloc.h>
 #include <rte_rwlock.h>
+#include <rte_spinlock.h>
 #include <rte_timer.h>
 
 #include <unixctl_command.h>
@@ -23,6 +25,10 @@
 
 #define LB_MAX_ARP 4096
 
+/* Per-lcore neighbor cache, direct mapped by next-hop address. */
+#define ARP_CACHE_SIZE 64
+#define ARP_CACHE_MASK (ARP_CACHE_SIZE - 1)
+
 struct arp_entry {
     struct arp_table *tbl;
     struct ether_addr ha;
@@ -30,14 +36,64 @@ struct arp_entry {
     uint32_t timeout;
     uint32_t create_time;
     rte_atomic32_t use_time;
+    /* Bumped whenever the entry is added, changes its MAC or is deleted. */
+    volatile uint32_t gen;
     struct rte_timer timer;
 };
 
+struct arp_cache_entry {
+    uint32_t ip;
+    uint32_t gen;
+    uint32_t use_time;
+    int32_t idx;
+    struct ether_addr ha;
+};
+
+struct arp_cache {
+    struct arp_cache_entry entries[ARP_CACHE_SIZE];
+} __rte_cache_aligned;
+
+/*
+ * Packets to an unresolved next hop are held until the reply arrives.
+ * Only the lcore creating the pending entry sends the first request, the
+ * master lcore retries with a doubling interval and gives up after
+ * ARP_PENDING_PROBES requests.
+ */
+#define ARP_PENDING_MAX 64
+#define ARP_PENDING_PKTS 16
+#define ARP_PENDING_PROBES 3
+#define ARP_PENDING_RETRANS (LB_CLOCK_HZ / 10)
+
+struct arp_pending {
+    uint32_t in_use;
+    uint32_t ip;
+    uint32_t probes;
+    uint32_t next_probe;
+    uint32_t nb_pkts;
+    struct rte_mbuf *pkts[ARP_PENDING_PKTS];
+};
+
+struct arp_pending_stats {
+    uint64_t requests;
+    uint64_t held;
+    uint64_t released;
+    uint64_t drops;
+    uint64_t timeouts;
+};
+
 struct arp_table {
     struct rte_hash *hash;
     struct arp_entry *entries;
     uint32_t timeout;
     rte_rwlock_t rwlock;
+    struct arp_cache *caches[RTE_MAX_LCORE];
+
+    struct lb_device *dev;
+    rte_spinlock_t pending_lock;
+    volatile uint32_t nb_pending;
+    struct arp_pending pending[ARP_PENDING_MAX];
+    struct arp_pending_stats pending_stats;
+    struct rte_timer pending_timer;
 };
 
 static struct arp_table arp_tbls[RTE_MAX_ETHPORTS];
@@ -55,6 +111,38 @@ ether_addr_cmp(struct ether_addr *ea, struct ether_addr *eb) {
     return ((*(uint64_t *)ea ^ *(uint64_t *)eb) & MAC_ADDR_CMP) == 0;
 }
 
+static inline struct arp_cache_entry *
+arp_cache_slot(struct arp_cache *cache, uint32_t ip) {
+    return &cache->entries[rte_be_to_cpu_32(ip) & ARP_CACHE_MASK];
+}
+
+static inline void
+arp_entry_gen_bump(struct arp_entry *entry) {
+    rte_wmb();
+    entry->gen++;
+}
+
+/*
+ * Workers only record the use time in their own cache, collect it here
+ * when deciding whether the entry is idle.
+ */
+static uint32_t
+arp_entry_use_time(struct arp_table *tbl, struct arp_entry *entry) {
+    struct arp_cache_entry *c;
+    uint32_t use_time, lcore_id;
+
+    use_time = rte_atomic32_read(&entry->use_time);
+    RTE_LCORE_FOREACH(lcore_id) {
+        if (tbl->caches[lcore_id] == NULL)
+            continue;
+        c = arp_cache_slot(tbl->caches[lcore_id], entry->ip);
+        if (c->ip == entry->ip && c->gen == entry->gen &&
+            (int32_t)(c->use_time - use_time) > 0)
+            use_time = c->use_time;
+    }
+    return use_time;
+}
+
 static void
 arp_expire(struct rte_timer *t, void *arg) {
     struct arp_entry *entry = arg;
@@ -63,10 +151,11 @@ arp_expire(struct rte_timer *t, void *arg) {
     int rc;
 
     curr_time = LB_CLOCK();
-    use_time = rte_atomic32_read(&entry->use_time);
+    use_time = arp_entry_use_time(tbl, entry);
     if (curr_time - use_time >= entry->timeout) {
         ARP_TABLE_RWLOCK_WLOCK(tbl);
         rte_hash_del_key(tbl->hash, &entry->ip);
+        arp_entry_gen_bump(entry);
         ARP_TABLE_RWLOCK_WUNLOCK(tbl);
         rc = rte_timer_stop(t);
         if (rc < 0) {
@@ -77,6 +166,56 @@ arp_expire(struct rte_timer *t, void *arg) {
     }
 }
 
+static struct arp_pending *
+arp_pending_find(struct arp_table *tbl, uint32_t ip) {
+    uint32_t i;
+
+    for (i = 0; i < ARP_PENDING_MAX; i++) {
+        if (tbl->pending[i].in_use && tbl->pending[i].ip == ip)
+            return &tbl->pending[i];
+    }
+    return NULL;
+}
+
+static void
+arp_pending_free(struct arp_table *tbl, struct arp_pending *p) {
+    p->in_use = 0;
+    p->nb_pkts = 0;
+    tbl->nb_pending--;
+}
+
+/* Called on the master lcore, the held packets leave on its TX queue. */
+static void
+arp_pending_release(struct arp_table *tbl, uint32_t ip, struct ether_addr *ha) {
+    struct lb_device *dev = tbl->dev;
+    struct rte_mbuf *pkts[ARP_PENDING_PKTS];
+    struct arp_pending *p;
+    struct ether_hdr *eth;
+    uint32_t lcore_id, i, n;
+
+    rte_spinlock_lock(&tbl->pending_lock);
+    p = arp_pending_find(tbl, ip);
+    if (p == NULL) {
+        rte_spinlock_unlock(&tbl->pending_lock);
+        return;
+    }
+    n = p->nb_pkts;
+    memcpy(pkts, p->pkts, n * sizeof(pkts[0]));
+    arp_pending_free(tbl, p);
+    tbl->pending_stats.released += n;
+    rte_spinlock_unlock(&tbl->pending_lock);
+
+    for (i = 0; i < n; i++) {
+        eth = rte_pktmbuf_mtod(pkts[i], struct ether_hdr *);
+        ether_addr_copy(ha, &eth->d_addr);
+        lb_device_tx_mbuf(pkts[i], dev);
+    }
+
+    lcore_id = rte_lcore_id();
+    rte_eth_tx_buffer_flush(dev->port_id, dev->lcore_conf[lcore_id].txq_id,
+                            dev->tx_buffer[lcore_id]);
+}
+
 void
 lb_arp_input(struct rte_mbuf *pkt, struct lb_device *dev) {
     struct arp_table *tbl;
@@ -110,6 +249,7 @@ lb_arp_input(struct rte_mbuf *pkt, struct lb_device *dev) {
         entry->timeout = tbl->timeout;
         entry->create_time = LB_CLOCK();
         rte_atomic32_set(&entry->use_time, entry->create_time);
+        arp_entry_gen_bump(entry);
         rte_timer_init(&entry->timer);
         rte_timer_reset(&entry->timer, SEC_TO_CYCLES(5), PERIODICAL,
                         rte_get_master_lcore(), arp_expire, entry);
@@ -121,9 +261,13 @@ lb_arp_input(struct rte_mbuf *pkt, struct lb_device *dev) {
             ARP_TABLE_RWLOCK_WLOCK(tbl);
             ether_addr_copy(sha, &entry->ha);
             rte_atomic32_set(&entry->use_time, LB_CLOCK());
+            arp_entry_gen_bump(entry);
             ARP_TABLE_RWLOCK_WUNLOCK(tbl);
         }
     }
+
+    if (tbl->nb_pending != 0)
+        arp_pending_release(tbl, sip, &entry->ha);
 }
 
 static int
@@ -180,20 +324,133 @@ lb_arp_request(uint32_t dip, struct lb_device *dev) {
     return arp_send(ARP_OP_REQUEST, dip, dev->ipv4, NULL, &dev->ha, dev);
 }
 
+int
+lb_arp_pending_add(uint32_t ip, struct rte_mbuf *m, struct lb_device *dev) {
+    struct arp_table *tbl;
+    struct arp_pending *p;
+    uint32_t i;
+    int probe = 0;
+
+    tbl = &arp_tbls[dev->port_id];
+    rte_spinlock_lock(&tbl->pending_lock);
+    p = arp_pending_find(tbl, ip);
+    if (p == NULL) {
+        for (i = 0; i < ARP_PENDING_MAX; i++) {
+            if (!tbl->pending[i].in_use)
+                break;
+        }
+        if (i == ARP_PENDING_MAX)
+            goto drop;
+        p = &tbl->pending[i];
+        p->in_use = 1;
+        p->ip = ip;
+        p->probes = 1;
+        p->next_probe = LB_CLOCK() + ARP_PENDING_RETRANS;
+        p->nb_pkts = 0;
+        tbl->nb_pending++;
+        tbl->pending_stats.requests++;
+        probe = 1;
+    }
+    if (p->nb_pkts == ARP_PENDING_PKTS)
+        goto drop;
+    p->pkts[p->nb_pkts++] = m;
+    tbl->pending_stats.held++;
+    rte_spinlock_unlock(&tbl->pending_lock);
+
+    if (probe)
+        lb_arp_request(ip, dev);
+    return 0;
+
+drop:
+    tbl->pending_stats.drops++;
+    rte_spinlock_unlock(&tbl->pending_lock);
+    rte_pktmbuf_free(m);
+    return -1;
+}
+
+static void
+arp_pending_timer_cb(__attribute__((unused)) struct rte_timer *t, void *arg) {
+    struct arp_table *tbl = arg;
+    struct arp_pending *p;
+    struct rte_mbuf *drops[ARP_PENDING_MAX * ARP_PENDING_PKTS];
+    uint32_t probes[ARP_PENDING_MAX];
+    uint32_t curr_time, i, nb_drops = 0, nb_probes = 0;
+
+    if (tbl->nb_pending == 0)
+        return;
+
+    curr_time = LB_CLOCK();
+    rte_spinlock_lock(&tbl->pending_lock);
+    for (i = 0; i < ARP_PENDING_MAX; i++) {
+        p = &tbl->pending[i];
+        if (!p->in_use || (int32_t)(curr_time - p->next_probe) < 0)
+            continue;
+        if (p->probes == ARP_PENDING_PROBES) {
+            memcpy(&drops[nb_drops], p->pkts, p->nb_pkts * sizeof(drops[0]));
+            nb_drops += p->nb_pkts;
+            tbl->pending_stats.timeouts += p->nb_pkts;
+            arp_pending_free(tbl, p);
+            continue;
+        }
+        p->next_probe = curr_time + (ARP_PENDING_RETRANS << p->probes);
+        p->probes++;
+        tbl->pending_stats.requests++;
+        probes[nb_probes++] = p->ip;
+    }
+    rte_spinlock_unlock(&tbl->pending_lock);
+
+    for (i = 0; i < nb_drops; i++)
+        rte_pktmbuf_free(drops[i]);
+    for (i = 0; i < nb_probes; i++)
+        lb_arp_request(probes[i], tbl->dev);
+}
+
+/*
+ * The cached MAC stays valid as long as the generation of the table entry
+ * it was copied from is unchanged, so hits need neither the lock nor the
+ * hash lookup, and touch no shared cache line for writing.
+ */
 int
 lb_arp_find(uint32_t ip, struct ether_addr *mac, struct lb_device *dev) {
     struct arp_table *tbl;
+    struct arp_cache *cache;
+    struct arp_cache_entry *c;
+    struct arp_entry *entry;
+    uint32_t gen;
     int i;
 
     tbl = &arp_tbls[dev->port_id];
+    cache = tbl->caches[rte_lcore_id()];
+    c = arp_cache_slot(cache, ip);
+    if (c->ip == ip && c->gen != 0 && c->gen == tbl->entries[c->idx].gen) {
+        ether_addr_copy(&c->ha, mac);
+        c->use_time = LB_CLOCK();
+        return c->idx;
+    }
+
     ARP_TABLE_RWLOCK_RLOCK(tbl);
     i = rte_hash_lookup(tbl->hash, &ip);
     if (i >= 0) {
-        ether_addr_copy(&tbl->entries[i].ha, mac);
-        rte_atomic32_set(&tbl->entries[i].use_time, LB_CLOCK());
+        entry = &tbl->entries[i];
+        gen = entry->gen;
+        rte_rmb();
+        ether_addr_copy(&entry->ha, mac);
     }
     ARP_TABLE_RWLOCK_RUNLOCK(tbl);
 
+    if (i < 0)
+        return i;
+
+    /* Hand the use time of the evicted neighbor back to the table. */
+    if (c->gen != 0 && c->ip != ip && c->gen == tbl->entries[c->idx].gen)
+        rte_atomic32_set(&tbl->entries[c->idx].use_time, c->use_time);
+
+    c->ip = ip;
+    c->gen = gen;
+    c->use_time = LB_CLOCK();
+    c->idx = i;
+    ether_addr_copy(mac, &c->ha);
+
     return i;
 }
 
@@ -205,6 +462,7 @@ lb_arp_init(void) {
     char name[RTE_HASH_NAMESIZE];
     int socket_id;
     struct arp_table *tbl;
+    uint32_t lcore_id;
 
     LB_DEVICE_FOREACH(i, dev) {
         tbl = &arp_tbls[dev->port_id];
@@ -234,8 +492,26 @@ lb_arp_init(void) {
         }
         rte_rwlock_init(&tbl->rwlock);
 
+        RTE_LCORE_FOREACH(lcore_id) {
+            tbl->caches[lcore_id] = rte_zmalloc_socket(
+                NULL, sizeof(struct arp_cache), RTE_CACHE_LINE_SIZE,
+                rte_lcore_to_socket_id(lcore_id));
+            if (tbl->caches[lcore_id] == NULL) {
+                RTE_LOG(ERR, USER1,
+                        "%s(): Alloc memory for arp cache failed.\n",
+                        __func__);
+                return -1;
+            }
+        }
+
         tbl->timeout = arp_timeout;
 
+        tbl->dev = dev;
+        rte_spinlock_init(&tbl->pending_lock);
+        rte_timer_init(&tbl->pending_timer);
+        rte_timer_reset(&tbl->pending_timer, MS_TO_CYCLES(10), PERIODICAL,
+                        rte_get_master_lcore(), arp_pending_timer_cb, tbl);
+
         RTE_LOG(INFO, USER1,
                 "%s(): Create arp table for port(%s) on socket%d.\n", __func__,
                 dev->name, socket_id);
@@ -256,6 +532,9 @@ arp_list_cb(int fd, __attribute__((unused)) char *argv[],
     struct arp_entry *entry;
     char ip[32], mac[32];
     uint32_t ctime, sec;
+    struct arp_pending *p;
+    struct arp_pending_stats *stats;
+    uint32_t j;
     int rc;
 
     unixctl_command_reply(
@@ -266,6 +545,8 @@ arp_list_cb(int fd, __attribute__((unused)) char *argv[],
     LB_DEVICE_FOREACH(i, dev) {
         tbl = &arp_tbls[dev->port_id];
         next = 0;
+        /* The master updates the table while the command runs. */
+        ARP_TABLE_RWLOCK_RLOCK(tbl);
         while ((rc = rte_hash_iterate(tbl->hash, &key, &data, &next)) >= 0) {
             entry = &tbl->entries[rc];
             ipv4_addr_tostring(entry->ip, ip, sizeof(ip));
@@ -274,6 +555,30 @@ arp_list_cb(int fd, __attribute__((unused)) char *argv[],
             unixctl_command_reply(fd, "%-15s  %-17s  %-10s  %u\n", ip, mac,
                                   dev->name, sec);
         }
+        ARP_TABLE_RWLOCK_RUNLOCK(tbl);
+        rte_spinlock_lock(&tbl->pending_lock);
+        for (j = 0; j < ARP_PENDING_MAX; j++) {
+            p = &tbl->pending[j];
+            if (!p->in_use)
+                continue;
+            ipv4_addr_tostring(p->ip, ip, sizeof(ip));
+            unixctl_command_reply(fd, "%-15s  %-17s  %-10s  -\n", ip,
+                                  "(incomplete)", dev->name);
+        }
+        rte_spinlock_unlock(&tbl->pending_lock);
+    }
+
+    unixctl_command_reply(fd, "\nIface       Pending  Requests    Held        "
+                              "Released    Drops       Timeouts\n");
+    LB_DEVICE_FOREACH(i, dev) {
+        tbl = &arp_tbls[dev->port_id];
+        stats = &tbl->pending_stats;
+        unixctl_command_reply(
+            fd,
+            "%-10s  %-7u  %-10" PRIu64 "  %-10" PRIu64 "  %-10" PRIu64
+            "  %-10" PRIu64 "  %" PRIu64 "\n",
+            dev->name, tbl->nb_pending, stats->requests, stats->held,
+            stats->released, stats->drops, stats->timeouts);
     }
 }
 
@@ -310,4 +615,5 @@ arp_timeout_cb(int fd, char *argv[], int argc) {
     }
 }
 
-UNIXCTL_CMD_REGISTER("arp/timeout", "[SEC].", "", 0, 1, arp_timeout_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH("arp/timeout", "[SEC].", "", 0, 1,
+                              arp_timeout_cb);
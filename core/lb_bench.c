@@ -0,0 +1,752 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <string.h>
+
+#include <rte_arp.h>
+#include <rte_byteorder.h>
+#include <rte_cycles.h>
+#include <rte_eth_ring.h>
+#include <rte_ethdev.h>
+#include <rte_jhash.h>
+#include <rte_lcore.h>
+#include <rte_log.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_memcpy.h>
+#include <rte_ring.h>
+
+#include <unixctl_command.h>
+
+#include "lb_bench.h"
+#include "lb_device.h"
+#include "lb_format.h"
+#include "lb_lcore.h"
+#include "lb_parser.h"
+
+#define BENCH_RING_SIZE 1024
+/* New flows are opened while the rx ring of their worker is below this. */
+#define BENCH_RING_FILL (BENCH_RING_SIZE / 2)
+
+#define BENCH_PAYLOAD 64
+#define BENCH_MAX_PAYLOAD 1400
+
+/* Clients live in 100.64.0.0/10, every other address is a backend. */
+#define BENCH_CIP_NET IPv4(100, 64, 0, 1)
+#define BENCH_CIP_MASK 0xffc00000
+#define BENCH_MIN_CPORT 1024
+
+struct bench_port {
+    uint16_t port_id;
+    uint16_t nb_rxq, nb_txq;
+    struct lb_device *dev;
+    /* The port receives from rxq[] and transmits to txq[]. */
+    struct rte_ring *rxq[RTE_MAX_LCORE];
+    struct rte_ring *txq[RTE_MAX_LCORE];
+    struct rte_mbuf *staged[RTE_MAX_LCORE][PKT_MAX_BURST];
+    uint16_t nb_staged[RTE_MAX_LCORE];
+};
+
+/* Headers of a generated packet, addresses and ports in network order. */
+struct bench_pkt {
+    uint8_t proto;
+    uint8_t flags;
+    uint32_t src, dst;
+    uint16_t sport, dport;
+    uint32_t seq, ack;
+    uint16_t len;
+};
+
+struct bench_stats {
+    uint64_t flows;
+    uint64_t done;
+    uint64_t resets;
+    /* Packets into the rx rings and out of the tx rings. */
+    uint64_t sent;
+    uint64_t received;
+    uint64_t ring_full;
+    uint64_t unknown;
+};
+
+struct bench_lcore_snap {
+    uint64_t packets;
+    uint64_t busy;
+    uint64_t rx_dropped;
+    uint64_t tx_dropped;
+    uint64_t redirect_drop;
+    uint64_t rx_cksum_bad;
+};
+
+static struct bench_port *bench_ports[RTE_MAX_ETHPORTS];
+static uint16_t bench_nb_ports;
+
+static const struct ether_addr bench_ha = {
+    .addr_bytes = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01},
+};
+
+/* Only the master lcore changes it, bench/stats reads it. */
+static struct {
+    int running;
+    uint8_t proto;
+    uint32_t vip;
+    uint16_t vport;
+    uint16_t payload;
+    /* Next client address and port, host byte order. */
+    uint32_t cip;
+    uint16_t cport;
+    uint64_t start_tsc, stop_tsc;
+    struct bench_stats stats;
+    struct bench_lcore_snap start[RTE_MAX_LCORE];
+    struct bench_lcore_snap stop[RTE_MAX_LCORE];
+} bench;
+
+static void
+bench_lcore_snap_take(struct bench_lcore_snap *snap, uint32_t lcore_id) {
+    struct lb_lcore_stats *s = &lb_lcore_stats[lcore_id];
+    struct lb_device *dev;
+    uint16_t devid;
+
+    memset(snap, 0, sizeof(*snap));
+    snap->packets = s->packets;
+    snap->busy = lb_lcore_stats_busy(s);
+    LB_DEVICE_FOREACH(devid, dev) {
+        snap->rx_dropped += dev->lcore_stats[lcore_id].rx_dropped;
+        snap->tx_dropped += dev->lcore_stats[lcore_id].tx_dropped;
+        snap->redirect_drop += dev->lcore_stats[lcore_id].redirect_drop;
+        snap->rx_cksum_bad += dev->lcore_stats[lcore_id].rx_cksum_bad;
+    }
+}
+
+static void
+bench_stage_flush(struct bench_port *bp, uint16_t q) {
+    uint16_t n, i;
+
+    if (bp->nb_staged[q] == 0)
+        return;
+    n = rte_ring_sp_enqueue_burst(bp->rxq[q], (void **)bp->staged[q],
+                                  bp->nb_staged[q], NULL);
+    bench.stats.sent += n;
+    bench.stats.ring_full += bp->nb_staged[q] - n;
+    for (i = n; i < bp->nb_staged[q]; i++)
+        rte_pktmbuf_free(bp->staged[q][i]);
+    bp->nb_staged[q] = 0;
+}
+
+static void
+bench_stage(struct bench_port *bp, uint16_t q, struct rte_mbuf *m) {
+    if (bp->nb_staged[q] == PKT_MAX_BURST)
+        bench_stage_flush(bp, q);
+    bp->staged[q][bp->nb_staged[q]++] = m;
+}
+
+/* Packets are answered in place, a shared one is copied first. */
+static struct rte_mbuf *
+bench_mbuf_own(struct bench_port *bp, struct rte_mbuf *m) {
+    struct rte_mbuf *c;
+    uint16_t len;
+
+    if (RTE_MBUF_DIRECT(m) && rte_mbuf_refcnt_read(m) == 1 &&
+        m->nb_segs == 1)
+        return m;
+
+    c = rte_pktmbuf_alloc(bp->dev->mp);
+    if (c != NULL) {
+        len = RTE_MIN(rte_pktmbuf_data_len(m), rte_pktmbuf_tailroom(c));
+        rte_memcpy(rte_pktmbuf_append(c, len), rte_pktmbuf_mtod(m, void *),
+                   len);
+    }
+    rte_pktmbuf_free(m);
+    return c;
+}
+
+/* Rewrites @m from scratch, the payload is left as it is. */
+static int
+bench_pkt_fill(struct bench_port *bp, struct rte_mbuf *m,
+               const struct bench_pkt *p) {
+    struct ether_hdr *eth;
+    struct ipv4_hdr *iph;
+    struct tcp_hdr *th;
+    struct udp_hdr *uh;
+    uint16_t l4_len;
+
+    l4_len = (p->proto == IPPROTO_TCP ? sizeof(*th) : sizeof(*uh)) + p->len;
+    rte_pktmbuf_reset(m);
+    eth = (struct ether_hdr *)rte_pktmbuf_append(
+        m, ETHER_HDR_LEN + sizeof(*iph) + l4_len);
+    if (eth == NULL)
+        return -1;
+    m->port = bp->port_id;
+
+    ether_addr_copy(&bench_ha, &eth->s_addr);
+    ether_addr_copy(&bp->dev->ha, &eth->d_addr);
+    eth->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
+
+    iph = (struct ipv4_hdr *)(eth + 1);
+    iph->version_ihl = 0x45;
+    iph->type_of_service = 0;
+    iph->total_length = rte_cpu_to_be_16(sizeof(*iph) + l4_len);
+    iph->packet_id = 0;
+    iph->fragment_offset = 0;
+    iph->time_to_live = 64;
+    iph->next_proto_id = p->proto;
+    iph->src_addr = p->src;
+    iph->dst_addr = p->dst;
+    iph->hdr_checksum = 0;
+    iph->hdr_checksum = rte_ipv4_cksum(iph);
+
+    if (p->proto == IPPROTO_TCP) {
+        th = (struct tcp_hdr *)(iph + 1);
+        th->src_port = p->sport;
+        th->dst_port = p->dport;
+        th->sent_seq = rte_cpu_to_be_32(p->seq);
+        th->recv_ack = rte_cpu_to_be_32(p->ack);
+        th->data_off = sizeof(*th) << 2;
+        th->tcp_flags = p->flags;
+        th->rx_win = rte_cpu_to_be_16(UINT16_MAX);
+        th->tcp_urp = 0;
+        th->cksum = 0;
+        th->cksum = rte_ipv4_udptcp_cksum(iph, th);
+    } else {
+        uh = (struct udp_hdr *)(iph + 1);
+        uh->src_port = p->sport;
+        uh->dst_port = p->dport;
+        uh->dgram_len = rte_cpu_to_be_16(l4_len);
+        uh->dgram_cksum = 0;
+        uh->dgram_cksum = rte_ipv4_udptcp_cksum(iph, uh);
+    }
+    return 0;
+}
+
+/* All packets of a client flow go to one worker. */
+static inline uint16_t
+bench_client_rxq(struct bench_port *bp, uint32_t cip, uint16_t cport) {
+    return rte_jhash_2words(cip, cport, 0) % bp->nb_rxq;
+}
+
+/* Backends answer the local address, RSS would pick the owner's queue. */
+static inline int
+bench_laddr_rxq(struct bench_port *bp, uint32_t lip) {
+    uint32_t lcore_id = lb_laddr_owner(bp->dev, lip);
+
+    if (lcore_id == RTE_MAX_LCORE)
+        return -1;
+    return bp->dev->lcore_conf[lcore_id].rxq_id;
+}
+
+static void
+bench_arp_answer(struct bench_port *bp, struct rte_mbuf *m) {
+    struct ether_hdr *eth;
+    struct arp_hdr *arph;
+    uint32_t tip;
+
+    eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    arph = (struct arp_hdr *)(eth + 1);
+    if (arph->arp_op != rte_cpu_to_be_16(ARP_OP_REQUEST)) {
+        bench.stats.unknown++;
+        rte_pktmbuf_free(m);
+        return;
+    }
+
+    m = bench_mbuf_own(bp, m);
+    if (m == NULL)
+        return;
+    eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    arph = (struct arp_hdr *)(eth + 1);
+
+    tip = arph->arp_data.arp_tip;
+    arph->arp_op = rte_cpu_to_be_16(ARP_OP_REPLY);
+    ether_addr_copy(&arph->arp_data.arp_sha, &arph->arp_data.arp_tha);
+    arph->arp_data.arp_tip = arph->arp_data.arp_sip;
+    ether_addr_copy(&bench_ha, &arph->arp_data.arp_sha);
+    arph->arp_data.arp_sip = tip;
+    ether_addr_copy(&eth->s_addr, &eth->d_addr);
+    ether_addr_copy(&bench_ha, &eth->s_addr);
+
+    m->ol_flags = 0;
+    m->packet_type = 0;
+    m->port = bp->port_id;
+    bench_stage(bp, 0, m);
+}
+
+/*
+ * A flow runs SYN, SYN-ACK, ACK with the request, the response with FIN,
+ * FIN-ACK and the last ACK; or a UDP request and its response. Each packet
+ * the workers send is answered by the side it is addressed to.
+ */
+static void
+bench_input(struct bench_port *bp, struct rte_mbuf *m) {
+    struct ether_hdr *eth;
+    struct ipv4_hdr *iph;
+    struct tcp_hdr *th;
+    struct udp_hdr *uh;
+    struct bench_pkt p;
+    uint16_t len;
+    int client, q;
+
+    eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    if (eth->ether_type == rte_cpu_to_be_16(ETHER_TYPE_ARP)) {
+        bench_arp_answer(bp, m);
+        return;
+    }
+    if (eth->ether_type != rte_cpu_to_be_16(ETHER_TYPE_IPv4))
+        goto unknown;
+
+    iph = (struct ipv4_hdr *)(eth + 1);
+    client = (rte_be_to_cpu_32(iph->dst_addr) & BENCH_CIP_MASK) ==
+             (BENCH_CIP_NET & BENCH_CIP_MASK);
+    memset(&p, 0, sizeof(p));
+    p.proto = iph->next_proto_id;
+    p.src = iph->dst_addr;
+    p.dst = iph->src_addr;
+
+    if (p.proto == IPPROTO_UDP) {
+        if (client)
+            goto done;
+        uh = UDP_HDR(iph);
+        p.sport = uh->dst_port;
+        p.dport = uh->src_port;
+        p.len = bench.payload;
+    } else if (p.proto == IPPROTO_TCP) {
+        th = TCP_HDR(iph);
+        if (RST(th)) {
+            bench.stats.resets++;
+            goto drop;
+        }
+        len = rte_be_to_cpu_16(iph->total_length) - IPv4_HLEN(iph) -
+              TCP_HLEN(th);
+        p.sport = th->dst_port;
+        p.dport = th->src_port;
+        p.seq = rte_be_to_cpu_32(th->recv_ack);
+        p.ack = rte_be_to_cpu_32(th->sent_seq) + len;
+        if (SYN(th)) {
+            p.ack++;
+            if (client) {
+                p.flags = TCP_ACK_FLAG | TCP_PSH_FLAG;
+                p.len = bench.payload;
+            } else {
+                p.flags = TCP_SYN_FLAG | TCP_ACK_FLAG;
+                p.seq = (uint32_t)rte_rdtsc();
+            }
+        } else if (FIN(th)) {
+            p.ack++;
+            p.flags = client ? TCP_ACK_FLAG | TCP_FIN_FLAG : TCP_ACK_FLAG;
+        } else if (client) {
+            goto done;
+        } else if (len != 0) {
+            p.flags = TCP_ACK_FLAG | TCP_PSH_FLAG | TCP_FIN_FLAG;
+            p.len = bench.payload;
+        } else {
+            goto drop;
+        }
+    } else {
+        goto unknown;
+    }
+
+    q = client ? bench_client_rxq(bp, p.src, p.sport)
+               : bench_laddr_rxq(bp, p.dst);
+    if (q < 0)
+        goto unknown;
+    m = bench_mbuf_own(bp, m);
+    if (m == NULL)
+        return;
+    if (bench_pkt_fill(bp, m, &p) < 0)
+        goto drop;
+    bench_stage(bp, q, m);
+    return;
+
+done:
+    bench.stats.done++;
+    goto drop;
+unknown:
+    bench.stats.unknown++;
+drop:
+    rte_pktmbuf_free(m);
+}
+
+static void
+bench_client_next(void) {
+    if (++bench.cport != 0)
+        return;
+    bench.cport = BENCH_MIN_CPORT;
+    if ((++bench.cip & ~BENCH_CIP_MASK) == 0)
+        bench.cip = BENCH_CIP_NET;
+}
+
+static uint32_t
+bench_flows_open(struct bench_port *bp) {
+    struct rte_mbuf *m;
+    struct bench_pkt p;
+    uint32_t i;
+    uint16_t q;
+
+    memset(&p, 0, sizeof(p));
+    p.proto = bench.proto;
+    p.dst = bench.vip;
+    p.dport = bench.vport;
+    if (p.proto == IPPROTO_TCP)
+        p.flags = TCP_SYN_FLAG;
+    else
+        p.len = bench.payload;
+
+    for (i = 0; i < PKT_MAX_BURST; i++) {
+        p.src = rte_cpu_to_be_32(bench.cip);
+        p.sport = rte_cpu_to_be_16(bench.cport);
+        q = bench_client_rxq(bp, p.src, p.sport);
+        if (rte_ring_count(bp->rxq[q]) + bp->nb_staged[q] >= BENCH_RING_FILL)
+            break;
+        m = rte_pktmbuf_alloc(bp->dev->mp);
+        if (m == NULL)
+            break;
+        p.seq = (uint32_t)bench.stats.flows;
+        if (bench_pkt_fill(bp, m, &p) < 0) {
+            rte_pktmbuf_free(m);
+            break;
+        }
+        bench_stage(bp, q, m);
+        bench.stats.flows++;
+        bench_client_next();
+    }
+    return i;
+}
+
+static int64_t
+bench_port_poll(struct bench_port *bp) {
+    struct rte_mbuf *pkts[PKT_MAX_BURST];
+    int64_t nb = 0;
+    uint16_t q, i, n;
+
+    for (q = 0; q < bp->nb_txq; q++) {
+        n = rte_ring_sc_dequeue_burst(bp->txq[q], (void **)pkts,
+                                      PKT_MAX_BURST, NULL);
+        for (i = 0; i < n; i++)
+            bench_input(bp, pkts[i]);
+        nb += n;
+    }
+    bench.stats.received += nb;
+
+    if (bench.running)
+        nb += bench_flows_open(bp);
+    for (q = 0; q < bp->nb_rxq; q++)
+        bench_stage_flush(bp, q);
+    return nb;
+}
+
+static struct lb_device *
+bench_port_dev(uint16_t port_id) {
+    struct lb_device *dev;
+    uint16_t devid;
+
+    LB_DEVICE_FOREACH(devid, dev) {
+        if (dev->port_id == port_id)
+            return dev;
+    }
+    return NULL;
+}
+
+int64_t
+lb_bench_job(__attribute__((unused)) void *arg) {
+    uint32_t lcore_id = rte_lcore_id();
+    struct rte_mbuf *pkts[PKT_MAX_BURST];
+    struct bench_port *bp;
+    struct ether_hdr *eth;
+    struct lb_device *dev;
+    uint16_t devid, i;
+    uint32_t j, n;
+    int64_t nb = 0;
+
+    /* What the workers pass to the kernel, ARP updates the table. */
+    LB_DEVICE_FOREACH(devid, dev) {
+        n = rte_ring_dequeue_burst(dev->ring, (void **)pkts, PKT_MAX_BURST,
+                                   NULL);
+        for (j = 0; j < n; j++) {
+            eth = rte_pktmbuf_mtod(pkts[j], struct ether_hdr *);
+            if (eth->ether_type == rte_cpu_to_be_16(ETHER_TYPE_ARP))
+                lb_arp_input(pkts[j], dev);
+            rte_pktmbuf_free(pkts[j]);
+        }
+        nb += n;
+        rte_eth_tx_buffer_flush(dev->port_id, dev->lcore_conf[lcore_id].txq_id,
+                                dev->tx_buffer[lcore_id]);
+    }
+
+    for (i = 0; i < bench_nb_ports; i++) {
+        bp = bench_ports[i];
+        if (bp->dev == NULL)
+            bp->dev = bench_port_dev(bp->port_id);
+        if (bp->dev != NULL)
+            nb += bench_port_poll(bp);
+    }
+    return nb;
+}
+
+static struct rte_ring *
+bench_ring_create(const char *dir, uint16_t port, uint16_t q,
+                  uint32_t socket_id) {
+    char name[RTE_RING_NAMESIZE];
+    struct rte_ring *r;
+
+    snprintf(name, sizeof(name), "bench_%s%u_%u", dir, port, q);
+    r = rte_ring_create(name, BENCH_RING_SIZE, socket_id,
+                        RING_F_SP_ENQ | RING_F_SC_DEQ);
+    if (r == NULL) {
+        RTE_LOG(ERR, USER1, "%s(): Create ring %s failed, %s.\n", __func__,
+                name, rte_strerror(rte_errno));
+    }
+    return r;
+}
+
+int
+lb_bench_init(struct lb_device_conf *configs, uint16_t num) {
+    struct lb_device_conf *conf;
+    struct bench_port *bp;
+    uint32_t lcore_id, socket_id;
+    uint16_t nb_rxq = 0, port_id, i, q;
+    int rc;
+
+    /* The devices get a queue for each worker on their socket. */
+    socket_id = rte_socket_id();
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        if (rte_lcore_to_socket_id(lcore_id) == socket_id)
+            nb_rxq++;
+    }
+    if (nb_rxq == 0) {
+        RTE_LOG(ERR, USER1, "%s(): No worker lcore on socket%u.\n", __func__,
+                socket_id);
+        return -1;
+    }
+
+    for (i = 0; i < num; i++) {
+        conf = &configs[i];
+        if (conf->nb_pcis != 0 ||
+            rte_eth_dev_get_port_by_name(conf->port, &port_id) == 0)
+            continue;
+
+        bp = rte_zmalloc_socket(NULL, sizeof(*bp), RTE_CACHE_LINE_SIZE,
+                                socket_id);
+        if (bp == NULL) {
+            RTE_LOG(ERR, USER1, "%s(): Alloc memory for bench port failed.\n",
+                    __func__);
+            return -1;
+        }
+        bp->nb_rxq = nb_rxq;
+        bp->nb_txq = nb_rxq + 1;
+        for (q = 0; q < bp->nb_txq; q++) {
+            if (q < bp->nb_rxq) {
+                bp->rxq[q] = bench_ring_create("rx", i, q, socket_id);
+                if (bp->rxq[q] == NULL)
+                    return -1;
+            }
+            bp->txq[q] = bench_ring_create("tx", i, q, socket_id);
+            if (bp->txq[q] == NULL)
+                return -1;
+        }
+
+        rc = rte_eth_from_rings(conf->port, bp->rxq, bp->nb_rxq, bp->txq,
+                                bp->nb_txq, socket_id);
+        if (rc < 0) {
+            RTE_LOG(ERR, USER1, "%s(): Create ring port %s failed.\n",
+                    __func__, conf->port);
+            return -1;
+        }
+        bp->port_id = rc;
+        bench_ports[bench_nb_ports++] = bp;
+        /* The PMD names the port net_ring_<name>. */
+        rte_eth_dev_get_name_by_port(bp->port_id, conf->port);
+        RTE_LOG(INFO, USER1, "%s(): Create ring port %s with %u rx queues.\n",
+                __func__, conf->port, bp->nb_rxq);
+    }
+    return 0;
+}
+
+static void
+bench_start_cmd_cb(int fd, char *argv[], int argc) {
+    uint16_t vport, payload = BENCH_PAYLOAD;
+    uint32_t vip, lcore_id;
+    uint8_t proto;
+
+    if (parse_ipv4_port(argv[0], &vip, &vport) < 0) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[0]);
+        return;
+    }
+    if (parse_l4_proto(argv[1], &proto) < 0) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[1]);
+        return;
+    }
+    if (argc > 2 && (parser_read_uint16(&payload, argv[2]) < 0 ||
+                     payload == 0 || payload > BENCH_MAX_PAYLOAD)) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[2]);
+        return;
+    }
+    if (bench_nb_ports == 0) {
+        unixctl_command_reply_error(fd, "No ring port to run on.\n");
+        return;
+    }
+
+    bench.proto = proto;
+    bench.vip = vip;
+    bench.vport = vport;
+    bench.payload = payload;
+    /* Clients go on from the last run, its flows may still be open. */
+    if (bench.cip == 0) {
+        bench.cip = BENCH_CIP_NET;
+        bench.cport = BENCH_MIN_CPORT;
+    }
+    memset(&bench.stats, 0, sizeof(bench.stats));
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        bench_lcore_snap_take(&bench.start[lcore_id], lcore_id);
+    }
+    bench.start_tsc = rte_rdtsc();
+    bench.running = 1;
+}
+
+UNIXCTL_CMD_REGISTER_DATAPATH("bench/start", "VIP:VPORT tcp|udp [PAYLOAD].",
+                              "Open flows to the virtual service as fast as "
+                              "the workers take them.",
+                              2, 3, bench_start_cmd_cb);
+
+static void
+bench_stop_cmd_cb(__attribute__((unused)) int fd,
+                  __attribute__((unused)) char *argv[],
+                  __attribute__((unused)) int argc) {
+    uint32_t lcore_id;
+
+    if (!bench.running)
+        return;
+    bench.running = 0;
+    bench.stop_tsc = rte_rdtsc();
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        bench_lcore_snap_take(&bench.stop[lcore_id], lcore_id);
+    }
+}
+
+UNIXCTL_CMD_REGISTER_DATAPATH("bench/stop", "", "Stop opening flows.", 0, 0,
+                              bench_stop_cmd_cb);
+
+static double
+bench_rate(uint64_t n, uint64_t cycles) {
+    return cycles ? (double)n * rte_get_tsc_hz() / cycles : 0;
+}
+
+static void
+bench_lcore_stats(int fd, int json_fmt, uint32_t lcore_id, uint64_t cycles) {
+    struct bench_lcore_snap now, *end = &now, *start = &bench.start[lcore_id];
+    uint64_t packets;
+
+    if (bench.running)
+        bench_lcore_snap_take(&now, lcore_id);
+    else
+        end = &bench.stop[lcore_id];
+    packets = end->packets - start->packets;
+
+    unixctl_command_reply(fd, json_fmt ? "{" JSON_KV_32_FMT("lcore", ",")
+                                       : "lcore%u:\n",
+                          lcore_id);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("packets", ",")
+                                   : "  " NORM_KV_64_FMT("packets", "\n"),
+                          packets);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_K_FMT("mpps") ":%.3f,"
+                                   : "  mpps: %.3f\n",
+                          bench_rate(packets, cycles) / 1e6);
+    unixctl_command_reply(
+        fd,
+        json_fmt ? JSON_KV_64_FMT("cycles-per-packet", ",")
+                 : "  " NORM_KV_64_FMT("cycles-per-packet", "\n"),
+        packets ? (end->busy - start->busy) / packets : 0);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("rx-dropped", ",")
+                                   : "  " NORM_KV_64_FMT("rx-dropped", "\n"),
+                          end->rx_dropped - start->rx_dropped);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("tx-dropped", ",")
+                                   : "  " NORM_KV_64_FMT("tx-dropped", "\n"),
+                          end->tx_dropped - start->tx_dropped);
+    unixctl_command_reply(
+        fd,
+        json_fmt ? JSON_KV_64_FMT("redirect-dropped", ",")
+                 : "  " NORM_KV_64_FMT("redirect-dropped", "\n"),
+        end->redirect_drop - start->redirect_drop);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("rx-cksum-bad", "}")
+                                   : "  " NORM_KV_64_FMT("rx-cksum-bad", "\n"),
+                          end->rx_cksum_bad - start->rx_cksum_bad);
+}
+
+static void
+bench_stats_cmd_cb(int fd, char *argv[], int argc) {
+    struct bench_stats *s = &bench.stats;
+    uint32_t lcore_id, first = 1;
+    uint64_t cycles;
+    int json_fmt;
+
+    json_fmt = argc > 0 && strcmp(argv[0], "--json") == 0;
+
+    if (bench.start_tsc == 0) {
+        unixctl_command_reply_error(fd, "No bench run.\n");
+        return;
+    }
+    cycles = (bench.running ? rte_rdtsc() : bench.stop_tsc) - bench.start_tsc;
+
+    if (json_fmt)
+        unixctl_command_reply(fd, "{");
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_S_FMT("proto", ",")
+                                   : NORM_KV_S_FMT("proto", "\n"),
+                          bench.proto == IPPROTO_TCP ? "tcp" : "udp");
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("elapsed-ms", ",")
+                                   : NORM_KV_64_FMT("elapsed-ms", "\n"),
+                          cycles * MS_PER_S / rte_get_tsc_hz());
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("flows", ",")
+                                   : NORM_KV_64_FMT("flows", "\n"),
+                          s->flows);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("completed", ",")
+                                   : NORM_KV_64_FMT("completed", "\n"),
+                          s->done);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("conns-per-sec", ",")
+                                   : NORM_KV_64_FMT("conns-per-sec", "\n"),
+                          (uint64_t)bench_rate(s->done, cycles));
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_K_FMT("mpps") ":%.3f,"
+                                   : "mpps: %.3f\n",
+                          bench_rate(s->sent, cycles) / 1e6);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("sent", ",")
+                                   : NORM_KV_64_FMT("sent", "\n"),
+                          s->sent);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("received", ",")
+                                   : NORM_KV_64_FMT("received", "\n"),
+                          s->received);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("ring-full", ",")
+                                   : NORM_KV_64_FMT("ring-full", "\n"),
+                          s->ring_full);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("resets", ",")
+                                   : NORM_KV_64_FMT("resets", "\n"),
+                          s->resets);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("unexpected", ",")
+                                   : NORM_KV_64_FMT("unexpected", "\n"),
+                          s->unknown);
+
+    if (json_fmt)
+        unixctl_command_reply(fd, JSON_K_FMT("lcores") ":[");
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        if (json_fmt && !first)
+            unixctl_command_reply(fd, ",");
+        first = 0;
+        bench_lcore_stats(fd, json_fmt, lcore_id, cycles);
+    }
+    if (json_fmt)
+        unixctl_command_reply(fd, "]}\n");
+}
+
+UNIXCTL_CMD_REGISTER("bench/stats", "[--json].",
+                     "Show the rates, cycles per packet and drops of the "
+                     "last bench run.",
+                     0, 1, bench_stats_cmd_cb);
@@ -0,0 +1,27 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_BENCH_H__
+#define __LB_BENCH_H__
+
+#include <stdint.h>
+
+#include "lb_config.h"
+
+/*
+ * jupiter-bench runs the workers against net_ring ports and plays the
+ * clients and backends of the flows on the master lcore: it opens TCP and
+ * UDP flows to a VIP, answers the backend side, and reflects every packet
+ * the workers send back into their rx queues. ARP and the packets for the
+ * KNI are answered there as well, the bench build has no KNI.
+ */
+
+/*
+ * Creates a net_ring port for each device configured by port name whose
+ * port does not exist yet, e.g. from a --vdev argument.
+ */
+int lb_bench_init(struct lb_device_conf *configs, uint16_t num);
+
+/* Master lcore job, returns the number of packets handled. */
+int64_t lb_bench_job(void *arg);
+
+#endif
@@ -0,0 +1,101 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_CKSUM_H__
+#define __LB_CKSUM_H__
+
+#include <string.h>
+
+#include <rte_byteorder.h>
+#include <rte_ip.h>
+
+/*
+ * Incremental checksum update (RFC 1624) for packets rewritten in place.
+ * The headers are saved before the rewrite, afterwards only the 16 bit
+ * words that changed are folded into the checksums: HC' = ~(~HC + ~m + m').
+ *
+ * The L4 header may grow by inserted options (TOA), the payload then
+ * moves by an even offset and keeps its sum.
+ */
+
+#define LB_CKSUM_L4_HDR_MAX 60
+
+struct lb_cksum_nat {
+    struct ipv4_hdr iph;
+    uint16_t l4_len;
+    uint16_t l4_hlen;
+    uint16_t l4h[LB_CKSUM_L4_HDR_MAX / 2];
+};
+
+static inline uint16_t
+lb_cksum_l4_len(const struct ipv4_hdr *iph) {
+    return rte_be_to_cpu_16(iph->total_length) -
+           (iph->version_ihl & IPV4_HDR_IHL_MASK) * IPV4_IHL_MULTIPLIER;
+}
+
+static inline void
+lb_cksum_nat_save(struct lb_cksum_nat *nat, const struct ipv4_hdr *iph,
+                  const void *l4h, uint16_t l4_hlen) {
+    nat->iph = *iph;
+    nat->l4_len = lb_cksum_l4_len(iph);
+    nat->l4_hlen = l4_hlen;
+    memcpy(nat->l4h, l4h, l4_hlen);
+}
+
+/* The headers are packed, their words are loaded with memcpy(). */
+static inline uint32_t
+lb_cksum_delta(const void *o, const void *n, uint32_t nb_words) {
+    uint16_t wo, wn;
+    uint32_t sum = 0;
+    uint32_t i;
+
+    for (i = 0; i < nb_words; i++) {
+        memcpy(&wo, (const uint8_t *)o + i * 2, sizeof(wo));
+        memcpy(&wn, (const uint8_t *)n + i * 2, sizeof(wn));
+        if (wo != wn)
+            sum += (uint16_t)~wo + wn;
+    }
+    return sum;
+}
+
+static inline uint32_t
+lb_cksum_delta16(uint16_t o, uint16_t n) {
+    return (uint16_t)~o + n;
+}
+
+static inline uint16_t
+lb_cksum_apply(uint16_t cksum, uint32_t delta) {
+    uint32_t sum;
+
+    sum = (uint16_t)~cksum + delta;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+static inline uint16_t
+lb_cksum_nat_ipv4(const struct lb_cksum_nat *nat, const struct ipv4_hdr *iph) {
+    return lb_cksum_apply(nat->iph.hdr_checksum,
+                          lb_cksum_delta(&nat->iph, iph, sizeof(*iph) / 2));
+}
+
+/* The checksum field itself must not have been written since the save. */
+static inline uint16_t
+lb_cksum_nat_l4(const struct lb_cksum_nat *nat, const struct ipv4_hdr *iph,
+                uint16_t cksum, const void *l4h, uint16_t l4_hlen) {
+    const uint16_t *n = l4h;
+    uint32_t delta;
+    uint32_t i;
+
+    /* Pseudo header. */
+    delta = lb_cksum_delta(&nat->iph.src_addr, &iph->src_addr, 4);
+    delta += lb_cksum_delta16(rte_cpu_to_be_16(nat->l4_len),
+                              rte_cpu_to_be_16(lb_cksum_l4_len(iph)));
+
+    delta += lb_cksum_delta(nat->l4h, n, nat->l4_hlen / 2);
+    for (i = nat->l4_hlen / 2; i < l4_hlen / 2; i++)
+        delta += n[i];
+
+    return lb_cksum_apply(cksum, delta);
+}
+
+#endif
@@ -0,0 +1,237 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <stddef.h>
+#include <string.h>
+
+#include <rte_byteorder.h>
+#include <rte_cpuflags.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_log.h>
+#include <rte_prefetch.h>
+
+#ifdef RTE_ARCH_X86
+#include <immintrin.h>
+#endif
+
+#include "lb_classify.h"
+
+#define OFF_TYPE offsetof(struct ether_hdr, ether_type)
+#define OFF_FRAG (ETHER_HDR_LEN + offsetof(struct ipv4_hdr, fragment_offset))
+#define OFF_DST (ETHER_HDR_LEN + offsetof(struct ipv4_hdr, dst_addr))
+
+#define FRAG_MASK (IPV4_HDR_MF_FLAG | IPV4_HDR_OFFSET_MASK)
+
+uint8_t lb_classify_protos[256];
+
+/* IP protocol of each protocol class, UINT32_MAX if not registered. */
+static uint32_t classify_ids[LB_IPPROTO_MAX];
+
+static void classify_scalar(struct rte_mbuf **pkts, uint16_t n,
+                            uint32_t local_ip, uint8_t *classes);
+
+static void (*classify_fn)(struct rte_mbuf **, uint16_t, uint32_t,
+                           uint8_t *) = classify_scalar;
+
+static inline uint8_t
+classify_one(struct rte_mbuf *m, uint32_t local_ip) {
+    struct ether_hdr *eth;
+    struct ipv4_hdr *iph;
+
+    eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    iph = (struct ipv4_hdr *)(eth + 1);
+
+    if (eth->ether_type == rte_cpu_to_be_16(ETHER_TYPE_ARP))
+        return LB_PKT_KNI;
+    if (eth->ether_type != rte_cpu_to_be_16(ETHER_TYPE_IPv4) ||
+        (iph->version_ihl >> 4) != 4 ||
+        (iph->version_ihl & IPV4_HDR_IHL_MASK) < 5)
+        return LB_PKT_DROP;
+    if (iph->dst_addr == local_ip || iph->next_proto_id == IPPROTO_OSPFIGP)
+        return LB_PKT_KNI;
+    if (iph->fragment_offset & rte_cpu_to_be_16(FRAG_MASK))
+        return LB_PKT_FRAG;
+    return lb_classify_protos[iph->next_proto_id];
+}
+
+static void
+classify_scalar(struct rte_mbuf **pkts, uint16_t n, uint32_t local_ip,
+                uint8_t *classes) {
+    uint16_t i;
+
+    for (i = 0; i < n; i++)
+        classes[i] = classify_one(pkts[i], local_ip);
+}
+
+#ifdef RTE_ARCH_X86
+
+/*
+ * The vector classifiers gather three little endian words per packet:
+ * ether type, version/IHL and TOS; fragment bits, TTL and protocol; the
+ * destination. Every lane then goes through the same compares and blends
+ * as classify_one(), the highest priority class is blended last.
+ */
+
+#define W_TYPE_MASK 0xffff
+#define W_IP_MASK (0xf0 << 16 | 0xffff)
+#define W_IP (0x40 << 16 | rte_cpu_to_be_16(ETHER_TYPE_IPv4))
+#define W_ARP rte_cpu_to_be_16(ETHER_TYPE_ARP)
+
+static inline uint32_t
+load32(struct rte_mbuf *m, size_t off) {
+    uint32_t v;
+
+    memcpy(&v, rte_pktmbuf_mtod_offset(m, char *, off), sizeof(v));
+    return v;
+}
+
+#define GATHER4(pkts, off)                                                     \
+    _mm_set_epi32(load32(pkts[3], off), load32(pkts[2], off),                  \
+                  load32(pkts[1], off), load32(pkts[0], off))
+
+static __attribute__((target("sse4.2"))) void
+classify_sse(struct rte_mbuf **pkts, uint16_t n, uint32_t local_ip,
+             uint8_t *classes) {
+    __m128i w0, w1, w2, ip, arp, kni, nfrag, proto, c;
+    uint32_t out[4];
+    uint16_t i, j;
+    uint32_t t;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        w0 = GATHER4((pkts + i), OFF_TYPE);
+        w1 = GATHER4((pkts + i), OFF_FRAG);
+        w2 = GATHER4((pkts + i), OFF_DST);
+
+        arp = _mm_cmpeq_epi32(_mm_and_si128(w0, _mm_set1_epi32(W_TYPE_MASK)),
+                              _mm_set1_epi32(W_ARP));
+        ip = _mm_cmpeq_epi32(_mm_and_si128(w0, _mm_set1_epi32(W_IP_MASK)),
+                             _mm_set1_epi32(W_IP));
+        ip = _mm_and_si128(
+            ip, _mm_cmpgt_epi32(
+                    _mm_and_si128(_mm_srli_epi32(w0, 16),
+                                  _mm_set1_epi32(IPV4_HDR_IHL_MASK)),
+                    _mm_set1_epi32(4)));
+        proto = _mm_srli_epi32(w1, 24);
+        nfrag = _mm_cmpeq_epi32(
+            _mm_and_si128(w1, _mm_set1_epi32(rte_cpu_to_be_16(FRAG_MASK))),
+            _mm_setzero_si128());
+        kni = _mm_or_si128(
+            _mm_cmpeq_epi32(w2, _mm_set1_epi32(local_ip)),
+            _mm_cmpeq_epi32(proto, _mm_set1_epi32(IPPROTO_OSPFIGP)));
+
+        c = _mm_set1_epi32(LB_PKT_DROP);
+        for (t = 0; t < LB_IPPROTO_MAX; t++) {
+            c = _mm_blendv_epi8(
+                c, _mm_set1_epi32(t),
+                _mm_cmpeq_epi32(proto, _mm_set1_epi32(classify_ids[t])));
+        }
+        c = _mm_blendv_epi8(_mm_set1_epi32(LB_PKT_FRAG), c, nfrag);
+        c = _mm_blendv_epi8(c, _mm_set1_epi32(LB_PKT_KNI), kni);
+        c = _mm_blendv_epi8(_mm_set1_epi32(LB_PKT_DROP), c, ip);
+        c = _mm_blendv_epi8(c, _mm_set1_epi32(LB_PKT_KNI), arp);
+
+        _mm_storeu_si128((__m128i *)out, c);
+        for (j = 0; j < 4; j++)
+            classes[i + j] = out[j];
+    }
+    for (; i < n; i++)
+        classes[i] = classify_one(pkts[i], local_ip);
+}
+
+#define GATHER8(pkts, off)                                                     \
+    _mm256_set_epi32(load32(pkts[7], off), load32(pkts[6], off),               \
+                     load32(pkts[5], off), load32(pkts[4], off),               \
+                     load32(pkts[3], off), load32(pkts[2], off),               \
+                     load32(pkts[1], off), load32(pkts[0], off))
+
+static __attribute__((target("avx2"))) void
+classify_avx2(struct rte_mbuf **pkts, uint16_t n, uint32_t local_ip,
+              uint8_t *classes) {
+    __m256i w0, w1, w2, ip, arp, kni, nfrag, proto, c;
+    uint32_t out[8];
+    uint16_t i, j;
+    uint32_t t;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        w0 = GATHER8((pkts + i), OFF_TYPE);
+        w1 = GATHER8((pkts + i), OFF_FRAG);
+        w2 = GATHER8((pkts + i), OFF_DST);
+
+        arp = _mm256_cmpeq_epi32(
+            _mm256_and_si256(w0, _mm256_set1_epi32(W_TYPE_MASK)),
+            _mm256_set1_epi32(W_ARP));
+        ip = _mm256_cmpeq_epi32(
+            _mm256_and_si256(w0, _mm256_set1_epi32(W_IP_MASK)),
+            _mm256_set1_epi32(W_IP));
+        ip = _mm256_and_si256(
+            ip, _mm256_cmpgt_epi32(
+                    _mm256_and_si256(_mm256_srli_epi32(w0, 16),
+                                     _mm256_set1_epi32(IPV4_HDR_IHL_MASK)),
+                    _mm256_set1_epi32(4)));
+        proto = _mm256_srli_epi32(w1, 24);
+        nfrag = _mm256_cmpeq_epi32(
+            _mm256_and_si256(w1,
+                             _mm256_set1_epi32(rte_cpu_to_be_16(FRAG_MASK))),
+            _mm256_setzero_si256());
+        kni = _mm256_or_si256(
+            _mm256_cmpeq_epi32(w2, _mm256_set1_epi32(local_ip)),
+            _mm256_cmpeq_epi32(proto, _mm256_set1_epi32(IPPROTO_OSPFIGP)));
+
+        c = _mm256_set1_epi32(LB_PKT_DROP);
+        for (t = 0; t < LB_IPPROTO_MAX; t++) {
+            c = _mm256_blendv_epi8(
+                c, _mm256_set1_epi32(t),
+                _mm256_cmpeq_epi32(proto, _mm256_set1_epi32(classify_ids[t])));
+        }
+        c = _mm256_blendv_epi8(_mm256_set1_epi32(LB_PKT_FRAG), c, nfrag);
+        c = _mm256_blendv_epi8(c, _mm256_set1_epi32(LB_PKT_KNI), kni);
+        c = _mm256_blendv_epi8(_mm256_set1_epi32(LB_PKT_DROP), c, ip);
+        c = _mm256_blendv_epi8(c, _mm256_set1_epi32(LB_PKT_KNI), arp);
+
+        _mm256_storeu_si256((__m256i *)out, c);
+        for (j = 0; j < 8; j++)
+            classes[i + j] = out[j];
+    }
+    for (; i < n; i++)
+        classes[i] = classify_one(pkts[i], local_ip);
+}
+
+#endif /* RTE_ARCH_X86 */
+
+void
+lb_classify_burst(struct rte_mbuf **pkts, uint16_t n, uint32_t local_ip,
+                  uint8_t *classes) {
+    uint16_t i;
+
+    for (i = 0; i < n; i++)
+        rte_prefetch0(rte_pktmbuf_mtod(pkts[i], void *));
+    classify_fn(pkts, n, local_ip, classes);
+}
+
+void
+lb_classify_init(void) {
+    const char *name = "scalar";
+    uint32_t t;
+
+    memset(lb_classify_protos, LB_PKT_DROP, sizeof(lb_classify_protos));
+    for (t = 0; t < LB_IPPROTO_MAX; t++) {
+        classify_ids[t] = UINT32_MAX;
+        if (lb_protos[t] == NULL)
+            continue;
+        classify_ids[t] = lb_protos[t]->id;
+        lb_classify_protos[lb_protos[t]->id] = t;
+    }
+
+#ifdef RTE_ARCH_X86
+    if (rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX2) > 0) {
+        classify_fn = classify_avx2;
+        name = "avx2";
+    } else if (rte_cpu_get_flag_enabled(RTE_CPUFLAG_SSE4_2) > 0) {
+        classify_fn = classify_sse;
+        name = "sse4.2";
+    }
+#endif
+
+    RTE_LOG(INFO, USER1, "%s(): Use the %s packet classifier.\n", __func__,
+            name);
+}
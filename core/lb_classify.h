@@ -0,0 +1,48 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_CLASSIFY_H__
+#define __LB_CLASSIFY_H__
+
+#include <rte_mbuf.h>
+
+#include "lb_proto.h"
+
+#ifndef IPPROTO_OSPFIGP
+#define IPPROTO_OSPFIGP 89
+#endif
+
+/*
+ * Classes of received packets. The protocol classes equal the protocol
+ * types, so they index the per-protocol batches directly.
+ */
+enum lb_pkt_class {
+    LB_PKT_TCP = LB_IPPROTO_TCP,
+    LB_PKT_UDP = LB_IPPROTO_UDP,
+    LB_PKT_ICMP = LB_IPPROTO_ICMP,
+    /* IPv4 fragment of any protocol. */
+    LB_PKT_FRAG = LB_IPPROTO_MAX,
+    /* ARP, OSPF and packets to the device address. */
+    LB_PKT_KNI,
+    LB_PKT_DROP,
+    LB_PKT_CLASS_MAX,
+};
+
+extern uint8_t lb_classify_protos[256];
+
+static inline enum lb_pkt_class
+lb_classify_proto(uint8_t proto) {
+    return lb_classify_protos[proto];
+}
+
+/*
+ * Reads the ethernet type, IPv4 version/IHL, fragment bits, protocol and
+ * destination of a burst and writes the class of each packet. local_ip is
+ * the address of the device, network byte order.
+ */
+void lb_classify_burst(struct rte_mbuf **pkts, uint16_t n, uint32_t local_ip,
+                       uint8_t *classes);
+
+/* Picks the AVX2, SSE4.2 or scalar classifier, after the protocols. */
+void lb_classify_init(void);
+
+#endif
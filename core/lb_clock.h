@@ -17,6 +17,9 @@ extern rte_atomic32_t lb_clock;
 /* MS_PER_S defined in rte_cycles.h */
 #define MS_TO_CYCLES(a) ((rte_get_timer_hz() + MS_PER_S - 1) / MS_PER_S * (a))
 
+/* US_PER_S defined in rte_cycles.h */
+#define US_TO_CYCLES(a) ((rte_get_timer_hz() + US_PER_S - 1) / US_PER_S * (a))
+
 #define SEC_TO_CYCLES(a) (rte_get_timer_hz() * (a))
 
 #define SEC_TO_LB_CLOCK(a) (LB_CLOCK_PER_S * (a))
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 
 #include <rte_cfgfile.h>
+#include <rte_cycles.h>
 #include <rte_eth_bond.h>
 #include <rte_ip.h>
 
@@ -185,6 +186,30 @@ device_entry_parse_txoffload(const char *token, void *_conf) {
     return 0;
 }
 
+static int
+device_entry_parse_lport_maps(const char *token, void *_conf) {
+    struct lb_device_conf *conf = _conf;
+    uint32_t num;
+
+    if (parser_read_uint32(&num, token) < 0 || num == 0)
+        return -1;
+
+    conf->lport_maps = num;
+    return 0;
+}
+
+static int
+device_entry_parse_frag_mbufs(const char *token, void *_conf) {
+    struct lb_device_conf *conf = _conf;
+    uint32_t num;
+
+    if (parser_read_uint32(&num, token) < 0 || num == 0)
+        return -1;
+
+    conf->frag_mbufs = num;
+    return 0;
+}
+
 static int
 device_entry_parse_local_ipv4(const char *token, void *_conf) {
     struct lb_device_conf *conf = _conf;
@@ -228,6 +253,43 @@ end:
     return 0;
 }
 
+/* "PREFIX/LEN [GW...], ..." without gateway the prefix is on-link. */
+static int
+device_entry_parse_routes(const char *token, void *_conf) {
+    struct lb_device_conf *conf = _conf;
+    struct lb_route_conf *route;
+    char *routes_str;
+    char *routes[LB_MAX_ROUTE_CONF];
+    char *tokens[LB_MAX_ROUTE_NH + 1];
+    int nb_routes, nb_tokens;
+    int i, j;
+
+    routes_str = strdup(token);
+    if (routes_str == NULL)
+        return -1;
+    nb_routes = str_split(routes_str, ",", routes, LB_MAX_ROUTE_CONF);
+    for (i = 0; i < nb_routes; i++) {
+        route = &conf->routes[i];
+        nb_tokens = str_split(routes[i], " ", tokens, RTE_DIM(tokens));
+        if (nb_tokens == 0 ||
+            parse_ipv4_prefix(tokens[0], &route->prefix, &route->depth) < 0)
+            goto err;
+        for (j = 1; j < nb_tokens; j++) {
+            if (parse_ipv4_addr(tokens[j],
+                                (struct in_addr *)&route->gws[j - 1]) < 0)
+                goto err;
+        }
+        route->nb_gws = nb_tokens - 1;
+    }
+    conf->nb_routes = nb_routes;
+    free(routes_str);
+    return 0;
+
+err:
+    free(routes_str);
+    return -1;
+}
+
 static int
 device_entry_parse_pci(const char *token, void *_conf) {
     struct lb_device_conf *conf = _conf;
@@ -252,6 +314,14 @@ device_entry_parse_pci(const char *token, void *_conf) {
     return 0;
 }
 
+static int
+device_entry_parse_port(const char *token, void *_conf) {
+    struct lb_device_conf *conf = _conf;
+
+    snprintf(conf->port, sizeof(conf->port), "%s", token);
+    return 0;
+}
+
 static const struct conf_entry device_entries[] = {
     {
         .name = "name",
@@ -308,11 +378,69 @@ static const struct conf_entry device_entries[] = {
         .required = 1,
         .parse = device_entry_parse_local_ipv4,
     },
+    {
+        .name = "lport-maps",
+        .required = 0,
+        .parse = device_entry_parse_lport_maps,
+    },
+    {
+        .name = "frag-mbufs",
+        .required = 0,
+        .parse = device_entry_parse_frag_mbufs,
+    },
+    {
+        .name = "routes",
+        .required = 0,
+        .parse = device_entry_parse_routes,
+    },
     {
         .name = "pci",
-        .required = 1,
+        .required = 0,
         .parse = device_entry_parse_pci,
     },
+    {
+        .name = "port",
+        .required = 0,
+        .parse = device_entry_parse_port,
+    },
+};
+
+static int
+power_entry_parse_mode(const char *token, void *_conf) {
+    struct lb_power_conf *conf = _conf;
+
+    if (strcmp(token, "poll") == 0)
+        conf->mode = LB_POWER_POLL;
+    else if (strcmp(token, "adaptive") == 0)
+        conf->mode = LB_POWER_ADAPTIVE;
+    else
+        return -1;
+    return 0;
+}
+
+static int
+power_entry_parse_latency(const char *token, void *_conf) {
+    struct lb_power_conf *conf = _conf;
+    uint32_t us;
+
+    if (parser_read_uint32(&us, token) < 0 || us == 0 || us > US_PER_S)
+        return -1;
+
+    conf->latency_us = us;
+    return 0;
+}
+
+static const struct conf_entry power_entries[] = {
+    {
+        .name = "mode",
+        .required = 0,
+        .parse = power_entry_parse_mode,
+    },
+    {
+        .name = "latency-us",
+        .required = 0,
+        .parse = power_entry_parse_latency,
+    },
 };
 
 static int
@@ -362,6 +490,28 @@ device_section_parse(struct rte_cfgfile *cfgfile, const char *section,
             }
         }
     }
+    if (conf->nb_pcis == 0 && conf->port[0] == '\0') {
+        printf("%s(): pci or port is required in section %s.\n", __func__,
+               section);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+power_section_parse(struct rte_cfgfile *cfgfile, const char *section,
+                    struct lb_power_conf *conf) {
+    const char *val;
+    uint32_t j;
+
+    for (j = 0; j < RTE_DIM(power_entries); j++) {
+        val = rte_cfgfile_get_entry(cfgfile, section, power_entries[j].name);
+        if (val != NULL && power_entries[j].parse(val, conf) < 0) {
+            printf("%s(): Cannot parse %s in section %s.\n", __func__,
+                   power_entries[j].name, section);
+            return -1;
+        }
+    }
     return 0;
 }
 
@@ -403,6 +553,7 @@ lb_config_file_load(const char *cfgfile_path) {
         return -1;
     }
     memset(lb_cfg, 0, sizeof(*lb_cfg));
+    lb_cfg->power.latency_us = LB_POWER_LATENCY_US;
 
     num_sections = rte_cfgfile_sections(cfgfile, sections, num_sections);
     for (i = 0; i < num_sections; i++) {
@@ -413,6 +564,8 @@ lb_config_file_load(const char *cfgfile_path) {
                                       &lb_cfg->devices[lb_cfg->nb_decices++]);
         else if (strcmp(sections[i], "DPDK") == 0)
             rc = dpdk_section_parse(cfgfile, sections[i], &lb_cfg->dpdk);
+        else if (strcmp(sections[i], "POWER") == 0)
+            rc = power_section_parse(cfgfile, sections[i], &lb_cfg->power);
 
         if (rc < 0) {
             printf("%s(): Cannot parse section %s.\n", __func__, sections[i]);
@@ -3,11 +3,22 @@
 #ifndef __LB_CONFIG_H__
 #define __LB_CONFIG_H__
 
+#include <rte_ethdev.h>
 #include <rte_kni.h>
 #include <rte_pci.h>
 
 #define LB_MAX_LADDR 256
 
+#define LB_MAX_ROUTE_CONF 64
+#define LB_MAX_ROUTE_NH 8
+
+struct lb_route_conf {
+    uint32_t prefix;
+    uint8_t depth;
+    uint8_t nb_gws;
+    uint32_t gws[LB_MAX_ROUTE_NH];
+};
+
 struct lb_device_conf {
     char name[RTE_KNI_NAMESIZE];
     uint32_t mode;
@@ -20,8 +31,16 @@ struct lb_device_conf {
     uint32_t txoffload;
     uint32_t nb_lips;
     uint32_t lips[LB_MAX_LADDR];
+    /* Preallocated local port bitmaps of each lcore and protocol. */
+    uint32_t lport_maps;
+    /* Mbufs the reassembly may hold, added to the mbuf pool. */
+    uint32_t frag_mbufs;
+    uint32_t nb_routes;
+    struct lb_route_conf routes[LB_MAX_ROUTE_CONF];
     uint16_t nb_pcis;
     struct rte_pci_addr pcis[RTE_MAX_ETHPORTS];
+    /* Port name of a virtual device, used without pci. */
+    char port[RTE_ETH_NAME_MAX_LEN];
 };
 
 #define LB_MAX_DPDK_ARGS 128
@@ -31,10 +50,24 @@ struct lb_dpdk_conf {
     int argc;
 };
 
+enum {
+    LB_POWER_POLL,
+    LB_POWER_ADAPTIVE,
+};
+
+/* Longest a sleeping worker leaves its rings unpolled. */
+#define LB_POWER_LATENCY_US 100
+
+struct lb_power_conf {
+    uint32_t mode;
+    uint32_t latency_us;
+};
+
 struct lb_conf {
     struct lb_device_conf devices[RTE_MAX_ETHPORTS];
     uint16_t nb_decices;
     struct lb_dpdk_conf dpdk;
+    struct lb_power_conf power;
 };
 
 extern struct lb_conf *lb_cfg;
@@ -10,6 +10,7 @@
 #include <rte_hash_crc.h>
 #include <rte_malloc.h>
 #include <rte_mempool.h>
+#include <rte_prefetch.h>
 #include <rte_timer.h>
 
 #include <unixctl_command.h>
@@ -21,6 +22,68 @@
 
 #define CONN_TIMER_CYCLE MS_TO_CYCLES(10)
 
+#define TW_LEVEL_SHIFT(n) (LB_CONN_TW_ROOT_BITS + (n)*LB_CONN_TW_BITS)
+#define TW_LEVEL_INDEX(t, n) (((t) >> TW_LEVEL_SHIFT(n)) & LB_CONN_TW_MASK)
+
+static void
+tw_conn_add(struct lb_conn_timer_wheel *tw, struct lb_conn *conn) {
+    struct lb_conn_list *slot;
+    uint32_t expire_time = conn->expire_time;
+    uint32_t idx = expire_time - tw->curr;
+    int n;
+
+    if ((int32_t)idx < 0) {
+        slot = &tw->root[tw->curr & LB_CONN_TW_ROOT_MASK];
+    } else if (idx < LB_CONN_TW_ROOT_SIZE) {
+        slot = &tw->root[expire_time & LB_CONN_TW_ROOT_MASK];
+    } else {
+        for (n = 0; n < LB_CONN_TW_LEVELS - 1; n++) {
+            if (idx < (1u << TW_LEVEL_SHIFT(n + 1)))
+                break;
+        }
+        slot = &tw->levels[n][TW_LEVEL_INDEX(expire_time, n)];
+    }
+    TAILQ_INSERT_TAIL(slot, conn, next);
+    conn->tw_slot = slot;
+}
+
+static inline void
+tw_conn_del(struct lb_conn *conn) {
+    if (conn->tw_slot != NULL) {
+        TAILQ_REMOVE(conn->tw_slot, conn, next);
+        conn->tw_slot = NULL;
+    }
+}
+
+static uint32_t
+tw_cascade(struct lb_conn_timer_wheel *tw, int n) {
+    struct lb_conn_list list;
+    struct lb_conn *conn;
+    uint32_t index = TW_LEVEL_INDEX(tw->curr, n);
+
+    TAILQ_INIT(&list);
+    TAILQ_CONCAT(&list, &tw->levels[n][index], next);
+    while ((conn = TAILQ_FIRST(&list)) != NULL) {
+        TAILQ_REMOVE(&list, conn, next);
+        tw_conn_add(tw, conn);
+    }
+    return index;
+}
+
+void
+lb_conn_timer_rearm(struct lb_conn *conn, uint32_t expire_time) {
+    struct lb_conn_table *ct = conn->ct;
+
+    rte_spinlock_lock(&ct->spinlock);
+    /* Already popped by the wheel, it is re-armed after the callbacks. */
+    if (conn->tw_slot != NULL) {
+        tw_conn_del(conn);
+        conn->expire_time = expire_time;
+        tw_conn_add(ct->tw, conn);
+    }
+    rte_spinlock_unlock(&ct->spinlock);
+}
+
 struct lb_conn *
 lb_conn_new(struct lb_conn_table *ct, uint32_t cip, uint32_t cport,
             struct lb_real_service *rs, uint8_t is_synproxy,
@@ -34,7 +97,8 @@ lb_conn_new(struct lb_conn_table *ct, uint32_t cip, uint32_t cport,
         return NULL;
     }
 
-    rc = lb_laddr_get(dev, ct->type, &conn->laddr, &conn->lport);
+    rc = lb_laddr_get(dev, ct->type, rs->rip, rs->rport, &conn->laddr,
+                      &conn->lport);
     if (rc < 0) {
         rte_mempool_put(ct->mp, conn);
         return NULL;
@@ -52,6 +116,7 @@ lb_conn_new(struct lb_conn_table *ct, uint32_t cip, uint32_t cport,
 
     conn->use_time = LB_CLOCK();
     conn->timeout = ct->timeout;
+    conn->expire_time = conn->use_time + conn->timeout + 1;
 
     conn->real_service = rs;
     conn->flags = 0;
@@ -73,7 +138,8 @@ lb_conn_new(struct lb_conn_table *ct, uint32_t cip, uint32_t cport,
     IPv4_4TUPLE(&tuple, conn->cip, conn->cport, conn->vip, conn->vport);
     rc = rte_hash_add_key_data(ct->hash, (const void *)&tuple, conn);
     if (rc < 0) {
-        lb_laddr_put(conn->laddr, conn->lport, ct->type);
+        lb_laddr_put(conn->laddr, conn->rip, conn->rport, conn->lport,
+                     ct->type);
         rte_mempool_put(ct->mp, conn);
         return NULL;
     }
@@ -83,14 +149,20 @@ lb_conn_new(struct lb_conn_table *ct, uint32_t cip, uint32_t cport,
     if (rc < 0) {
         IPv4_4TUPLE(&tuple, conn->cip, conn->cport, conn->vip, conn->vport);
         rte_hash_del_key(ct->hash, (const void *)&tuple);
-        lb_laddr_put(conn->laddr, conn->lport, ct->type);
+        lb_laddr_put(conn->laddr, conn->rip, conn->rport, conn->lport,
+                     ct->type);
         rte_mempool_put(ct->mp, conn);
         return NULL;
     }
 
+    /* Let the task callback run on the next tick. */
+    if (is_synproxy && ct->timer_task_cb != NULL)
+        conn->expire_time = conn->use_time + 1;
+
     rte_spinlock_lock(&ct->spinlock);
-    TAILQ_INSERT_TAIL(&ct->timeout_list, conn, next);
+    tw_conn_add(ct->tw, conn);
     rte_spinlock_unlock(&ct->spinlock);
+    ct->gen++;
 
     return conn;
 }
@@ -119,6 +191,49 @@ lb_conn_find(struct lb_conn_table *ct, uint32_t sip, uint32_t dip,
     return conn;
 }
 
+/*
+ * Resolve up to RTE_HASH_LOOKUP_BULK_MAX tuples with one bulk lookup, so
+ * the hash bucket misses of a whole burst overlap. A result is only valid
+ * while ct->gen is unchanged, callers that add or expire conns between
+ * the lookup and the use have to fall back to lb_conn_find().
+ */
+void
+lb_conn_find_bulk(struct lb_conn_table *ct, const struct ipv4_4tuple *tuples,
+                  uint32_t n, struct lb_conn **conns, uint8_t *dirs) {
+    const void *keys[RTE_HASH_LOOKUP_BULK_MAX];
+    struct lb_conn *conn;
+    uint64_t hits = 0;
+    uint32_t curr_time;
+    uint32_t i;
+
+    RTE_ASSERT(n <= RTE_HASH_LOOKUP_BULK_MAX);
+    for (i = 0; i < n; i++)
+        keys[i] = &tuples[i];
+    if (n > 0)
+        rte_hash_lookup_bulk_data(ct->hash, keys, n, &hits, (void **)conns);
+
+    for (i = 0; i < n; i++) {
+        if (hits & (1ULL << i))
+            rte_prefetch0(conns[i]);
+        else
+            conns[i] = NULL;
+    }
+
+    curr_time = LB_CLOCK();
+    for (i = 0; i < n; i++) {
+        conn = conns[i];
+        if (conn == NULL) {
+            dirs[i] = LB_DIR_ORIGINAL;
+            continue;
+        }
+        conn->use_time = curr_time;
+        if (conn->cip == tuples[i].sip && conn->cport == tuples[i].sport)
+            dirs[i] = LB_DIR_ORIGINAL;
+        else
+            dirs[i] = LB_DIR_REPLY;
+    }
+}
+
 static void
 __conn_expire(struct lb_conn_table *ct, struct lb_conn *conn) {
     struct ipv4_4tuple tuple;
@@ -139,11 +254,12 @@ __conn_expire(struct lb_conn_table *ct, struct lb_conn *conn) {
     IPv4_4TUPLE(&tuple, conn->rip, conn->rport, conn->lip, conn->lport);
     rte_hash_del_key(ct->hash, (const void *)&tuple);
 
-    lb_laddr_put(conn->laddr, conn->lport, ct->type);
+    lb_laddr_put(conn->laddr, conn->rip, conn->rport, conn->lport, ct->type);
     lb_vs_put_rs(conn->real_service);
-    rte_mempool_put(ct->mp, conn);
 
-    TAILQ_REMOVE(&ct->timeout_list, conn, next);
+    tw_conn_del(conn);
+    rte_mempool_put(ct->mp, conn);
+    ct->gen++;
 }
 
 void
@@ -153,34 +269,114 @@ lb_conn_expire(struct lb_conn_table *ct, struct lb_conn *conn) {
     rte_spinlock_unlock(&ct->spinlock);
 }
 
-static void
-conn_table_expire_cb(__attribute((unused)) struct rte_timer *timer, void *arg) {
-    struct lb_conn_table *ct = arg;
+static uint32_t
+conn_table_expire_slot(struct lb_conn_table *ct, struct lb_conn_list *slot,
+                       uint32_t curr_time, uint32_t budget) {
+    struct lb_conn_timer_wheel *tw = ct->tw;
     struct lb_conn *conn;
-    void *tmp;
-    uint32_t curr_time;
+    uint32_t expire_time, next;
+    uint32_t n = 0;
 
-    curr_time = LB_CLOCK();
-    rte_spinlock_lock(&ct->spinlock);
-    for_each_conn_safe(conn, &ct->timeout_list, next, tmp) {
+    while (n < budget && (conn = TAILQ_FIRST(slot)) != NULL) {
+        n++;
+        tw_conn_del(conn);
+
+        next = 0;
         if (ct->timer_task_cb)
-            ct->timer_task_cb(conn);
+            next = ct->timer_task_cb(conn);
         if (ct->timer_expire_cb &&
             (ct->timer_expire_cb(conn, curr_time) == 0)) {
             __conn_expire(ct, conn);
+            continue;
+        }
+
+        expire_time = conn->use_time + conn->timeout + 1;
+        if (next != 0 && LB_CLOCK_BEFORE(curr_time + next, expire_time))
+            expire_time = curr_time + next;
+        /* Never re-arm into the slot being processed. */
+        if (!LB_CLOCK_AFTER(expire_time, tw->curr))
+            expire_time = tw->curr + 1;
+        conn->expire_time = expire_time;
+        tw_conn_add(tw, conn);
+    }
+    return n;
+}
+
+static void
+conn_table_expire_cb(__attribute((unused)) struct rte_timer *timer, void *arg) {
+    struct lb_conn_table *ct = arg;
+    struct lb_conn_timer_wheel *tw = ct->tw;
+    struct lb_conn_list *slot;
+    uint32_t curr_time, index;
+    uint32_t budget;
+    int n;
+
+    curr_time = LB_CLOCK();
+    budget = ct->expire_budget;
+    rte_spinlock_lock(&ct->spinlock);
+    while (!LB_CLOCK_AFTER(tw->curr, curr_time)) {
+        index = tw->curr & LB_CONN_TW_ROOT_MASK;
+        if (index == 0) {
+            for (n = 0; n < LB_CONN_TW_LEVELS; n++) {
+                if (tw_cascade(tw, n) != 0)
+                    break;
+            }
+        }
+        slot = &tw->root[index];
+        budget -= conn_table_expire_slot(ct, slot, curr_time, budget);
+        /* Out of budget, continue with this slot on the next tick. */
+        if (!TAILQ_EMPTY(slot))
+            break;
+        tw->curr++;
+    }
+    rte_spinlock_unlock(&ct->spinlock);
+}
+
+#define TW_NB_SLOTS                                                            \
+    (LB_CONN_TW_ROOT_SIZE + LB_CONN_TW_LEVELS * LB_CONN_TW_SIZE)
+
+static struct lb_conn_list *
+tw_slot_get(struct lb_conn_timer_wheel *tw, uint32_t i) {
+    if (i < LB_CONN_TW_ROOT_SIZE)
+        return &tw->root[i];
+    i -= LB_CONN_TW_ROOT_SIZE;
+    return &tw->levels[i / LB_CONN_TW_SIZE][i % LB_CONN_TW_SIZE];
+}
+
+uint32_t
+lb_conn_table_walk(struct lb_conn_table *ct, struct lb_conn_walk *walk,
+                   struct lb_conn *conns, uint32_t n) {
+    struct lb_conn *conn = NULL;
+    uint32_t i = 0, pos;
+
+    rte_spinlock_lock(&ct->spinlock);
+    for (; i < n && walk->slot < TW_NB_SLOTS; walk->slot++, walk->pos = 0) {
+        pos = 0;
+        TAILQ_FOREACH(conn, tw_slot_get(ct->tw, walk->slot), next) {
+            if (pos++ < walk->pos)
+                continue;
+            if (i == n)
+                break;
+            conns[i++] = *conn;
+            walk->pos++;
         }
+        /* The batch is full in the middle of the slot. */
+        if (conn != NULL)
+            break;
     }
     rte_spinlock_unlock(&ct->spinlock);
+    return i;
 }
 
 int
 lb_conn_table_init(struct lb_conn_table *ct, enum lb_proto_type type,
                    uint32_t lcore_id, uint32_t timeout, uint32_t size,
-                   void (*task_cb)(struct lb_conn *),
+                   uint32_t (*task_cb)(struct lb_conn *),
                    int (*expire_cb)(struct lb_conn *, uint32_t)) {
     struct rte_hash_parameters param;
     char name[RTE_HASH_NAMESIZE];
     uint32_t socket_id;
+    int i, n;
 
     socket_id = rte_lcore_to_socket_id(lcore_id);
 
@@ -211,7 +407,20 @@ lb_conn_table_init(struct lb_conn_table *ct, enum lb_proto_type type,
         return -1;
     }
 
-    TAILQ_INIT(&ct->timeout_list);
+    ct->tw = rte_zmalloc_socket(NULL, sizeof(struct lb_conn_timer_wheel),
+                                RTE_CACHE_LINE_SIZE, socket_id);
+    if (ct->tw == NULL) {
+        RTE_LOG(ERR, USER1, "%s(): Alloc timer wheel failed.\n", __func__);
+        return -1;
+    }
+    for (i = 0; i < LB_CONN_TW_ROOT_SIZE; i++)
+        TAILQ_INIT(&ct->tw->root[i]);
+    for (n = 0; n < LB_CONN_TW_LEVELS; n++) {
+        for (i = 0; i < LB_CONN_TW_SIZE; i++)
+            TAILQ_INIT(&ct->tw->levels[n][i]);
+    }
+    ct->tw->curr = LB_CLOCK();
+    ct->expire_budget = LB_CONN_EXPIRE_BUDGET;
     ct->timeout = timeout;
     ct->timer_task_cb = task_cb;
     ct->timer_expire_cb = expire_cb;
@@ -33,6 +33,8 @@ struct ipv4_4tuple {
         (t)->dport = dp;                                                       \
     } while (0)
 
+TAILQ_HEAD(lb_conn_list, lb_conn);
+
 struct lb_conn {
     TAILQ_ENTRY(lb_conn) next;
 
@@ -45,8 +47,9 @@ struct lb_conn {
     uint32_t timeout;
     uint32_t create_time;
     uint32_t use_time;
-
-    struct rte_timer timer;
+    /* Timer wheel slot the conn is linked in, and its LB_CLOCK tick. */
+    uint32_t expire_time;
+    struct lb_conn_list *tw_slot;
 
     struct lb_real_service *real_service;
     struct lb_laddr *laddr;
@@ -60,21 +63,55 @@ struct lb_conn {
     struct tcp_secret_seq tseq;
 };
 
+/*
+ * Hierarchical timing wheel, one per conn table (and so per lcore).
+ * The root level has 256 slots of one LB_CLOCK tick, every upper level
+ * has 64 slots and covers 64 times the range of the level below it, so
+ * the whole 32bit LB_CLOCK range can be armed.
+ */
+#define LB_CONN_TW_ROOT_BITS 8
+#define LB_CONN_TW_ROOT_SIZE (1 << LB_CONN_TW_ROOT_BITS)
+#define LB_CONN_TW_ROOT_MASK (LB_CONN_TW_ROOT_SIZE - 1)
+#define LB_CONN_TW_BITS 6
+#define LB_CONN_TW_SIZE (1 << LB_CONN_TW_BITS)
+#define LB_CONN_TW_MASK (LB_CONN_TW_SIZE - 1)
+#define LB_CONN_TW_LEVELS 4
+
+struct lb_conn_timer_wheel {
+    /* The next tick to be processed. */
+    uint32_t curr;
+    struct lb_conn_list root[LB_CONN_TW_ROOT_SIZE];
+    struct lb_conn_list levels[LB_CONN_TW_LEVELS][LB_CONN_TW_SIZE];
+};
+
+#define LB_CONN_EXPIRE_BUDGET 4096
+
 struct lb_conn_table {
     enum lb_proto_type type;
     struct rte_hash *hash;
     struct rte_mempool *mp;
     uint32_t timeout;
     rte_spinlock_t spinlock;
-    TAILQ_HEAD(, lb_conn) timeout_list;
+    struct lb_conn_timer_wheel *tw;
+    /* Max number of conns handled by the wheel in one tick. */
+    uint32_t expire_budget;
+    /* Bumped on every conn add and delete, see lb_conn_find_bulk(). */
+    uint32_t gen;
     struct rte_timer timer;
     int (*timer_expire_cb)(struct lb_conn *, uint32_t);
-    void (*timer_task_cb)(struct lb_conn *);
+    uint32_t (*timer_task_cb)(struct lb_conn *);
+};
+
+/* Where a batched walk of the table resumes, see lb_conn_table_walk(). */
+struct lb_conn_walk {
+    uint32_t slot;
+    uint32_t pos;
 };
 
-#define for_each_conn_safe(var, head, field, tvar)                             \
-    for ((var) = TAILQ_FIRST((head));                                          \
-         (var) && ((tvar) = TAILQ_NEXT((var), field), 1); (var) = (tvar))
+#define LB_CONN_WALK_BATCH 64
+
+#define LB_CLOCK_BEFORE(a, b) ((int32_t)((a) - (b)) < 0)
+#define LB_CLOCK_AFTER(a, b) LB_CLOCK_BEFORE(b, a)
 
 struct lb_conn *lb_conn_new(struct lb_conn_table *ct, uint32_t cip,
                             uint32_t cport, struct lb_real_service *rs,
@@ -83,9 +120,36 @@ void lb_conn_expire(struct lb_conn_table *ct, struct lb_conn *conn);
 struct lb_conn *lb_conn_find(struct lb_conn_table *ct, uint32_t sip,
                              uint32_t dip, uint16_t sport, uint16_t dport,
                              uint8_t *dir);
+void lb_conn_find_bulk(struct lb_conn_table *ct,
+                       const struct ipv4_4tuple *tuples, uint32_t n,
+                       struct lb_conn **conns, uint8_t *dirs);
+void lb_conn_timer_rearm(struct lb_conn *conn, uint32_t expire_time);
+/*
+ * Copies up to @n conns of the table from where @walk stopped, zeroed to
+ * start. The lock is only held for the batch, conns moved by the wheel in
+ * between may be missed or copied twice. Returns 0 at the end.
+ */
+uint32_t lb_conn_table_walk(struct lb_conn_table *ct,
+                            struct lb_conn_walk *walk, struct lb_conn *conns,
+                            uint32_t n);
 int lb_conn_table_init(struct lb_conn_table *ct, enum lb_proto_type type,
                        uint32_t lcore_id, uint32_t timeout, uint32_t size,
-                       void (*task_cb)(struct lb_conn *),
+                       uint32_t (*task_cb)(struct lb_conn *),
                        int (*expire_cb)(struct lb_conn *, uint32_t));
 
+/*
+ * Refreshing a conn in lb_conn_find() only stores use_time, the wheel
+ * re-arms it lazily when its slot fires. Only a shorter timeout has to
+ * move the conn to an earlier slot right away.
+ */
+static inline void
+lb_conn_set_timeout(struct lb_conn *conn, uint32_t timeout) {
+    uint32_t expire_time;
+
+    conn->timeout = timeout;
+    expire_time = conn->use_time + timeout + 1;
+    if (LB_CLOCK_BEFORE(expire_time, conn->expire_time))
+        lb_conn_timer_rearm(conn, expire_time);
+}
+
 #endif
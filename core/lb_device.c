@@ -1,6 +1,7 @@
 /* Copyright (c) 2018. TIG developer. */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -17,11 +18,14 @@
 #include <rte_eth_bond.h>
 #include <rte_eth_ctrl.h>
 #include <rte_ethdev.h>
+#include <rte_flow.h>
+#include <rte_jhash.h>
 #include <rte_kni.h>
 #include <rte_log.h>
 #include <rte_malloc.h>
 #include <rte_pci.h>
 #include <rte_ring.h>
+#include <rte_thash.h>
 
 #include <unixctl_command.h>
 
@@ -29,148 +33,23 @@
 #include "lb_device.h"
 #include "lb_format.h"
 #include "lb_parser.h"
+#include "lb_power.h"
 
 #define LB_PKTMBUF_POOL_DEFAULT_SIZE 4096
 
-struct lb_device *lb_devices[RTE_MAX_ETHPORTS];
-uint16_t lb_device_count;
-
-static int
-__fdir_filter_input_set(uint16_t port_id, uint32_t flow_type,
-                        enum rte_eth_input_set_field filed,
-                        enum rte_filter_input_set_op op) {
-    struct rte_eth_fdir_filter_info info;
-
-    memset(&info, 0, sizeof(info));
-    info.info_type = RTE_ETH_FDIR_FILTER_INPUT_SET_SELECT;
-    info.info.input_set_conf.flow_type = flow_type;
-    info.info.input_set_conf.field[0] = filed;
-    info.info.input_set_conf.inset_size = 1;
-    info.info.input_set_conf.op = op;
-    info.info.input_set_conf.op = RTE_ETH_INPUT_SET_ADD;
-    return rte_eth_dev_filter_ctrl(port_id, RTE_ETH_FILTER_FDIR,
-                                   RTE_ETH_FILTER_SET, &info);
-}
-
-static int
-_fdir_filter_input_set(uint16_t port_id) {
-    int rc = 0;
-
-    rc += __fdir_filter_input_set(port_id, RTE_ETH_FLOW_NONFRAG_IPV4_TCP,
-                                  RTE_ETH_INPUT_SET_NONE,
-                                  RTE_ETH_INPUT_SET_SELECT);
-    rc += __fdir_filter_input_set(port_id, RTE_ETH_FLOW_NONFRAG_IPV4_TCP,
-                                  RTE_ETH_INPUT_SET_L3_DST_IP4,
-                                  RTE_ETH_INPUT_SET_ADD);
-    rc += __fdir_filter_input_set(port_id, RTE_ETH_FLOW_NONFRAG_IPV4_UDP,
-                                  RTE_ETH_INPUT_SET_NONE,
-                                  RTE_ETH_INPUT_SET_SELECT);
-    rc += __fdir_filter_input_set(port_id, RTE_ETH_FLOW_NONFRAG_IPV4_UDP,
-                                  RTE_ETH_INPUT_SET_L3_DST_IP4,
-                                  RTE_ETH_INPUT_SET_ADD);
-    return rc;
-}
-
-static int
-_fdir_filter_add(uint16_t port_id, uint32_t flow_type, uint32_t dst_ip,
-                 uint32_t rxq_id) {
-    struct rte_eth_fdir_filter fdir;
-
-    memset(&fdir, 0, sizeof(fdir));
-    fdir.input.flow_type = flow_type;
-    fdir.input.flow.tcp4_flow.ip.dst_ip = dst_ip;
-    fdir.action.rx_queue = rxq_id;
-    return rte_eth_dev_filter_ctrl(port_id, RTE_ETH_FILTER_FDIR,
-                                   RTE_ETH_FILTER_ADD, &fdir);
-}
-
-static int
-dpdk_dev_fdir_filter_add(uint16_t port_id, uint32_t dst_ip, uint32_t rxq_id) {
-    static uint8_t input_set_once[RTE_MAX_ETHPORTS] = {0};
-    int rc;
-
-    if (!input_set_once[port_id]) {
-        rc = _fdir_filter_input_set(port_id);
-        if (rc < 0) {
-            RTE_LOG(
-                WARNING, USER1,
-                "%s(): Port%u doesn't support FDIR input set configuration.\n",
-                __func__, port_id);
-        }
-        input_set_once[port_id] = 1;
-    }
-
-    rc = _fdir_filter_add(port_id, RTE_ETH_FLOW_NONFRAG_IPV4_TCP, dst_ip,
-                          rxq_id);
-    if (rc < 0) {
-        RTE_LOG(ERR, USER1,
-                "%s(): Port%u add FDIR fileter failed, "
-                "type:NONFRAG_IPV4_TCP, dst-ip:" IPv4_BE_FMT ", rxq:%u\n",
-                __func__, port_id, IPv4_BE_ARG(dst_ip), rxq_id);
-        return rc;
-    }
-    rc = _fdir_filter_add(port_id, RTE_ETH_FLOW_NONFRAG_IPV4_UDP, dst_ip,
-                          rxq_id);
-    if (rc < 0) {
-        RTE_LOG(ERR, USER1,
-                "%s(): Port%u add FDIR fileter failed, "
-                "type:NONFRAG_IPV4_UDP, dst-ip:" IPv4_BE_FMT ", rxq:%u\n",
-                __func__, port_id, IPv4_BE_ARG(dst_ip), rxq_id);
-        return rc;
-    }
-    RTE_LOG(INFO, USER1,
-            "%s(): Port%u add FDIR filter, "
-            "type:NONFRAG_IPV4_TCP|NONFRAG_IPV4_UDP, dst-ip:" IPv4_BE_FMT
-            ", rxq:%u\n",
-            __func__, port_id, IPv4_BE_ARG(dst_ip), rxq_id);
-    return 0;
-}
-
-static int
-dpdk_dev_5tuple_filter_add(uint16_t port_id, uint32_t dst_ip, uint32_t rxq_id) {
-    struct rte_eth_ntuple_filter ntuple;
-    int rc;
-
-    memset(&ntuple, 0, sizeof(ntuple));
-    ntuple.flags = RTE_5TUPLE_FLAGS;
-    ntuple.dst_ip = dst_ip;
-    ntuple.dst_ip_mask = UINT32_MAX;
-    ntuple.priority = 1;
-    ntuple.queue = rxq_id;
-    rc = rte_eth_dev_filter_ctrl(port_id, RTE_ETH_FILTER_NTUPLE,
-                                 RTE_ETH_FILTER_ADD, &ntuple);
-    if (rc < 0) {
-        RTE_LOG(ERR, USER1,
-                "%s(): Port%u add 5Tuple filter failed, dst-ip:" IPv4_BE_FMT
-                ", rxq:%u.\n",
-                __func__, port_id, IPv4_BE_ARG(dst_ip), rxq_id);
-        return rc;
-    }
-    RTE_LOG(INFO, USER1,
-            "%s(): Port%u add 5Tuple filter, dst-ip:" IPv4_BE_FMT ", rxq:%u\n",
-            __func__, port_id, IPv4_BE_ARG(dst_ip), rxq_id);
-    return rc;
-}
-
-static int
-dpdk_dev_filter_add(uint16_t port_id, uint32_t dst_ip, uint32_t rxq_id) {
-    if (rte_eth_dev_filter_supported(port_id, RTE_ETH_FILTER_NTUPLE) == 0) {
-        return dpdk_dev_5tuple_filter_add(port_id, dst_ip, rxq_id);
-    }
-
-    RTE_LOG(ERR, USER1, "%s(): Port%u does not support 5Tuple filter.\n",
-            __func__, port_id);
-
-    if (rte_eth_dev_filter_supported(port_id, RTE_ETH_FILTER_FDIR) == 0) {
-        return dpdk_dev_fdir_filter_add(port_id, dst_ip, rxq_id);
-    }
+/*
+ * Local port bitmaps preallocated for each lcore, one per (lip, rip, rport)
+ * in use. More are allocated when they run out.
+ */
+#define LB_LPORT_MAPS 512
 
-    RTE_LOG(ERR, USER1, "%s(): Port%u does not support FDIR filter.\n",
-            __func__, port_id);
+/* Mbufs added to the pool for the fragments under reassembly. */
+#define LB_FRAG_MBUFS 4096
 
-    return -1;
-}
+struct lb_device *lb_devices[RTE_MAX_ETHPORTS];
+uint16_t lb_device_count;
 
+#ifndef LB_BENCH
 static int
 kni_get_mac(const char *name, struct ether_addr *ha) {
     int fd;
@@ -200,6 +79,7 @@ kni_get_mac(const char *name, struct ether_addr *ha) {
 
     return 0;
 }
+#endif
 
 static void
 tx_buffer_callback(struct rte_mbuf **pkts, uint16_t unsend, void *userdata) {
@@ -212,35 +92,21 @@ tx_buffer_callback(struct rte_mbuf **pkts, uint16_t unsend, void *userdata) {
     dev->lcore_stats[rte_lcore_id()].tx_dropped += unsend;
 }
 
-static struct rte_ring *
-l4_ports_create(const char *name, uint16_t min, uint16_t max,
-                uint32_t socket_id) {
-    struct rte_ring *r;
-    uint16_t p;
-
-    r = rte_ring_create(name, UINT16_MAX + 1, socket_id,
-                        RING_F_SP_ENQ | RING_F_SC_DEQ);
-    if (r == NULL) {
-        RTE_LOG(ERR, USER1, "%s(): Create ports ring %s failed, %s.\n",
-                __func__, name, rte_strerror(rte_errno));
-        return NULL;
-    }
-    for (p = min; p != max; p++) {
-        rte_ring_sp_enqueue(r, (void *)(uintptr_t)rte_cpu_to_be_16(p));
-    }
-    return r;
-}
-
 static int
-dpdk_dev_config_and_set_ipfilter(uint16_t port_id, struct lb_device *dev,
-                                 uint8_t ipfilter_enabled) {
+dpdk_dev_config(uint16_t port_id, struct lb_device *dev) {
     struct rte_eth_conf dev_conf;
+    struct rte_eth_dev_info dev_info;
+    struct rte_eth_rxconf rxconf;
+    struct rte_eth_txconf txconf;
     int rc;
     uint16_t i;
 
     memset(&dev_conf, 0, sizeof(dev_conf));
     dev_conf.rxmode.mq_mode = ETH_MQ_RX_RSS;
     dev_conf.rxmode.max_rx_pkt_len = ETHER_MAX_LEN;
+    dev_conf.rxmode.ignore_offload_bitfield = 1;
+    dev_conf.rxmode.offloads = dev->rx_offload;
+    dev_conf.txmode.offloads = dev->tx_offload;
     dev_conf.rx_adv_conf.rss_conf.rss_hf = ETH_RSS_PROTO_MASK;
     dev_conf.fdir_conf.mode = RTE_FDIR_MODE_PERFECT;
     dev_conf.fdir_conf.mask.ipv4_mask.src_ip = 0xFFFFFFFF;
@@ -248,6 +114,9 @@ dpdk_dev_config_and_set_ipfilter(uint16_t port_id, struct lb_device *dev,
     dev_conf.fdir_conf.mask.src_port_mask = 0xFFFF;
     dev_conf.fdir_conf.mask.dst_port_mask = 0xFFFF;
     dev_conf.fdir_conf.drop_queue = 127;
+    /* The bonding PMD has no rx interrupts. */
+    if (lb_power_adaptive && dev->type == LB_DEV_T_NORM)
+        dev_conf.intr_conf.rxq = 1;
 
     rc = rte_eth_dev_configure(port_id, dev->nb_rxq, dev->nb_txq, &dev_conf);
     if (rc < 0) {
@@ -256,9 +125,16 @@ dpdk_dev_config_and_set_ipfilter(uint16_t port_id, struct lb_device *dev,
         return rc;
     }
 
+    rte_eth_dev_info_get(port_id, &dev_info);
+    rxconf = dev_info.default_rxconf;
+    rxconf.offloads = dev_conf.rxmode.offloads;
+    txconf = dev_info.default_txconf;
+    txconf.txq_flags = ETH_TXQ_FLAGS_IGNORE;
+    txconf.offloads = dev_conf.txmode.offloads;
+
     for (i = 0; i < dev->nb_rxq; i++) {
         rc = rte_eth_rx_queue_setup(port_id, i, dev->rxq_size, dev->socket_id,
-                                    NULL, dev->mp);
+                                    &rxconf, dev->mp);
         if (rc < 0) {
             RTE_LOG(ERR, USER1, "%s(): Setup the rxq%u of port%u failed, %s.\n",
                     __func__, i, port_id, strerror(-rc));
@@ -268,7 +144,7 @@ dpdk_dev_config_and_set_ipfilter(uint16_t port_id, struct lb_device *dev,
 
     for (i = 0; i < dev->nb_txq; i++) {
         rc = rte_eth_tx_queue_setup(port_id, i, dev->txq_size, dev->socket_id,
-                                    NULL);
+                                    &txconf);
         if (rc < 0) {
             RTE_LOG(ERR, USER1, "%s(): Setup the txq%u of port%u failed, %s.\n",
                     __func__, i, port_id, strerror(-rc));
@@ -278,29 +154,324 @@ dpdk_dev_config_and_set_ipfilter(uint16_t port_id, struct lb_device *dev,
 
     rte_eth_promiscuous_enable(port_id);
 
-    if (ipfilter_enabled && dev->nb_rxq > 1) {
-        uint32_t lcore_id;
+    return 0;
+}
 
-        RTE_LCORE_FOREACH_SLAVE(lcore_id) {
-            struct lb_laddr_list *laddr_list;
-            struct lb_laddr *laddr;
-            uint32_t lid;
+/*
+ * Keep the configured offloads every port of the device supports, the
+ * datapath does the others in software.
+ */
+static void
+dpdk_dev_offload_negotiate(struct lb_device *dev) {
+    struct rte_eth_dev_info dev_info;
+    uint64_t rx_capa, tx_capa;
+    uint32_t i;
 
-            laddr_list = &dev->laddr_list[lcore_id];
-            for (lid = 0; lid < laddr_list->nb; lid++) {
-                laddr = &laddr_list->entries[lid];
-                rc = dpdk_dev_filter_add(port_id, laddr->ipv4, laddr->rxq_id);
-                if (rc < 0) {
-                    RTE_LOG(ERR, USER1, "%s(): dpdk_dev_filter_add failed.\n",
-                            __func__);
-                    return rc;
-                }
+    if (dev->type == LB_DEV_T_NORM) {
+        rte_eth_dev_info_get(dev->port_id, &dev_info);
+        rx_capa = dev_info.rx_offload_capa;
+        tx_capa = dev_info.tx_offload_capa;
+    } else {
+        rx_capa = tx_capa = UINT64_MAX;
+        for (i = 0; i < dev->nb_slaves; i++) {
+            rte_eth_dev_info_get(dev->slave_ports[i], &dev_info);
+            rx_capa &= dev_info.rx_offload_capa;
+            tx_capa &= dev_info.tx_offload_capa;
+        }
+    }
+
+    if (dev->rx_offload & ~rx_capa) {
+        RTE_LOG(WARNING, USER1,
+                "%s(): %s does not support rx offload 0x%" PRIx64 ".\n",
+                __func__, dev->name, dev->rx_offload & ~rx_capa);
+    }
+    if (dev->tx_offload & ~tx_capa) {
+        RTE_LOG(WARNING, USER1,
+                "%s(): %s does not support tx offload 0x%" PRIx64 ".\n",
+                __func__, dev->name, dev->tx_offload & ~tx_capa);
+    }
+    dev->rx_offload &= rx_capa;
+    dev->tx_offload &= tx_capa;
+}
+
+/* Use the packet type from the NIC when it reports IPv4 and TCP/UDP. */
+static void
+dpdk_dev_ptype_get(struct lb_device *dev) {
+    uint32_t ptypes[32];
+    uint32_t l3 = 0, l4 = 0;
+    int i, n;
+
+    n = rte_eth_dev_get_supported_ptypes(dev->port_id,
+                                         RTE_PTYPE_L3_MASK | RTE_PTYPE_L4_MASK,
+                                         ptypes, RTE_DIM(ptypes));
+    for (i = 0; i < n && i < (int)RTE_DIM(ptypes); i++) {
+        if (RTE_ETH_IS_IPV4_HDR(ptypes[i]))
+            l3 = 1;
+        if ((ptypes[i] & RTE_PTYPE_L4_MASK) == RTE_PTYPE_L4_TCP ||
+            (ptypes[i] & RTE_PTYPE_L4_MASK) == RTE_PTYPE_L4_UDP)
+            l4 = 1;
+    }
+    dev->rx_ptype = l3 && l4;
+}
+
+/*
+ * Read back the RSS key and redirection table of the device, and hand
+ * them to the local port allocators of the lcores.
+ */
+static int
+dpdk_dev_rss_steer_init(struct lb_device *dev) {
+    struct rte_eth_dev_info dev_info;
+    struct rte_eth_rss_conf rss_conf;
+    struct rte_eth_rss_reta_entry64 reta_conf[ETH_RSS_RETA_SIZE_512 /
+                                              RTE_RETA_GROUP_SIZE];
+    struct rte_ipv4_tuple tuple;
+    struct lb_laddr_list *laddr_list;
+    uint32_t lcore_id, type, i;
+    uint16_t reta_size;
+    int rc;
+
+    rte_eth_dev_info_get(dev->port_id, &dev_info);
+    reta_size = dev_info.reta_size;
+    if (reta_size == 0 || reta_size > ETH_RSS_RETA_SIZE_512 ||
+        !rte_is_power_of_2(reta_size) ||
+        dev_info.hash_key_size > LB_RSS_KEY_SIZE) {
+        RTE_LOG(ERR, USER1, "%s(): Port%u has no usable RSS table.\n",
+                __func__, dev->port_id);
+        return -1;
+    }
+
+    memset(&rss_conf, 0, sizeof(rss_conf));
+    rss_conf.rss_key = dev->rss_key;
+    rss_conf.rss_key_len = sizeof(dev->rss_key);
+    rc = rte_eth_dev_rss_hash_conf_get(dev->port_id, &rss_conf);
+    if (rc < 0) {
+        RTE_LOG(ERR, USER1, "%s(): Get RSS key of port%u failed, %s.\n",
+                __func__, dev->port_id, strerror(-rc));
+        return rc;
+    }
+    if (!(rss_conf.rss_hf & ETH_RSS_NONFRAG_IPV4_TCP) ||
+        !(rss_conf.rss_hf & ETH_RSS_NONFRAG_IPV4_UDP)) {
+        RTE_LOG(ERR, USER1, "%s(): Port%u does not hash TCP/UDP ports.\n",
+                __func__, dev->port_id);
+        return -1;
+    }
+
+    memset(reta_conf, 0, sizeof(reta_conf));
+    for (i = 0; i < reta_size / RTE_RETA_GROUP_SIZE; i++)
+        reta_conf[i].mask = UINT64_MAX;
+    rc = rte_eth_dev_rss_reta_query(dev->port_id, reta_conf, reta_size);
+    if (rc < 0) {
+        RTE_LOG(ERR, USER1, "%s(): Query RETA of port%u failed, %s.\n",
+                __func__, dev->port_id, strerror(-rc));
+        return rc;
+    }
+    for (i = 0; i < reta_size; i++) {
+        dev->reta[i] = reta_conf[i / RTE_RETA_GROUP_SIZE]
+                           .reta[i % RTE_RETA_GROUP_SIZE];
+    }
+
+    dev->rss_lport = rte_malloc_socket(NULL, 65536 * sizeof(uint32_t),
+                                       RTE_CACHE_LINE_SIZE, dev->socket_id);
+    if (dev->rss_lport == NULL) {
+        RTE_LOG(ERR, USER1, "%s(): Alloc memory for RSS table failed.\n",
+                __func__);
+        return -1;
+    }
+    memset(&tuple, 0, sizeof(tuple));
+    for (i = 0; i < 65536; i++) {
+        tuple.dport = i;
+        dev->rss_lport[i] = rte_softrss((uint32_t *)&tuple,
+                                        RTE_THASH_V4_L4_LEN, dev->rss_key);
+    }
+
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        laddr_list = &dev->laddr_list[lcore_id];
+        if (laddr_list->nb == 0)
+            continue;
+        for (type = LB_IPPROTO_TCP; type <= LB_IPPROTO_UDP; type++) {
+            rc = lb_lport_pool_rss_set(&laddr_list->lports[type],
+                                       dev->rss_key, dev->rss_lport,
+                                       dev->reta, reta_size,
+                                       dev->lcore_conf[lcore_id].rxq_id);
+            if (rc < 0)
+                return rc;
+        }
+    }
+
+    RTE_LOG(INFO, USER1, "%s(): Port%u steers replies by RSS, reta size %u.\n",
+            __func__, dev->port_id, reta_size);
+    return 0;
+}
+
+static int
+dpdk_dev_flow_add(uint16_t port_id, uint32_t dst_ip, uint8_t proto,
+                  uint16_t rxq_id) {
+    struct rte_flow_attr attr;
+    struct rte_flow_item pattern[4];
+    struct rte_flow_action actions[2];
+    struct rte_flow_item_ipv4 ip_spec, ip_mask;
+    struct rte_flow_item_tcp tcp_spec, tcp_mask;
+    struct rte_flow_item_udp udp_spec, udp_mask;
+    struct rte_flow_action_queue queue;
+    struct rte_flow_error error;
+    struct rte_flow *flow;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.ingress = 1;
+
+    memset(&ip_spec, 0, sizeof(ip_spec));
+    memset(&ip_mask, 0, sizeof(ip_mask));
+    ip_spec.hdr.dst_addr = dst_ip;
+    ip_spec.hdr.next_proto_id = proto;
+    ip_mask.hdr.dst_addr = UINT32_MAX;
+    ip_mask.hdr.next_proto_id = UINT8_MAX;
+    memset(&tcp_spec, 0, sizeof(tcp_spec));
+    memset(&tcp_mask, 0, sizeof(tcp_mask));
+    memset(&udp_spec, 0, sizeof(udp_spec));
+    memset(&udp_mask, 0, sizeof(udp_mask));
+
+    memset(pattern, 0, sizeof(pattern));
+    pattern[0].type = RTE_FLOW_ITEM_TYPE_ETH;
+    pattern[1].type = RTE_FLOW_ITEM_TYPE_IPV4;
+    pattern[1].spec = &ip_spec;
+    pattern[1].mask = &ip_mask;
+    if (proto == IPPROTO_TCP) {
+        pattern[2].type = RTE_FLOW_ITEM_TYPE_TCP;
+        pattern[2].spec = &tcp_spec;
+        pattern[2].mask = &tcp_mask;
+    } else {
+        pattern[2].type = RTE_FLOW_ITEM_TYPE_UDP;
+        pattern[2].spec = &udp_spec;
+        pattern[2].mask = &udp_mask;
+    }
+    pattern[3].type = RTE_FLOW_ITEM_TYPE_END;
+
+    memset(actions, 0, sizeof(actions));
+    queue.index = rxq_id;
+    actions[0].type = RTE_FLOW_ACTION_TYPE_QUEUE;
+    actions[0].conf = &queue;
+    actions[1].type = RTE_FLOW_ACTION_TYPE_END;
+
+    memset(&error, 0, sizeof(error));
+    if (rte_flow_validate(port_id, &attr, pattern, actions, &error) == 0)
+        flow = rte_flow_create(port_id, &attr, pattern, actions, &error);
+    else
+        flow = NULL;
+    if (flow == NULL) {
+        RTE_LOG(ERR, USER1,
+                "%s(): Port%u add flow failed, proto:%u, dst-ip:" IPv4_BE_FMT
+                ", rxq:%u, %s.\n",
+                __func__, port_id, proto, IPv4_BE_ARG(dst_ip), rxq_id,
+                error.message ? error.message : "unknown error");
+        return -1;
+    }
+    return 0;
+}
+
+static int
+dpdk_dev_flow_steer(uint16_t port_id, struct lb_device *dev) {
+    struct lb_laddr_list *laddr_list;
+    struct lb_laddr *laddr;
+    uint32_t lcore_id, i;
+
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        laddr_list = &dev->laddr_list[lcore_id];
+        for (i = 0; i < laddr_list->nb; i++) {
+            laddr = &laddr_list->entries[i];
+            if (dpdk_dev_flow_add(port_id, laddr->ipv4, IPPROTO_TCP,
+                                  laddr->rxq_id) < 0 ||
+                dpdk_dev_flow_add(port_id, laddr->ipv4, IPPROTO_UDP,
+                                  laddr->rxq_id) < 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+dpdk_dev_redirect_init(struct lb_device *dev) {
+    char name[RTE_RING_NAMESIZE];
+    uint32_t src, dst;
+
+    dev->redirect = rte_zmalloc_socket(
+        NULL, RTE_MAX_LCORE * RTE_MAX_LCORE * sizeof(dev->redirect[0]),
+        RTE_CACHE_LINE_SIZE, dev->socket_id);
+    if (dev->redirect == NULL) {
+        RTE_LOG(ERR, USER1, "%s(): Alloc memory for redirect rings failed.\n",
+                __func__);
+        return -1;
+    }
+
+    RTE_LCORE_FOREACH_SLAVE(src) {
+        if (!dev->lcore_conf[src].rxq_enable)
+            continue;
+        RTE_LCORE_FOREACH_SLAVE(dst) {
+            if (src == dst || !dev->lcore_conf[dst].rxq_enable)
+                continue;
+            snprintf(name, sizeof(name), "redir%u_%u_%u", dev->port_id, src,
+                     dst);
+            dev->redirect[src * RTE_MAX_LCORE + dst] =
+                rte_ring_create(name, LB_REDIRECT_RING_SIZE, dev->socket_id,
+                                RING_F_SP_ENQ | RING_F_SC_DEQ);
+            if (dev->redirect[src * RTE_MAX_LCORE + dst] == NULL) {
+                RTE_LOG(ERR, USER1, "%s(): Create ring (%s) failed, %s.\n",
+                        __func__, name, rte_strerror(rte_errno));
+                return -1;
             }
         }
     }
     return 0;
 }
 
+/*
+ * Replies to a local address must reach the lcore owning it. rte_flow
+ * rules are tried first, on the slaves of a bond. Without them local
+ * ports are picked by RSS if possible, and the rest is redirected. The
+ * redirect rings exist with the rules too, non-first fragments carry no
+ * ports to match and are redirected to be reassembled on the owner.
+ */
+static int
+dpdk_dev_steer_init(struct lb_device *dev) {
+    struct rte_flow_error error;
+    uint32_t i;
+    int rc = 0;
+
+    if (dev->nb_rxq <= 1)
+        return 0;
+
+    rc = dpdk_dev_redirect_init(dev);
+    if (rc < 0)
+        return rc;
+
+    if (dev->type == LB_DEV_T_BOND) {
+        for (i = 0; rc == 0 && i < dev->nb_slaves; i++)
+            rc = dpdk_dev_flow_steer(dev->slave_ports[i], dev);
+    } else {
+        rc = dpdk_dev_flow_steer(dev->port_id, dev);
+    }
+    if (rc == 0) {
+        RTE_LOG(INFO, USER1, "%s(): %s steers replies by rte_flow.\n",
+                __func__, dev->name);
+        return 0;
+    }
+
+    if (dev->type == LB_DEV_T_BOND) {
+        for (i = 0; i < dev->nb_slaves; i++)
+            rte_flow_flush(dev->slave_ports[i], &error);
+    } else {
+        rte_flow_flush(dev->port_id, &error);
+    }
+
+    RTE_LOG(WARNING, USER1,
+            "%s(): %s has no usable rte_flow rules, redirect replies in "
+            "software.\n",
+            __func__, dev->name);
+    dev->sw_redirect = 1;
+    if (dpdk_dev_rss_steer_init(dev) == 0)
+        dev->rss_steer = 1;
+    return 0;
+}
+
 static int
 dpdk_dev_port_id_get_by_pci(struct rte_pci_addr *pci) {
     char pci_name[PCI_PRI_STR_SIZE];
@@ -317,6 +488,20 @@ dpdk_dev_port_id_get_by_pci(struct rte_pci_addr *pci) {
     return port_id;
 }
 
+static int
+dpdk_dev_port_id_get_by_name(const char *name) {
+    uint16_t port_id;
+    int rc;
+
+    rc = rte_eth_dev_get_port_by_name(name, &port_id);
+    if (rc < 0) {
+        RTE_LOG(ERR, USER1, "%s(): Get port id of %s failed.\n", __func__,
+                name);
+        return rc;
+    }
+    return port_id;
+}
+
 static int
 dpdk_dev_socket_id_get_by_pci(struct rte_pci_addr *pci) {
     uint16_t port_id;
@@ -341,11 +526,21 @@ dpdk_dev_socket_id_get_by_pci(struct rte_pci_addr *pci) {
     return rc;
 }
 
+static void
+conf_queue_size_adjust(struct lb_device_conf *conf, uint16_t port_id) {
+    struct rte_eth_dev_info info;
+
+    rte_eth_dev_info_get(port_id, &info);
+    conf->rxqsize = RTE_MIN(conf->rxqsize, info.rx_desc_lim.nb_max);
+    conf->rxqsize = RTE_MAX(conf->rxqsize, info.rx_desc_lim.nb_min);
+    conf->txqsize = RTE_MIN(conf->txqsize, info.tx_desc_lim.nb_max);
+    conf->txqsize = RTE_MAX(conf->txqsize, info.tx_desc_lim.nb_min);
+}
+
 static int
 lb_device_conf_check_and_adjust(struct lb_device_conf configs[], uint16_t num) {
     uint16_t i, j;
     struct lb_device_conf *conf;
-    struct rte_eth_dev_info info;
     int port_id;
     uint8_t all_ports[RTE_MAX_ETHPORTS] = {0};
 
@@ -368,12 +563,13 @@ lb_device_conf_check_and_adjust(struct lb_device_conf configs[], uint16_t num) {
                 return -1;
             }
 
-            /* Adjust queue_size .*/
-            rte_eth_dev_info_get(port_id, &info);
-            conf->rxqsize = RTE_MIN(conf->rxqsize, info.rx_desc_lim.nb_max);
-            conf->rxqsize = RTE_MAX(conf->rxqsize, info.rx_desc_lim.nb_min);
-            conf->txqsize = RTE_MIN(conf->txqsize, info.tx_desc_lim.nb_max);
-            conf->txqsize = RTE_MAX(conf->txqsize, info.tx_desc_lim.nb_min);
+            conf_queue_size_adjust(conf, port_id);
+        }
+        if (conf->nb_pcis == 0) {
+            port_id = dpdk_dev_port_id_get_by_name(conf->port);
+            if (port_id < 0)
+                return -1;
+            conf_queue_size_adjust(conf, port_id);
         }
     }
     return 0;
@@ -385,7 +581,7 @@ init_mempool(struct lb_device *dev) {
     char mp_name[RTE_MEMPOOL_NAMESIZE];
 
     mp_size = dev->nb_rxq * dev->rxq_size + dev->nb_txq * dev->txq_size;
-    mp_size += LB_PKTMBUF_POOL_DEFAULT_SIZE;
+    mp_size += LB_PKTMBUF_POOL_DEFAULT_SIZE + dev->frag_mbufs;
     snprintf(mp_name, sizeof(mp_name), "mp%p", dev);
     dev->mp =
         rte_pktmbuf_pool_create(mp_name, mp_size,
@@ -403,6 +599,7 @@ init_mempool(struct lb_device *dev) {
     return 0;
 }
 
+#ifndef LB_BENCH
 static int
 init_kni(struct lb_device *dev) {
     struct rte_kni_conf kni_conf;
@@ -440,6 +637,7 @@ init_kni(struct lb_device *dev) {
     }
     return 0;
 }
+#endif
 
 static int
 init_master_worker_ring(struct lb_device *dev) {
@@ -496,14 +694,29 @@ rxq_to_lcore_id(struct lb_device *dev, uint16_t rxq_id) {
     return lcore_id;
 }
 
+static void
+laddr_owner_add(struct lb_device *dev, uint32_t lip, uint32_t lcore_id) {
+    uint32_t mask = LB_LADDR_OWNERS - 1;
+    uint32_t i;
+
+    for (i = rte_jhash_1word(lip, 0) & mask; dev->laddr_owners[i].ipv4 != 0;
+         i = (i + 1) & mask)
+        ;
+    dev->laddr_owners[i].ipv4 = lip;
+    dev->laddr_owners[i].lcore_id = lcore_id;
+}
+
 static int
-init_laddr_list(struct lb_device *dev, uint32_t lips[], uint32_t nb_lips) {
+init_laddr_list(struct lb_device *dev, uint32_t lips[], uint32_t nb_lips,
+                uint32_t nb_maps) {
     uint32_t i;
     uint16_t rxq_id;
     uint32_t lcore_id;
     struct lb_laddr_list *laddr_list;
     struct lb_laddr *laddr;
-    char name[RTE_RING_NAMESIZE];
+    char name[RTE_HASH_NAMESIZE];
+    uint32_t type;
+    int rc;
 
     if (nb_lips < dev->nb_rxq) {
         RTE_LOG(ERR, USER1,
@@ -529,19 +742,25 @@ init_laddr_list(struct lb_device *dev, uint32_t lips[], uint32_t nb_lips) {
         laddr->ipv4 = lips[i];
         laddr->port_id = dev->port_id;
         laddr->rxq_id = rxq_id;
+        laddr->lports = laddr_list->lports;
+        laddr->cursor[LB_IPPROTO_TCP] = LB_MIN_L4_PORT;
+        laddr->cursor[LB_IPPROTO_UDP] = LB_MIN_L4_PORT;
 
-        snprintf(name, sizeof(name), "tcpport%p", laddr);
-        laddr->ports[LB_IPPROTO_TCP] = l4_ports_create(
-            name, LB_MIN_L4_PORT, LB_MAX_L4_PORT, dev->socket_id);
-
-        snprintf(name, sizeof(name), "udpport%p", laddr);
-        laddr->ports[LB_IPPROTO_UDP] = l4_ports_create(
-            name, LB_MIN_L4_PORT, LB_MAX_L4_PORT, dev->socket_id);
+        laddr_owner_add(dev, lips[i], lcore_id);
+    }
 
-        if (laddr->ports[LB_IPPROTO_TCP] == NULL ||
-            laddr->ports[LB_IPPROTO_UDP] == NULL) {
-            RTE_LOG(ERR, USER1, "%s(): l4_ports_create failed.\n", __func__);
-            return -1;
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        laddr_list = &dev->laddr_list[lcore_id];
+        if (laddr_list->nb == 0)
+            continue;
+        for (type = LB_IPPROTO_TCP; type <= LB_IPPROTO_UDP; type++) {
+            snprintf(name, sizeof(name), "lport%u_%u_%u", dev->port_id,
+                     lcore_id, type);
+            rc = lb_lport_pool_init(&laddr_list->lports[type], name,
+                                    nb_maps, LB_MIN_L4_PORT,
+                                    LB_MAX_L4_PORT, dev->socket_id);
+            if (rc < 0)
+                return rc;
         }
     }
     return 0;
@@ -563,13 +782,21 @@ lb_device_init(struct lb_device_conf *configs, uint16_t num) {
         return rc;
     }
 
+#ifndef LB_BENCH
     rte_kni_init(num);
+#endif
 
     for (i = 0; i < num; i++) {
         conf = &configs[i];
 
         /* Get the socket id by pci. */
         socket_id = -1;
+        if (conf->nb_pcis == 0) {
+            rc = dpdk_dev_port_id_get_by_name(conf->port);
+            socket_id = rc < 0 ? -1 : rte_eth_dev_socket_id(rc);
+            if (socket_id < 0)
+                socket_id = 0;
+        }
         for (j = 0; j < conf->nb_pcis; j++) {
             int tmp_sid;
             tmp_sid = dpdk_dev_socket_id_get_by_pci(&conf->pcis[j]);
@@ -618,10 +845,13 @@ lb_device_init(struct lb_device_conf *configs, uint16_t num) {
                     dpdk_dev_port_id_get_by_pci(&conf->pcis[i]);
             }
         } else {
-            rc = dpdk_dev_port_id_get_by_pci(&conf->pcis[0]);
+            if (conf->nb_pcis == 1)
+                rc = dpdk_dev_port_id_get_by_pci(&conf->pcis[0]);
+            else
+                rc = dpdk_dev_port_id_get_by_name(conf->port);
             if (rc < 0) {
-                RTE_LOG(ERR, USER1, "%s(): Get port id from pci failed.\n",
-                        __func__);
+                RTE_LOG(ERR, USER1, "%s(): Get port id of %s failed.\n",
+                        __func__, conf->name);
                 return rc;
             }
             dev->type = LB_DEV_T_NORM;
@@ -643,8 +873,11 @@ lb_device_init(struct lb_device_conf *configs, uint16_t num) {
         dev->nb_rxq = qid;
         dev->nb_txq = qid + 1;
 
+        dev->mtu = conf->mtu != 0 ? conf->mtu : ETHER_MTU;
         dev->rxq_size = conf->rxqsize;
         dev->txq_size = conf->txqsize;
+        dev->frag_mbufs =
+            conf->frag_mbufs != 0 ? conf->frag_mbufs : LB_FRAG_MBUFS;
         dev->rx_offload = conf->rxoffload;
         dev->tx_offload = conf->txoffload;
         dev->ipv4 = conf->ipv4;
@@ -652,7 +885,9 @@ lb_device_init(struct lb_device_conf *configs, uint16_t num) {
         dev->gw = conf->gw;
         memcpy(dev->name, conf->name, sizeof(dev->name));
 
-        rc = init_laddr_list(dev, conf->lips, conf->nb_lips);
+        rc = init_laddr_list(dev, conf->lips, conf->nb_lips,
+                             conf->lport_maps != 0 ? conf->lport_maps
+                                                   : LB_LPORT_MAPS);
         if (rc < 0) {
             RTE_LOG(ERR, USER1, "%s(): init laddr list failed.\n", __func__);
             return rc;
@@ -664,11 +899,16 @@ lb_device_init(struct lb_device_conf *configs, uint16_t num) {
             return rc;
         }
 
+#ifdef LB_BENCH
+        /* The bench generator plays the kernel side. */
+        rte_eth_macaddr_get(dev->port_id, &dev->ha);
+#else
         rc = init_kni(dev);
         if (rc < 0) {
             RTE_LOG(ERR, USER1, "%s(): init kni failed.\n", __func__);
             return rc;
         }
+#endif
 
         rc = init_tx_buffer(dev);
         if (rc < 0) {
@@ -683,22 +923,20 @@ lb_device_init(struct lb_device_conf *configs, uint16_t num) {
             return rc;
         }
 
-        rc = dpdk_dev_config_and_set_ipfilter(
-            dev->port_id, dev, dev->type == LB_DEV_T_NORM ? 1 : 0);
+        dpdk_dev_offload_negotiate(dev);
+
+        rc = dpdk_dev_config(dev->port_id, dev);
         if (rc < 0) {
-            RTE_LOG(
-                ERR, USER1,
-                "%s(): config dpdk dev or add ip filter failed, port_id=%u.\n",
-                __func__, dev->port_id);
+            RTE_LOG(ERR, USER1, "%s(): config dpdk dev failed, port_id=%u.\n",
+                    __func__, dev->port_id);
             return rc;
         }
 
         for (j = 0; j < dev->nb_slaves; j++) {
-            rc = dpdk_dev_config_and_set_ipfilter(dev->slave_ports[j], dev, 1);
+            rc = dpdk_dev_config(dev->slave_ports[j], dev);
             if (rc < 0) {
                 RTE_LOG(ERR, USER1,
-                        "%s(): config dpdk dev or add ip filter failed, "
-                        "port_id=%u.\n",
+                        "%s(): config dpdk dev failed, port_id=%u.\n",
                         __func__, dev->slave_ports[j]);
                 return rc;
             }
@@ -718,6 +956,15 @@ lb_device_init(struct lb_device_conf *configs, uint16_t num) {
                     dev->port_id);
             return rc;
         }
+
+        dpdk_dev_ptype_get(dev);
+
+        rc = dpdk_dev_steer_init(dev);
+        if (rc < 0) {
+            RTE_LOG(ERR, USER1, "%s(): Replies of %s can not be steered.\n",
+                    __func__, dev->name);
+            return rc;
+        }
     }
 
     return 0;
@@ -772,6 +1019,8 @@ netdev_show_stats_cmd_cb(int fd, char *argv[], int argc) {
     uint32_t lcore_id;
     uint64_t tx_dropped;
     uint64_t rx_dropped;
+    uint64_t rx_cksum_bad;
+    uint64_t redirect_tx, redirect_rx, redirect_drop;
     uint64_t throughput[4];
     uint32_t mbuf_in_use, mbuf_avail;
 
@@ -787,12 +1036,20 @@ netdev_show_stats_cmd_cb(int fd, char *argv[], int argc) {
     LB_DEVICE_FOREACH(i, dev) {
         tx_dropped = 0;
         rx_dropped = 0;
+        rx_cksum_bad = 0;
+        redirect_tx = 0;
+        redirect_rx = 0;
+        redirect_drop = 0;
         memset(throughput, 0, sizeof(throughput));
 
         rte_eth_stats_get(dev->port_id, &stats);
         RTE_LCORE_FOREACH(lcore_id) {
             tx_dropped += dev->lcore_stats[lcore_id].tx_dropped;
             rx_dropped += dev->lcore_stats[lcore_id].rx_dropped;
+            rx_cksum_bad += dev->lcore_stats[lcore_id].rx_cksum_bad;
+            redirect_tx += dev->lcore_stats[lcore_id].redirect_tx;
+            redirect_rx += dev->lcore_stats[lcore_id].redirect_rx;
+            redirect_drop += dev->lcore_stats[lcore_id].redirect_drop;
         }
         netdev_throughput_get(&stats, throughput);
 
@@ -832,6 +1089,10 @@ netdev_show_stats_cmd_cb(int fd, char *argv[], int argc) {
                               json_fmt ? JSON_KV_64_FMT("RX-dropped", ",")
                                        : NORM_KV_64_FMT("  RX-dropped", "\n"),
                               rx_dropped);
+        unixctl_command_reply(fd,
+                              json_fmt ? JSON_KV_64_FMT("RX-cksum-bad", ",")
+                                       : NORM_KV_64_FMT("  RX-cksum-bad", "\n"),
+                              rx_cksum_bad);
         unixctl_command_reply(fd,
                               json_fmt ? JSON_KV_64_FMT("TX-packets", ",")
                                        : NORM_KV_64_FMT("  TX-packets", "\n"),
@@ -848,6 +1109,19 @@ netdev_show_stats_cmd_cb(int fd, char *argv[], int argc) {
                               json_fmt ? JSON_KV_64_FMT("TX-dropped", ",")
                                        : NORM_KV_64_FMT("  TX-dropped", "\n"),
                               tx_dropped);
+        unixctl_command_reply(fd,
+                              json_fmt ? JSON_KV_64_FMT("Redirect-tx", ",")
+                                       : NORM_KV_64_FMT("  Redirect-tx", "\n"),
+                              redirect_tx);
+        unixctl_command_reply(fd,
+                              json_fmt ? JSON_KV_64_FMT("Redirect-rx", ",")
+                                       : NORM_KV_64_FMT("  Redirect-rx", "\n"),
+                              redirect_rx);
+        unixctl_command_reply(
+            fd,
+            json_fmt ? JSON_KV_64_FMT("Redirect-dropped", ",")
+                     : NORM_KV_64_FMT("  Redirect-dropped", "\n"),
+            redirect_drop);
         unixctl_command_reply(fd,
                               json_fmt ? JSON_KV_64_FMT("Rx-pps", ",")
                                        : NORM_KV_64_FMT("  Rx-pps", "\n"),
@@ -895,8 +1169,9 @@ netdev_reset_stats_cmd_cb(__attribute__((unused)) int fd,
     }
 }
 
-UNIXCTL_CMD_REGISTER("netdev/reset", "", "Reset NIC packet statistics.", 0, 0,
-                     netdev_reset_stats_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH("netdev/reset", "",
+                              "Reset NIC packet statistics.", 0, 0,
+                              netdev_reset_stats_cmd_cb);
 
 static void
 netdev_show_ipaddr_cmd_cb(int fd, __attribute__((unused)) char *argv[],
@@ -921,8 +1196,15 @@ netdev_show_ipaddr_cmd_cb(int fd, __attribute__((unused)) char *argv[],
             for (i = 0; i < laddr_list->nb; i++) {
                 laddr = &laddr_list->entries[i];
                 unixctl_command_reply(
-                    fd, "  local-ip[c%uq%u]: " IPv4_BE_FMT "\n", lcore_id,
-                    laddr->rxq_id, IPv4_BE_ARG(laddr->ipv4));
+                    fd,
+                    "  local-ip[c%uq%u]: " IPv4_BE_FMT
+                    " tcp-ports: %" PRIu64 " tcp-exhausted: %" PRIu64
+                    " udp-ports: %" PRIu64 " udp-exhausted: %" PRIu64 "\n",
+                    lcore_id, laddr->rxq_id, IPv4_BE_ARG(laddr->ipv4),
+                    laddr->nb_ports[LB_IPPROTO_TCP],
+                    laddr->exhausted[LB_IPPROTO_TCP],
+                    laddr->nb_ports[LB_IPPROTO_UDP],
+                    laddr->exhausted[LB_IPPROTO_UDP]);
             }
         }
     }
@@ -945,6 +1227,12 @@ netdev_show_hwinfo_cmd_cb(int fd, __attribute__((unused)) char *argv[],
         unixctl_command_reply(fd, "  hw: %s\n", mac);
 
         unixctl_command_reply(fd, "  rxq-num: %u\n", dev->nb_rxq);
+        unixctl_command_reply(fd, "  rx-offload: 0x%" PRIx64 "\n",
+                              dev->rx_offload);
+        unixctl_command_reply(fd, "  tx-offload: 0x%" PRIx64 "\n",
+                              dev->tx_offload);
+        unixctl_command_reply(fd, "  rx-ptype: %s\n",
+                              dev->rx_ptype ? "yes" : "no");
         memset(&link_params, 0, sizeof(link_params));
         rte_eth_link_get_nowait(dev->port_id, &link_params);
         unixctl_command_reply(fd, "  link-status: %s\n",
@@ -1217,21 +1505,16 @@ laddr_stats_cmd_cb(int fd, char *argv[], int argc) {
 
     json_first_obj = 1;
     LB_DEVICE_FOREACH(devid, dev) {
-        uint32_t inuse_lports[RTE_MAX_LCORE][LB_IPPROTO_MAX] = {{0}},
-                 avail_lports[RTE_MAX_LCORE][LB_IPPROTO_MAX] = {{0}};
+        uint64_t inuse_lports[RTE_MAX_LCORE][LB_IPPROTO_MAX] = {{0}},
+                 exhausted[RTE_MAX_LCORE][LB_IPPROTO_MAX] = {{0}};
 
         RTE_LCORE_FOREACH_SLAVE(lcore_id) {
             laddr_list = &dev->laddr_list[lcore_id];
             for (i = 0; i < laddr_list->nb; i++) {
                 laddr = &laddr_list->entries[i];
                 for (j = 0; j < LB_IPPROTO_MAX; j++) {
-                    if (laddr->ports[j] != NULL) {
-                        uint32_t avail;
-                        avail = rte_ring_count(laddr->ports[j]);
-                        avail_lports[lcore_id][j] += avail;
-                        inuse_lports[lcore_id][j] +=
-                            LB_MAX_L4_PORT - LB_MIN_L4_PORT - avail;
-                    }
+                    inuse_lports[lcore_id][j] += laddr->nb_ports[j];
+                    exhausted[lcore_id][j] += laddr->exhausted[j];
                 }
             }
         }
@@ -1245,30 +1528,30 @@ laddr_stats_cmd_cb(int fd, char *argv[], int argc) {
             }
             unixctl_command_reply(fd, "\n");
 
-            unixctl_command_reply(fd, "  tcp_avail_lports:");
+            unixctl_command_reply(fd, "  tcp_exhausted   :");
             RTE_LCORE_FOREACH_SLAVE(lcore_id) {
-                unixctl_command_reply(fd, " %-10" PRIu32,
-                                      avail_lports[lcore_id][LB_IPPROTO_TCP]);
+                unixctl_command_reply(fd, " %-10" PRIu64,
+                                      exhausted[lcore_id][LB_IPPROTO_TCP]);
             }
             unixctl_command_reply(fd, "\n");
 
             unixctl_command_reply(fd, "  tcp_inuse_lports:");
             RTE_LCORE_FOREACH_SLAVE(lcore_id) {
-                unixctl_command_reply(fd, " %-10" PRIu32,
+                unixctl_command_reply(fd, " %-10" PRIu64,
                                       inuse_lports[lcore_id][LB_IPPROTO_TCP]);
             }
             unixctl_command_reply(fd, "\n");
 
-            unixctl_command_reply(fd, "  udp_avail_lports:");
+            unixctl_command_reply(fd, "  udp_exhausted   :");
             RTE_LCORE_FOREACH_SLAVE(lcore_id) {
-                unixctl_command_reply(fd, " %-10" PRIu32,
-                                      avail_lports[lcore_id][LB_IPPROTO_UDP]);
+                unixctl_command_reply(fd, " %-10" PRIu64,
+                                      exhausted[lcore_id][LB_IPPROTO_UDP]);
             }
             unixctl_command_reply(fd, "\n");
 
             unixctl_command_reply(fd, "  udp_inuse_lports:");
             RTE_LCORE_FOREACH_SLAVE(lcore_id) {
-                unixctl_command_reply(fd, " %-10" PRIu32,
+                unixctl_command_reply(fd, " %-10" PRIu64,
                                       inuse_lports[lcore_id][LB_IPPROTO_UDP]);
             }
             unixctl_command_reply(fd, "\n");
@@ -1283,17 +1566,15 @@ laddr_stats_cmd_cb(int fd, char *argv[], int argc) {
                 json_first_obj2 = 0;
                 unixctl_command_reply(fd, JSON_KV_32_FMT("lcore", ","),
                                       lcore_id);
+                unixctl_command_reply(fd, JSON_KV_64_FMT("tcp_exhausted", ","),
+                                      exhausted[lcore_id][LB_IPPROTO_TCP]);
                 unixctl_command_reply(fd,
-                                      JSON_KV_32_FMT("tcp_avail_lports", ","),
-                                      avail_lports[lcore_id][LB_IPPROTO_TCP]);
-                unixctl_command_reply(fd,
-                                      JSON_KV_32_FMT("tcp_inuse_lports", ","),
+                                      JSON_KV_64_FMT("tcp_inuse_lports", ","),
                                       inuse_lports[lcore_id][LB_IPPROTO_TCP]);
+                unixctl_command_reply(fd, JSON_KV_64_FMT("udp_exhausted", ","),
+                                      exhausted[lcore_id][LB_IPPROTO_UDP]);
                 unixctl_command_reply(fd,
-                                      JSON_KV_32_FMT("udp_avail_lports", ","),
-                                      avail_lports[lcore_id][LB_IPPROTO_UDP]);
-                unixctl_command_reply(fd,
-                                      JSON_KV_32_FMT("udp_inuse_lports", "}"),
+                                      JSON_KV_64_FMT("udp_inuse_lports", "}"),
                                       inuse_lports[lcore_id][LB_IPPROTO_UDP]);
             }
             unixctl_command_reply(fd, "]");
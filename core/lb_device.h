@@ -3,19 +3,36 @@
 #ifndef __LB_DEVICE_H__
 #define __LB_DEVICE_H__
 
+#include <string.h>
+
 #include <rte_ethdev.h>
 #include <rte_ether.h>
 #include <rte_ip.h>
+#include <rte_jhash.h>
 #include <rte_kni.h>
+#include <rte_log.h>
 #include <rte_pci.h>
 #include <rte_ring.h>
+#include <rte_tcp.h>
+#include <rte_udp.h>
 
 #include "lb_arp.h"
+#include "lb_cksum.h"
 #include "lb_config.h"
+#include "lb_frag.h"
+#include "lb_lport.h"
 #include "lb_proto.h"
+#include "lb_route.h"
 
 #define PKT_MAX_BURST 32
 
+#define LB_RSS_KEY_SIZE 52
+
+/* Open addressing table of local addresses, at most half full. */
+#define LB_LADDR_OWNERS (LB_MAX_LADDR * 2)
+
+#define LB_REDIRECT_RING_SIZE 1024
+
 #define LB_MIN_L4_PORT (1024)
 #define LB_MAX_L4_PORT (65535)
 
@@ -28,12 +45,17 @@ struct lb_laddr {
     uint32_t ipv4;
     uint16_t port_id;
     uint16_t rxq_id;
-    struct rte_ring *ports[LB_IPPROTO_MAX];
+    struct lb_lport_pool *lports;
+    /* Where the search for a free port starts, host byte order. */
+    uint16_t cursor[LB_IPPROTO_MAX];
+    uint64_t nb_ports[LB_IPPROTO_MAX];
+    uint64_t exhausted[LB_IPPROTO_MAX];
 };
 
 struct lb_laddr_list {
     uint32_t nb;
     struct lb_laddr entries[LB_MAX_LADDR];
+    struct lb_lport_pool lports[LB_IPPROTO_MAX];
 };
 
 struct lb_device {
@@ -48,12 +70,31 @@ struct lb_device {
     uint32_t ipv4;
     uint32_t netmask;
     uint32_t gw;
+    struct lb_route_table *route;
 
     uint16_t nb_rxq, nb_txq;
     uint16_t rxq_size, txq_size;
-
-    uint32_t rx_offload;
-    uint32_t tx_offload;
+    /* Share of the mbuf pool the reassembly of all lcores may hold. */
+    uint32_t frag_mbufs;
+
+    /* Offloads enabled on every port of the device. */
+    uint64_t rx_offload;
+    uint64_t tx_offload;
+    /* The NIC sets the IPv4 and TCP/UDP packet type of received mbufs. */
+    uint32_t rx_ptype;
+
+    /*
+     * No rte_flow rule steers replies by local address. Local ports are
+     * picked so that RSS delivers the replies to the owning lcore when the
+     * RSS table can be read back (rss_steer), replies arriving on another
+     * lcore are redirected to the owner in software (sw_redirect).
+     */
+    uint32_t sw_redirect;
+    uint32_t rss_steer;
+    uint8_t rss_key[LB_RSS_KEY_SIZE];
+    uint16_t reta[ETH_RSS_RETA_SIZE_512];
+    /* Toeplitz hash share of each local port in the reply tuple. */
+    uint32_t *rss_lport;
 
     struct {
         uint32_t rxq_enable;
@@ -64,6 +105,10 @@ struct lb_device {
     struct {
         uint64_t rx_dropped;
         uint64_t tx_dropped;
+        uint64_t rx_cksum_bad;
+        uint64_t redirect_tx;
+        uint64_t redirect_rx;
+        uint64_t redirect_drop;
     } lcore_stats[RTE_MAX_LCORE];
 
     struct rte_eth_dev_tx_buffer *tx_buffer[RTE_MAX_LCORE];
@@ -79,6 +124,18 @@ struct lb_device {
 
     struct lb_laddr_list laddr_list[RTE_MAX_LCORE];
 
+    /* The lcore owning each local address. */
+    struct {
+        uint32_t ipv4;
+        uint32_t lcore_id;
+    } laddr_owners[LB_LADDR_OWNERS];
+
+    /*
+     * SPSC rings, redirect[src * RTE_MAX_LCORE + dst], NULL with a single
+     * rx queue. Fragments are always redirected to the owner.
+     */
+    struct rte_ring **redirect;
+
     uint32_t nb_slaves;
     uint32_t slave_ports[RTE_MAX_ETHPORTS];
 };
@@ -103,12 +160,35 @@ lb_is_laddr_exist(uint32_t lip, struct lb_device *dev) {
     return 0;
 }
 
+/* Returns the lcore owning the local address, RTE_MAX_LCORE if none. */
+static inline uint32_t
+lb_laddr_owner(struct lb_device *dev, uint32_t lip) {
+    uint32_t mask = LB_LADDR_OWNERS - 1;
+    uint32_t i;
+
+    for (i = rte_jhash_1word(lip, 0) & mask; dev->laddr_owners[i].ipv4 != 0;
+         i = (i + 1) & mask) {
+        if (dev->laddr_owners[i].ipv4 == lip)
+            return dev->laddr_owners[i].lcore_id;
+    }
+    return RTE_MAX_LCORE;
+}
+
+static inline struct rte_ring *
+lb_device_redirect_ring(struct lb_device *dev, uint32_t src, uint32_t dst) {
+    return dev->redirect[src * RTE_MAX_LCORE + dst];
+}
+
+/*
+ * The cursor of the local address moves on with every allocation, so a
+ * freed port is not handed out again right away, even when the bitmap of
+ * the backend was released meanwhile.
+ */
 static inline int
-lb_laddr_get(struct lb_device *dev, enum lb_proto_type type,
-             struct lb_laddr **laddr, uint16_t *port) {
+lb_laddr_get(struct lb_device *dev, enum lb_proto_type type, uint32_t rip,
+             uint16_t rport, struct lb_laddr **laddr, uint16_t *port) {
     struct lb_laddr_list *list;
     struct lb_laddr *addr;
-    void *p = NULL;
     uint32_t lcore_id, i;
 
     lcore_id = rte_lcore_id();
@@ -116,41 +196,39 @@ lb_laddr_get(struct lb_device *dev, enum lb_proto_type type,
 
     for (i = 0; i < list->nb; i++) {
         addr = &list->entries[i];
-        if (rte_ring_sc_dequeue(addr->ports[type], (void **)&p) == 0) {
+        if (lb_lport_get(addr->lports + type, addr->ipv4, rip, rport,
+                         addr->cursor[type], port) == 0) {
+            addr->cursor[type] = rte_be_to_cpu_16(*port) + 1;
+            addr->nb_ports[type]++;
             *laddr = addr;
-            *port = (uint16_t)(uintptr_t)p;
             return 0;
         }
+        addr->exhausted[type]++;
     }
     return -1;
 }
 
 static inline void
-lb_laddr_put(struct lb_laddr *laddr, uint16_t port, enum lb_proto_type type) {
-    rte_ring_sp_enqueue(laddr->ports[type], (void *)(uintptr_t)port);
+lb_laddr_put(struct lb_laddr *laddr, uint32_t rip, uint16_t rport,
+             uint16_t port, enum lb_proto_type type) {
+    lb_lport_put(laddr->lports + type, laddr->ipv4, rip, rport, port);
+    laddr->nb_ports[type]--;
 }
 
-#define IS_SAME_NETWORK(addr1, addr2, netmask)                                 \
-    ((addr1 & netmask) == (addr2 & netmask))
-
-static inline int
-lb_device_dst_mac_find(uint32_t dip, struct ether_addr *ea,
-                       struct lb_device *dev) {
-    uint32_t rip;
-    int rc;
-
-    if (IS_SAME_NETWORK(dip, dev->ipv4, dev->netmask)) {
-        rip = dip;
-    } else {
-        rip = dev->gw;
-    }
-
-    rc = lb_arp_find(rip, ea, dev);
-    if (rc < 0) {
-        lb_arp_request(rip, dev);
-    }
-
-    return rc;
+/*
+ * Flow hash for picking the ECMP gateway. Received packets reuse the RSS
+ * hash, so all packets of a flow direction leave through one gateway.
+ */
+static inline uint32_t
+lb_device_flow_hash(struct rte_mbuf *m, struct ipv4_hdr *iph) {
+    uint32_t ports = 0;
+
+    if (m->ol_flags & PKT_RX_RSS_HASH)
+        return m->hash.rss;
+    if (iph->next_proto_id == IPPROTO_TCP ||
+        iph->next_proto_id == IPPROTO_UDP)
+        memcpy(&ports, (uint8_t *)iph + IPv4_HLEN(iph), sizeof(ports));
+    return rte_jhash_3words(iph->src_addr, iph->dst_addr, ports, 0);
 }
 
 static inline void
@@ -169,22 +247,151 @@ static inline int
 lb_device_output(struct rte_mbuf *m, struct ipv4_hdr *iph,
                  struct lb_device *dev) {
     struct ether_hdr *eth;
+    uint32_t nh;
     int rc;
 
+    /* Datagrams with DF set go out as before. */
+    if (unlikely(m->pkt_len > (uint32_t)ETHER_HDR_LEN + dev->mtu) &&
+        !(iph->fragment_offset & rte_cpu_to_be_16(IPV4_HDR_DF_FLAG)))
+        return lb_frag_output(m, iph, dev);
+
     eth = rte_pktmbuf_mtod(m, struct ether_hdr *);
+    ether_addr_copy(&dev->ha, &eth->s_addr);
+    eth->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
 
-    rc = lb_device_dst_mac_find(iph->dst_addr, &eth->d_addr, dev);
-    if (rc < 0) {
+    nh = lb_route_next_hop(dev->route, iph->dst_addr,
+                           lb_device_flow_hash(m, iph));
+    if (unlikely(nh == 0)) {
         rte_pktmbuf_free(m);
-        return rc;
+        return -1;
+    }
+    rc = lb_arp_find(nh, &eth->d_addr, dev);
+    if (rc < 0) {
+        /* Held until the next hop is resolved. */
+        return lb_arp_pending_add(nh, m, dev);
     }
-    ether_addr_copy(&dev->ha, &eth->s_addr);
-    eth->ether_type = rte_cpu_to_be_16(ETHER_TYPE_IPv4);
 
     lb_device_tx_mbuf(m, dev);
     return 0;
 }
 
+/*
+ * Checksums of outgoing packets. The NIC fills them when the device has
+ * the TX offload. Otherwise packets rewritten in place pass the headers
+ * saved by lb_cksum_nat_save() and get an incremental update, packets
+ * built from scratch pass NULL and get a full computation. The IPv4
+ * header must be final when the TCP/UDP helpers are called.
+ */
+static inline void
+lb_device_tx_offload_prepare(struct rte_mbuf *m, struct ipv4_hdr *iph,
+                             uint64_t ol_flags) {
+    m->l2_len = ETHER_HDR_LEN;
+    m->l3_len = IPv4_HLEN(iph);
+    m->ol_flags |= PKT_TX_IPV4 | ol_flags;
+}
+
+#ifdef CKSUM_DEBUG
+static inline void
+lb_device_cksum_validate(const char *name, uint16_t *cksum, uint16_t full) {
+    /* 0 and 0xffff are both the one's complement zero. */
+    if (*cksum != full && !((*cksum == 0 || *cksum == 0xffff) &&
+                            (full == 0 || full == 0xffff))) {
+        RTE_LOG(WARNING, USER1, "%s(): %s cksum 0x%04x, expected 0x%04x.\n",
+                __func__, name, rte_be_to_cpu_16(*cksum),
+                rte_be_to_cpu_16(full));
+        *cksum = full;
+    }
+}
+#endif
+
+static inline void
+lb_device_ipv4_cksum(struct rte_mbuf *m, struct ipv4_hdr *iph,
+                     const struct lb_cksum_nat *nat, struct lb_device *dev) {
+    if (dev->tx_offload & DEV_TX_OFFLOAD_IPV4_CKSUM) {
+        iph->hdr_checksum = 0;
+        lb_device_tx_offload_prepare(m, iph, PKT_TX_IP_CKSUM);
+    } else if (nat != NULL) {
+        iph->hdr_checksum = lb_cksum_nat_ipv4(nat, iph);
+#ifdef CKSUM_DEBUG
+        {
+            uint16_t cksum = iph->hdr_checksum;
+
+            iph->hdr_checksum = 0;
+            lb_device_cksum_validate("ipv4", &cksum, rte_ipv4_cksum(iph));
+            iph->hdr_checksum = cksum;
+        }
+#endif
+    } else {
+        iph->hdr_checksum = 0;
+        iph->hdr_checksum = rte_ipv4_cksum(iph);
+    }
+}
+
+static inline void
+lb_device_tcp_cksum(struct rte_mbuf *m, struct ipv4_hdr *iph,
+                    struct tcp_hdr *th, const struct lb_cksum_nat *nat,
+                    struct lb_device *dev) {
+    if (dev->tx_offload & DEV_TX_OFFLOAD_TCP_CKSUM) {
+        lb_device_tx_offload_prepare(m, iph, PKT_TX_TCP_CKSUM);
+        th->cksum = 0;
+        th->cksum = rte_ipv4_phdr_cksum(iph, m->ol_flags);
+    } else if (nat != NULL) {
+        th->cksum = lb_cksum_nat_l4(nat, iph, th->cksum, th, TCP_HLEN(th));
+#ifdef CKSUM_DEBUG
+        {
+            uint16_t cksum = th->cksum;
+
+            th->cksum = 0;
+            lb_device_cksum_validate("tcp", &cksum,
+                                     rte_ipv4_udptcp_cksum(iph, th));
+            th->cksum = cksum;
+        }
+#endif
+    } else {
+        th->cksum = 0;
+        th->cksum = rte_ipv4_udptcp_cksum(iph, th);
+    }
+}
+
+/* A zero UDP checksum means none and is kept. */
+static inline void
+lb_device_udp_cksum(struct rte_mbuf *m, struct ipv4_hdr *iph,
+                    struct udp_hdr *uh, const struct lb_cksum_nat *nat,
+                    struct lb_device *dev) {
+    if (uh->dgram_cksum == 0)
+        return;
+    if (dev->tx_offload & DEV_TX_OFFLOAD_UDP_CKSUM) {
+        lb_device_tx_offload_prepare(m, iph, PKT_TX_UDP_CKSUM);
+        uh->dgram_cksum = 0;
+        uh->dgram_cksum = rte_ipv4_phdr_cksum(iph, m->ol_flags);
+    } else if (nat != NULL) {
+        uh->dgram_cksum =
+            lb_cksum_nat_l4(nat, iph, uh->dgram_cksum, uh, sizeof(*uh));
+        if (uh->dgram_cksum == 0)
+            uh->dgram_cksum = 0xffff;
+#ifdef CKSUM_DEBUG
+        {
+            uint16_t cksum = uh->dgram_cksum;
+
+            uh->dgram_cksum = 0;
+            lb_device_cksum_validate("udp", &cksum,
+                                     rte_ipv4_udptcp_cksum(iph, uh));
+            uh->dgram_cksum = cksum;
+        }
+#endif
+    } else {
+        uh->dgram_cksum = 0;
+        uh->dgram_cksum = rte_ipv4_udptcp_cksum(iph, uh);
+    }
+}
+
+/* Checksum errors found by the NIC, unchecked packets pass. */
+static inline int
+lb_device_rx_cksum_bad(struct rte_mbuf *m) {
+    return (m->ol_flags & PKT_RX_IP_CKSUM_MASK) == PKT_RX_IP_CKSUM_BAD ||
+           (m->ol_flags & PKT_RX_L4_CKSUM_MASK) == PKT_RX_L4_CKSUM_BAD;
+}
+
 static inline struct rte_mbuf *
 lb_device_pktmbuf_alloc(struct lb_device *dev) {
     return rte_pktmbuf_alloc(dev->mp);
@@ -0,0 +1,275 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <stddef.h>
+#include <string.h>
+
+#include <rte_cycles.h>
+#include <rte_ip_frag.h>
+#include <rte_lcore.h>
+#include <rte_log.h>
+#include <rte_malloc.h>
+#include <rte_timer.h>
+
+#include <unixctl_command.h>
+
+#include "lb_clock.h"
+#include "lb_device.h"
+#include "lb_format.h"
+#include "lb_frag.h"
+
+#define FRAG_BUCKET_ENTRIES 16
+#define FRAG_TIMEOUT_MS 2000
+#define FRAG_EXPIRE_PERIOD_MS 100
+
+#define FRAG_OUT_MAX 32
+#define FRAG_PREFETCH 3
+
+struct frag_stats {
+    uint64_t rx_frags;
+    uint64_t reassembled;
+    uint64_t timeouts;
+    uint64_t in_use;
+    uint64_t tx_frags;
+    uint64_t tx_dropped;
+};
+
+struct frag_lcore {
+    struct rte_ip_frag_tbl *tbl;
+    struct rte_ip_frag_death_row dr;
+    struct rte_timer timer;
+    uint32_t max_flows;
+    uint64_t max_cycles;
+    uint32_t socket_id;
+    struct frag_stats stats;
+} __rte_cache_aligned;
+
+static struct frag_lcore *frag_lcores[RTE_MAX_LCORE];
+
+struct rte_mbuf *
+lb_frag_reassemble(struct rte_mbuf *m, struct ipv4_hdr *iph) {
+    struct frag_lcore *fl = frag_lcores[rte_lcore_id()];
+    struct rte_mbuf *r;
+
+    fl->stats.rx_frags++;
+    m->l2_len = ETHER_HDR_LEN;
+    m->l3_len = IPv4_HLEN(iph);
+    r = rte_ipv4_frag_reassemble_packet(fl->tbl, &fl->dr, m, rte_rdtsc(),
+                                        iph);
+    if (r == NULL)
+        return NULL;
+
+    fl->stats.reassembled++;
+    /* The library leaves the header checksum to the TX offload. */
+    r->ol_flags &= ~PKT_TX_IP_CKSUM;
+    iph = rte_pktmbuf_mtod_offset(r, struct ipv4_hdr *, ETHER_HDR_LEN);
+    iph->hdr_checksum = rte_ipv4_cksum(iph);
+    return r;
+}
+
+void
+lb_frag_death_row_free(void) {
+    struct frag_lcore *fl = frag_lcores[rte_lcore_id()];
+
+    if (fl->dr.cnt != 0)
+        rte_ip_frag_free_death_row(&fl->dr, FRAG_PREFETCH);
+}
+
+/*
+ * A datagram holds at most RTE_LIBRTE_IP_FRAG_MAX_FRAG mbufs. The lcore
+ * may hold as many datagrams as its share of each of its pools allows.
+ */
+static uint32_t
+frag_max_flows(uint32_t lcore_id) {
+    struct lb_device *dev;
+    uint32_t flows = UINT32_MAX;
+    uint16_t devid;
+
+    LB_DEVICE_FOREACH(devid, dev) {
+        if (!dev->lcore_conf[lcore_id].rxq_enable)
+            continue;
+        flows = RTE_MIN(flows, dev->frag_mbufs / dev->nb_rxq /
+                                   RTE_LIBRTE_IP_FRAG_MAX_FRAG);
+    }
+    return flows != UINT32_MAX ? RTE_MAX(flows, 1U) : 1;
+}
+
+static struct rte_ip_frag_tbl *
+frag_table_create(struct frag_lcore *fl) {
+    return rte_ip_frag_table_create(
+        RTE_MAX(fl->max_flows / FRAG_BUCKET_ENTRIES, 1U), FRAG_BUCKET_ENTRIES,
+        fl->max_flows, fl->max_cycles, fl->socket_id);
+}
+
+/*
+ * The table drops a timed out datagram only when its bucket is needed
+ * again. Once the oldest datagram, at the head of the LRU list, timed out,
+ * the table is replaced by an empty one to free the mbufs of all of them.
+ */
+static void
+frag_expire_cb(__attribute__((unused)) struct rte_timer *timer, void *arg) {
+    struct frag_lcore *fl = arg;
+    struct rte_ip_frag_tbl *tbl;
+    const struct ip_frag_pkt *fp;
+
+    fl->stats.in_use = fl->tbl->use_entries;
+    fp = TAILQ_FIRST(&fl->tbl->lru);
+    if (fp == NULL || rte_rdtsc() - fp->start <= fl->max_cycles)
+        return;
+
+    tbl = frag_table_create(fl);
+    if (tbl == NULL)
+        return;
+    rte_ip_frag_table_destroy(fl->tbl);
+    fl->tbl = tbl;
+    fl->stats.timeouts += fl->stats.in_use;
+    fl->stats.in_use = 0;
+}
+
+/* The L4 checksum covers the whole datagram, it can't be offloaded. */
+static void
+frag_l4_cksum(struct rte_mbuf *m, struct ipv4_hdr *iph) {
+    uint8_t *cksum;
+    uint16_t sum = 0;
+
+    /* The headers are packed, the checksum is stored with memcpy(). */
+    switch (m->ol_flags & PKT_TX_L4_MASK) {
+    case PKT_TX_TCP_CKSUM:
+        cksum = (uint8_t *)TCP_HDR(iph) + offsetof(struct tcp_hdr, cksum);
+        break;
+    case PKT_TX_UDP_CKSUM:
+        cksum = (uint8_t *)UDP_HDR(iph) + offsetof(struct udp_hdr, dgram_cksum);
+        break;
+    default:
+        return;
+    }
+
+    /* The checksum field holds the pseudo header sum. */
+    rte_raw_cksum_mbuf(m, ETHER_HDR_LEN + IPv4_HLEN(iph),
+                       lb_cksum_l4_len(iph), &sum);
+    if (sum != 0xffff)
+        sum = ~sum;
+    memcpy(cksum, &sum, sizeof(sum));
+    m->ol_flags &= ~PKT_TX_L4_MASK;
+}
+
+int
+lb_frag_output(struct rte_mbuf *m, struct ipv4_hdr *iph,
+               struct lb_device *dev) {
+    struct frag_lcore *fl = frag_lcores[rte_lcore_id()];
+    struct rte_mbuf *frags[FRAG_OUT_MAX];
+    struct ether_hdr *eth;
+    int32_t i, n;
+
+    frag_l4_cksum(m, iph);
+    rte_pktmbuf_adj(m, ETHER_HDR_LEN);
+    n = rte_ipv4_fragment_packet(m, frags, FRAG_OUT_MAX, dev->mtu, dev->mp,
+                                 dev->mp);
+    rte_pktmbuf_free(m);
+    if (n < 0) {
+        fl->stats.tx_dropped++;
+        return n;
+    }
+
+    fl->stats.tx_frags += n;
+    for (i = 0; i < n; i++) {
+        eth = (struct ether_hdr *)rte_pktmbuf_prepend(frags[i], ETHER_HDR_LEN);
+        if (unlikely(eth == NULL)) {
+            fl->stats.tx_dropped++;
+            rte_pktmbuf_free(frags[i]);
+            continue;
+        }
+        iph = (struct ipv4_hdr *)(eth + 1);
+        frags[i]->ol_flags = 0;
+        lb_device_ipv4_cksum(frags[i], iph, NULL, dev);
+        lb_device_output(frags[i], iph, dev);
+    }
+    return 0;
+}
+
+int
+lb_frag_init(void) {
+    struct frag_lcore *fl;
+    uint32_t lcore_id, socket_id;
+    uint64_t max_cycles;
+
+    max_cycles =
+        (rte_get_tsc_hz() + MS_PER_S - 1) / MS_PER_S * FRAG_TIMEOUT_MS;
+    RTE_LCORE_FOREACH(lcore_id) {
+        socket_id = rte_lcore_to_socket_id(lcore_id);
+        fl = rte_zmalloc_socket(NULL, sizeof(*fl), RTE_CACHE_LINE_SIZE,
+                                socket_id);
+        if (fl == NULL) {
+            RTE_LOG(ERR, USER1, "%s(): Alloc memory for frag table failed.\n",
+                    __func__);
+            return -1;
+        }
+
+        fl->max_flows = frag_max_flows(lcore_id);
+        fl->max_cycles = max_cycles;
+        fl->socket_id = socket_id;
+        fl->tbl = frag_table_create(fl);
+        if (fl->tbl == NULL) {
+            RTE_LOG(ERR, USER1, "%s(): Create frag table on lcore%u failed.\n",
+                    __func__, lcore_id);
+            return -1;
+        }
+
+        rte_timer_init(&fl->timer);
+        rte_timer_reset(&fl->timer, MS_TO_CYCLES(FRAG_EXPIRE_PERIOD_MS),
+                        PERIODICAL, lcore_id, frag_expire_cb, fl);
+        frag_lcores[lcore_id] = fl;
+    }
+    return 0;
+}
+
+static void
+frag_stats_cmd_cb(int fd, char *argv[], int argc) {
+    struct frag_stats stats;
+    struct frag_lcore *fl;
+    uint32_t lcore_id;
+    int json_fmt;
+
+    json_fmt = argc > 0 && strcmp(argv[0], "--json") == 0;
+
+    memset(&stats, 0, sizeof(stats));
+    RTE_LCORE_FOREACH(lcore_id) {
+        fl = frag_lcores[lcore_id];
+        stats.rx_frags += fl->stats.rx_frags;
+        stats.reassembled += fl->stats.reassembled;
+        stats.timeouts += fl->stats.timeouts;
+        stats.tx_frags += fl->stats.tx_frags;
+        stats.tx_dropped += fl->stats.tx_dropped;
+        stats.in_use += fl->stats.in_use;
+    }
+
+    if (json_fmt)
+        unixctl_command_reply(fd, "{");
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("rx-fragments", ",")
+                                   : NORM_KV_64_FMT("rx-fragments", "\n"),
+                          stats.rx_frags);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("reassembled", ",")
+                                   : NORM_KV_64_FMT("reassembled", "\n"),
+                          stats.reassembled);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("timeouts", ",")
+                                   : NORM_KV_64_FMT("timeouts", "\n"),
+                          stats.timeouts);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("in-use", ",")
+                                   : NORM_KV_64_FMT("in-use", "\n"),
+                          stats.in_use);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("tx-fragments", ",")
+                                   : NORM_KV_64_FMT("tx-fragments", "\n"),
+                          stats.tx_frags);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("tx-dropped", "}\n")
+                                   : NORM_KV_64_FMT("tx-dropped", "\n"),
+                          stats.tx_dropped);
+}
+
+UNIXCTL_CMD_REGISTER("frag/stats", "[--json].",
+                     "Show IPv4 reassembly and fragmentation statistics.", 0, 1,
+                     frag_stats_cmd_cb);
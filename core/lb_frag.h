@@ -0,0 +1,30 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_FRAG_H__
+#define __LB_FRAG_H__
+
+#include <rte_ip.h>
+#include <rte_mbuf.h>
+
+struct lb_device;
+
+/*
+ * IPv4 fragments are reassembled per lcore before the fullnat handlers
+ * see them. The NIC hashes fragments by addresses only, so all fragments
+ * of a datagram arrive on one queue, and fragments of replies are
+ * redirected to the lcore owning the local address first. Datagrams
+ * larger than the MTU after the rewrite are fragmented again on output.
+ */
+
+/* Returns the reassembled datagram, NULL while fragments are missing. */
+struct rte_mbuf *lb_frag_reassemble(struct rte_mbuf *m, struct ipv4_hdr *iph);
+
+/* Frees the fragments dropped by the reassembly, once per burst. */
+void lb_frag_death_row_free(void);
+
+int lb_frag_output(struct rte_mbuf *m, struct ipv4_hdr *iph,
+                   struct lb_device *dev);
+
+int lb_frag_init(void);
+
+#endif
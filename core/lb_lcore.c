@@ -0,0 +1,333 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <rte_log.h>
+
+#include <unixctl_command.h>
+
+#include "lb_clock.h"
+#include "lb_format.h"
+#include "lb_lcore.h"
+
+/* The smallest step of an adaptive period. */
+#define JOB_PERIOD_STEP_US 1
+
+struct lb_lcore_stats lb_lcore_stats[RTE_MAX_LCORE];
+struct lb_lcore_loop lb_lcore_loops[RTE_MAX_LCORE];
+
+static double
+percent(uint64_t part, uint64_t total) {
+    return total ? (double)part * 100 / total : 0;
+}
+
+/* Halves the period above the target, grows it by an eighth below it. */
+static void
+lcore_job_update_period(struct rte_jobstats *job, int64_t result) {
+    uint64_t period = job->period;
+
+    if (result > job->target)
+        period /= 2;
+    else
+        period += period / 8 + US_TO_CYCLES(JOB_PERIOD_STEP_US);
+    rte_jobstats_set_period(job, period, 1);
+}
+
+int
+lb_lcore_job_add(const char *name, lb_lcore_job_func *fn, void *arg,
+                 uint64_t min_period, uint64_t max_period, int64_t target,
+                 uint32_t flags) {
+    struct lb_lcore_loop *loop = &lb_lcore_loops[rte_lcore_id()];
+    struct lb_lcore_job *job;
+
+    if (loop->nb_jobs == LB_LCORE_MAX_JOBS) {
+        RTE_LOG(ERR, USER1, "%s(): Too many jobs on lcore%u.\n", __func__,
+                rte_lcore_id());
+        return -1;
+    }
+
+    job = &loop->jobs[loop->nb_jobs];
+    rte_jobstats_init(&job->stats, name, min_period, max_period, min_period,
+                      target);
+    rte_jobstats_set_update_period_function(&job->stats,
+                                            lcore_job_update_period);
+    job->fn = fn;
+    job->arg = arg;
+    job->flags = flags;
+    loop->nb_jobs++;
+    return 0;
+}
+
+void
+lb_lcore_loop_set_idle(lb_lcore_idle_func *fn) {
+    lb_lcore_loops[rte_lcore_id()].idle = fn;
+}
+
+static void
+lcore_loop_wakeup(struct lb_lcore_loop *loop) {
+    struct lb_lcore_job *job;
+    uint64_t now = rte_rdtsc();
+    uint32_t i;
+
+    for (i = 0; i < loop->nb_jobs; i++) {
+        job = &loop->jobs[i];
+        rte_jobstats_set_period(&job->stats, job->stats.min_period, 1);
+        job->next_tsc = now;
+    }
+}
+
+void
+lb_lcore_loop_run(int *running) {
+    struct lb_lcore_loop *loop = &lb_lcore_loops[rte_lcore_id()];
+    struct lb_lcore_job *job;
+    uint64_t now, deadline, sleep_deadline;
+    uint32_t i;
+    int idle = 0;
+
+    rte_jobstats_context_init(&loop->ctx);
+    lb_lcore_stats_start();
+    now = rte_rdtsc();
+    for (i = 0; i < loop->nb_jobs; i++)
+        loop->jobs[i].next_tsc = now;
+
+    while (*(volatile int *)running) {
+        rte_jobstats_context_start(&loop->ctx);
+        now = rte_rdtsc();
+        deadline = sleep_deadline = UINT64_MAX;
+        for (i = 0; i < loop->nb_jobs; i++) {
+            job = &loop->jobs[i];
+            if (now >= job->next_tsc) {
+                if (idle) {
+                    lb_lcore_stage(LB_STAGE_IDLE);
+                    idle = 0;
+                }
+                rte_jobstats_start(&loop->ctx, &job->stats);
+                rte_jobstats_finish(&job->stats, job->fn(job->arg));
+                job->next_tsc = now + job->stats.period;
+            }
+            if (job->next_tsc < deadline)
+                deadline = job->next_tsc;
+            if (!(job->flags & LB_LCORE_JOB_F_RX) &&
+                job->next_tsc < sleep_deadline)
+                sleep_deadline = job->next_tsc;
+        }
+        if (loop->ctx.loop_executed_jobs == 0) {
+            idle = 1;
+            if (loop->idle != NULL && loop->idle(deadline, sleep_deadline))
+                lcore_loop_wakeup(loop);
+        }
+        rte_jobstats_context_finish(&loop->ctx);
+    }
+}
+
+#ifdef LB_LCORE_STATS
+
+static const char *lb_lcore_stage_names[LB_STAGE_MAX] = {
+    [LB_STAGE_RX_EMPTY] = "rx-empty", [LB_STAGE_RX] = "rx",
+    [LB_STAGE_CLASSIFY] = "classify", [LB_STAGE_LOOKUP] = "lookup",
+    [LB_STAGE_NAT] = "nat",           [LB_STAGE_TX] = "tx",
+    [LB_STAGE_TIMER] = "timer",       [LB_STAGE_IDLE] = "idle",
+};
+
+static void
+lcore_stats_normal(int fd) {
+    struct lb_lcore_stats *s;
+    uint32_t lcore_id, i;
+
+    unixctl_command_reply(fd, "              ");
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        unixctl_command_reply(fd, "lcore%-7u  ", lcore_id);
+    }
+    unixctl_command_reply(fd, "\npackets       ");
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        unixctl_command_reply(fd, "%-12" PRIu64 "  ",
+                              lb_lcore_stats[lcore_id].packets);
+    }
+    unixctl_command_reply(fd, "\nempty-polls   ");
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        s = &lb_lcore_stats[lcore_id];
+        unixctl_command_reply(fd, "%-12" PRIu64 "  ", s->empty_polls);
+    }
+    unixctl_command_reply(fd, "\nbusy          ");
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        s = &lb_lcore_stats[lcore_id];
+        unixctl_command_reply(
+            fd, "%-11.2f%%  ",
+            percent(lb_lcore_stats_busy(s), lb_lcore_stats_total(s)));
+    }
+    unixctl_command_reply(fd, "\ncycles/pkt    ");
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        s = &lb_lcore_stats[lcore_id];
+        unixctl_command_reply(
+            fd, "%-12" PRIu64 "  ",
+            s->packets ? lb_lcore_stats_busy(s) / s->packets : 0);
+    }
+    unixctl_command_reply(fd, "\n");
+
+    for (i = 0; i < LB_STAGE_MAX; i++) {
+        unixctl_command_reply(fd, "  %-10s  ", lb_lcore_stage_names[i]);
+        RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+            s = &lb_lcore_stats[lcore_id];
+            unixctl_command_reply(
+                fd, "%-11.2f%%  ",
+                percent(lb_lcore_stats_stage(s, i), lb_lcore_stats_total(s)));
+        }
+        unixctl_command_reply(fd, "\n");
+    }
+}
+
+static void
+lcore_stats_json(int fd) {
+    struct lb_lcore_stats *s;
+    uint32_t lcore_id, i;
+    uint8_t json_first_obj = 1;
+    uint64_t total, busy;
+
+    unixctl_command_reply(fd, "[");
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        s = &lb_lcore_stats[lcore_id];
+        total = lb_lcore_stats_total(s);
+        busy = lb_lcore_stats_busy(s);
+        unixctl_command_reply(fd, json_first_obj ? "{" : ",{");
+        json_first_obj = 0;
+        unixctl_command_reply(fd, JSON_KV_32_FMT("lcore", ","), lcore_id);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("packets", ","), s->packets);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("polls", ","), s->polls);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("empty-polls", ","),
+                              s->empty_polls);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("cycles", ","), total);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("busy-cycles", ","), busy);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("busy-percent", ","),
+                              total ? busy * 100 / total : 0);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("cycles-per-packet", ","),
+                              s->packets ? busy / s->packets : 0);
+        unixctl_command_reply(fd, JSON_K_FMT("stages") ":{");
+        for (i = 0; i < LB_STAGE_MAX; i++) {
+            unixctl_command_reply(fd, "\"%s\":%" PRIu64 "%s",
+                                  lb_lcore_stage_names[i],
+                                  lb_lcore_stats_stage(s, i),
+                                  i + 1 < LB_STAGE_MAX ? "," : "");
+        }
+        unixctl_command_reply(fd, "}}");
+    }
+    unixctl_command_reply(fd, "]\n");
+}
+
+#endif /* LB_LCORE_STATS */
+
+static void
+lcore_stats_cmd_cb(int fd, char *argv[], int argc) {
+    int json_fmt;
+
+    json_fmt = argc > 0 && strcmp(argv[0], "--json") == 0;
+    if (argc > 0 && !json_fmt) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[0]);
+        return;
+    }
+#ifdef LB_LCORE_STATS
+    if (json_fmt)
+        lcore_stats_json(fd);
+    else
+        lcore_stats_normal(fd);
+#else
+    unixctl_command_reply_error(fd, "Built without LB_LCORE_STATS.\n");
+#endif
+}
+
+UNIXCTL_CMD_REGISTER("lcore/stats", "[--json].",
+                     "Show cycles spent per stage of the worker lcores.", 0, 1,
+                     lcore_stats_cmd_cb);
+
+static void
+lcore_jobs_normal(int fd) {
+    struct lb_lcore_loop *loop;
+    struct rte_jobstats *job;
+    uint64_t total, hz = rte_get_timer_hz();
+    uint32_t lcore_id, i;
+
+    RTE_LCORE_FOREACH(lcore_id) {
+        loop = &lb_lcore_loops[lcore_id];
+        if (loop->nb_jobs == 0)
+            continue;
+        total = rte_get_timer_cycles() - loop->ctx.start_time;
+        unixctl_command_reply(fd, "lcore%u\n", lcore_id);
+        unixctl_command_reply(fd,
+                              "  load: %.2f%%  idle: %.2f%%  loops: %" PRIu64
+                              "\n",
+                              percent(loop->ctx.exec_time, total),
+                              percent(loop->ctx.management_time, total),
+                              loop->ctx.loop_cnt);
+        unixctl_command_reply(fd, "  %-10s  %-12s  %-10s  %-10s  %s\n", "job",
+                              "runs", "avg-cycles", "max-cycles",
+                              "period(us)");
+        for (i = 0; i < loop->nb_jobs; i++) {
+            job = &loop->jobs[i].stats;
+            unixctl_command_reply(
+                fd,
+                "  %-10s  %-12" PRIu64 "  %-10" PRIu64 "  %-10" PRIu64
+                "  %.2f\n",
+                job->name, job->exec_cnt,
+                job->exec_cnt ? job->exec_time / job->exec_cnt : 0,
+                job->max_exec_time, (double)job->period * US_PER_S / hz);
+        }
+    }
+}
+
+static void
+lcore_jobs_json(int fd) {
+    struct lb_lcore_loop *loop;
+    struct rte_jobstats *job;
+    uint64_t total, hz = rte_get_timer_hz();
+    uint32_t lcore_id, i;
+    uint8_t json_first_obj = 1;
+
+    unixctl_command_reply(fd, "[");
+    RTE_LCORE_FOREACH(lcore_id) {
+        loop = &lb_lcore_loops[lcore_id];
+        if (loop->nb_jobs == 0)
+            continue;
+        total = rte_get_timer_cycles() - loop->ctx.start_time;
+        unixctl_command_reply(fd, json_first_obj ? "{" : ",{");
+        json_first_obj = 0;
+        unixctl_command_reply(fd, JSON_KV_32_FMT("lcore", ","), lcore_id);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("cycles", ","), total);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("exec-cycles", ","),
+                              loop->ctx.exec_time);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("idle-cycles", ","),
+                              loop->ctx.management_time);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("loops", ","),
+                              loop->ctx.loop_cnt);
+        unixctl_command_reply(fd, JSON_K_FMT("jobs") ":[");
+        for (i = 0; i < loop->nb_jobs; i++) {
+            job = &loop->jobs[i].stats;
+            unixctl_command_reply(fd, i == 0 ? "{" : ",{");
+            unixctl_command_reply(fd, JSON_KV_S_FMT("name", ","), job->name);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("runs", ","),
+                                  job->exec_cnt);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("exec-cycles", ","),
+                                  job->exec_time);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("max-cycles", ","),
+                                  job->max_exec_time);
+            unixctl_command_reply(fd, JSON_KV_64_FMT("period-ns", "}"),
+                                  job->period * NS_PER_S / hz);
+        }
+        unixctl_command_reply(fd, "]}");
+    }
+    unixctl_command_reply(fd, "]\n");
+}
+
+static void
+lcore_jobs_cmd_cb(int fd, char *argv[], int argc) {
+    if (argc > 0 && strcmp(argv[0], "--json") == 0) {
+        lcore_jobs_json(fd);
+    } else if (argc > 0) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[0]);
+    } else {
+        lcore_jobs_normal(fd);
+    }
+}
+
+UNIXCTL_CMD_REGISTER("lcore/jobs", "[--json].",
+                     "Show load, idle time and job periods of the lcores.", 0,
+                     1, lcore_jobs_cmd_cb);
@@ -0,0 +1,222 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_LCORE_H__
+#define __LB_LCORE_H__
+
+#include <stdint.h>
+
+#include <rte_cycles.h>
+#include <rte_jobstats.h>
+#include <rte_lcore.h>
+#include <rte_memory.h>
+
+/*
+ * Stages of a worker loop. Jobs stamp the TSC as they end, a burst of
+ * packets takes a single rdtsc. Its split between the RX to NAT stages is
+ * only stamped on one burst in LB_LCORE_STAGE_SAMPLE, the cycles of all
+ * bursts are spread by that sample. Only the workers are accounted.
+ */
+enum lb_lcore_stage {
+    LB_STAGE_RX_EMPTY,
+    /* Stages of a burst. */
+    LB_STAGE_RX,
+    LB_STAGE_CLASSIFY,
+    LB_STAGE_LOOKUP,
+    LB_STAGE_NAT,
+    LB_STAGE_TX,
+    LB_STAGE_TIMER,
+    /* Waiting for the next job. */
+    LB_STAGE_IDLE,
+    LB_STAGE_MAX,
+};
+
+#define LB_STAGE_BURST(stage)                                                  \
+    ((stage) >= LB_STAGE_RX && (stage) <= LB_STAGE_NAT)
+
+#define LB_LCORE_STAGE_SAMPLE 16
+
+struct lb_lcore_stats {
+    uint64_t last_tsc;
+    /* Cycles of the stages out of bursts, and of all bursts. */
+    uint64_t cycles[LB_STAGE_MAX];
+    uint64_t burst_cycles;
+    /* Cycles of the stages of the sampled bursts. */
+    uint64_t sampled[LB_STAGE_MAX];
+    uint64_t sample_tsc;
+    uint32_t bursts;
+    uint32_t sampling;
+    uint64_t polls;
+    uint64_t empty_polls;
+    uint64_t packets;
+} __rte_cache_aligned;
+
+extern struct lb_lcore_stats lb_lcore_stats[RTE_MAX_LCORE];
+
+static inline uint64_t
+lb_lcore_stats_total(const struct lb_lcore_stats *s) {
+    uint64_t total = s->burst_cycles;
+    uint32_t i;
+
+    for (i = 0; i < LB_STAGE_MAX; i++)
+        total += s->cycles[i];
+    return total;
+}
+
+/* Cycles spent on packets, empty polls and waits for jobs left out. */
+static inline uint64_t
+lb_lcore_stats_busy(const struct lb_lcore_stats *s) {
+    return lb_lcore_stats_total(s) - s->cycles[LB_STAGE_RX_EMPTY] -
+           s->cycles[LB_STAGE_IDLE];
+}
+
+/* Cycles of @stage, estimated from the sample for the stages of a burst. */
+static inline uint64_t
+lb_lcore_stats_stage(const struct lb_lcore_stats *s, uint32_t stage) {
+    uint64_t sampled = 0;
+    uint32_t i;
+
+    if (!LB_STAGE_BURST(stage))
+        return s->cycles[stage];
+    for (i = LB_STAGE_RX; i <= LB_STAGE_NAT; i++)
+        sampled += s->sampled[i];
+    return sampled ? (double)s->burst_cycles * s->sampled[stage] / sampled : 0;
+}
+
+#ifdef LB_LCORE_STATS
+
+static inline void
+lb_lcore_stage(enum lb_lcore_stage stage) {
+    struct lb_lcore_stats *s = &lb_lcore_stats[rte_lcore_id()];
+    uint64_t now;
+
+    if (LB_STAGE_BURST(stage)) {
+        if (s->sampling) {
+            now = rte_rdtsc();
+            s->sampled[stage] += now - s->sample_tsc;
+            s->sample_tsc = now;
+        }
+        return;
+    }
+    now = rte_rdtsc();
+    s->cycles[stage] += now - s->last_tsc;
+    s->last_tsc = now;
+}
+
+/* Starts a burst, the cycles since the last stamp are its RX stage. */
+static inline void
+lb_lcore_burst_start(void) {
+    struct lb_lcore_stats *s = &lb_lcore_stats[rte_lcore_id()];
+
+    s->sampling = (s->bursts++ & (LB_LCORE_STAGE_SAMPLE - 1)) == 0;
+    if (s->sampling) {
+        s->sample_tsc = s->last_tsc;
+        lb_lcore_stage(LB_STAGE_RX);
+    }
+}
+
+static inline void
+lb_lcore_burst_end(void) {
+    struct lb_lcore_stats *s = &lb_lcore_stats[rte_lcore_id()];
+    uint64_t now = rte_rdtsc();
+
+    s->burst_cycles += now - s->last_tsc;
+    s->last_tsc = now;
+    s->sampling = 0;
+}
+
+/* Ends the RX of a loop that received @n packets on all queues. */
+static inline void
+lb_lcore_stage_rx(uint32_t n) {
+    struct lb_lcore_stats *s = &lb_lcore_stats[rte_lcore_id()];
+
+    s->polls++;
+    s->packets += n;
+    if (n == 0) {
+        s->empty_polls++;
+        lb_lcore_stage(LB_STAGE_RX_EMPTY);
+    } else {
+        lb_lcore_burst_start();
+    }
+}
+
+static inline void
+lb_lcore_stats_start(void) {
+    lb_lcore_stats[rte_lcore_id()].last_tsc = rte_rdtsc();
+}
+
+#else
+
+static inline void
+lb_lcore_stage(__attribute__((unused)) enum lb_lcore_stage stage) {
+}
+
+static inline void
+lb_lcore_burst_start(void) {
+}
+
+static inline void
+lb_lcore_burst_end(void) {
+}
+
+static inline void
+lb_lcore_stage_rx(__attribute__((unused)) uint32_t n) {
+}
+
+static inline void
+lb_lcore_stats_start(void) {
+}
+
+#endif /* LB_LCORE_STATS */
+
+/*
+ * Each lcore runs its jobs from a loop of its own. A job runs once its
+ * period has passed and returns a value, the period adapts to how far the
+ * value is from the job's target: shorter above it, longer below it.
+ */
+
+#define LB_LCORE_MAX_JOBS 8
+
+typedef int64_t lb_lcore_job_func(void *arg);
+
+/* The job only has work after packets arrive, rx interrupts announce it. */
+#define LB_LCORE_JOB_F_RX 0x1
+
+/*
+ * Called when a loop found no job due, @deadline is the TSC of the next one
+ * and @sleep_deadline of the next one without LB_LCORE_JOB_F_RX. Returns
+ * nonzero when packets ended the wait, the jobs then run at once at their
+ * shortest period.
+ */
+typedef int lb_lcore_idle_func(uint64_t deadline, uint64_t sleep_deadline);
+
+struct lb_lcore_job {
+    struct rte_jobstats stats;
+    uint64_t next_tsc;
+    lb_lcore_job_func *fn;
+    void *arg;
+    uint32_t flags;
+};
+
+struct lb_lcore_loop {
+    struct rte_jobstats_context ctx;
+    struct lb_lcore_job jobs[LB_LCORE_MAX_JOBS];
+    uint32_t nb_jobs;
+    lb_lcore_idle_func *idle;
+} __rte_cache_aligned;
+
+extern struct lb_lcore_loop lb_lcore_loops[RTE_MAX_LCORE];
+
+/*
+ * Adds a job to the calling lcore, periods are in TSC cycles. A job with
+ * equal periods runs at a fixed period.
+ */
+int lb_lcore_job_add(const char *name, lb_lcore_job_func *fn, void *arg,
+                     uint64_t min_period, uint64_t max_period, int64_t target,
+                     uint32_t flags);
+
+void lb_lcore_loop_set_idle(lb_lcore_idle_func *fn);
+
+/* Runs the jobs of the calling lcore while *running is set. */
+void lb_lcore_loop_run(int *running);
+
+#endif
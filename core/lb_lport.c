@@ -0,0 +1,288 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <rte_byteorder.h>
+#include <rte_errno.h>
+#include <rte_hash.h>
+#include <rte_hash_crc.h>
+#include <rte_log.h>
+#include <rte_malloc.h>
+#include <rte_thash.h>
+
+#include "lb_lport.h"
+
+/* rte_hash_create() rejects less than a bucket of entries. */
+#define LPORT_HASH_MIN_ENTRIES 8U
+
+static inline uint32_t
+ctz64(uint64_t v) {
+    return __builtin_ctzll(v);
+}
+
+static inline void
+lport_map_set_free(struct lb_lport_map *map, uint32_t p) {
+    uint32_t w = p >> 6, s = w >> 6;
+
+    map->bits[w] |= 1ULL << (p & 63);
+    map->summary[s] |= 1ULL << (w & 63);
+    map->top |= 1ULL << s;
+}
+
+static inline void
+lport_map_set_used(struct lb_lport_map *map, uint32_t p) {
+    uint32_t w = p >> 6, s = w >> 6;
+
+    map->bits[w] &= ~(1ULL << (p & 63));
+    if (map->bits[w] != 0)
+        return;
+    map->summary[s] &= ~(1ULL << (w & 63));
+    if (map->summary[s] == 0)
+        map->top &= ~(1ULL << s);
+}
+
+static inline uint32_t
+lport_map_first(struct lb_lport_map *map, uint32_t s) {
+    uint32_t w = (s << 6) | ctz64(map->summary[s]);
+
+    return (w << 6) | ctz64(map->bits[w]);
+}
+
+/* The first free port from @from on, wrapping around. */
+static int
+lport_map_find(struct lb_lport_map *map, uint32_t from) {
+    uint32_t w = from >> 6, s = w >> 6;
+    uint64_t m;
+
+    m = map->bits[w] & (~0ULL << (from & 63));
+    if (m != 0)
+        return (w << 6) | ctz64(m);
+
+    if ((w & 63) != 63) {
+        m = map->summary[s] & (~0ULL << ((w & 63) + 1));
+        if (m != 0) {
+            w = (s << 6) | ctz64(m);
+            return (w << 6) | ctz64(map->bits[w]);
+        }
+    }
+
+    m = map->top & (~0ULL << (s + 1));
+    if (m == 0)
+        m = map->top;
+    if (m == 0)
+        return -1;
+    return lport_map_first(map, ctz64(m));
+}
+
+/*
+ * The Toeplitz hash is linear, the hash of the reply tuple is the hash
+ * with a zero lport xor the precomputed share of the lport. The share of
+ * port w * 64 + j is the share of w * 64 xor the share of j, so the ports
+ * of a word steered to rxq are rss_words[] of the reta index of its first.
+ */
+static void
+lport_map_rss_filter(struct lb_lport_pool *pool, struct lb_lport_map *map) {
+    struct rte_ipv4_tuple tuple;
+    uint32_t base, w;
+
+    memset(&tuple, 0, sizeof(tuple));
+    tuple.src_addr = rte_be_to_cpu_32(map->key.rip);
+    tuple.dst_addr = rte_be_to_cpu_32(map->key.lip);
+    tuple.sport = rte_be_to_cpu_16(map->key.rport);
+    base = rte_softrss((uint32_t *)&tuple, RTE_THASH_V4_L4_LEN, pool->rss_key);
+
+    for (w = pool->min >> 6; w <= (uint32_t)(pool->max - 1) >> 6; w++) {
+        map->bits[w] &=
+            pool->rss_words[(base ^ pool->rss_lport[w << 6]) & pool->reta_mask];
+    }
+}
+
+static void
+lport_map_init(struct lb_lport_pool *pool, struct lb_lport_map *map,
+               const struct lb_lport_key *key) {
+    uint32_t p, w;
+
+    map->key = *key;
+    map->nb_used = 0;
+    map->top = 0;
+    memset(map->summary, 0, sizeof(map->summary));
+    memset(map->bits, 0, sizeof(map->bits));
+
+    for (p = pool->min; p < pool->max && (p & 63) != 0; p++)
+        map->bits[p >> 6] |= 1ULL << (p & 63);
+    for (; p + 64 <= pool->max; p += 64)
+        map->bits[p >> 6] = ~0ULL;
+    for (; p < pool->max; p++)
+        map->bits[p >> 6] |= 1ULL << (p & 63);
+
+    if (pool->rss_key != NULL)
+        lport_map_rss_filter(pool, map);
+
+    for (w = 0; w < LB_LPORT_WORDS; w++) {
+        if (map->bits[w] != 0) {
+            map->summary[w >> 6] |= 1ULL << (w & 63);
+            map->top |= 1ULL << (w >> 6);
+        }
+    }
+}
+
+static struct rte_hash *
+lport_hash_create(struct lb_lport_pool *pool, uint32_t entries) {
+    struct rte_hash_parameters params;
+    char name[RTE_HASH_NAMESIZE];
+
+    snprintf(name, sizeof(name), "%s_%u", pool->name, pool->hash_gen);
+    memset(&params, 0, sizeof(params));
+    params.name = name;
+    params.entries = entries;
+    params.key_len = sizeof(struct lb_lport_key);
+    params.hash_func = rte_hash_crc;
+    params.socket_id = pool->socket_id;
+    return rte_hash_create(&params);
+}
+
+/* Moves the keys to a hash of twice the size, the pool is lcore private. */
+static int
+lport_hash_grow(struct lb_lport_pool *pool) {
+    struct rte_hash *hash;
+    const void *key;
+    void *data;
+    uint32_t next = 0;
+
+    pool->hash_gen++;
+    hash = lport_hash_create(pool, pool->hash_entries * 2);
+    if (hash == NULL)
+        return -1;
+    while (rte_hash_iterate(pool->hash, &key, &data, &next) >= 0) {
+        if (rte_hash_add_key_data(hash, key, data) < 0) {
+            rte_hash_free(hash);
+            return -1;
+        }
+    }
+    rte_hash_free(pool->hash);
+    pool->hash = hash;
+    pool->hash_entries *= 2;
+    return 0;
+}
+
+static struct lb_lport_map *
+lport_map_alloc(struct lb_lport_pool *pool) {
+    struct lb_lport_map *map;
+
+    map = SLIST_FIRST(&pool->free_maps);
+    if (map != NULL) {
+        SLIST_REMOVE_HEAD(&pool->free_maps, next);
+        return map;
+    }
+    return rte_malloc_socket(NULL, sizeof(*map), RTE_CACHE_LINE_SIZE,
+                             pool->socket_id);
+}
+
+int
+lb_lport_get(struct lb_lport_pool *pool, uint32_t lip, uint32_t rip,
+             uint16_t rport, uint16_t cursor, uint16_t *lport) {
+    struct lb_lport_key key = {.lip = lip, .rip = rip, .rport = rport};
+    struct lb_lport_map *map;
+    int p, rc;
+
+    if (rte_hash_lookup_data(pool->hash, &key, (void **)&map) < 0) {
+        map = lport_map_alloc(pool);
+        if (map == NULL)
+            return -1;
+        rc = rte_hash_add_key_data(pool->hash, &key, map);
+        if (rc == -ENOSPC && lport_hash_grow(pool) == 0)
+            rc = rte_hash_add_key_data(pool->hash, &key, map);
+        if (rc < 0) {
+            SLIST_INSERT_HEAD(&pool->free_maps, map, next);
+            return -1;
+        }
+        lport_map_init(pool, map, &key);
+    }
+
+    p = lport_map_find(map, cursor);
+    if (p < 0)
+        return -1;
+    lport_map_set_used(map, p);
+    map->nb_used++;
+    *lport = rte_cpu_to_be_16(p);
+    return 0;
+}
+
+void
+lb_lport_put(struct lb_lport_pool *pool, uint32_t lip, uint32_t rip,
+             uint16_t rport, uint16_t lport) {
+    struct lb_lport_key key = {.lip = lip, .rip = rip, .rport = rport};
+    struct lb_lport_map *map;
+
+    if (rte_hash_lookup_data(pool->hash, &key, (void **)&map) < 0)
+        return;
+
+    lport_map_set_free(map, rte_be_to_cpu_16(lport));
+    if (--map->nb_used == 0) {
+        rte_hash_del_key(pool->hash, &key);
+        SLIST_INSERT_HEAD(&pool->free_maps, map, next);
+    }
+}
+
+int
+lb_lport_pool_rss_set(struct lb_lport_pool *pool, const uint8_t *rss_key,
+                      const uint32_t *rss_lport, const uint16_t *reta,
+                      uint16_t reta_size, uint16_t rxq) {
+    uint32_t i, j;
+    uint64_t m;
+
+    pool->rss_words = rte_malloc_socket(NULL, reta_size * sizeof(uint64_t),
+                                        RTE_CACHE_LINE_SIZE, pool->socket_id);
+    if (pool->rss_words == NULL) {
+        RTE_LOG(ERR, USER1, "%s(): Alloc memory for RSS words failed.\n",
+                __func__);
+        return -1;
+    }
+    for (i = 0; i < reta_size; i++) {
+        m = 0;
+        for (j = 0; j < 64; j++) {
+            if (reta[(i ^ rss_lport[j]) & (reta_size - 1)] == rxq)
+                m |= 1ULL << j;
+        }
+        pool->rss_words[i] = m;
+    }
+    pool->rss_lport = rss_lport;
+    pool->reta_mask = reta_size - 1;
+    pool->rss_key = rss_key;
+    return 0;
+}
+
+int
+lb_lport_pool_init(struct lb_lport_pool *pool, const char *name,
+                   uint32_t nb_maps, uint16_t min, uint16_t max,
+                   int socket_id) {
+    uint32_t i;
+
+    snprintf(pool->name, sizeof(pool->name), "%s", name);
+    pool->socket_id = socket_id;
+    pool->hash_entries = RTE_MAX(nb_maps * 2, LPORT_HASH_MIN_ENTRIES);
+    pool->hash = lport_hash_create(pool, pool->hash_entries);
+    if (pool->hash == NULL) {
+        RTE_LOG(ERR, USER1, "%s(): Create lport hash (%s) failed, %s.\n",
+                __func__, name, rte_strerror(rte_errno));
+        return -1;
+    }
+
+    pool->maps = rte_zmalloc_socket(NULL, nb_maps * sizeof(pool->maps[0]),
+                                    RTE_CACHE_LINE_SIZE, socket_id);
+    if (pool->maps == NULL) {
+        RTE_LOG(ERR, USER1, "%s(): Alloc memory for lport maps failed.\n",
+                __func__);
+        return -1;
+    }
+
+    SLIST_INIT(&pool->free_maps);
+    for (i = 0; i < nb_maps; i++)
+        SLIST_INSERT_HEAD(&pool->free_maps, &pool->maps[i], next);
+
+    pool->min = min;
+    pool->max = max;
+    return 0;
+}
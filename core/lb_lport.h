@@ -0,0 +1,75 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_LPORT_H__
+#define __LB_LPORT_H__
+
+#include <sys/queue.h>
+
+#include <rte_hash.h>
+
+/*
+ * Local port allocator. A local port only has to be unique per
+ * (lip, rip, rport), the key of the reply direction in the conn table, so
+ * every backend of a local address gets its own port bitmap. A set bit is
+ * a free port, two summary levels find the next free port with three
+ * ctz, whatever the fill of the bitmap. Bitmaps are created on the first
+ * conn to a backend and released with its last conn. Once the preallocated
+ * bitmaps are in use, more are allocated and the hash grows, on the slow
+ * path of the owning lcore.
+ */
+
+#define LB_LPORT_WORDS (65536 / 64)
+#define LB_LPORT_SUMMARY_WORDS (LB_LPORT_WORDS / 64)
+
+struct lb_lport_key {
+    uint32_t lip;
+    uint32_t rip;
+    uint16_t rport;
+    uint16_t pad;
+};
+
+struct lb_lport_map {
+    SLIST_ENTRY(lb_lport_map) next;
+    struct lb_lport_key key;
+    uint32_t nb_used;
+    /* Bit i: summary[i] is not zero. */
+    uint64_t top;
+    /* Bit j of summary[i]: bits[i * 64 + j] is not zero. */
+    uint64_t summary[LB_LPORT_SUMMARY_WORDS];
+    uint64_t bits[LB_LPORT_WORDS];
+};
+
+/* Per device, lcore and protocol, only used by the owning lcore. */
+struct lb_lport_pool {
+    struct rte_hash *hash;
+    uint32_t hash_entries;
+    uint32_t hash_gen;
+    char name[RTE_HASH_NAMESIZE];
+    int socket_id;
+    struct lb_lport_map *maps;
+    SLIST_HEAD(, lb_lport_map) free_maps;
+    /* Port range, host byte order, max excluded. */
+    uint16_t min, max;
+    /*
+     * Set when replies are steered by RSS, a port is only handed out when
+     * the reply tuple (rip, lip, rport, lport) hashes to rxq.
+     */
+    const uint8_t *rss_key;
+    const uint32_t *rss_lport;
+    /* Bit j of rss_words[i]: reta[i ^ rss_lport[j]] is rxq. */
+    uint64_t *rss_words;
+    uint16_t reta_mask;
+};
+
+int lb_lport_pool_init(struct lb_lport_pool *pool, const char *name,
+                       uint32_t nb_maps, uint16_t min, uint16_t max,
+                       int socket_id);
+int lb_lport_pool_rss_set(struct lb_lport_pool *pool, const uint8_t *rss_key,
+                          const uint32_t *rss_lport, const uint16_t *reta,
+                          uint16_t reta_size, uint16_t rxq);
+int lb_lport_get(struct lb_lport_pool *pool, uint32_t lip, uint32_t rip,
+                 uint16_t rport, uint16_t cursor, uint16_t *lport);
+void lb_lport_put(struct lb_lport_pool *pool, uint32_t lip, uint32_t rip,
+                  uint16_t rport, uint16_t lport);
+
+#endif
@@ -0,0 +1,823 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <rte_arp.h>
+#include <rte_atomic.h>
+#include <rte_byteorder.h>
+#include <rte_cycles.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_launch.h>
+#include <rte_lcore.h>
+#include <rte_log.h>
+#include <rte_malloc.h>
+#include <rte_mbuf.h>
+#include <rte_tcp.h>
+
+#include <conhash.h>
+
+#include "lb_arp.h"
+#include "lb_clock.h"
+#include "lb_conn.h"
+#include "lb_device.h"
+#include "lb_microbench.h"
+#include "lb_proto.h"
+#include "lb_scheduler.h"
+#include "lb_service.h"
+#include "lb_synproxy.h"
+#include "lb_tcp_secret_seq.h"
+
+/*
+ * Ops are timed in batches. Warm runs cycle through MB_WARM_KEYS keys
+ * without touching anything else. Cold runs draw their keys from
+ * MB_COLD_KEYS and write a buffer larger than the LLC before each batch,
+ * so a batch starts with none of its data cached.
+ */
+#define MB_BATCH 64
+#define MB_WARM_OPS (1 << 18)
+#define MB_COLD_OPS (MB_BATCH * 256)
+#define MB_WARM_KEYS 64
+#define MB_COLD_KEYS (1 << 16)
+#define MB_EVICT_SIZE (32 << 20)
+#define MB_MAX_OPS 3
+
+#define MB_CIP(k) rte_cpu_to_be_32(IPv4(100, 64, 0, 0) + (k))
+#define MB_CPORT(k) rte_cpu_to_be_16(1024 + ((k)&0x7fff))
+#define MB_VIP rte_cpu_to_be_32(IPv4(10, 0, 0, 1))
+#define MB_VPORT rte_cpu_to_be_16(80)
+#define MB_RIP(k) rte_cpu_to_be_32(IPv4(192, 168, 0, 1) + (k))
+#define MB_RPORT rte_cpu_to_be_16(8080)
+#define MB_ARP_IP(k) rte_cpu_to_be_32(IPv4(10, 128, 0, 0) + (k))
+
+/* Conns held in the table during cold runs, half of its size. */
+#define MB_CONN_FILL (MB_COLD_KEYS / 2)
+#define MB_CONN_TIMEOUT (60 * LB_CLOCK_HZ)
+
+/* Backends holding a local port during cold lb_laddr_get() runs. */
+#define MB_LADDR_RIPS 256
+
+/* Neighbors in the ARP table, cold runs miss the per-lcore cache. */
+#define MB_ARP_ENTRIES 2048
+
+#define MB_CONHASH_REPLICAS 256
+
+struct mb_lcore {
+    uint32_t lcore_id;
+    int cold;
+    int rc;
+    uint64_t seed;
+    uint8_t *evict;
+    struct lb_conn_table *ct;
+    uint32_t keys[MB_BATCH];
+    uint64_t ops[MB_MAX_OPS];
+    uint64_t cycles[MB_MAX_OPS];
+} __rte_cache_aligned;
+
+struct mb_case {
+    const char *const *ops;
+    char tag[32];
+    int (*run)(struct mb_lcore *, void *);
+    void *arg;
+    int scale;
+};
+
+struct mb_vs {
+    struct lb_virt_service *vs;
+    struct lb_real_service *rss;
+};
+
+static struct mb_lcore mb_lcores[RTE_MAX_LCORE];
+static uint32_t mb_slaves[RTE_MAX_LCORE];
+static uint32_t mb_nb_slaves;
+static struct lb_device *mb_dev;
+static uint64_t mb_tsc_overhead;
+static rte_atomic32_t mb_ready;
+static volatile int mb_go;
+static volatile uint32_t mb_sink;
+
+static inline uint64_t
+mb_rand(struct mb_lcore *ml) {
+    uint64_t x = ml->seed;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    ml->seed = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+static inline uint32_t
+mb_nb_ops(struct mb_lcore *ml) {
+    return ml->cold ? MB_COLD_OPS : MB_WARM_OPS;
+}
+
+static void
+mb_keys_fill(struct mb_lcore *ml, uint32_t n) {
+    uint32_t i;
+
+    for (i = 0; i < MB_BATCH; i++) {
+        if (ml->cold)
+            ml->keys[i] = (uint32_t)(mb_rand(ml) >> 32) % MB_COLD_KEYS;
+        else
+            ml->keys[i] = (n + i) % MB_WARM_KEYS;
+    }
+}
+
+static void
+mb_evict(struct mb_lcore *ml) {
+    uint32_t i;
+
+    for (i = 0; i < MB_EVICT_SIZE; i += RTE_CACHE_LINE_SIZE)
+        ml->evict[i]++;
+}
+
+static inline uint64_t
+mb_begin(struct mb_lcore *ml) {
+    if (ml->cold)
+        mb_evict(ml);
+    return rte_rdtsc_precise();
+}
+
+static inline void
+mb_end(struct mb_lcore *ml, int op, uint64_t start, uint32_t n) {
+    uint64_t cycles = rte_rdtsc_precise() - start;
+
+    if (cycles > mb_tsc_overhead)
+        ml->cycles[op] += cycles - mb_tsc_overhead;
+    ml->ops[op] += n;
+}
+
+static uint64_t
+mb_tsc_overhead_get(void) {
+    uint64_t min = UINT64_MAX;
+    uint64_t t;
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        t = rte_rdtsc_precise();
+        t = rte_rdtsc_precise() - t;
+        if (t < min)
+            min = t;
+    }
+    return min;
+}
+
+/*
+ * Every lcore opens conns of its own table, finds them from the client
+ * side and expires them, a batch at a time. Cold runs do so in a table
+ * holding MB_CONN_FILL other conns.
+ */
+static int
+mb_conn_run(struct mb_lcore *ml, void *arg) {
+    struct lb_real_service *rs = arg;
+    struct lb_virt_service *vs = rs->virt_service;
+    struct lb_conn_table *ct = ml->ct;
+    struct lb_conn *conns[MB_BATCH];
+    struct lb_conn *found[MB_BATCH];
+    struct lb_conn *conn;
+    uint32_t nb_fill = ml->cold ? MB_CONN_FILL : 0;
+    uint32_t i, n, k;
+    uint64_t start;
+    uint8_t dir;
+    int rc = 0;
+
+    for (i = 0; i < nb_fill; i++) {
+        if (lb_conn_new(ct, MB_CIP(i), MB_CPORT(i), rs, 0, mb_dev) == NULL) {
+            nb_fill = i;
+            rc = -1;
+            goto done;
+        }
+    }
+
+    for (n = 0; n < mb_nb_ops(ml); n += MB_BATCH) {
+        for (i = 0; i < MB_BATCH; i++) {
+            if (ml->cold)
+                k = (n + i) % (MB_COLD_KEYS - MB_CONN_FILL);
+            else
+                k = i;
+            ml->keys[i] = nb_fill + k;
+        }
+
+        start = mb_begin(ml);
+        for (i = 0; i < MB_BATCH; i++) {
+            k = ml->keys[i];
+            conns[i] = lb_conn_new(ct, MB_CIP(k), MB_CPORT(k), rs, 0, mb_dev);
+        }
+        mb_end(ml, 0, start, MB_BATCH);
+
+        start = mb_begin(ml);
+        for (i = 0; i < MB_BATCH; i++) {
+            k = ml->keys[i];
+            found[i] = lb_conn_find(ct, MB_CIP(k), vs->vip, MB_CPORT(k),
+                                    vs->vport, &dir);
+        }
+        mb_end(ml, 1, start, MB_BATCH);
+
+        for (i = 0; i < MB_BATCH; i++) {
+            if (conns[i] == NULL || found[i] != conns[i])
+                rc = -1;
+        }
+        if (rc < 0) {
+            for (i = 0; i < MB_BATCH; i++) {
+                if (conns[i] != NULL)
+                    lb_conn_expire(ct, conns[i]);
+            }
+            break;
+        }
+
+        start = mb_begin(ml);
+        for (i = 0; i < MB_BATCH; i++)
+            lb_conn_expire(ct, conns[i]);
+        mb_end(ml, 2, start, MB_BATCH);
+    }
+
+done:
+    for (i = 0; i < nb_fill; i++) {
+        conn = lb_conn_find(ct, MB_CIP(i), vs->vip, MB_CPORT(i), vs->vport,
+                            &dir);
+        if (conn != NULL)
+            lb_conn_expire(ct, conn);
+    }
+    return rc;
+}
+
+static int
+mb_dispatch_run(struct mb_lcore *ml, void *arg) {
+    struct lb_virt_service *vs = arg;
+    struct lb_real_service *rs;
+    uint32_t i, n, k;
+    uint64_t start;
+    int rc = 0;
+
+    for (n = 0; n < mb_nb_ops(ml); n += MB_BATCH) {
+        mb_keys_fill(ml, n);
+        start = mb_begin(ml);
+        for (i = 0; i < MB_BATCH; i++) {
+            k = ml->keys[i];
+            rs = vs->sched->dispatch(vs, MB_CIP(k), MB_CPORT(k));
+            if (rs == NULL)
+                rc = -1;
+        }
+        mb_end(ml, 0, start, MB_BATCH);
+    }
+    return rc;
+}
+
+/* Keyed like the conhash ipport scheduler that Maglev replaced. */
+static int
+mb_conhash_run(struct mb_lcore *ml, void *arg) {
+    struct conhash_s *conhash = arg;
+    uint64_t key;
+    uint32_t i, n, k;
+    uint64_t start;
+    int rc = 0;
+
+    for (n = 0; n < mb_nb_ops(ml); n += MB_BATCH) {
+        mb_keys_fill(ml, n);
+        start = mb_begin(ml);
+        for (i = 0; i < MB_BATCH; i++) {
+            k = ml->keys[i];
+            key = ((uint64_t)MB_CIP(k) << 32) | ((uint64_t)MB_CPORT(k) << 16);
+            if (conhash_lookup(conhash, (const char *)&key, sizeof(key)) ==
+                NULL)
+                rc = -1;
+        }
+        mb_end(ml, 0, start, MB_BATCH);
+    }
+    return rc;
+}
+
+static int
+mb_synproxy_run(struct mb_lcore *ml, __attribute__((unused)) void *arg) {
+    struct ipv4_hdr iph[MB_BATCH];
+    struct tcp_hdr th[MB_BATCH];
+    uint32_t cookies[MB_BATCH];
+    struct synproxy_options opts, chk;
+    uint32_t i, n, k, seq;
+    uint32_t valid;
+    uint64_t start;
+    int rc = 0;
+
+    memset(iph, 0, sizeof(iph));
+    memset(th, 0, sizeof(th));
+    memset(&opts, 0, sizeof(opts));
+    opts.mss_clamp = 1460;
+    opts.sack_ok = 1;
+    opts.tstamp_ok = 1;
+    opts.wscale_ok = 1;
+    opts.snd_wscale = 7;
+
+    for (n = 0; n < mb_nb_ops(ml); n += MB_BATCH) {
+        mb_keys_fill(ml, n);
+        for (i = 0; i < MB_BATCH; i++) {
+            k = ml->keys[i];
+            iph[i].src_addr = MB_CIP(k);
+            iph[i].dst_addr = MB_VIP;
+            th[i].src_port = MB_CPORT(k);
+            th[i].dst_port = MB_VPORT;
+            th[i].sent_seq = rte_cpu_to_be_32(k * 2654435761U);
+        }
+
+        start = mb_begin(ml);
+        for (i = 0; i < MB_BATCH; i++)
+            cookies[i] =
+                synproxy_cookie_ipv4_init_sequence(&iph[i], &th[i], &opts);
+        mb_end(ml, 0, start, MB_BATCH);
+
+        /* The ACK completing the handshake. */
+        for (i = 0; i < MB_BATCH; i++) {
+            seq = rte_be_to_cpu_32(th[i].sent_seq);
+            th[i].sent_seq = rte_cpu_to_be_32(seq + 1);
+            th[i].recv_ack = rte_cpu_to_be_32(cookies[i] + 1);
+        }
+
+        valid = 0;
+        start = mb_begin(ml);
+        for (i = 0; i < MB_BATCH; i++)
+            valid += synproxy_cookie_ipv4_check(&iph[i], &th[i], &chk);
+        mb_end(ml, 1, start, MB_BATCH);
+        if (valid != MB_BATCH)
+            rc = -1;
+    }
+    return rc;
+}
+
+static int
+mb_tcp_secret_run(struct mb_lcore *ml, __attribute__((unused)) void *arg) {
+    uint32_t i, n, k;
+    uint32_t sum = 0;
+    uint64_t start;
+
+    for (n = 0; n < mb_nb_ops(ml); n += MB_BATCH) {
+        mb_keys_fill(ml, n);
+        start = mb_begin(ml);
+        for (i = 0; i < MB_BATCH; i++) {
+            k = ml->keys[i];
+            sum += tcp_secret_new_seq(MB_CIP(k), MB_VIP, MB_CPORT(k),
+                                      MB_VPORT);
+        }
+        mb_end(ml, 0, start, MB_BATCH);
+    }
+    mb_sink = sum;
+    return 0;
+}
+
+/*
+ * Gets and puts local ports towards one backend, or towards one of
+ * MB_LADDR_RIPS when cold. Every backend keeps a port for the whole run,
+ * so its bitmap is not released by the puts.
+ */
+static int
+mb_laddr_run(struct mb_lcore *ml, __attribute__((unused)) void *arg) {
+    struct lb_laddr *held_laddrs[MB_LADDR_RIPS];
+    uint16_t held_ports[MB_LADDR_RIPS];
+    struct lb_laddr *laddrs[MB_BATCH];
+    uint16_t ports[MB_BATCH];
+    uint32_t nb_rips = ml->cold ? MB_LADDR_RIPS : 1;
+    uint32_t nb_held, nb_got;
+    uint32_t i, n, r;
+    uint64_t start;
+    int rc = 0;
+
+    for (nb_held = 0; nb_held < nb_rips; nb_held++) {
+        if (lb_laddr_get(mb_dev, LB_IPPROTO_TCP, MB_RIP(nb_held), MB_RPORT,
+                         &held_laddrs[nb_held], &held_ports[nb_held]) < 0) {
+            rc = -1;
+            goto done;
+        }
+    }
+
+    for (n = 0; n < mb_nb_ops(ml); n += MB_BATCH) {
+        mb_keys_fill(ml, n);
+        nb_got = 0;
+        start = mb_begin(ml);
+        for (i = 0; i < MB_BATCH; i++) {
+            r = ml->keys[i] % nb_rips;
+            if (lb_laddr_get(mb_dev, LB_IPPROTO_TCP, MB_RIP(r), MB_RPORT,
+                             &laddrs[i], &ports[i]) < 0)
+                break;
+            nb_got++;
+        }
+        mb_end(ml, 0, start, nb_got);
+
+        start = mb_begin(ml);
+        for (i = 0; i < nb_got; i++) {
+            r = ml->keys[i] % nb_rips;
+            lb_laddr_put(laddrs[i], MB_RIP(r), MB_RPORT, ports[i],
+                         LB_IPPROTO_TCP);
+        }
+        mb_end(ml, 1, start, nb_got);
+
+        if (nb_got != MB_BATCH) {
+            rc = -1;
+            break;
+        }
+    }
+
+done:
+    for (i = 0; i < nb_held; i++)
+        lb_laddr_put(held_laddrs[i], MB_RIP(i), MB_RPORT, held_ports[i],
+                     LB_IPPROTO_TCP);
+    return rc;
+}
+
+/*
+ * The warm neighbors fit the per-lcore cache, cold lookups mostly miss it
+ * and go to the shared table under its read lock.
+ */
+static int
+mb_arp_run(struct mb_lcore *ml, __attribute__((unused)) void *arg) {
+    struct ether_addr mac;
+    uint32_t i, n;
+    uint64_t start;
+    int rc = 0;
+
+    for (n = 0; n < mb_nb_ops(ml); n += MB_BATCH) {
+        mb_keys_fill(ml, n);
+        start = mb_begin(ml);
+        for (i = 0; i < MB_BATCH; i++) {
+            if (lb_arp_find(MB_ARP_IP(ml->keys[i] % MB_ARP_ENTRIES), &mac,
+                            mb_dev) < 0)
+                rc = -1;
+        }
+        mb_end(ml, 0, start, MB_BATCH);
+    }
+    return rc;
+}
+
+static int
+mb_lcore_main(void *arg) {
+    struct mb_case *c = arg;
+    struct mb_lcore *ml = &mb_lcores[rte_lcore_id()];
+
+    rte_atomic32_inc(&mb_ready);
+    while (!mb_go)
+        rte_pause();
+    ml->rc = c->run(ml, c->arg);
+    return 0;
+}
+
+static void
+mb_case_print(struct mb_case *c, uint32_t nb_lcores) {
+    struct mb_lcore *ml;
+    char name[64];
+    double hz = rte_get_tsc_hz();
+    double ns, rate;
+    uint32_t i;
+    int op;
+
+    for (op = 0; op < MB_MAX_OPS && c->ops[op] != NULL; op++) {
+        ns = 0;
+        rate = 0;
+        for (i = 0; i < nb_lcores; i++) {
+            ml = &mb_lcores[mb_slaves[i]];
+            if (ml->ops[op] == 0 || ml->cycles[op] == 0)
+                continue;
+            ns += ml->cycles[op] * 1E9 / hz / ml->ops[op];
+            rate += ml->ops[op] * hz / ml->cycles[op];
+        }
+        snprintf(name, sizeof(name), "%s%s", c->ops[op], c->tag);
+        printf("%-36s %-5s %6u %10.1f %14.0f\n", name,
+               mb_lcores[mb_slaves[0]].cold ? "cold" : "warm", nb_lcores,
+               ns / nb_lcores, rate);
+    }
+}
+
+static int
+mb_case_run(struct mb_case *c, int cold, uint32_t nb_lcores) {
+    struct mb_lcore *ml;
+    uint32_t i;
+    int rc = 0;
+
+    for (i = 0; i < nb_lcores; i++) {
+        ml = &mb_lcores[mb_slaves[i]];
+        ml->cold = cold;
+        ml->rc = 0;
+        memset(ml->ops, 0, sizeof(ml->ops));
+        memset(ml->cycles, 0, sizeof(ml->cycles));
+    }
+
+    mb_go = 0;
+    rte_atomic32_set(&mb_ready, 0);
+    for (i = 0; i < nb_lcores; i++) {
+        if (rte_eal_remote_launch(mb_lcore_main, c, mb_slaves[i]) < 0) {
+            RTE_LOG(ERR, USER1, "%s(): Launch on lcore%u failed.\n",
+                    __func__, mb_slaves[i]);
+            nb_lcores = i;
+            rc = -1;
+            break;
+        }
+    }
+    while ((uint32_t)rte_atomic32_read(&mb_ready) < nb_lcores)
+        rte_pause();
+    mb_go = 1;
+
+    for (i = 0; i < nb_lcores; i++) {
+        rte_eal_wait_lcore(mb_slaves[i]);
+        if (mb_lcores[mb_slaves[i]].rc < 0) {
+            RTE_LOG(ERR, USER1, "%s(): %s%s failed on lcore%u.\n", __func__,
+                    c->ops[0], c->tag, mb_slaves[i]);
+            rc = -1;
+        }
+    }
+    if (rc == 0)
+        mb_case_print(c, nb_lcores);
+    return rc;
+}
+
+static int
+mb_case(struct mb_case *c) {
+    uint32_t nb = 1;
+
+    if (mb_case_run(c, 0, 1) < 0 || mb_case_run(c, 1, 1) < 0)
+        return -1;
+    if (!c->scale)
+        return 0;
+    while (nb < mb_nb_slaves) {
+        nb = RTE_MIN(nb * 2, mb_nb_slaves);
+        if (mb_case_run(c, 0, nb) < 0 || mb_case_run(c, 1, nb) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * A virt service with @nb_rs backends of weight 1 to 4. The scheduler
+ * tables are built from the whole list of real services, so one add call
+ * builds them for all of them.
+ */
+static int
+mb_vs_create(struct mb_vs *mv, const char *sched_name, uint32_t nb_rs) {
+    const struct lb_scheduler *sched;
+    struct lb_service_stats *stats;
+    struct lb_virt_service *vs;
+    struct lb_real_service *rs;
+    uint32_t socket_id = rte_socket_id();
+    uint32_t i;
+
+    memset(mv, 0, sizeof(*mv));
+    if (lb_scheduler_lookup_by_name(sched_name, &sched) < 0)
+        return -1;
+
+    vs = rte_zmalloc_socket("vs", sizeof(*vs), RTE_CACHE_LINE_SIZE,
+                            socket_id);
+    stats = rte_zmalloc_socket("vs", RTE_MAX_LCORE * sizeof(*stats),
+                               RTE_CACHE_LINE_SIZE, socket_id);
+    mv->rss = rte_zmalloc_socket("rs", nb_rs * sizeof(*rs),
+                                 RTE_CACHE_LINE_SIZE, socket_id);
+    if (vs == NULL || stats == NULL || mv->rss == NULL)
+        goto free;
+
+    vs->vip = MB_VIP;
+    vs->vport = MB_VPORT;
+    vs->proto = IPPROTO_TCP;
+    vs->max_conns = INT32_MAX;
+    vs->socket_id = socket_id;
+    vs->sched = sched;
+    vs->stats = stats;
+    rte_atomic32_set(&vs->refcnt, 1);
+    rte_rwlock_init(&vs->rwlock);
+    LIST_INIT(&vs->real_services);
+    if (sched->init && sched->init(vs) < 0)
+        goto free;
+    mv->vs = vs;
+
+    for (i = 0; i < nb_rs; i++) {
+        rs = &mv->rss[i];
+        rs->rip = MB_RIP(i);
+        rs->rport = MB_RPORT;
+        rs->proto = vs->proto;
+        rs->weight = 1 + i % 4;
+        rs->flags = LB_RS_F_AVAILABLE;
+        rs->virt_service = vs;
+        rs->stats = stats;
+        LIST_INSERT_HEAD(&vs->real_services, rs, next);
+    }
+    if (sched->add(vs, &mv->rss[0]) < 0) {
+        if (sched->fini)
+            sched->fini(vs);
+        goto free;
+    }
+    return 0;
+
+free:
+    mv->vs = NULL;
+    rte_free(mv->rss);
+    rte_free(stats);
+    rte_free(vs);
+    return -1;
+}
+
+static void
+mb_vs_free(struct mb_vs *mv) {
+    if (mv->vs == NULL)
+        return;
+    if (mv->vs->sched->fini)
+        mv->vs->sched->fini(mv->vs);
+    rte_free(mv->vs->stats);
+    rte_free(mv->vs);
+    rte_free(mv->rss);
+    mv->vs = NULL;
+}
+
+static struct conhash_s *
+mb_conhash_create(uint32_t nb_nodes, struct node_s **nodes) {
+    struct conhash_s *conhash;
+    char iden[8];
+    uint32_t i;
+
+    conhash = conhash_init(NULL);
+    *nodes = rte_zmalloc(NULL, nb_nodes * sizeof(struct node_s), 0);
+    if (conhash == NULL || *nodes == NULL) {
+        if (conhash != NULL)
+            conhash_fini(conhash);
+        rte_free(*nodes);
+        return NULL;
+    }
+    for (i = 0; i < nb_nodes; i++) {
+        snprintf(iden, sizeof(iden), "%u", i);
+        conhash_set_node(&(*nodes)[i], iden, MB_CONHASH_REPLICAS, NULL);
+        conhash_add_node(conhash, &(*nodes)[i]);
+    }
+    return conhash;
+}
+
+/* Resolve the MB_ARP_ENTRIES neighbors with forged ARP replies. */
+static int
+mb_arp_fill(void) {
+    struct rte_mbuf *m;
+    struct ether_hdr *eth;
+    struct arp_hdr *arph;
+    uint32_t i;
+
+    m = lb_device_pktmbuf_alloc(mb_dev);
+    if (m == NULL)
+        return -1;
+    eth = (struct ether_hdr *)rte_pktmbuf_append(
+        m, ETHER_HDR_LEN + sizeof(struct arp_hdr));
+    if (eth == NULL) {
+        rte_pktmbuf_free(m);
+        return -1;
+    }
+    memset(eth, 0, ETHER_HDR_LEN + sizeof(struct arp_hdr));
+    eth->ether_type = rte_cpu_to_be_16(ETHER_TYPE_ARP);
+    arph = (struct arp_hdr *)(eth + 1);
+    arph->arp_op = rte_cpu_to_be_16(ARP_OP_REPLY);
+    for (i = 0; i < MB_ARP_ENTRIES; i++) {
+        arph->arp_data.arp_sip = MB_ARP_IP(i);
+        arph->arp_data.arp_sha.addr_bytes[0] = 0x02;
+        arph->arp_data.arp_sha.addr_bytes[4] = i >> 8;
+        arph->arp_data.arp_sha.addr_bytes[5] = i & 0xff;
+        lb_arp_input(m, mb_dev);
+    }
+    rte_pktmbuf_free(m);
+    return 0;
+}
+
+static int
+mb_lcores_init(void) {
+    struct mb_lcore *ml;
+    uint32_t lcore_id, socket_id;
+
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        if (mb_dev->laddr_list[lcore_id].nb == 0) {
+            RTE_LOG(ERR, USER1, "%s(): No local address on lcore%u.\n",
+                    __func__, lcore_id);
+            return -1;
+        }
+
+        socket_id = rte_lcore_to_socket_id(lcore_id);
+        ml = &mb_lcores[lcore_id];
+        ml->lcore_id = lcore_id;
+        ml->seed = 0x9e3779b97f4a7c15ULL * (lcore_id + 1);
+        ml->evict = rte_zmalloc_socket(NULL, MB_EVICT_SIZE,
+                                       RTE_CACHE_LINE_SIZE, socket_id);
+        ml->ct = rte_zmalloc_socket(NULL, sizeof(*ml->ct),
+                                    RTE_CACHE_LINE_SIZE, socket_id);
+        if (ml->evict == NULL || ml->ct == NULL) {
+            RTE_LOG(ERR, USER1, "%s(): Alloc memory failed.\n", __func__);
+            return -1;
+        }
+        if (lb_conn_table_init(ml->ct, LB_IPPROTO_TCP, lcore_id,
+                               MB_CONN_TIMEOUT, MB_COLD_KEYS, NULL,
+                               NULL) < 0)
+            return -1;
+        mb_slaves[mb_nb_slaves++] = lcore_id;
+    }
+    return 0;
+}
+
+static const char *const mb_conn_ops[] = {"lb_conn_new", "lb_conn_find",
+                                          "lb_conn_expire"};
+static const char *const mb_dispatch_ops[] = {"dispatch", NULL};
+static const char *const mb_conhash_ops[] = {"conhash_lookup", NULL};
+static const char *const mb_synproxy_ops[] = {
+    "synproxy_cookie_ipv4_init_sequence", "synproxy_cookie_ipv4_check", NULL};
+static const char *const mb_tcp_secret_ops[] = {"tcp_secret_new_seq", NULL};
+static const char *const mb_laddr_ops[] = {"lb_laddr_get", "lb_laddr_put",
+                                           NULL};
+static const char *const mb_arp_ops[] = {"lb_arp_find", NULL};
+
+static const char *const mb_scheds[] = {"ipport", "iponly", "rr",
+                                        "wrr",    "lc",     "wlc"};
+static const uint32_t mb_backends[] = {10, 100, 1000};
+
+int
+lb_microbench_run(void) {
+    struct mb_case c;
+    struct mb_vs mv;
+    struct conhash_s *conhash;
+    struct node_s *nodes;
+    uint32_t i, j;
+    int rc;
+
+    mb_dev = lb_devices[0];
+    if (mb_dev == NULL || rte_lcore_count() < 2) {
+        RTE_LOG(ERR, USER1, "%s(): Needs a device and a worker lcore.\n",
+                __func__);
+        return -1;
+    }
+    if (mb_lcores_init() < 0 || mb_arp_fill() < 0) {
+        RTE_LOG(ERR, USER1, "%s(): Init failed.\n", __func__);
+        return -1;
+    }
+    mb_tsc_overhead = mb_tsc_overhead_get();
+
+    printf("%-36s %-5s %6s %10s %14s\n", "primitive", "cache", "lcores",
+           "ns/op", "ops/s");
+
+    memset(&c, 0, sizeof(c));
+    if (mb_vs_create(&mv, "rr", 1) < 0)
+        return -1;
+    c.ops = mb_conn_ops;
+    c.run = mb_conn_run;
+    c.arg = &mv.rss[0];
+    c.scale = 1;
+    rc = mb_case(&c);
+    mb_vs_free(&mv);
+    if (rc < 0)
+        return rc;
+
+    for (i = 0; i < RTE_DIM(mb_scheds); i++) {
+        for (j = 0; j < RTE_DIM(mb_backends); j++) {
+            if (mb_vs_create(&mv, mb_scheds[i], mb_backends[j]) < 0) {
+                RTE_LOG(ERR, USER1, "%s(): Create %s vs failed.\n",
+                        __func__, mb_scheds[i]);
+                return -1;
+            }
+            memset(&c, 0, sizeof(c));
+            c.ops = mb_dispatch_ops;
+            snprintf(c.tag, sizeof(c.tag), "/%s/%u", mb_scheds[i],
+                     mb_backends[j]);
+            c.run = mb_dispatch_run;
+            c.arg = mv.vs;
+            c.scale = mb_backends[j] == 100;
+            rc = mb_case(&c);
+            mb_vs_free(&mv);
+            if (rc < 0)
+                return rc;
+        }
+    }
+
+    for (j = 0; j < RTE_DIM(mb_backends); j++) {
+        conhash = mb_conhash_create(mb_backends[j], &nodes);
+        if (conhash == NULL)
+            return -1;
+        memset(&c, 0, sizeof(c));
+        c.ops = mb_conhash_ops;
+        snprintf(c.tag, sizeof(c.tag), "/%u", mb_backends[j]);
+        c.run = mb_conhash_run;
+        c.arg = conhash;
+        rc = mb_case(&c);
+        conhash_fini(conhash);
+        rte_free(nodes);
+        if (rc < 0)
+            return rc;
+    }
+
+    memset(&c, 0, sizeof(c));
+    c.ops = mb_synproxy_ops;
+    c.run = mb_synproxy_run;
+    if (mb_case(&c) < 0)
+        return -1;
+
+    memset(&c, 0, sizeof(c));
+    c.ops = mb_tcp_secret_ops;
+    c.run = mb_tcp_secret_run;
+    if (mb_case(&c) < 0)
+        return -1;
+
+    memset(&c, 0, sizeof(c));
+    c.ops = mb_laddr_ops;
+    c.run = mb_laddr_run;
+    if (mb_case(&c) < 0)
+        return -1;
+
+    memset(&c, 0, sizeof(c));
+    c.ops = mb_arp_ops;
+    c.run = mb_arp_run;
+    c.scale = 1;
+    return mb_case(&c);
+}
@@ -0,0 +1,15 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_MICROBENCH_H__
+#define __LB_MICROBENCH_H__
+
+/*
+ * jupiter-microbench is the bench build that, once initialized, times the
+ * hot primitives one at a time on the worker lcores instead of starting
+ * them. Every primitive runs with warm and with cold caches, the ones
+ * touching shared state also on more and more lcores. It prints ns/op and
+ * ops/s of each run.
+ */
+int lb_microbench_run(void);
+
+#endif
@@ -818,3 +818,25 @@ parse_ipv4_port(const char *token, uint32_t *ip, uint16_t *port)
 	return 0;
 }
 
+int
+parse_ipv4_prefix(const char *token, uint32_t *ip, uint8_t *depth)
+{
+	char *t, *p;
+
+	t = strdup(token);
+	if (t == NULL)
+		return -1;
+	p = strtok(t, "/");
+	if (!p || parse_ipv4_addr(p, (struct in_addr *)ip) < 0) {
+		free(t);
+		return -1;
+	}
+	p = strtok(NULL, "/");
+	if (!p || parser_read_uint8(depth, p) < 0 || *depth > 32) {
+		free(t);
+		return -1;
+	}
+	free(t);
+	return 0;
+}
+
@@ -89,6 +89,7 @@ int parse_pipeline_core(uint32_t *socket, uint32_t *core, uint32_t *ht,	const ch
 
 int str_split(char *str, const char *delim, char *tokens[], int limit);
 int parse_ipv4_port(const char *token, uint32_t *ip, uint16_t *port);
+int parse_ipv4_prefix(const char *token, uint32_t *ip, uint8_t *depth);
 
 static inline void
 mac_addr_tostring(struct ether_addr *addr, char *buf, size_t len)
@@ -0,0 +1,299 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <inttypes.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <rte_cycles.h>
+#include <rte_ethdev.h>
+#include <rte_interrupts.h>
+#include <rte_lcore.h>
+#include <rte_log.h>
+#include <rte_power.h>
+
+#include <unixctl_command.h>
+
+#include "lb_config.h"
+#include "lb_device.h"
+#include "lb_format.h"
+#include "lb_power.h"
+#include "lb_rcu.h"
+
+/* Consecutive empty polls before pausing, per frequency step, to sleep. */
+#define POWER_PAUSE_POLLS 16
+#define POWER_FREQ_DOWN_POLLS 1024
+#define POWER_SLEEP_POLLS 4096
+
+#define POWER_MAX_RXQ RTE_MAX_ETHPORTS
+#define POWER_MAX_EVENTS 8
+
+struct power_lcore {
+    int enabled;
+    int freq_scaling;
+    uint32_t empty_polls;
+    /* Frequency steps below the max. */
+    uint32_t freq_steps;
+    int timer_fd;
+    struct rte_epoll_event timer_ev;
+    uint16_t nb_rxq;
+    /* Inputs without interrupts, polled within the latency budget. */
+    uint32_t nb_polled;
+    struct {
+        uint16_t port_id;
+        uint16_t rxq_id;
+    } rxq[POWER_MAX_RXQ];
+    uint64_t pauses;
+    uint64_t sleeps;
+    uint64_t rx_wakeups;
+    uint64_t sleep_cycles;
+} __rte_cache_aligned;
+
+int lb_power_adaptive;
+static uint64_t power_latency;
+static struct power_lcore power_lcores[RTE_MAX_LCORE];
+
+int
+lb_power_init(struct lb_power_conf *conf) {
+    lb_power_adaptive = conf->mode == LB_POWER_ADAPTIVE;
+    power_latency = conf->latency_us * (rte_get_tsc_hz() / US_PER_S);
+    if (lb_power_adaptive) {
+        RTE_LOG(INFO, USER1, "%s(): Adaptive polling, latency %uus.\n",
+                __func__, conf->latency_us);
+    }
+    return 0;
+}
+
+static void
+power_timer_cb(int fd, __attribute__((unused)) void *arg) {
+    uint64_t expirations;
+
+    if (read(fd, &expirations, sizeof(expirations)) < 0)
+        return;
+}
+
+int
+lb_power_lcore_init(void) {
+    uint32_t lcore_id = rte_lcore_id();
+    struct power_lcore *pl = &power_lcores[lcore_id];
+
+    if (rte_power_init(lcore_id) == 0) {
+        pl->freq_scaling = 1;
+    } else {
+        RTE_LOG(WARNING, USER1, "%s(): No frequency scaling on lcore%u.\n",
+                __func__, lcore_id);
+    }
+
+    pl->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (pl->timer_fd < 0) {
+        RTE_LOG(ERR, USER1, "%s(): Create timerfd on lcore%u failed, %s.\n",
+                __func__, lcore_id, strerror(errno));
+        return -1;
+    }
+    pl->timer_ev.epdata.event = EPOLLIN;
+    pl->timer_ev.epdata.cb_fun = power_timer_cb;
+    if (rte_epoll_ctl(RTE_EPOLL_PER_THREAD, EPOLL_CTL_ADD, pl->timer_fd,
+                      &pl->timer_ev) < 0) {
+        RTE_LOG(ERR, USER1, "%s(): Add timerfd on lcore%u failed.\n",
+                __func__, lcore_id);
+        close(pl->timer_fd);
+        return -1;
+    }
+    pl->enabled = 1;
+    return 0;
+}
+
+void
+lb_power_rxq_add(uint16_t port_id, uint16_t rxq_id) {
+    struct power_lcore *pl = &power_lcores[rte_lcore_id()];
+
+    if (rte_eth_dev_rx_intr_ctl_q(port_id, rxq_id, RTE_EPOLL_PER_THREAD,
+                                  RTE_INTR_EVENT_ADD, NULL) < 0) {
+        RTE_LOG(WARNING, USER1,
+                "%s(): No rx interrupt on port%u rxq%u, it is polled "
+                "within the latency budget.\n",
+                __func__, port_id, rxq_id);
+        pl->nb_polled++;
+        return;
+    }
+    pl->rxq[pl->nb_rxq].port_id = port_id;
+    pl->rxq[pl->nb_rxq].rxq_id = rxq_id;
+    pl->nb_rxq++;
+}
+
+void
+lb_power_polled_add(uint32_t n) {
+    power_lcores[rte_lcore_id()].nb_polled += n;
+}
+
+void
+lb_power_lcore_exit(void) {
+    uint32_t lcore_id = rte_lcore_id();
+    struct power_lcore *pl = &power_lcores[lcore_id];
+
+    if (!pl->enabled)
+        return;
+    rte_epoll_ctl(RTE_EPOLL_PER_THREAD, EPOLL_CTL_DEL, pl->timer_fd,
+                  &pl->timer_ev);
+    close(pl->timer_fd);
+    if (pl->freq_scaling)
+        rte_power_exit(lcore_id);
+    pl->enabled = 0;
+}
+
+void
+lb_power_rx(uint32_t n) {
+    uint32_t lcore_id = rte_lcore_id();
+    struct power_lcore *pl = &power_lcores[lcore_id];
+
+    if (n == 0) {
+        pl->empty_polls++;
+        if (pl->freq_scaling && pl->empty_polls % POWER_FREQ_DOWN_POLLS == 0 &&
+            rte_power_freq_down(lcore_id) == 1)
+            pl->freq_steps++;
+        return;
+    }
+
+    pl->empty_polls = 0;
+    if (pl->freq_steps == 0)
+        return;
+    if (n >= PKT_MAX_BURST) {
+        rte_power_freq_max(lcore_id);
+        pl->freq_steps = 0;
+    } else if (rte_power_freq_up(lcore_id) == 1) {
+        pl->freq_steps--;
+    } else {
+        pl->freq_steps = 0;
+    }
+}
+
+/*
+ * Sleeps on the rx interrupts and the timerfd until @wake_tsc, offline so
+ * that writers don't wait for the sleeper. Returns nonzero if packets woke it.
+ */
+static int
+power_sleep(struct power_lcore *pl, uint64_t wake_tsc) {
+    struct rte_epoll_event events[POWER_MAX_EVENTS];
+    uint32_t lcore_id = rte_lcore_id();
+    struct itimerspec its;
+    uint64_t now, ns;
+    int i, n;
+
+    now = rte_rdtsc();
+    if (wake_tsc <= now)
+        return 0;
+    ns = (wake_tsc - now) * NS_PER_S / rte_get_tsc_hz();
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = ns / NS_PER_S;
+    its.it_value.tv_nsec = ns % NS_PER_S;
+    if (timerfd_settime(pl->timer_fd, 0, &its, NULL) < 0)
+        return 0;
+
+    for (i = 0; i < pl->nb_rxq; i++)
+        rte_eth_dev_rx_intr_enable(pl->rxq[i].port_id, pl->rxq[i].rxq_id);
+    lb_rcu_offline(lcore_id);
+    n = rte_epoll_wait(RTE_EPOLL_PER_THREAD, events, POWER_MAX_EVENTS, -1);
+    lb_rcu_online(lcore_id);
+    for (i = 0; i < pl->nb_rxq; i++)
+        rte_eth_dev_rx_intr_disable(pl->rxq[i].port_id, pl->rxq[i].rxq_id);
+
+    pl->sleeps++;
+    pl->sleep_cycles += rte_rdtsc() - now;
+    for (i = 0; i < n; i++) {
+        if (events[i].fd != pl->timer_fd) {
+            pl->rx_wakeups++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int
+lb_power_idle(uint64_t deadline, uint64_t sleep_deadline) {
+    struct power_lcore *pl = &power_lcores[rte_lcore_id()];
+    uint64_t now;
+
+    if (pl->empty_polls < POWER_PAUSE_POLLS)
+        return 0;
+
+    now = rte_rdtsc();
+    if (pl->empty_polls < POWER_SLEEP_POLLS) {
+        pl->pauses++;
+        deadline = RTE_MIN(deadline, now + power_latency);
+        while (rte_rdtsc() < deadline)
+            rte_pause();
+        return 0;
+    }
+    /* The rx interrupts stand in for the rx, redirect and tx polls. */
+    if (pl->nb_polled == 0)
+        return power_sleep(pl, sleep_deadline);
+    return power_sleep(pl, RTE_MIN(sleep_deadline, now + power_latency));
+}
+
+static void
+power_stats_normal(int fd) {
+    struct power_lcore *pl;
+    uint32_t lcore_id;
+
+    unixctl_command_reply(fd, "%-8s  %-12s  %-10s  %-12s  %-12s  %-12s  %s\n",
+                          "lcore", "empty-polls", "freq-down", "pauses",
+                          "sleeps", "rx-wakeups", "sleep(ms)");
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        pl = &power_lcores[lcore_id];
+        if (!pl->enabled)
+            continue;
+        unixctl_command_reply(fd,
+                              "%-8u  %-12u  %-10u  %-12" PRIu64 "  %-12" PRIu64
+                              "  %-12" PRIu64 "  %" PRIu64 "\n",
+                              lcore_id, pl->empty_polls, pl->freq_steps,
+                              pl->pauses, pl->sleeps, pl->rx_wakeups,
+                              pl->sleep_cycles * MS_PER_S / rte_get_tsc_hz());
+    }
+}
+
+static void
+power_stats_json(int fd) {
+    struct power_lcore *pl;
+    uint32_t lcore_id;
+    uint8_t json_first_obj = 1;
+
+    unixctl_command_reply(fd, "[");
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        pl = &power_lcores[lcore_id];
+        if (!pl->enabled)
+            continue;
+        unixctl_command_reply(fd, json_first_obj ? "{" : ",{");
+        json_first_obj = 0;
+        unixctl_command_reply(fd, JSON_KV_32_FMT("lcore", ","), lcore_id);
+        unixctl_command_reply(fd, JSON_KV_32_FMT("empty-polls", ","),
+                              pl->empty_polls);
+        unixctl_command_reply(fd, JSON_KV_32_FMT("freq-down", ","),
+                              pl->freq_steps);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("pauses", ","), pl->pauses);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("sleeps", ","), pl->sleeps);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("rx-wakeups", ","),
+                              pl->rx_wakeups);
+        unixctl_command_reply(fd, JSON_KV_64_FMT("sleep-cycles", "}"),
+                              pl->sleep_cycles);
+    }
+    unixctl_command_reply(fd, "]\n");
+}
+
+static void
+power_stats_cmd_cb(int fd, char *argv[], int argc) {
+    if (!lb_power_adaptive) {
+        unixctl_command_reply_error(fd, "Adaptive polling is off.\n");
+    } else if (argc > 0 && strcmp(argv[0], "--json") == 0) {
+        power_stats_json(fd);
+    } else if (argc > 0) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[0]);
+    } else {
+        power_stats_normal(fd);
+    }
+}
+
+UNIXCTL_CMD_REGISTER("power/stats", "[--json].",
+                     "Show empty polls, frequency steps and sleeps of the "
+                     "workers.",
+                     0, 1, power_stats_cmd_cb);
@@ -0,0 +1,35 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_POWER_H__
+#define __LB_POWER_H__
+
+#include <stdint.h>
+
+struct lb_power_conf;
+
+/*
+ * Adaptive polling of the worker lcores. After consecutive empty polls a
+ * worker pauses between polls and steps its frequency down, then sleeps
+ * on the rx interrupts of its queues. A sleep ends at an interrupt or at
+ * the next due timer. A worker which also polls inputs without interrupts,
+ * redirect rings or queues whose interrupt failed, wakes up after the
+ * latency budget at the latest.
+ */
+
+extern int lb_power_adaptive;
+
+int lb_power_init(struct lb_power_conf *conf);
+
+/* Sets up the calling worker, then its rx queues are added one by one. */
+int lb_power_lcore_init(void);
+void lb_power_rxq_add(uint16_t port_id, uint16_t rxq_id);
+/* Accounts @n redirect rings or other inputs without interrupts. */
+void lb_power_polled_add(uint32_t n);
+void lb_power_lcore_exit(void);
+
+/* Accounts a poll which received @n packets on all queues. */
+void lb_power_rx(uint32_t n);
+
+int lb_power_idle(uint64_t deadline, uint64_t sleep_deadline);
+
+#endif
@@ -29,13 +29,15 @@ struct lb_proto {
     uint8_t id;
     enum lb_proto_type type;
     int (*init)(void);
-    int (*fullnat_handle)(struct rte_mbuf *, struct ipv4_hdr *,
-                          struct lb_device *dev);
+    /* Handles a burst of unfragmented IPv4 packets of this protocol. */
+    void (*fullnat_handle_burst)(struct rte_mbuf **, uint16_t,
+                                 struct lb_device *dev);
 };
 
 #define IPv4_HLEN(iph) (((iph)->version_ihl & IPV4_HDR_IHL_MASK) << 2)
 #define TCP_HDR(iph) (struct tcp_hdr *)((char *)(iph) + IPv4_HLEN(iph))
 #define UDP_HDR(iph) (struct udp_hdr *)((char *)(iph) + IPv4_HLEN(iph))
+#define TCP_HLEN(th) ((th)->data_off >> 2)
 
 #define SYN(th) ((th)->tcp_flags & TCP_SYN_FLAG)
 #define ACK(th) ((th)->tcp_flags & TCP_ACK_FLAG)
@@ -2,20 +2,19 @@
 
 #include <rte_icmp.h>
 #include <rte_ip.h>
-#include <rte_ip_frag.h>
 #include <rte_mbuf.h>
 
 #include "lb_device.h"
 #include "lb_proto.h"
 #include "lb_service.h"
 
+/* Reassembled echo requests span several segments. */
 static uint32_t
-icmp_cksum(const struct ipv4_hdr *iph, const struct icmp_hdr *icmph) {
-    uint16_t cksum;
-    size_t len;
+icmp_cksum(const struct rte_mbuf *m, const struct ipv4_hdr *iph) {
+    uint16_t cksum = 0;
 
-    len = rte_be_to_cpu_16(iph->total_length) - sizeof(struct ipv4_hdr);
-    cksum = rte_raw_cksum(icmph, len);
+    rte_raw_cksum_mbuf(m, ETHER_HDR_LEN + IPv4_HLEN(iph),
+                       lb_cksum_l4_len(iph), &cksum);
     return (cksum == 0xffff) ? cksum : ~cksum;
 }
 
@@ -25,11 +24,6 @@ icmp_fullnat_handle(struct rte_mbuf *m, struct ipv4_hdr *iph,
     struct icmp_hdr *icmph;
     uint32_t tmpaddr;
 
-    if (rte_ipv4_frag_pkt_is_fragmented(iph)) {
-        rte_pktmbuf_free(m);
-        return 0;
-    }
-
     if (!lb_is_vip_exist(iph->dst_addr) &&
         !lb_is_laddr_exist(iph->dst_addr, dev)) {
         rte_pktmbuf_free(m);
@@ -51,11 +45,24 @@ icmp_fullnat_handle(struct rte_mbuf *m, struct ipv4_hdr *iph,
 
     icmph->icmp_type = IP_ICMP_ECHO_REPLY;
     icmph->icmp_cksum = 0;
-    icmph->icmp_cksum = icmp_cksum(iph, icmph);
+    icmph->icmp_cksum = icmp_cksum(m, iph);
 
     return lb_device_output(m, iph, dev);
 }
 
+static void
+icmp_fullnat_handle_burst(struct rte_mbuf **pkts, uint16_t n,
+                          struct lb_device *dev) {
+    uint16_t i;
+
+    for (i = 0; i < n; i++) {
+        icmp_fullnat_handle(pkts[i],
+                            rte_pktmbuf_mtod_offset(pkts[i], struct ipv4_hdr *,
+                                                    ETHER_HDR_LEN),
+                            dev);
+    }
+}
+
 static int
 icmp_init(void) {
     return 0;
@@ -65,7 +72,7 @@ static struct lb_proto proto_icmp = {
     .id = IPPROTO_ICMP,
     .type = LB_IPPROTO_ICMP,
     .init = icmp_init,
-    .fullnat_handle = icmp_fullnat_handle,
+    .fullnat_handle_burst = icmp_fullnat_handle_burst,
 };
 
 LB_PROTO_REGISTER(proto_icmp);
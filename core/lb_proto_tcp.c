@@ -15,6 +15,8 @@
 #include "lb_conn.h"
 #include "lb_device.h"
 #include "lb_format.h"
+#include "lb_lcore.h"
+#include "lb_parser.h"
 #include "lb_proto.h"
 #include "lb_synproxy.h"
 #include "lb_tcp_secret_seq.h"
@@ -277,8 +279,8 @@ tcp_set_conntack_state(struct lb_conn *conn, struct tcp_hdr *th, int dir) {
         conn->flags |= LB_CONN_F_ACTIVE;
         rte_atomic32_add(&rs->active_conns, 1);
         rte_atomic32_add(&vs->active_conns, 1);
-        vs->stats[lcore_id].conns += 1;
-        rs->stats[lcore_id].conns += 1;
+        lb_service_stats_get(vs->stats, lcore_id)->conns += 1;
+        lb_service_stats_get(rs->stats, lcore_id)->conns += 1;
     } else if ((conn->flags & LB_CONN_F_ACTIVE) &&
                (new_state != TCP_CONNTRACK_ESTABLISHED)) {
         conn->flags &= ~LB_CONN_F_ACTIVE;
@@ -287,12 +289,10 @@ tcp_set_conntack_state(struct lb_conn *conn, struct tcp_hdr *th, int dir) {
     }
     if (new_state < TCP_CONNTRACK_MAX) {
         conn->state = new_state;
-        conn->timeout = tcp_timeouts[new_state];
-    }
-    if (new_state == TCP_CONNTRACK_ESTABLISHED) {
-        timeout = vs->est_timeout;
-        conn->timeout =
-            timeout != 0 ? timeout : tcp_timeouts[TCP_CONNTRACK_ESTABLISHED];
+        timeout = tcp_timeouts[new_state];
+        if (new_state == TCP_CONNTRACK_ESTABLISHED && vs->est_timeout != 0)
+            timeout = vs->est_timeout;
+        lb_conn_set_timeout(conn, timeout);
     }
 
     if (conn->state == TCP_CONNTRACK_CLOSE ||
@@ -314,18 +314,21 @@ static void
 tcp_set_packet_stats(struct lb_conn *conn, struct rte_mbuf *m, uint8_t dir) {
     struct lb_real_service *rs;
     struct lb_virt_service *vs;
+    struct lb_service_stats *vstats, *rstats;
     uint32_t cid;
 
     cid = rte_lcore_id();
     rs = conn->real_service;
     vs = rs->virt_service;
-    vs->stats[cid].bytes[dir] += m->pkt_len;
-    vs->stats[cid].packets[dir] += 1;
-    rs->stats[cid].bytes[dir] += m->pkt_len;
-    rs->stats[cid].packets[dir] += 1;
+    vstats = lb_service_stats_get(vs->stats, cid);
+    rstats = lb_service_stats_get(rs->stats, cid);
+    vstats->bytes[dir] += m->pkt_len;
+    vstats->packets[dir] += 1;
+    rstats->bytes[dir] += m->pkt_len;
+    rstats->packets[dir] += 1;
 }
 
-static void
+static uint32_t
 tcp_conn_timer_task_cb(struct lb_conn *conn) {
     struct rte_mbuf *mcopy;
     struct ipv4_hdr *iph;
@@ -345,8 +348,11 @@ tcp_conn_timer_task_cb(struct lb_conn *conn) {
                                               ETHER_HDR_LEN);
                 lb_device_output(mcopy, iph, conn->dev);
             }
+            /* Retransmit the SYN on the next tick. */
+            return 1;
         }
     }
+    return 0;
 }
 
 static int
@@ -460,8 +466,7 @@ tcp_response_rst(struct rte_mbuf *m, struct ipv4_hdr *iph, struct tcp_hdr *th,
     tmpaddr = iph->src_addr;
     iph->src_addr = iph->dst_addr;
     iph->dst_addr = tmpaddr;
-    iph->hdr_checksum = 0;
-    iph->hdr_checksum = rte_ipv4_cksum(iph);
+    lb_device_ipv4_cksum(m, iph, NULL, dev);
 
     if (ACK(th)) {
         seq = th->sent_seq;
@@ -488,8 +493,7 @@ tcp_response_rst(struct rte_mbuf *m, struct ipv4_hdr *iph, struct tcp_hdr *th,
     nth->tcp_flags = tcp_flags;
     nth->rx_win = 0;
     nth->tcp_urp = 0;
-    nth->cksum = 0;
-    nth->cksum = rte_ipv4_udptcp_cksum(iph, th);
+    lb_device_tcp_cksum(m, iph, nth, NULL, dev);
 
     lb_device_output(m, iph, dev);
 }
@@ -498,6 +502,8 @@ static int
 tcp_fullnat_recv_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
                         struct tcp_hdr *th, struct lb_conn_table *ct,
                         struct lb_conn *conn, struct lb_device *dev) {
+    struct lb_cksum_nat nat;
+
     if (conn != NULL) {
         if (conn->state == TCP_CONNTRACK_CLOSE) {
             tcp_response_rst(m, iph, th, dev);
@@ -549,6 +555,7 @@ tcp_fullnat_recv_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
         return 0;
     }
 
+    lb_cksum_nat_save(&nat, iph, th, TCP_HLEN(th));
     if (SYN(th)) {
         tcp_opt_remove_timestamp(th);
         tcp_secret_seq_init(conn->lip, conn->rip, conn->lport, conn->rport,
@@ -558,7 +565,7 @@ tcp_fullnat_recv_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
     if ((conn->flags & LB_CONN_F_TOA) &&
         (conn->state == TCP_CONNTRACK_SYN_RECV) && !SYN(th) && ACK(th) &&
         !RST(th) && !FIN(th))
-        tcp_opt_add_toa(m, iph, th, conn->cip, conn->cport);
+        tcp_opt_add_toa(m, &iph, &th, conn->cip, conn->cport, dev->mtu);
 
     tcp_set_conntack_state(conn, th, LB_DIR_ORIGINAL);
     tcp_set_packet_stats(conn, m, LB_DIR_ORIGINAL);
@@ -569,10 +576,8 @@ tcp_fullnat_recv_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
     th->dst_port = conn->rport;
     tcp_secret_seq_adjust_client(th, &conn->tseq);
     synproxy_seq_adjust_client(th, &conn->proxy);
-    iph->hdr_checksum = 0;
-    iph->hdr_checksum = rte_ipv4_cksum(iph);
-    th->cksum = 0;
-    th->cksum = rte_ipv4_udptcp_cksum(iph, th);
+    lb_device_ipv4_cksum(m, iph, &nat, dev);
+    lb_device_tcp_cksum(m, iph, th, &nat, dev);
 
     return lb_device_output(m, iph, dev);
 }
@@ -581,50 +586,81 @@ static int
 tcp_fullnat_recv_backend(struct rte_mbuf *m, struct ipv4_hdr *iph,
                          struct tcp_hdr *th, struct lb_conn *conn,
                          struct lb_device *dev) {
+    struct lb_cksum_nat nat;
+
     if (synproxy_recv_backend_synack(m, iph, th, conn, dev) == 0)
         return 0;
 
     tcp_set_conntack_state(conn, th, LB_DIR_REPLY);
     tcp_set_packet_stats(conn, m, LB_DIR_REPLY);
 
+    lb_cksum_nat_save(&nat, iph, th, TCP_HLEN(th));
     iph->src_addr = conn->vip;
     iph->dst_addr = conn->cip;
     th->src_port = conn->vport;
     th->dst_port = conn->cport;
     tcp_secret_seq_adjust_backend(th, &conn->tseq);
     synproxy_seq_adjust_backend(th, &conn->proxy);
-    iph->hdr_checksum = 0;
-    iph->hdr_checksum = rte_ipv4_cksum(iph);
-    th->cksum = 0;
-    th->cksum = rte_ipv4_udptcp_cksum(iph, th);
+    lb_device_ipv4_cksum(m, iph, &nat, dev);
+    lb_device_tcp_cksum(m, iph, th, &nat, dev);
 
     return lb_device_output(m, iph, dev);
 }
 
 static int
-tcp_fullnat_handle(struct rte_mbuf *m, struct ipv4_hdr *iph,
-                   struct lb_device *dev) {
+tcp_fullnat_handle_conn(struct rte_mbuf *m, struct ipv4_hdr *iph,
+                        struct tcp_hdr *th, struct lb_conn_table *ct,
+                        struct lb_conn *conn, uint8_t dir,
+                        struct lb_device *dev) {
+    if (dir == LB_DIR_REPLY) {
+        TCP_PRINT(IPv4_TCP_FMT " [REPLY]\n", IPv4_TCP_ARG(iph, th));
+        return tcp_fullnat_recv_backend(m, iph, th, conn, dev);
+    } else {
+        TCP_PRINT(IPv4_TCP_FMT " [ORIGINAL]\n", IPv4_TCP_ARG(iph, th));
+        return tcp_fullnat_recv_client(m, iph, th, ct, conn, dev);
+    }
+}
+
+static void
+tcp_fullnat_handle_burst(struct rte_mbuf **pkts, uint16_t n,
+                         struct lb_device *dev) {
+    struct ipv4_4tuple tuples[PKT_MAX_BURST] = {{0}};
+    struct lb_conn *conns[PKT_MAX_BURST];
+    uint8_t dirs[PKT_MAX_BURST];
     struct lb_conn_table *ct;
-    struct lb_conn *conn;
+    struct ipv4_hdr *iph;
     struct tcp_hdr *th;
-    uint8_t dir;
+    uint32_t gen;
+    uint16_t i;
 
     ct = &lb_conn_tbls[rte_lcore_id()];
-    th = TCP_HDR(iph);
+    for (i = 0; i < n; i++) {
+        iph = rte_pktmbuf_mtod_offset(pkts[i], struct ipv4_hdr *,
+                                      ETHER_HDR_LEN);
+        th = TCP_HDR(iph);
+        IPv4_4TUPLE(&tuples[i], iph->src_addr, th->src_port, iph->dst_addr,
+                    th->dst_port);
+    }
 
-    TCP_PRINT(IPv4_TCP_FMT " [NEW PACKET]\n", IPv4_TCP_ARG(iph, th));
+    gen = ct->gen;
+    lb_conn_find_bulk(ct, tuples, n, conns, dirs);
+    lb_lcore_stage(LB_STAGE_LOOKUP);
 
-    if (synproxy_recv_client_syn(m, iph, th, dev) == 0)
-        return 0;
+    for (i = 0; i < n; i++) {
+        iph = rte_pktmbuf_mtod_offset(pkts[i], struct ipv4_hdr *,
+                                      ETHER_HDR_LEN);
+        th = TCP_HDR(iph);
 
-    conn = lb_conn_find(ct, iph->src_addr, iph->dst_addr, th->src_port,
-                        th->dst_port, &dir);
-    if (dir == LB_DIR_REPLY) {
-        TCP_PRINT(IPv4_TCP_FMT " [REPLY]\n", IPv4_TCP_ARG(iph, th));
-        return tcp_fullnat_recv_backend(m, iph, th, conn, dev);
-    } else {
-        TCP_PRINT(IPv4_TCP_FMT " [ORIGINAL]\n", IPv4_TCP_ARG(iph, th));
-        return tcp_fullnat_recv_client(m, iph, th, ct, conn, dev);
+        TCP_PRINT(IPv4_TCP_FMT " [NEW PACKET]\n", IPv4_TCP_ARG(iph, th));
+
+        if (synproxy_recv_client_syn(pkts[i], iph, th, dev) == 0)
+            continue;
+
+        /* An earlier packet of the burst added or expired a conn. */
+        if (ct->gen != gen)
+            conns[i] = lb_conn_find(ct, iph->src_addr, iph->dst_addr,
+                                    th->src_port, th->dst_port, &dirs[i]);
+        tcp_fullnat_handle_conn(pkts[i], iph, th, ct, conns[i], dirs[i], dev);
     }
 }
 
@@ -656,43 +692,49 @@ static struct lb_proto proto_tcp = {
     .id = IPPROTO_TCP,
     .type = LB_IPPROTO_TCP,
     .init = tcp_fullnat_init,
-    .fullnat_handle = tcp_fullnat_handle,
+    .fullnat_handle_burst = tcp_fullnat_handle_burst,
 };
 
 LB_PROTO_REGISTER(proto_tcp);
 
+static void
+tcp_conn_dump_one(int fd, const struct lb_conn *conn) {
+    unixctl_command_reply(
+        fd,
+        "cip: " IPv4_BE_FMT ", cport: %u, "
+        "vip: " IPv4_BE_FMT ", vport: %u, "
+        "lip: " IPv4_BE_FMT ", lport: %u, "
+        "rip: " IPv4_BE_FMT ", rport: %u, "
+        "flags: 0x%x, state: %s, usetime:%u, timeout=%u\n",
+        IPv4_BE_ARG(conn->cip), rte_be_to_cpu_16(conn->cport),
+        IPv4_BE_ARG(conn->vip), rte_be_to_cpu_16(conn->vport),
+        IPv4_BE_ARG(conn->lip), rte_be_to_cpu_16(conn->lport),
+        IPv4_BE_ARG(conn->rip), rte_be_to_cpu_16(conn->rport),
+        conn->flags, tcp_conntrack_names[conn->state], conn->use_time,
+        conn->timeout);
+}
+
 static void
 tcp_conn_dump_cmd_cb(int fd, __attribute__((unused)) char *argv[],
                      __attribute__((unused)) int argc) {
-    uint32_t lcore_id;
-    struct lb_conn_table *ct;
-    struct lb_conn *conn;
-    void *tmp;
+    struct lb_conn conns[LB_CONN_WALK_BATCH];
+    struct lb_conn_walk walk;
+    uint32_t lcore_id, i, n;
 
     RTE_LCORE_FOREACH_SLAVE(lcore_id) {
-        ct = &lb_conn_tbls[lcore_id];
-        rte_spinlock_lock(&ct->spinlock);
-        for_each_conn_safe(conn, &ct->timeout_list, next, tmp) {
-            unixctl_command_reply(
-                fd,
-                "cip: " IPv4_BE_FMT ", cport: %u, "
-                "vip: " IPv4_BE_FMT ", vport: %u, "
-                "lip: " IPv4_BE_FMT ", lport: %u, "
-                "rip: " IPv4_BE_FMT ", rport: %u, "
-                "flags: 0x%x, state: %s, usetime:%u, timeout=%u\n",
-                IPv4_BE_ARG(conn->cip), rte_be_to_cpu_16(conn->cport),
-                IPv4_BE_ARG(conn->vip), rte_be_to_cpu_16(conn->vport),
-                IPv4_BE_ARG(conn->lip), rte_be_to_cpu_16(conn->lport),
-                IPv4_BE_ARG(conn->rip), rte_be_to_cpu_16(conn->rport),
-                conn->flags, tcp_conntrack_names[conn->state], conn->use_time,
-                conn->timeout);
+        memset(&walk, 0, sizeof(walk));
+        while ((n = lb_conn_table_walk(&lb_conn_tbls[lcore_id], &walk, conns,
+                                       LB_CONN_WALK_BATCH)) != 0) {
+            for (i = 0; i < n; i++)
+                tcp_conn_dump_one(fd, &conns[i]);
+            if (unixctl_command_flush(fd) < 0)
+                return;
         }
-        rte_spinlock_unlock(&ct->spinlock);
     }
 }
 
-UNIXCTL_CMD_REGISTER("tcp/conn/dump", "", "Dump TCP connections.", 0, 0,
-                     tcp_conn_dump_cmd_cb);
+UNIXCTL_CMD_REGISTER_STREAM("tcp/conn/dump", "", "Dump TCP connections.", 0, 0,
+                            tcp_conn_dump_cmd_cb);
 
 static void
 tcp_conn_stats_normal(int fd) {
@@ -755,4 +797,32 @@ tcp_conn_stats_cmd_cb(int fd, char *argv[], int argc) {
 
 UNIXCTL_CMD_REGISTER("tcp/conn/stats", "[--json].",
                      "Show the number of TCP connections.", 0, 1,
-                     tcp_conn_stats_cmd_cb);
\ No newline at end of file
+                     tcp_conn_stats_cmd_cb);
+
+static void
+tcp_max_expire_num_cmd_cb(int fd, char *argv[], int argc) {
+    uint32_t lcore_id;
+    uint32_t num;
+    int rc;
+
+    if (argc == 0) {
+        lcore_id = rte_get_next_lcore(-1, 1, 0);
+        unixctl_command_reply(fd, "%u\n",
+                              lb_conn_tbls[lcore_id].expire_budget);
+        return;
+    }
+
+    rc = parser_read_uint32(&num, argv[0]);
+    if (rc < 0 || num == 0) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[0]);
+        return;
+    }
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        lb_conn_tbls[lcore_id].expire_budget = num;
+    }
+}
+
+UNIXCTL_CMD_REGISTER_DATAPATH("tcp/max-expire-num", "[VALUE].",
+                              "Show or set max number of expired TCP "
+                              "connections per tick.",
+                              0, 1, tcp_max_expire_num_cmd_cb);
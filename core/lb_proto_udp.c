@@ -9,6 +9,8 @@
 #include "lb_clock.h"
 #include "lb_conn.h"
 #include "lb_format.h"
+#include "lb_lcore.h"
+#include "lb_parser.h"
 #include "lb_proto.h"
 
 #define UDP_MAX_CONN (1 << 20)
@@ -26,16 +28,18 @@ udp_set_conntrack_state(struct lb_conn *conn, __rte_unused struct udp_hdr *uh,
     if (dir == LB_DIR_ORIGINAL) {
         if (!(conn->flags & LB_CONN_F_ACTIVE)) {
             conn->flags |= LB_CONN_F_ACTIVE;
-            conn->timeout = vs->est_timeout ? vs->est_timeout : udp_timeout;
+            lb_conn_set_timeout(conn, vs->est_timeout ? vs->est_timeout
+                                                      : udp_timeout);
             rte_atomic32_add(&rs->active_conns, 1);
             rte_atomic32_add(&vs->active_conns, 1);
-            vs->stats[lcore_id].conns += 1;
-            rs->stats[lcore_id].conns += 1;
+            lb_service_stats_get(vs->stats, lcore_id)->conns += 1;
+            lb_service_stats_get(rs->stats, lcore_id)->conns += 1;
         }
-    } else {
+    } else if (vs->flags & LB_VS_F_OPS) {
+        /* The reply ends a one packet scheduled conn. */
         if (conn->flags & LB_CONN_F_ACTIVE) {
             conn->flags &= ~LB_CONN_F_ACTIVE;
-            conn->timeout = 0;
+            lb_conn_set_timeout(conn, 0);
             rte_atomic32_add(&rs->active_conns, -1);
             rte_atomic32_add(&vs->active_conns, -1);
         }
@@ -46,12 +50,15 @@ static void
 udp_set_packet_stats(struct lb_conn *conn, struct rte_mbuf *m, uint8_t dir) {
     struct lb_real_service *rs = conn->real_service;
     struct lb_virt_service *vs = rs->virt_service;
+    struct lb_service_stats *vstats, *rstats;
     uint32_t cid = rte_lcore_id();
 
-    vs->stats[cid].bytes[dir] += m->pkt_len;
-    vs->stats[cid].packets[dir] += 1;
-    rs->stats[cid].bytes[dir] += m->pkt_len;
-    rs->stats[cid].packets[dir] += 1;
+    vstats = lb_service_stats_get(vs->stats, cid);
+    rstats = lb_service_stats_get(rs->stats, cid);
+    vstats->bytes[dir] += m->pkt_len;
+    vstats->packets[dir] += 1;
+    rstats->bytes[dir] += m->pkt_len;
+    rstats->packets[dir] += 1;
 }
 
 static int
@@ -89,7 +96,11 @@ static int
 udp_fullnat_recv_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
                         struct udp_hdr *uh, struct lb_conn_table *ct,
                         struct lb_conn *conn, struct lb_device *dev) {
-    if (conn != NULL) {
+    struct lb_cksum_nat nat;
+
+    if (conn != NULL &&
+        ((conn->real_service->virt_service->flags & LB_VS_F_OPS) ||
+         !(conn->real_service->flags & LB_RS_F_AVAILABLE))) {
         lb_conn_expire(ct, conn);
         conn = NULL;
     }
@@ -105,17 +116,14 @@ udp_fullnat_recv_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
     udp_set_conntrack_state(conn, uh, LB_DIR_ORIGINAL);
     udp_set_packet_stats(conn, m, LB_DIR_ORIGINAL);
 
+    lb_cksum_nat_save(&nat, iph, uh, sizeof(*uh));
     iph->time_to_live = 63;
     iph->src_addr = conn->lip;
     iph->dst_addr = conn->rip;
     uh->src_port = conn->lport;
     uh->dst_port = conn->rport;
-    iph->hdr_checksum = 0;
-    iph->hdr_checksum = rte_ipv4_cksum(iph);
-    if (uh->dgram_cksum != 0) {
-        uh->dgram_cksum = 0;
-        uh->dgram_cksum = rte_ipv4_udptcp_cksum(iph, uh);
-    }
+    lb_device_ipv4_cksum(m, iph, &nat, dev);
+    lb_device_udp_cksum(m, iph, uh, &nat, dev);
 
     return lb_device_output(m, iph, dev);
 }
@@ -124,44 +132,62 @@ static int
 udp_fullnat_recv_backend(struct rte_mbuf *m, struct ipv4_hdr *iph,
                          struct udp_hdr *uh, struct lb_conn *conn,
                          struct lb_device *dev) {
+    struct lb_cksum_nat nat;
+
     udp_set_conntrack_state(conn, uh, LB_DIR_REPLY);
     udp_set_packet_stats(conn, m, LB_DIR_REPLY);
 
+    lb_cksum_nat_save(&nat, iph, uh, sizeof(*uh));
     iph->time_to_live = 63;
     iph->src_addr = conn->vip;
     iph->dst_addr = conn->cip;
     uh->src_port = conn->vport;
     uh->dst_port = conn->cport;
-    iph->hdr_checksum = 0;
-    iph->hdr_checksum = rte_ipv4_cksum(iph);
-    if (uh->dgram_cksum != 0) {
-        uh->dgram_cksum = 0;
-        uh->dgram_cksum = rte_ipv4_udptcp_cksum(iph, uh);
-    }
+    lb_device_ipv4_cksum(m, iph, &nat, dev);
+    lb_device_udp_cksum(m, iph, uh, &nat, dev);
 
     return lb_device_output(m, iph, dev);
 }
 
-static int
-udp_fullnat_handle(struct rte_mbuf *m, struct ipv4_hdr *iph,
-                   struct lb_device *dev) {
+static void
+udp_fullnat_handle_burst(struct rte_mbuf **pkts, uint16_t n,
+                         struct lb_device *dev) {
+    struct ipv4_4tuple tuples[PKT_MAX_BURST] = {{0}};
+    struct lb_conn *conns[PKT_MAX_BURST];
+    uint8_t dirs[PKT_MAX_BURST];
     struct lb_conn_table *ct;
-    struct lb_conn *conn;
+    struct ipv4_hdr *iph;
     struct udp_hdr *uh;
-    uint8_t dir;
-    int rc;
+    uint32_t gen;
+    uint16_t i;
 
     ct = &lb_conn_tbls[rte_lcore_id()];
-    uh = UDP_HDR(iph);
-
-    conn = lb_conn_find(ct, iph->src_addr, iph->dst_addr, uh->src_port,
-                        uh->dst_port, &dir);
-    if (dir == LB_DIR_REPLY)
-        rc = udp_fullnat_recv_backend(m, iph, uh, conn, dev);
-    else
-        rc = udp_fullnat_recv_client(m, iph, uh, ct, conn, dev);
+    for (i = 0; i < n; i++) {
+        iph = rte_pktmbuf_mtod_offset(pkts[i], struct ipv4_hdr *,
+                                      ETHER_HDR_LEN);
+        uh = UDP_HDR(iph);
+        IPv4_4TUPLE(&tuples[i], iph->src_addr, uh->src_port, iph->dst_addr,
+                    uh->dst_port);
+    }
 
-    return rc;
+    gen = ct->gen;
+    lb_conn_find_bulk(ct, tuples, n, conns, dirs);
+    lb_lcore_stage(LB_STAGE_LOOKUP);
+
+    for (i = 0; i < n; i++) {
+        iph = rte_pktmbuf_mtod_offset(pkts[i], struct ipv4_hdr *,
+                                      ETHER_HDR_LEN);
+        uh = UDP_HDR(iph);
+
+        /* An earlier packet of the burst added or expired a conn. */
+        if (ct->gen != gen)
+            conns[i] = lb_conn_find(ct, iph->src_addr, iph->dst_addr,
+                                    uh->src_port, uh->dst_port, &dirs[i]);
+        if (dirs[i] == LB_DIR_REPLY)
+            udp_fullnat_recv_backend(pkts[i], iph, uh, conns[i], dev);
+        else
+            udp_fullnat_recv_client(pkts[i], iph, uh, ct, conns[i], dev);
+    }
 }
 
 static int
@@ -191,42 +217,48 @@ static struct lb_proto proto_udp = {
     .id = IPPROTO_UDP,
     .type = LB_IPPROTO_UDP,
     .init = udp_fullnat_init,
-    .fullnat_handle = udp_fullnat_handle,
+    .fullnat_handle_burst = udp_fullnat_handle_burst,
 };
 
 LB_PROTO_REGISTER(proto_udp);
 
+static void
+udp_conn_dump_one(int fd, const struct lb_conn *conn) {
+    unixctl_command_reply(
+        fd,
+        "cip: " IPv4_BE_FMT ", cport: %u, "
+        "vip: " IPv4_BE_FMT ", vport: %u, "
+        "lip: " IPv4_BE_FMT ", lport: %u, "
+        "rip: " IPv4_BE_FMT ", rport: %u, "
+        "flags: 0x%x, usetime:%u, timeout=%u\n",
+        IPv4_BE_ARG(conn->cip), rte_be_to_cpu_16(conn->cport),
+        IPv4_BE_ARG(conn->vip), rte_be_to_cpu_16(conn->vport),
+        IPv4_BE_ARG(conn->lip), rte_be_to_cpu_16(conn->lport),
+        IPv4_BE_ARG(conn->rip), rte_be_to_cpu_16(conn->rport),
+        conn->flags, conn->use_time, conn->timeout);
+}
+
 static void
 udp_conn_dump_cmd_cb(int fd, __attribute__((unused)) char *argv[],
                      __attribute__((unused)) int argc) {
-    uint32_t lcore_id;
-    struct lb_conn_table *ct;
-    struct lb_conn *conn;
-    void *tmp;
+    struct lb_conn conns[LB_CONN_WALK_BATCH];
+    struct lb_conn_walk walk;
+    uint32_t lcore_id, i, n;
 
     RTE_LCORE_FOREACH_SLAVE(lcore_id) {
-        ct = &lb_conn_tbls[lcore_id];
-        rte_spinlock_lock(&ct->spinlock);
-        for_each_conn_safe(conn, &ct->timeout_list, next, tmp) {
-            unixctl_command_reply(
-                fd,
-                "cip: " IPv4_BE_FMT ", cport: %u, "
-                "vip: " IPv4_BE_FMT ", vport: %u, "
-                "lip: " IPv4_BE_FMT ", lport: %u, "
-                "rip: " IPv4_BE_FMT ", rport: %u, "
-                "flags: 0x%x, usetime:%u, timeout=%u\n",
-                IPv4_BE_ARG(conn->cip), rte_be_to_cpu_16(conn->cport),
-                IPv4_BE_ARG(conn->vip), rte_be_to_cpu_16(conn->vport),
-                IPv4_BE_ARG(conn->lip), rte_be_to_cpu_16(conn->lport),
-                IPv4_BE_ARG(conn->rip), rte_be_to_cpu_16(conn->rport),
-                conn->flags, conn->use_time, conn->timeout);
+        memset(&walk, 0, sizeof(walk));
+        while ((n = lb_conn_table_walk(&lb_conn_tbls[lcore_id], &walk, conns,
+                                       LB_CONN_WALK_BATCH)) != 0) {
+            for (i = 0; i < n; i++)
+                udp_conn_dump_one(fd, &conns[i]);
+            if (unixctl_command_flush(fd) < 0)
+                return;
         }
-        rte_spinlock_unlock(&ct->spinlock);
     }
 }
 
-UNIXCTL_CMD_REGISTER("udp/conn/dump", "", "Dump UDP connections.", 0, 0,
-                     udp_conn_dump_cmd_cb);
+UNIXCTL_CMD_REGISTER_STREAM("udp/conn/dump", "", "Dump UDP connections.", 0, 0,
+                            udp_conn_dump_cmd_cb);
 
 static void
 udp_conn_stats_normal(int fd) {
@@ -289,4 +321,32 @@ udp_conn_stats_cmd_cb(int fd, char *argv[], int argc) {
 
 UNIXCTL_CMD_REGISTER("udp/conn/stats", "[--json].",
                      "Show the number of UDP connections.", 0, 1,
-                     udp_conn_stats_cmd_cb);
\ No newline at end of file
+                     udp_conn_stats_cmd_cb);
+
+static void
+udp_max_expire_num_cmd_cb(int fd, char *argv[], int argc) {
+    uint32_t lcore_id;
+    uint32_t num;
+    int rc;
+
+    if (argc == 0) {
+        lcore_id = rte_get_next_lcore(-1, 1, 0);
+        unixctl_command_reply(fd, "%u\n",
+                              lb_conn_tbls[lcore_id].expire_budget);
+        return;
+    }
+
+    rc = parser_read_uint32(&num, argv[0]);
+    if (rc < 0 || num == 0) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[0]);
+        return;
+    }
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        lb_conn_tbls[lcore_id].expire_budget = num;
+    }
+}
+
+UNIXCTL_CMD_REGISTER_DATAPATH("udp/max-expire-num", "[VALUE].",
+                              "Show or set max number of expired UDP "
+                              "connections per tick.",
+                              0, 1, udp_max_expire_num_cmd_cb);
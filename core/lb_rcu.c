@@ -0,0 +1,43 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <rte_atomic.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <rte_pause.h>
+
+#include "lb_rcu.h"
+
+volatile uint64_t lb_rcu_gp;
+struct lb_rcu_lcore lb_rcu_lcores[RTE_MAX_LCORE];
+
+void
+lb_rcu_online(uint32_t lcore_id) {
+    lb_rcu_lcores[lcore_id].qs = lb_rcu_gp;
+    rte_smp_mb();
+    lb_rcu_lcores[lcore_id].online = 1;
+    rte_smp_mb();
+}
+
+void
+lb_rcu_offline(uint32_t lcore_id) {
+    rte_smp_mb();
+    lb_rcu_lcores[lcore_id].online = 0;
+}
+
+/* Wait until every online worker passed a quiescent state. Writers only. */
+void
+lb_rcu_synchronize(void) {
+    uint32_t lcore_id;
+    uint64_t gp;
+
+    rte_smp_mb();
+    gp = ++lb_rcu_gp;
+    rte_smp_mb();
+
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        while (lb_rcu_lcores[lcore_id].online &&
+               lb_rcu_lcores[lcore_id].qs < gp)
+            rte_pause();
+    }
+    rte_smp_mb();
+}
@@ -0,0 +1,36 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_RCU_H__
+#define __LB_RCU_H__
+
+#include <rte_atomic.h>
+#include <rte_lcore.h>
+#include <rte_memory.h>
+
+/*
+ * Quiescent state based reclamation. Worker lcores read the service and
+ * route tables without locks and report a quiescent state once per
+ * loop iteration, when they hold no reference to those objects. Writers
+ * unpublish an object, wait in lb_rcu_synchronize() and then free it.
+ */
+
+struct lb_rcu_lcore {
+    volatile uint64_t qs;
+    volatile uint32_t online;
+} __rte_cache_aligned;
+
+extern volatile uint64_t lb_rcu_gp;
+extern struct lb_rcu_lcore lb_rcu_lcores[RTE_MAX_LCORE];
+
+static inline void
+lb_rcu_quiescent(uint32_t lcore_id) {
+    /* Order the reads of this iteration before the report. */
+    rte_smp_rmb();
+    lb_rcu_lcores[lcore_id].qs = lb_rcu_gp;
+}
+
+void lb_rcu_online(uint32_t lcore_id);
+void lb_rcu_offline(uint32_t lcore_id);
+void lb_rcu_synchronize(void);
+
+#endif
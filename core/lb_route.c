@@ -0,0 +1,312 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#include <errno.h>
+#include <string.h>
+
+#include <rte_errno.h>
+#include <rte_lcore.h>
+#include <rte_log.h>
+#include <rte_lpm.h>
+#include <rte_malloc.h>
+
+#include <unixctl_command.h>
+
+#include "lb_device.h"
+#include "lb_parser.h"
+#include "lb_rcu.h"
+#include "lb_route.h"
+
+#define ROUTE_TBL8S 256
+
+#define DEPTH_TO_MASK(d) ((d) == 0 ? 0 : (uint32_t)(~0U << (32 - (d))))
+
+static void
+route_tbl_flip(struct lb_route_table *t) {
+    rte_smp_wmb();
+    t->active = !t->active;
+    lb_rcu_synchronize();
+}
+
+static int
+route_nh_find(struct lb_route_table *t, uint32_t prefix, uint8_t depth) {
+    int i;
+
+    for (i = 0; i < LB_MAX_ROUTE; i++) {
+        if (t->nhs[i].in_use && t->nhs[i].prefix == prefix &&
+            t->nhs[i].depth == depth)
+            return i;
+    }
+    return -1;
+}
+
+static int
+route_nh_alloc(struct lb_route_table *t) {
+    int i;
+
+    for (i = 0; i < LB_MAX_ROUTE; i++) {
+        if (!t->nhs[i].in_use)
+            return i;
+    }
+    return -1;
+}
+
+/* Adds or replaces a route, prefix and gateways in network byte order. */
+static int
+route_add(struct lb_route_table *t, uint32_t prefix, uint8_t depth,
+          const uint32_t *gws, uint8_t nb_gws) {
+    struct lb_route_nh *nh;
+    uint32_t ip, standby;
+    int idx, old;
+    int rc;
+
+    if (nb_gws > LB_MAX_ROUTE_NH)
+        return -EINVAL;
+
+    ip = rte_be_to_cpu_32(prefix) & DEPTH_TO_MASK(depth);
+    prefix = rte_cpu_to_be_32(ip);
+
+    idx = route_nh_alloc(t);
+    if (idx < 0)
+        return -ENOSPC;
+    old = route_nh_find(t, prefix, depth);
+
+    nh = &t->nhs[idx];
+    nh->prefix = prefix;
+    nh->depth = depth;
+    nh->nb_gws = nb_gws;
+    memcpy(nh->gws, gws, nb_gws * sizeof(gws[0]));
+    nh->in_use = 1;
+
+    if (depth == 0) {
+        rte_smp_wmb();
+        t->dflt = idx;
+        lb_rcu_synchronize();
+        goto done;
+    }
+
+    standby = !t->active;
+    rc = rte_lpm_add(t->lpm[standby], ip, depth, idx);
+    if (rc < 0) {
+        nh->in_use = 0;
+        return rc;
+    }
+    route_tbl_flip(t);
+
+    rc = rte_lpm_add(t->lpm[!standby], ip, depth, idx);
+    if (unlikely(rc < 0)) {
+        route_tbl_flip(t);
+        if (old >= 0)
+            rte_lpm_add(t->lpm[standby], ip, depth, old);
+        else
+            rte_lpm_delete(t->lpm[standby], ip, depth);
+        route_tbl_flip(t);
+        nh->in_use = 0;
+        return rc;
+    }
+
+done:
+    if (old >= 0)
+        t->nhs[old].in_use = 0;
+    return 0;
+}
+
+static int
+route_del(struct lb_route_table *t, uint32_t prefix, uint8_t depth) {
+    uint32_t ip, standby;
+    int idx;
+
+    ip = rte_be_to_cpu_32(prefix) & DEPTH_TO_MASK(depth);
+    idx = route_nh_find(t, rte_cpu_to_be_32(ip), depth);
+    if (idx < 0)
+        return -ENOENT;
+
+    if (depth == 0) {
+        t->dflt = -1;
+        lb_rcu_synchronize();
+    } else {
+        standby = !t->active;
+        rte_lpm_delete(t->lpm[standby], ip, depth);
+        route_tbl_flip(t);
+        rte_lpm_delete(t->lpm[!standby], ip, depth);
+    }
+
+    t->nhs[idx].in_use = 0;
+    return 0;
+}
+
+static struct lb_route_table *
+route_tbl_create(struct lb_device *dev) {
+    struct lb_route_table *t;
+    struct rte_lpm_config config;
+    char name[RTE_LPM_NAMESIZE];
+    int i;
+
+    t = rte_zmalloc_socket(NULL, sizeof(*t), RTE_CACHE_LINE_SIZE,
+                           dev->socket_id);
+    if (t == NULL) {
+        RTE_LOG(ERR, USER1, "%s(): Alloc memory for route table failed.\n",
+                __func__);
+        return NULL;
+    }
+
+    t->dflt = -1;
+    memset(&config, 0, sizeof(config));
+    config.max_rules = LB_MAX_ROUTE;
+    config.number_tbl8s = ROUTE_TBL8S;
+    for (i = 0; i < 2; i++) {
+        snprintf(name, sizeof(name), "route%u_%d", dev->port_id, i);
+        t->lpm[i] = rte_lpm_create(name, dev->socket_id, &config);
+        if (t->lpm[i] == NULL) {
+            RTE_LOG(ERR, USER1, "%s(): Create lpm (%s) failed, %s.\n",
+                    __func__, name, rte_strerror(rte_errno));
+            return NULL;
+        }
+    }
+    return t;
+}
+
+int
+lb_route_init(struct lb_device_conf *confs) {
+    uint16_t i;
+    uint32_t j;
+    struct lb_device *dev;
+    struct lb_device_conf *conf;
+    struct lb_route_conf *route;
+    struct lb_route_table *t;
+    int rc;
+
+    LB_DEVICE_FOREACH(i, dev) {
+        conf = &confs[i];
+        t = route_tbl_create(dev);
+        if (t == NULL)
+            return -1;
+
+        rc = route_add(t, dev->ipv4, __builtin_popcount(dev->netmask), NULL,
+                       0);
+        if (rc == 0 && dev->gw != 0)
+            rc = route_add(t, 0, 0, &dev->gw, 1);
+        for (j = 0; rc == 0 && j < conf->nb_routes; j++) {
+            route = &conf->routes[j];
+            rc = route_add(t, route->prefix, route->depth, route->gws,
+                           route->nb_gws);
+        }
+        if (rc < 0) {
+            RTE_LOG(ERR, USER1, "%s(): Add route to port(%s) failed, %s.\n",
+                    __func__, dev->name, strerror(-rc));
+            return rc;
+        }
+
+        dev->route = t;
+    }
+
+    return 0;
+}
+
+static struct lb_device *
+route_dev_find(const char *name) {
+    uint16_t i;
+    struct lb_device *dev;
+
+    LB_DEVICE_FOREACH(i, dev) {
+        if (strcmp(dev->name, name) == 0)
+            return dev;
+    }
+    return NULL;
+}
+
+static void
+route_add_cmd_cb(int fd, char *argv[], int argc) {
+    struct lb_device *dev;
+    uint32_t prefix;
+    uint8_t depth;
+    uint32_t gws[LB_MAX_ROUTE_NH];
+    int i, rc;
+
+    dev = route_dev_find(argv[0]);
+    if (dev == NULL) {
+        unixctl_command_reply_error(fd, "Unknown device: %s.\n", argv[0]);
+        return;
+    }
+    if (parse_ipv4_prefix(argv[1], &prefix, &depth) < 0) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[1]);
+        return;
+    }
+    for (i = 2; i < argc; i++) {
+        if (parse_ipv4_addr(argv[i], (struct in_addr *)&gws[i - 2]) < 0) {
+            unixctl_command_reply_error(fd, "Invalid parameter: %s.\n",
+                                        argv[i]);
+            return;
+        }
+    }
+
+    rc = route_add(dev->route, prefix, depth, gws, argc - 2);
+    if (rc < 0) {
+        unixctl_command_reply_error(fd, "Add route failed, %s.\n",
+                                    strerror(-rc));
+    }
+}
+
+UNIXCTL_CMD_REGISTER_DATAPATH(
+    "route/add", "IFNAME PREFIX/LEN [GW...].",
+    "Add or replace route, several gateways for ECMP.", 2,
+    2 + LB_MAX_ROUTE_NH, route_add_cmd_cb);
+
+static void
+route_del_cmd_cb(int fd, char *argv[], __attribute__((unused)) int argc) {
+    struct lb_device *dev;
+    uint32_t prefix;
+    uint8_t depth;
+    int rc;
+
+    dev = route_dev_find(argv[0]);
+    if (dev == NULL) {
+        unixctl_command_reply_error(fd, "Unknown device: %s.\n", argv[0]);
+        return;
+    }
+    if (parse_ipv4_prefix(argv[1], &prefix, &depth) < 0) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[1]);
+        return;
+    }
+
+    rc = route_del(dev->route, prefix, depth);
+    if (rc < 0) {
+        unixctl_command_reply_error(fd, "Delete route failed, %s.\n",
+                                    strerror(-rc));
+    }
+}
+
+UNIXCTL_CMD_REGISTER_DATAPATH("route/del", "IFNAME PREFIX/LEN.",
+                              "Delete route.", 2, 2, route_del_cmd_cb);
+
+static void
+route_list_cmd_cb(int fd, __attribute__((unused)) char *argv[],
+                  __attribute__((unused)) int argc) {
+    uint16_t i;
+    struct lb_device *dev;
+    struct lb_route_nh *nh;
+    char prefix[32], gw[32];
+    uint32_t j, k;
+
+    unixctl_command_reply(fd, "Destination         Iface       Gateway\n");
+    LB_DEVICE_FOREACH(i, dev) {
+        for (j = 0; j < LB_MAX_ROUTE; j++) {
+            nh = &dev->route->nhs[j];
+            if (!nh->in_use)
+                continue;
+            ipv4_addr_tostring(nh->prefix, prefix, sizeof(prefix));
+            snprintf(prefix + strlen(prefix), sizeof(prefix) - strlen(prefix),
+                     "/%u", nh->depth);
+            unixctl_command_reply(fd, "%-18s  %-10s  ", prefix, dev->name);
+            if (nh->nb_gws == 0)
+                unixctl_command_reply(fd, "on-link");
+            for (k = 0; k < nh->nb_gws; k++) {
+                ipv4_addr_tostring(nh->gws[k], gw, sizeof(gw));
+                unixctl_command_reply(fd, "%s%s", k ? " " : "", gw);
+            }
+            unixctl_command_reply(fd, "\n");
+        }
+    }
+}
+
+UNIXCTL_CMD_REGISTER("route/list", "", "List all routes.", 0, 0,
+                     route_list_cmd_cb);
@@ -0,0 +1,65 @@
+/* Copyright (c) 2018. TIG developer. */
+
+#ifndef __LB_ROUTE_H__
+#define __LB_ROUTE_H__
+
+#include <rte_byteorder.h>
+#include <rte_lpm.h>
+
+#include "lb_config.h"
+
+#define LB_MAX_ROUTE 1024
+
+/* Next-hop group of a route, no gateway means the prefix is on-link. */
+struct lb_route_nh {
+    uint32_t in_use;
+    uint32_t prefix;
+    uint8_t depth;
+    uint8_t nb_gws;
+    uint32_t gws[LB_MAX_ROUTE_NH];
+};
+
+/*
+ * The LPM table is kept twice like the virt service tables. Workers look
+ * up the active copy without locks, writers update the standby copy, flip
+ * active, wait for a grace period and replay the update on the other copy.
+ * A next-hop group is not reused before neither copy refers to it.
+ */
+struct lb_route_table {
+    struct rte_lpm *lpm[2];
+    volatile uint32_t active;
+    /* Next-hop group of the default route, rte_lpm has no /0. */
+    volatile int32_t dflt;
+    struct lb_route_nh nhs[LB_MAX_ROUTE];
+};
+
+/* Returns the next hop of dip, 0 if there is no route. */
+static inline uint32_t
+lb_route_next_hop(struct lb_route_table *t, uint32_t dip, uint32_t hash) {
+    struct lb_route_nh *nh;
+    uint32_t idx;
+    int32_t dflt;
+
+    if (rte_lpm_lookup(t->lpm[t->active], rte_be_to_cpu_32(dip), &idx) < 0) {
+        /* Read once, route/del of the default route may reset it. */
+        dflt = t->dflt;
+        if (dflt < 0)
+            return 0;
+        idx = dflt;
+    }
+
+    nh = &t->nhs[idx];
+    switch (nh->nb_gws) {
+    case 0:
+        return dip;
+    case 1:
+        return nh->gws[0];
+    default:
+        /* ECMP, the high bits of the hash pick the gateway. */
+        return nh->gws[((uint64_t)hash * nh->nb_gws) >> 32];
+    }
+}
+
+int lb_route_init(struct lb_device_conf *confs);
+
+#endif
@@ -1,15 +1,19 @@
 /* Copyright (c) 2018. TIG developer. */
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <sys/queue.h>
 
 #include <rte_atomic.h>
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_hash_crc.h>
 #include <rte_malloc.h>
 
-#include "conhash.h"
 #include "lb_format.h"
+#include "lb_rcu.h"
 #include "lb_scheduler.h"
 #include "lb_service.h"
 
@@ -25,145 +29,450 @@
     } while (0)
 #endif
 
-#define MAX_RS_REPLICA 256
+#define IP_PORT_TO_UINT64(ip, port)                                            \
+    (((uint64_t)(ip) << 32) | ((uint64_t)(port) << 16))
+
+/*
+ * Scheduler tables are read by the workers without locks. A new table is
+ * published with a pointer store, the old one is freed after a grace
+ * period.
+ */
+static void
+sched_table_swap(void *volatile *slot, void *t) {
+    void *old = *slot;
+
+    rte_smp_wmb();
+    *slot = t;
+    if (old != NULL) {
+        lb_rcu_synchronize();
+        rte_free(old);
+    }
+}
+
+/*
+ * Maglev hashing: every VS owns a prime sized lookup table that is filled
+ * from the per-backend permutations, dispatch is a single array index.
+ * Tables are rebuilt by the add/del/update hooks and published with a
+ * pointer swap.
+ */
+
+#define MAGLEV_SLOTS_PER_RS 100
+#define MAGLEV_OFFSET_SEED 0x7a1e3b5dU
+#define MAGLEV_SKIP_SEED 0x2c6f9e41U
+
+static const uint32_t maglev_primes[] = {
+    251, 509, 1021, 2039, 4093, 8191, 16381, 32749, 65521, 131071,
+};
+
+struct maglev_table {
+    uint32_t size;
+    uint32_t nb_rs;
+    struct lb_real_service **rss;
+    /* Weights the table was built with. */
+    int *weights;
+    struct lb_real_service *entries[0];
+};
+
+struct maglev_data {
+    struct maglev_table *volatile table;
+};
 
 static int
-conhash_sched_init(struct lb_virt_service *vs) {
-    vs->sched_data = conhash_init(NULL);
+maglev_sched_init(struct lb_virt_service *vs) {
+    vs->sched_data = rte_zmalloc_socket(NULL, sizeof(struct maglev_data),
+                                        RTE_CACHE_LINE_SIZE, vs->socket_id);
     return vs->sched_data != NULL ? 0 : -1;
 }
 
 static void
-conhash_sched_fini(struct lb_virt_service *vs) {
-    conhash_fini(vs->sched_data);
+maglev_sched_fini(struct lb_virt_service *vs) {
+    struct maglev_data *md = vs->sched_data;
+
+    if (md != NULL)
+        rte_free(md->table);
+    rte_free(md);
+    vs->sched_data = NULL;
 }
 
-#define IP_PORT_TO_STR(ip, port, s)                                            \
-    do {                                                                       \
-        s[0] = (unsigned char)((ip) >> 24 & 0xff);                             \
-        s[1] = (unsigned char)((ip) >> 16 & 0xff);                             \
-        s[2] = (unsigned char)((ip) >> 8 & 0xff);                              \
-        s[3] = (unsigned char)((ip)&0xff);                                     \
-        s[4] = (unsigned char)((port) >> 8 & 0xff);                            \
-        s[5] = (unsigned char)((port)&0xff);                                   \
-        s[6] = '\0';                                                           \
-    } while (0)
+static uint32_t
+maglev_table_size(uint32_t nb_rs) {
+    uint32_t i;
+
+    for (i = 0; i < RTE_DIM(maglev_primes) - 1; i++) {
+        if (maglev_primes[i] >= nb_rs * MAGLEV_SLOTS_PER_RS)
+            break;
+    }
+    return maglev_primes[i];
+}
 
 static int
-conhash_sched_add(struct lb_virt_service *vs, struct lb_real_service *rs) {
-    struct conhash_s *conhash = vs->sched_data;
-    struct node_s *node;
-    char buf[8];
+maglev_rs_cmp(const void *a, const void *b) {
+    const struct lb_real_service *x = *(struct lb_real_service *const *)a;
+    const struct lb_real_service *y = *(struct lb_real_service *const *)b;
+    uint64_t kx = IP_PORT_TO_UINT64(x->rip, x->rport);
+    uint64_t ky = IP_PORT_TO_UINT64(y->rip, y->rport);
 
-    if (unlikely(conhash == NULL))
-        return -1;
-    node = rte_zmalloc_socket(NULL, sizeof(struct node_s), RTE_CACHE_LINE_SIZE,
-                              vs->socket_id);
-    if (node != NULL) {
-        IP_PORT_TO_STR(rs->rip, rs->rport, buf);
-        conhash_set_node(node, buf, MAX_RS_REPLICA, rs);
-        conhash_add_node(conhash, node);
+    return kx < ky ? -1 : kx > ky;
+}
+
+/*
+ * Every round each backend earns credit equal to its weight and takes one
+ * slot from its permutation per max_weight credits, so the share of the
+ * table is proportional to the weight.
+ */
+static void
+maglev_populate(struct maglev_table *t, uint32_t *offset, uint32_t *skip,
+                uint32_t *next, int *credit) {
+    struct lb_real_service *rs;
+    uint32_t i, c, filled = 0;
+    uint64_t key;
+    int max_weight = 0;
+
+    for (i = 0; i < t->nb_rs; i++) {
+        rs = t->rss[i];
+        key = IP_PORT_TO_UINT64(rs->rip, rs->rport);
+        offset[i] = rte_hash_crc_8byte(key, MAGLEV_OFFSET_SEED) % t->size;
+        skip[i] = rte_hash_crc_8byte(key, MAGLEV_SKIP_SEED) % (t->size - 1) + 1;
+        next[i] = 0;
+        credit[i] = 0;
+        if (max_weight < t->weights[i])
+            max_weight = t->weights[i];
+    }
+
+    for (;;) {
+        for (i = 0; i < t->nb_rs; i++) {
+            credit[i] += t->weights[i];
+            if (credit[i] < max_weight)
+                continue;
+            credit[i] -= max_weight;
+            do {
+                c = (offset[i] + (uint64_t)next[i] * skip[i]) % t->size;
+                next[i]++;
+            } while (t->entries[c] != NULL);
+            t->entries[c] = t->rss[i];
+            if (++filled == t->size)
+                return;
+        }
     }
-    return (rs->sched_node = node) != NULL ? 0 : -1;
+}
+
+static inline int
+maglev_rs_weight(struct lb_real_service *rs, int all_zero) {
+    return all_zero ? 1 : rs->weight;
+}
+
+/*
+ * Build a table from the available real services with a non-zero weight,
+ * except @exclude. If all weights are zero every backend counts as equal.
+ * Backends are ordered by address so the permutations, and therefore the
+ * slots of the unchanged backends, stay the same across rebuilds.
+ */
+static struct maglev_table *
+maglev_table_build(struct lb_virt_service *vs, struct lb_real_service *exclude,
+                   int *err) {
+    struct maglev_table *t;
+    struct lb_real_service *rs;
+    uint32_t nb_rs = 0, size, i;
+    uint32_t *tmp;
+    int all_zero = 1;
+
+    *err = 0;
+    LIST_FOREACH(rs, &vs->real_services, next) {
+        if ((rs->flags & LB_RS_F_AVAILABLE) && rs != exclude &&
+            rs->weight > 0)
+            all_zero = 0;
+    }
+    LIST_FOREACH(rs, &vs->real_services, next) {
+        if ((rs->flags & LB_RS_F_AVAILABLE) && rs != exclude &&
+            maglev_rs_weight(rs, all_zero) > 0)
+            nb_rs++;
+    }
+    if (nb_rs == 0)
+        return NULL;
+
+    size = maglev_table_size(nb_rs);
+    t = rte_zmalloc_socket(NULL,
+                           sizeof(*t) + size * sizeof(t->entries[0]) +
+                               nb_rs * sizeof(t->rss[0]) +
+                               nb_rs * sizeof(t->weights[0]),
+                           RTE_CACHE_LINE_SIZE, vs->socket_id);
+    tmp = rte_malloc(NULL, 4 * nb_rs * sizeof(uint32_t), 0);
+    if (t == NULL || tmp == NULL) {
+        rte_free(t);
+        rte_free(tmp);
+        *err = -1;
+        return NULL;
+    }
+
+    t->size = size;
+    t->rss = (struct lb_real_service **)&t->entries[size];
+    t->weights = (int *)&t->rss[nb_rs];
+    LIST_FOREACH(rs, &vs->real_services, next) {
+        if ((rs->flags & LB_RS_F_AVAILABLE) && rs != exclude &&
+            maglev_rs_weight(rs, all_zero) > 0)
+            t->rss[t->nb_rs++] = rs;
+    }
+    qsort(t->rss, t->nb_rs, sizeof(t->rss[0]), maglev_rs_cmp);
+    for (i = 0; i < t->nb_rs; i++)
+        t->weights[i] = maglev_rs_weight(t->rss[i], all_zero);
+    maglev_populate(t, tmp, tmp + nb_rs, tmp + 2 * nb_rs,
+                    (int *)(tmp + 3 * nb_rs));
+    rte_free(tmp);
+
+    return t;
 }
 
 static int
-conhash_sched_del(struct lb_virt_service *vs, struct lb_real_service *rs) {
-    struct conhash_s *conhash = vs->sched_data;
+maglev_table_rebuild(struct lb_virt_service *vs,
+                     struct lb_real_service *exclude) {
+    struct maglev_data *md = vs->sched_data;
+    struct maglev_table *t;
+    int err;
 
-    if (unlikely(conhash == NULL))
+    if (unlikely(md == NULL))
         return -1;
-    conhash_del_node(conhash, rs->sched_node);
-    rte_free(rs->sched_node);
-    rs->sched_node = NULL;
+    t = maglev_table_build(vs, exclude, &err);
+    if (err < 0)
+        return -1;
+
+    sched_table_swap((void *volatile *)&md->table, t);
+
+    SCHED_PRINT("MAGLEV: vip=" IPv4_BE_FMT ", vport=%u, size=%u, nb_rs=%u\n",
+                IPv4_BE_ARG(vs->vip), rte_be_to_cpu_16(vs->vport),
+                t ? t->size : 0, t ? t->nb_rs : 0);
     return 0;
 }
 
 static int
-conhash_sched_update(__rte_unused struct lb_virt_service *vs,
-                     __rte_unused struct lb_real_service *rs) {
-    return 0;
+maglev_table_find(struct maglev_table *t, struct lb_real_service *rs) {
+    uint32_t i;
+
+    if (t != NULL) {
+        for (i = 0; i < t->nb_rs; i++) {
+            if (t->rss[i] == rs)
+                return i;
+        }
+    }
+    return -1;
 }
 
-#define IP_PORT_TO_UINT64(ip, port)                                            \
-    (((uint64_t)(ip) << 32) | ((uint64_t)(port) << 16))
+static int
+maglev_sched_add(struct lb_virt_service *vs, struct lb_real_service *rs) {
+    struct maglev_data *md = vs->sched_data;
 
-static struct lb_real_service *
-conhash_schedule_ipport(struct lb_virt_service *vs, uint32_t ip,
-                        uint16_t port) {
-    struct conhash_s *conhash = vs->sched_data;
-    uint64_t key;
-    struct node_s *node;
+    if (unlikely(md == NULL))
+        return -1;
+
+    /* Switching schedulers adds every backend, build the table only once. */
+    if (maglev_table_find(md->table, rs) >= 0)
+        return 0;
+    return maglev_table_rebuild(vs, NULL);
+}
+
+static int
+maglev_sched_del(struct lb_virt_service *vs, struct lb_real_service *rs) {
+    return maglev_table_rebuild(vs, rs);
+}
+
+static int
+maglev_sched_update(struct lb_virt_service *vs, struct lb_real_service *rs) {
+    struct maglev_data *md = vs->sched_data;
+    struct maglev_table *t;
+    int i;
+
+    if (unlikely(md == NULL))
+        return -1;
+
+    /* Nothing to do unless the weight the table was built with changed. */
+    t = md->table;
+    i = maglev_table_find(t, rs);
+    if (i >= 0 && t->weights[i] == rs->weight)
+        return 0;
+    if (i < 0 && rs->weight == 0 && t != NULL)
+        return 0;
+    return maglev_table_rebuild(vs, NULL);
+}
+
+static inline struct lb_real_service *
+maglev_lookup(struct lb_virt_service *vs, uint32_t hash) {
+    struct maglev_data *md = vs->sched_data;
+    struct maglev_table *t;
 
-    if (unlikely(conhash == NULL))
+    if (unlikely(md == NULL))
         return NULL;
-    key = IP_PORT_TO_UINT64(ip, port);
-    node = conhash_lookup(conhash, (const char *)&key, sizeof(uint64_t));
-    return node != NULL ? node->userdata : NULL;
+    t = md->table;
+    if (t == NULL)
+        return NULL;
+    return t->entries[hash % t->size];
 }
 
 static struct lb_real_service *
-conhash_schedule_iponly(struct lb_virt_service *vs, uint32_t ip,
-                        __rte_unused uint16_t port) {
-    struct conhash_s *conhash = vs->sched_data;
-    struct node_s *node;
+maglev_schedule_ipport(struct lb_virt_service *vs, uint32_t ip,
+                       uint16_t port) {
+    return maglev_lookup(
+        vs, rte_hash_crc_8byte(IP_PORT_TO_UINT64(ip, port), 0xffffffff));
+}
 
-    if (unlikely(conhash == NULL))
-        return NULL;
-    node = conhash_lookup(conhash, (const char *)&ip, sizeof(uint32_t));
-    return node != NULL ? node->userdata : NULL;
+static struct lb_real_service *
+maglev_schedule_iponly(struct lb_virt_service *vs, uint32_t ip,
+                       __rte_unused uint16_t port) {
+    return maglev_lookup(vs, rte_hash_crc_4byte(ip, 0xffffffff));
+}
+
+/*
+ * rr, wrr and lc dispatch from a flat array of the available backends.
+ * The array is rebuilt by the add/del/update hooks, per-lcore state only
+ * keeps an index into it.
+ */
+struct sched_rs_table {
+    uint32_t nb_rs;
+    uint32_t max_weight;
+    uint32_t gcd_weight;
+    struct lb_real_service **rss;
+    uint32_t weights[0];
+};
+
+static uint32_t
+gcd(uint32_t a, uint32_t b) {
+    uint32_t c;
+
+    while ((c = a % b)) {
+        a = b;
+        b = c;
+    }
+    return b;
+}
+
+/*
+ * Collect the available real services except @exclude. When @weighted,
+ * backends with weight 0 are left out, unless every weight is 0.
+ */
+static int
+sched_rs_table_build(struct lb_virt_service *vs,
+                     struct lb_real_service *exclude, int weighted,
+                     struct sched_rs_table **table) {
+    struct sched_rs_table *t;
+    struct lb_real_service *rs;
+    uint32_t nb_rs = 0;
+    uint32_t weight;
+    int all_zero = 1;
+
+    *table = NULL;
+    LIST_FOREACH(rs, &vs->real_services, next) {
+        if ((rs->flags & LB_RS_F_AVAILABLE) && rs != exclude) {
+            nb_rs++;
+            if (rs->weight > 0)
+                all_zero = 0;
+        }
+    }
+    if (nb_rs == 0)
+        return 0;
+
+    t = rte_zmalloc_socket(NULL,
+                           sizeof(*t) + nb_rs * sizeof(t->weights[0]) +
+                               nb_rs * sizeof(t->rss[0]),
+                           RTE_CACHE_LINE_SIZE, vs->socket_id);
+    if (t == NULL)
+        return -1;
+    t->rss = (struct lb_real_service **)&t->weights[nb_rs];
+    LIST_FOREACH(rs, &vs->real_services, next) {
+        if (!(rs->flags & LB_RS_F_AVAILABLE) || rs == exclude)
+            continue;
+        if (!weighted || all_zero)
+            weight = 1;
+        else if (rs->weight > 0)
+            weight = rs->weight;
+        else
+            continue;
+        t->weights[t->nb_rs] = weight;
+        t->rss[t->nb_rs++] = rs;
+        if (t->max_weight < weight)
+            t->max_weight = weight;
+        t->gcd_weight = t->gcd_weight ? gcd(t->gcd_weight, weight) : weight;
+    }
+    if (t->nb_rs == 0) {
+        rte_free(t);
+        return 0;
+    }
+
+    *table = t;
+    return 0;
 }
 
 struct rr_data {
-    struct lb_real_service *real_services[RTE_MAX_LCORE];
-} __rte_cache_aligned;
+    struct sched_rs_table *volatile table;
+    int weighted;
+    struct {
+        uint32_t index;
+        uint32_t cw;
+    } __rte_cache_aligned cores[RTE_MAX_LCORE];
+};
 
 static int
-rr_sched_init(struct lb_virt_service *vs) {
+rr_sched_init_common(struct lb_virt_service *vs, int weighted) {
     struct rr_data *rr;
 
     rr = rte_zmalloc_socket(NULL, sizeof(struct rr_data), RTE_CACHE_LINE_SIZE,
                             vs->socket_id);
-    return (vs->sched_data = rr) != NULL ? 0 : -1;
+    if (rr == NULL)
+        return -1;
+    rr->weighted = weighted;
+    vs->sched_data = rr;
+    return 0;
+}
+
+static int
+rr_sched_init(struct lb_virt_service *vs) {
+    return rr_sched_init_common(vs, 0);
+}
+
+static int
+wrr_sched_init(struct lb_virt_service *vs) {
+    return rr_sched_init_common(vs, 1);
 }
 
 static void
 rr_sched_fini(struct lb_virt_service *vs) {
-    rte_free(vs->sched_data);
+    struct rr_data *rr = vs->sched_data;
+
+    if (rr != NULL)
+        rte_free(rr->table);
+    rte_free(rr);
+    vs->sched_data = NULL;
 }
 
 static int
-rr_sched_add(struct lb_virt_service *vs,
-             __rte_unused struct lb_real_service *rs) {
+rr_table_rebuild(struct lb_virt_service *vs, struct lb_real_service *exclude) {
     struct rr_data *rr = vs->sched_data;
-    uint32_t lcore_id;
+    struct sched_rs_table *t;
 
     if (unlikely(rr == NULL))
         return -1;
-    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
-        rr->real_services[lcore_id] = LIST_FIRST(&vs->real_services);
-    }
+    if (sched_rs_table_build(vs, exclude, rr->weighted, &t) < 0)
+        return -1;
+    sched_table_swap((void *volatile *)&rr->table, t);
     return 0;
 }
 
 static int
-rr_sched_del(struct lb_virt_service *vs,
+rr_sched_add(struct lb_virt_service *vs,
              __rte_unused struct lb_real_service *rs) {
-    struct rr_data *rr = vs->sched_data;
-    uint32_t lcore_id;
+    return rr_table_rebuild(vs, NULL);
+}
 
-    if (unlikely(rr == NULL))
-        return -1;
-    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
-        rr->real_services[lcore_id] = LIST_FIRST(&vs->real_services);
-    }
-    return 0;
+static int
+rr_sched_del(struct lb_virt_service *vs, struct lb_real_service *rs) {
+    return rr_table_rebuild(vs, rs);
 }
 
 static int
-rr_sched_update(__rte_unused struct lb_virt_service *vs,
+rr_sched_update(struct lb_virt_service *vs,
                 __rte_unused struct lb_real_service *rs) {
-    return 0;
+    struct rr_data *rr = vs->sched_data;
+
+    if (unlikely(rr == NULL))
+        return -1;
+    return rr->weighted ? rr_table_rebuild(vs, NULL) : 0;
 }
 
 static struct lb_real_service *
@@ -171,194 +480,203 @@ rr_schedule(struct lb_virt_service *vs, __rte_unused uint32_t ip,
             __rte_unused uint16_t port) {
     uint32_t lcore_id = rte_lcore_id();
     struct rr_data *rr = vs->sched_data;
-    struct lb_real_service *rs, *p;
+    struct sched_rs_table *t;
+    struct lb_real_service *rs;
+    uint32_t i;
 
     if (unlikely(rr == NULL))
         return NULL;
-
-    rs = rr->real_services[lcore_id];
-    if (rs == NULL)
+    t = rr->table;
+    if (t == NULL)
         return NULL;
-    p = rs;
-
-    do {
-        if (rs->flags & LB_RS_F_AVAILABLE)
-            goto hit;
-        rs = LIST_NEXT(rs, next);
-        if (rs == NULL)
-            rs = LIST_FIRST(&vs->real_services);
-    } while (rs != p);
 
-    return NULL;
+    i = rr->cores[lcore_id].index + 1;
+    if (i >= t->nb_rs)
+        i = 0;
+    rr->cores[lcore_id].index = i;
+    rs = t->rss[i];
 
-hit:
     SCHED_PRINT(
         "RR: lcore%u, vip=" IPv4_BE_FMT ", vport=%u, proto=%u, rip=" IPv4_BE_FMT
         ", rport=%u, weight=%u\n",
         lcore_id, IPv4_BE_ARG(vs->vip), rte_be_to_cpu_16(vs->vport), vs->proto,
         IPv4_BE_ARG(rs->rip), rte_be_to_cpu_16(rs->rport), rs->weight);
-    p = LIST_NEXT(rs, next);
-    if (p == NULL)
-        p = LIST_FIRST(&vs->real_services);
-    rr->real_services[lcore_id] = p;
     return rs;
 }
 
-struct wrr_data {
-    struct {
-        struct lb_real_service *real_service;
-        int cw;
-    } __rte_cache_aligned cores[RTE_MAX_LCORE];
-    int mw;
-    int dw;
-};
+static struct lb_real_service *
+wrr_schedule(struct lb_virt_service *vs, __rte_unused uint32_t ip,
+             __rte_unused uint16_t port) {
+    uint32_t lcore_id = rte_lcore_id();
+    struct rr_data *rr = vs->sched_data;
+    struct sched_rs_table *t;
+    struct lb_real_service *rs;
+    uint32_t i, cw;
 
-static int
-wrr_sched_init(struct lb_virt_service *vs) {
-    struct wrr_data *wrr;
+    if (unlikely(rr == NULL))
+        return NULL;
+    t = rr->table;
+    if (t == NULL)
+        return NULL;
 
-    wrr = rte_zmalloc_socket(NULL, sizeof(struct wrr_data), RTE_CACHE_LINE_SIZE,
-                             vs->socket_id);
-    return (vs->sched_data = wrr) != NULL ? 0 : -1;
-}
+    i = rr->cores[lcore_id].index;
+    cw = rr->cores[lcore_id].cw;
+    if (cw > t->max_weight)
+        cw = t->max_weight;
+    for (;;) {
+        if (++i >= t->nb_rs) {
+            i = 0;
+            if (cw <= t->gcd_weight)
+                cw = t->max_weight;
+            else
+                cw -= t->gcd_weight;
+        }
+        if (t->weights[i] >= cw)
+            break;
+    }
+    rr->cores[lcore_id].index = i;
+    rr->cores[lcore_id].cw = cw;
+    rs = t->rss[i];
 
-static void
-wrr_sched_fini(struct lb_virt_service *vs) {
-    rte_free(vs->sched_data);
+    SCHED_PRINT(
+        "WRR: lcore%u, vip=" IPv4_BE_FMT
+        ", vport=%u, proto=%u, rip=" IPv4_BE_FMT ", rport=%u, weight=%u\n",
+        lcore_id, IPv4_BE_ARG(vs->vip), rte_be_to_cpu_16(vs->vport), vs->proto,
+        IPv4_BE_ARG(rs->rip), rte_be_to_cpu_16(rs->rport), rs->weight);
+    return rs;
 }
 
+/*
+ * Least connections with power-of-two-choices: dispatch samples two
+ * available backends and takes the one with fewer active conns, scaled by
+ * weight for wlc. The shared counters are only read on this path.
+ */
+struct lc_data {
+    struct sched_rs_table *volatile table;
+    int weighted;
+    struct {
+        uint64_t seed;
+    } __rte_cache_aligned cores[RTE_MAX_LCORE];
+};
+
 static int
-wrr_max_weight(struct lb_virt_service *vs) {
-    struct lb_real_service *rs;
-    int max = 0;
+lc_sched_init_common(struct lb_virt_service *vs, int weighted) {
+    struct lc_data *lc;
+    uint32_t lcore_id;
 
-    LIST_FOREACH(rs, &vs->real_services, next) {
-        if (!(rs->flags & LB_RS_F_AVAILABLE))
-            continue;
-        if (max < rs->weight)
-            max = rs->weight;
+    lc = rte_zmalloc_socket(NULL, sizeof(struct lc_data), RTE_CACHE_LINE_SIZE,
+                            vs->socket_id);
+    if (lc == NULL)
+        return -1;
+    lc->weighted = weighted;
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        lc->cores[lcore_id].seed = rte_rdtsc() ^ ((uint64_t)lcore_id << 32) ^
+                                   (uintptr_t)vs;
+        if (lc->cores[lcore_id].seed == 0)
+            lc->cores[lcore_id].seed = 1;
     }
-    return max;
+    vs->sched_data = lc;
+    return 0;
 }
 
 static int
-gcd(int a, int b) {
-    int c;
-
-    while ((c = a % b)) {
-        a = b;
-        b = c;
-    }
-    return b;
+lc_sched_init(struct lb_virt_service *vs) {
+    return lc_sched_init_common(vs, 0);
 }
 
 static int
-wrr_gcd_weight(struct lb_virt_service *vs) {
-    struct lb_real_service *rs;
-    int g = 0;
-
-    LIST_FOREACH(rs, &vs->real_services, next) {
-        if (!(rs->flags & LB_RS_F_AVAILABLE))
-            continue;
-        if (rs->weight == 0)
-            continue;
-        if (g == 0)
-            g = rs->weight;
-        else
-            g = gcd(g, rs->weight);
-    }
-    return g ? g : 1;
+wlc_sched_init(struct lb_virt_service *vs) {
+    return lc_sched_init_common(vs, 1);
 }
 
 static void
-wrr_update_weight(struct lb_virt_service *vs) {
-    struct wrr_data *wrr = vs->sched_data;
-    struct lb_real_service *real_service;
-    uint32_t lcore_id;
-    int weight = 0;
+lc_sched_fini(struct lb_virt_service *vs) {
+    struct lc_data *lc = vs->sched_data;
 
-    if (unlikely(wrr == NULL))
-        return;
-
-    wrr->mw = wrr_max_weight(vs);
-    wrr->dw = wrr_gcd_weight(vs);
-    LIST_FOREACH(real_service, &vs->real_services, next) {
-        if ((real_service->flags & LB_RS_F_AVAILABLE) &&
-            (real_service->weight != 0)) {
-            weight = real_service->weight;
-            break;
-        }
-    }
-    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
-        wrr->cores[lcore_id].real_service = real_service;
-        wrr->cores[lcore_id].cw = weight;
-    }
+    if (lc != NULL)
+        rte_free(lc->table);
+    rte_free(lc);
+    vs->sched_data = NULL;
 }
 
 static int
-wrr_sched_add(struct lb_virt_service *vs,
-              __rte_unused struct lb_real_service *rs) {
-    wrr_update_weight(vs);
+lc_table_rebuild(struct lb_virt_service *vs, struct lb_real_service *exclude) {
+    struct lc_data *lc = vs->sched_data;
+    struct sched_rs_table *t;
+
+    if (unlikely(lc == NULL))
+        return -1;
+    if (sched_rs_table_build(vs, exclude, lc->weighted, &t) < 0)
+        return -1;
+    sched_table_swap((void *volatile *)&lc->table, t);
     return 0;
 }
 
 static int
-wrr_sched_del(struct lb_virt_service *vs,
-              __rte_unused struct lb_real_service *rs) {
-    wrr_update_weight(vs);
-    return 0;
+lc_sched_add(struct lb_virt_service *vs,
+             __rte_unused struct lb_real_service *rs) {
+    return lc_table_rebuild(vs, NULL);
 }
 
 static int
-wrr_sched_update(struct lb_virt_service *vs,
-                 __rte_unused struct lb_real_service *rs) {
-    wrr_update_weight(vs);
-    return 0;
+lc_sched_del(struct lb_virt_service *vs, struct lb_real_service *rs) {
+    return lc_table_rebuild(vs, rs);
+}
+
+static int
+lc_sched_update(struct lb_virt_service *vs,
+                __rte_unused struct lb_real_service *rs) {
+    struct lc_data *lc = vs->sched_data;
+
+    if (unlikely(lc == NULL))
+        return -1;
+    return lc->weighted ? lc_table_rebuild(vs, NULL) : 0;
+}
+
+static inline uint64_t
+lc_rand(uint64_t *seed) {
+    uint64_t x = *seed;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *seed = x;
+    return x * 0x2545f4914f6cdd1dULL;
 }
 
 static struct lb_real_service *
-wrr_schedule(struct lb_virt_service *vs, __rte_unused uint32_t ip,
-             __rte_unused uint16_t port) {
+lc_schedule(struct lb_virt_service *vs, __rte_unused uint32_t ip,
+            __rte_unused uint16_t port) {
     uint32_t lcore_id = rte_lcore_id();
-    struct wrr_data *wrr = vs->sched_data;
-    struct lb_real_service *rs, *p;
-    int cw;
+    struct lc_data *lc = vs->sched_data;
+    struct sched_rs_table *t;
+    struct lb_real_service *rs;
+    uint32_t i, j;
+    uint64_t r;
+    uint64_t ci, cj;
 
-    if (unlikely(wrr == NULL))
+    if (unlikely(lc == NULL))
         return NULL;
-
-    cw = wrr->cores[lcore_id].cw;
-    rs = wrr->cores[lcore_id].real_service;
-    if (rs == NULL)
+    t = lc->table;
+    if (t == NULL)
         return NULL;
-    p = rs;
-
-    cw -= wrr->dw;
-    if (cw >= 0)
-        goto hit;
-
-    do {
-        rs = LIST_NEXT(rs, next);
-        if (rs == NULL)
-            rs = LIST_FIRST(&vs->real_services);
-        if (rs->flags & LB_RS_F_AVAILABLE) {
-            cw = rs->weight;
-            cw -= wrr->dw;
-            if (cw >= 0)
-                goto hit;
-        }
-    } while (rs != p);
+    if (t->nb_rs == 1)
+        return t->rss[0];
 
-    return NULL;
+    r = lc_rand(&lc->cores[lcore_id].seed);
+    i = (uint32_t)r % t->nb_rs;
+    j = (i + 1 + (uint32_t)(r >> 32) % (t->nb_rs - 1)) % t->nb_rs;
+
+    /* ci / wi <= cj / wj */
+    ci = (uint64_t)rte_atomic32_read(&t->rss[i]->active_conns) * t->weights[j];
+    cj = (uint64_t)rte_atomic32_read(&t->rss[j]->active_conns) * t->weights[i];
+    rs = ci <= cj ? t->rss[i] : t->rss[j];
 
-hit:
     SCHED_PRINT(
-        "WRR: lcore%u, vip=" IPv4_BE_FMT
-        ", vport=%u, proto=%u, rip=" IPv4_BE_FMT ", rport=%u, weight=%u\n",
+        "LC: lcore%u, vip=" IPv4_BE_FMT ", vport=%u, proto=%u, rip=" IPv4_BE_FMT
+        ", rport=%u, weight=%u\n",
         lcore_id, IPv4_BE_ARG(vs->vip), rte_be_to_cpu_16(vs->vport), vs->proto,
         IPv4_BE_ARG(rs->rip), rte_be_to_cpu_16(rs->rport), rs->weight);
-    wrr->cores[lcore_id].cw = cw;
-    wrr->cores[lcore_id].real_service = rs;
     return rs;
 }
 
@@ -367,6 +685,8 @@ enum sched_type {
     LB_SCHED_T_IPONLY,
     LB_SCHED_T_RR,
     LB_SCHED_T_WRR,
+    LB_SCHED_T_LC,
+    LB_SCHED_T_WLC,
     LB_SCHED_T_NONE,
 };
 
@@ -374,22 +694,22 @@ static const struct lb_scheduler schedulers[LB_SCHED_T_NONE] = {
     [LB_SCHED_T_IPPORT] =
         {
             .name = "ipport",
-            .init = conhash_sched_init,
-            .fini = conhash_sched_fini,
-            .add = conhash_sched_add,
-            .del = conhash_sched_del,
-            .update = conhash_sched_update,
-            .dispatch = conhash_schedule_ipport,
+            .init = maglev_sched_init,
+            .fini = maglev_sched_fini,
+            .add = maglev_sched_add,
+            .del = maglev_sched_del,
+            .update = maglev_sched_update,
+            .dispatch = maglev_schedule_ipport,
         },
     [LB_SCHED_T_IPONLY] =
         {
             .name = "iponly",
-            .init = conhash_sched_init,
-            .fini = conhash_sched_fini,
-            .add = conhash_sched_add,
-            .del = conhash_sched_del,
-            .update = conhash_sched_update,
-            .dispatch = conhash_schedule_iponly,
+            .init = maglev_sched_init,
+            .fini = maglev_sched_fini,
+            .add = maglev_sched_add,
+            .del = maglev_sched_del,
+            .update = maglev_sched_update,
+            .dispatch = maglev_schedule_iponly,
         },
     [LB_SCHED_T_RR] =
         {
@@ -405,12 +725,32 @@ static const struct lb_scheduler schedulers[LB_SCHED_T_NONE] = {
         {
             .name = "wrr",
             .init = wrr_sched_init,
-            .fini = wrr_sched_fini,
-            .add = wrr_sched_add,
-            .del = wrr_sched_del,
-            .update = wrr_sched_update,
+            .fini = rr_sched_fini,
+            .add = rr_sched_add,
+            .del = rr_sched_del,
+            .update = rr_sched_update,
             .dispatch = wrr_schedule,
         },
+    [LB_SCHED_T_LC] =
+        {
+            .name = "lc",
+            .init = lc_sched_init,
+            .fini = lc_sched_fini,
+            .add = lc_sched_add,
+            .del = lc_sched_del,
+            .update = lc_sched_update,
+            .dispatch = lc_schedule,
+        },
+    [LB_SCHED_T_WLC] =
+        {
+            .name = "wlc",
+            .init = wlc_sched_init,
+            .fini = lc_sched_fini,
+            .add = lc_sched_add,
+            .del = lc_sched_del,
+            .update = lc_sched_update,
+            .dispatch = lc_schedule,
+        },
 };
 
 int
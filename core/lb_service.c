@@ -9,6 +9,7 @@
 #include <rte_log.h>
 #include <rte_malloc.h>
 #include <rte_rwlock.h>
+#include <rte_timer.h>
 
 #include <unixctl_command.h>
 
@@ -16,30 +17,51 @@
 #include "lb_device.h"
 #include "lb_format.h"
 #include "lb_parser.h"
+#include "lb_rcu.h"
 #include "lb_scheduler.h"
 #include "lb_service.h"
 
 #define virt_service_key(ip, port, proto)                                      \
     (((uint64_t)(ip) << 32) | ((uint64_t)(port) << 16) | (uint64_t)(proto))
 
+/*
+ * rte_hash does not allow lookups concurrent with updates, so each table
+ * is kept twice. Workers look up the active copy without locks, writers
+ * update the standby copy, flip active, wait for a grace period and then
+ * replay the update on the other copy.
+ */
 struct lb_vs_table {
-    struct rte_hash *vs_htbl;
-    struct rte_hash *vip_htbl;
-    rte_rwlock_t rwlock;
+    struct rte_hash *vs_htbl[2];
+    struct rte_hash *vip_htbl[2];
+    volatile uint32_t active;
 } __rte_cache_aligned;
 
-#define LB_VS_TBL_WLOCK(t) rte_rwlock_write_lock(&(t)->rwlock)
-#define LB_VS_TBL_WUNLOCK(t) rte_rwlock_write_unlock(&(t)->rwlock)
-#define LB_VS_TBL_RLOCK(t) rte_rwlock_read_lock(&(t)->rwlock)
-#define LB_VS_TBL_RUNLOCK(t) rte_rwlock_read_unlock(&(t)->rwlock)
+#define VS_HTBL(t) ((t)->vs_htbl[(t)->active])
+#define VIP_HTBL(t) ((t)->vip_htbl[(t)->active])
 
+/* Serializes the writers of a virt service, workers never take it. */
 #define LB_VS_WLOCK(t) rte_rwlock_write_lock(&(t)->rwlock)
 #define LB_VS_WUNLOCK(t) rte_rwlock_write_unlock(&(t)->rwlock)
-#define LB_VS_RLOCK(t) rte_rwlock_read_lock(&(t)->rwlock)
-#define LB_VS_RUNLOCK(t) rte_rwlock_read_unlock(&(t)->rwlock)
+
+#define RS_GC_CYCLE SEC_TO_CYCLES(1)
+#define STATS_SAMPLE_CYCLE SEC_TO_CYCLES(1)
 
 static struct lb_vs_table *lb_vs_tbls[RTE_MAX_NUMA_NODES];
 
+/* Real services waiting for the conns of all lcores to go away. */
+static LIST_HEAD(, lb_real_service) rs_gc_list;
+static struct rte_timer rs_gc_timer;
+
+static void rs_gc_timer_cb(struct rte_timer *timer, void *arg);
+
+static struct rte_timer stats_sample_timer;
+
+static void stats_sample_timer_cb(struct rte_timer *timer, void *arg);
+
+uint16_t lb_service_stats_idx[RTE_MAX_LCORE];
+/* Worker slots of the largest socket plus the shared spare slot. */
+static uint16_t service_stats_nb;
+
 static inline uint32_t
 vs_tbl_get_next(int sid) {
     sid++;
@@ -57,6 +79,106 @@ vs_tbl_get_next(int sid) {
     for (socket_id = vs_tbl_get_next(-1); socket_id < RTE_MAX_NUMA_NODES;      \
          socket_id = vs_tbl_get_next(socket_id))
 
+/*
+ * Give the worker lcores of each socket consecutive arena slots. A service
+ * is only touched by the workers of its own socket, so slots are reused
+ * across sockets.
+ */
+static void
+service_stats_init(void) {
+    uint16_t nb[RTE_MAX_NUMA_NODES] = {0};
+    uint32_t lcore_id, socket_id;
+    uint16_t devid;
+    struct lb_device *dev;
+    int worker;
+
+    for (lcore_id = 0; lcore_id < RTE_MAX_LCORE; lcore_id++)
+        lb_service_stats_idx[lcore_id] = UINT16_MAX;
+
+    service_stats_nb = 0;
+    RTE_LCORE_FOREACH_SLAVE(lcore_id) {
+        worker = 0;
+        LB_DEVICE_FOREACH(devid, dev) {
+            if (dev->lcore_conf[lcore_id].rxq_enable)
+                worker = 1;
+        }
+        if (!worker)
+            continue;
+        socket_id = rte_lcore_to_socket_id(lcore_id);
+        lb_service_stats_idx[lcore_id] = nb[socket_id]++;
+        if (nb[socket_id] > service_stats_nb)
+            service_stats_nb = nb[socket_id];
+    }
+
+    for (lcore_id = 0; lcore_id < RTE_MAX_LCORE; lcore_id++) {
+        if (lb_service_stats_idx[lcore_id] == UINT16_MAX)
+            lb_service_stats_idx[lcore_id] = service_stats_nb;
+    }
+    service_stats_nb += 1;
+}
+
+static struct lb_service_stats *
+service_stats_alloc(uint32_t socket_id) {
+    return rte_zmalloc_socket("service_stats",
+                              service_stats_nb * sizeof(struct lb_service_stats),
+                              RTE_CACHE_LINE_SIZE, socket_id);
+}
+
+void
+lb_service_stats_read(struct lb_service_stats *stats,
+                      const struct lb_service_stats_snap *snap,
+                      struct lb_service_stats_sum *sum) {
+    uint16_t i;
+    int dir;
+
+    for (i = 0; i < service_stats_nb; i++) {
+        for (dir = 0; dir < LB_DIR_MAX; dir++) {
+            sum->packets[dir] += stats[i].packets[dir];
+            sum->bytes[dir] += stats[i].bytes[dir];
+            sum->drops[dir] += stats[i].drops[dir];
+        }
+        sum->conns += stats[i].conns;
+    }
+    for (dir = 0; dir < LB_DIR_MAX; dir++) {
+        sum->pps[dir] += snap->pps[dir];
+        sum->bps[dir] += snap->bps[dir];
+    }
+    sum->cps += snap->cps;
+}
+
+static void
+service_stats_sample(struct lb_service_stats *stats,
+                     struct lb_service_stats_snap *snap) {
+    struct lb_service_stats_snap now;
+    uint64_t cycles = 0;
+    double hz = (double)rte_get_tsc_hz();
+    uint16_t i;
+    int dir;
+
+    memset(&now, 0, sizeof(now));
+    for (i = 0; i < service_stats_nb; i++) {
+        for (dir = 0; dir < LB_DIR_MAX; dir++) {
+            now.packets[dir] += stats[i].packets[dir];
+            now.bytes[dir] += stats[i].bytes[dir];
+        }
+        now.conns += stats[i].conns;
+    }
+    now.cycles = rte_rdtsc();
+    if (snap->cycles != 0)
+        cycles = now.cycles - snap->cycles;
+
+    if (cycles > 0) {
+        for (dir = 0; dir < LB_DIR_MAX; dir++) {
+            now.pps[dir] =
+                (now.packets[dir] - snap->packets[dir]) * hz / cycles;
+            now.bps[dir] =
+                (now.bytes[dir] - snap->bytes[dir]) * 8 * hz / cycles;
+        }
+        now.cps = (now.conns - snap->conns) * hz / cycles;
+    }
+    *snap = now;
+}
+
 int
 lb_service_init(void) {
     uint16_t devid;
@@ -65,6 +187,7 @@ lb_service_init(void) {
     char name[RTE_HASH_NAMESIZE];
     struct rte_hash_parameters param;
     struct lb_vs_table *t;
+    uint32_t i;
 
     LB_DEVICE_FOREACH(devid, dev) {
         socket_id = dev->socket_id;
@@ -78,41 +201,50 @@ lb_service_init(void) {
             return -1;
         }
 
-        memset(&param, 0, sizeof(param));
-        snprintf(name, sizeof(name), "vs_htbl%u", socket_id);
-        param.name = name;
-        param.entries = LB_MAX_VS;
-        param.key_len = sizeof(uint64_t);
-        param.socket_id = socket_id;
-        param.hash_func = rte_hash_crc;
-
-        t->vs_htbl = rte_hash_create(&param);
-        if (t->vs_htbl == NULL) {
-            RTE_LOG(ERR, USER1, "%s(): Create hash table %s failed, %s.",
-                    __func__, name, rte_strerror(rte_errno));
-            return -1;
-        }
+        for (i = 0; i < 2; i++) {
+            memset(&param, 0, sizeof(param));
+            snprintf(name, sizeof(name), "vs_htbl%u_%u", socket_id, i);
+            param.name = name;
+            param.entries = LB_MAX_VS;
+            param.key_len = sizeof(uint64_t);
+            param.socket_id = socket_id;
+            param.hash_func = rte_hash_crc;
+
+            t->vs_htbl[i] = rte_hash_create(&param);
+            if (t->vs_htbl[i] == NULL) {
+                RTE_LOG(ERR, USER1, "%s(): Create hash table %s failed, %s.",
+                        __func__, name, rte_strerror(rte_errno));
+                return -1;
+            }
 
-        memset(&param, 0, sizeof(param));
-        snprintf(name, sizeof(name), "vip_htbl%u", socket_id);
-        param.name = name;
-        param.entries = LB_MAX_VS;
-        param.key_len = sizeof(uint32_t);
-        param.socket_id = socket_id;
-        param.hash_func = rte_hash_crc;
-
-        t->vip_htbl = rte_hash_create(&param);
-        if (t->vip_htbl == NULL) {
-            RTE_LOG(ERR, USER1, "%s(): Create hash table %s failed, %s.",
-                    __func__, name, rte_strerror(rte_errno));
-            return -1;
+            memset(&param, 0, sizeof(param));
+            snprintf(name, sizeof(name), "vip_htbl%u_%u", socket_id, i);
+            param.name = name;
+            param.entries = LB_MAX_VS;
+            param.key_len = sizeof(uint32_t);
+            param.socket_id = socket_id;
+            param.hash_func = rte_hash_crc;
+
+            t->vip_htbl[i] = rte_hash_create(&param);
+            if (t->vip_htbl[i] == NULL) {
+                RTE_LOG(ERR, USER1, "%s(): Create hash table %s failed, %s.",
+                        __func__, name, rte_strerror(rte_errno));
+                return -1;
+            }
         }
 
-        rte_rwlock_init(&t->rwlock);
-
         lb_vs_tbls[socket_id] = t;
     }
 
+    service_stats_init();
+
+    rte_timer_init(&rs_gc_timer);
+    rte_timer_reset(&rs_gc_timer, RS_GC_CYCLE, PERIODICAL,
+                    rte_get_master_lcore(), rs_gc_timer_cb, NULL);
+    rte_timer_init(&stats_sample_timer);
+    rte_timer_reset(&stats_sample_timer, STATS_SAMPLE_CYCLE, PERIODICAL,
+                    rte_get_master_lcore(), stats_sample_timer_cb, NULL);
+
     return 0;
 }
 
@@ -121,7 +253,7 @@ lb_is_vip_exist(uint32_t vip) {
     struct lb_vs_table *t;
 
     t = lb_vs_tbls[rte_socket_id()];
-    return rte_hash_lookup(t->vip_htbl, &vip) >= 0;
+    return rte_hash_lookup(VIP_HTBL(t), &vip) >= 0;
 }
 
 static struct lb_virt_service *
@@ -131,52 +263,54 @@ vs_tbl_find(struct lb_vs_table *t, uint32_t vip, uint16_t vport,
     uint64_t key;
 
     key = virt_service_key(vip, vport, proto);
-    rte_hash_lookup_data(t->vs_htbl, &key, (void **)&vs);
+    rte_hash_lookup_data(VS_HTBL(t), &key, (void **)&vs);
 
     return vs;
 }
 
 static int
-vs_tbl_add(struct lb_vs_table *t, struct lb_virt_service *vs) {
+__vs_tbl_add(struct rte_hash *vs_htbl, struct rte_hash *vip_htbl,
+             struct lb_virt_service *vs) {
     uint64_t key;
     int rc;
     void *p;
     uint32_t count = 0;
 
     key = virt_service_key(vs->vip, vs->vport, vs->proto);
-    rc = rte_hash_add_key_data(t->vs_htbl, &key, vs);
+    rc = rte_hash_add_key_data(vs_htbl, &key, vs);
     if (rc < 0) {
         return rc;
     }
 
-    rc = rte_hash_lookup_data(t->vip_htbl, &vs->vip, &p);
+    rc = rte_hash_lookup_data(vip_htbl, &vs->vip, &p);
     if (rc == 0) {
         count = (uint32_t)(uintptr_t)p;
     }
     count += 1;
 
-    rc = rte_hash_add_key_data(t->vip_htbl, &vs->vip, (void *)(uintptr_t)count);
+    rc = rte_hash_add_key_data(vip_htbl, &vs->vip, (void *)(uintptr_t)count);
     if (unlikely(rc < 0)) {
-        rte_hash_del_key(t->vs_htbl, &key);
+        rte_hash_del_key(vs_htbl, &key);
     }
 
     return rc;
 }
 
 static void
-vs_tbl_del(struct lb_vs_table *t, struct lb_virt_service *vs) {
+__vs_tbl_del(struct rte_hash *vs_htbl, struct rte_hash *vip_htbl,
+             struct lb_virt_service *vs) {
     uint64_t key;
     int rc;
     void *p;
     uint32_t count;
 
     key = virt_service_key(vs->vip, vs->vport, vs->proto);
-    rc = rte_hash_del_key(t->vs_htbl, &key);
+    rc = rte_hash_del_key(vs_htbl, &key);
     if (rc < 0) {
         return;
     }
 
-    rc = rte_hash_lookup_data(t->vip_htbl, &vs->vip, &p);
+    rc = rte_hash_lookup_data(vip_htbl, &vs->vip, &p);
     if (unlikely(rc < 0)) {
         return;
     }
@@ -184,12 +318,46 @@ vs_tbl_del(struct lb_vs_table *t, struct lb_virt_service *vs) {
     count = (uint32_t)(uintptr_t)p;
     count -= 1;
     if (count == 0) {
-        rte_hash_del_key(t->vip_htbl, &key);
+        rte_hash_del_key(vip_htbl, &vs->vip);
     } else {
-        rte_hash_add_key_data(t->vip_htbl, &vs->vip, (void *)(uintptr_t)count);
+        rte_hash_add_key_data(vip_htbl, &vs->vip, (void *)(uintptr_t)count);
     }
 }
 
+static void
+vs_tbl_flip(struct lb_vs_table *t) {
+    rte_smp_wmb();
+    t->active = !t->active;
+    lb_rcu_synchronize();
+}
+
+static int
+vs_tbl_add(struct lb_vs_table *t, struct lb_virt_service *vs) {
+    uint32_t standby = !t->active;
+    int rc;
+
+    rc = __vs_tbl_add(t->vs_htbl[standby], t->vip_htbl[standby], vs);
+    if (rc < 0)
+        return rc;
+    vs_tbl_flip(t);
+
+    rc = __vs_tbl_add(t->vs_htbl[!standby], t->vip_htbl[!standby], vs);
+    if (unlikely(rc < 0)) {
+        vs_tbl_flip(t);
+        __vs_tbl_del(t->vs_htbl[standby], t->vip_htbl[standby], vs);
+    }
+    return rc;
+}
+
+static void
+vs_tbl_del(struct lb_vs_table *t, struct lb_virt_service *vs) {
+    uint32_t standby = !t->active;
+
+    __vs_tbl_del(t->vs_htbl[standby], t->vip_htbl[standby], vs);
+    vs_tbl_flip(t);
+    __vs_tbl_del(t->vs_htbl[!standby], t->vip_htbl[!standby], vs);
+}
+
 static struct lb_real_service *
 vs_find_rs(struct lb_virt_service *vs, uint32_t rip, uint16_t rport) {
     struct lb_real_service *rs;
@@ -233,41 +401,24 @@ lb_rs_list_update_by_weight(struct lb_virt_service *vs,
 
 struct lb_virt_service *
 lb_vs_get(uint32_t vip, uint16_t vport, uint8_t proto) {
-    uint32_t socket_id = rte_socket_id();
-    struct lb_virt_service *vs;
-
-    LB_VS_TBL_RLOCK(lb_vs_tbls[socket_id]);
-    vs = vs_tbl_find(lb_vs_tbls[socket_id], vip, vport, proto);
-    if (vs != NULL) {
-        rte_atomic32_add(&vs->refcnt, 1);
-    }
-    LB_VS_TBL_RUNLOCK(lb_vs_tbls[socket_id]);
-
-    return vs;
-}
-
-void
-lb_vs_put(struct lb_virt_service *vs) {
-    lb_vs_free(vs);
+    return vs_tbl_find(lb_vs_tbls[rte_socket_id()], vip, vport, proto);
 }
 
 struct lb_real_service *
 lb_vs_get_rs(struct lb_virt_service *vs, uint32_t cip, uint16_t cport) {
     struct lb_real_service *rs;
 
-    LB_VS_RLOCK(vs);
     rs = vs->sched->dispatch(vs, cip, cport);
     if (rs != NULL) {
-        rte_atomic32_add(&rs->refcnt, 1);
+        lb_service_stats_get(rs->stats, rte_lcore_id())->refcnt++;
     }
-    LB_VS_RUNLOCK(vs);
 
     return rs;
 }
 
 void
 lb_vs_put_rs(struct lb_real_service *rs) {
-    lb_rs_free(rs);
+    lb_service_stats_get(rs->stats, rte_lcore_id())->refcnt--;
 }
 
 static struct lb_virt_service *
@@ -279,7 +430,14 @@ lb_vs_alloc(uint32_t vip, uint16_t vport, uint8_t proto,
     if (vs == NULL)
         return NULL;
 
+    vs->stats = service_stats_alloc(socket_id);
+    if (vs->stats == NULL) {
+        rte_free(vs);
+        return NULL;
+    }
+
     if (sched->init && sched->init(vs) < 0) {
+        rte_free(vs->stats);
         rte_free(vs);
         return NULL;
     }
@@ -304,6 +462,7 @@ lb_vs_free(struct lb_virt_service *vs) {
         return;
     if (vs->sched->fini)
         vs->sched->fini(vs);
+    rte_free(vs->stats);
     rte_free(vs);
 }
 
@@ -317,25 +476,85 @@ lb_rs_alloc(uint32_t rip, uint32_t rport, int weight,
     if (rs == NULL)
         return NULL;
 
+    rs->stats = service_stats_alloc(vs->socket_id);
+    if (rs->stats == NULL) {
+        rte_free(rs);
+        return NULL;
+    }
+
     rs->rip = rip;
     rs->rport = rport;
     rs->proto = vs->proto;
     rs->weight = weight;
     rs->virt_service = vs;
     rte_atomic32_add(&vs->refcnt, 1);
-    rte_atomic32_set(&rs->refcnt, 1);
 
     return rs;
 }
 
+static int
+rs_in_use(struct lb_real_service *rs) {
+    uint16_t i;
+    int64_t refcnt = 0;
+
+    for (i = 0; i < service_stats_nb; i++) {
+        refcnt += *(volatile int64_t *)&rs->stats[i].refcnt;
+    }
+    return refcnt != 0;
+}
+
+static void
+rs_gc_timer_cb(__attribute__((unused)) struct rte_timer *timer,
+               __attribute__((unused)) void *arg) {
+    struct lb_real_service *rs, *next;
+
+    if (LIST_EMPTY(&rs_gc_list))
+        return;
+
+    /* Let lb_vs_get_rs() calls that might still see them finish. */
+    lb_rcu_synchronize();
+    for (rs = LIST_FIRST(&rs_gc_list); rs != NULL; rs = next) {
+        next = LIST_NEXT(rs, gc_next);
+        if (rs_in_use(rs))
+            continue;
+        LIST_REMOVE(rs, gc_next);
+        lb_vs_free(rs->virt_service);
+        rte_free(rs->stats);
+        rte_free(rs);
+    }
+}
+
+/* The services only change on the master lcore, which runs this timer. */
+static void
+stats_sample_timer_cb(__attribute__((unused)) struct rte_timer *timer,
+                      __attribute__((unused)) void *arg) {
+    struct lb_virt_service *vs;
+    struct lb_real_service *rs;
+    uint32_t socket_id;
+    const void *key;
+    uint32_t pos;
+
+    VS_TBL_FOREACH_SOCKET(socket_id) {
+        pos = 0;
+        while (rte_hash_iterate(VS_HTBL(lb_vs_tbls[socket_id]), &key,
+                                (void **)&vs, &pos) >= 0) {
+            service_stats_sample(vs->stats, &vs->stats_snap);
+            LIST_FOREACH(rs, &vs->real_services, next) {
+                service_stats_sample(rs->stats, &rs->stats_snap);
+            }
+        }
+    }
+}
+
+/*
+ * The caller must have unlinked @rs from its virt service and scheduler.
+ * It is freed once no conn of any lcore refers to it.
+ */
 void
 lb_rs_free(struct lb_real_service *rs) {
     if (rs == NULL)
         return;
-    if (rte_atomic32_add_return(&rs->refcnt, -1) != 0)
-        return;
-    lb_vs_free(rs->virt_service);
-    rte_free(rs);
+    LIST_INSERT_HEAD(&rs_gc_list, rs, gc_next);
 }
 
 static void
@@ -411,9 +630,7 @@ vs_add_cmd_cb(int fd, char *argv[], int argc) {
     }
 
     VS_TBL_FOREACH_SOCKET(socket_id) {
-        LB_VS_TBL_WLOCK(lb_vs_tbls[socket_id]);
         rc = vs_tbl_add(lb_vs_tbls[socket_id], vss[socket_id]);
-        LB_VS_TBL_WUNLOCK(lb_vs_tbls[socket_id]);
         if (rc < 0) {
             unixctl_command_reply_error(fd, "No space in the table.\n");
             goto del_vss;
@@ -424,17 +641,16 @@ vs_add_cmd_cb(int fd, char *argv[], int argc) {
 
 del_vss:
     VS_TBL_FOREACH_SOCKET(socket_id) {
-        LB_VS_TBL_WLOCK(lb_vs_tbls[socket_id]);
         vs_tbl_del(lb_vs_tbls[socket_id], vss[socket_id]);
-        LB_VS_TBL_WUNLOCK(lb_vs_tbls[socket_id]);
     }
 
 free_vss:
     VS_TBL_FOREACH_SOCKET(socket_id) { lb_vs_free(vss[socket_id]); }
 }
 
-UNIXCTL_CMD_REGISTER("vs/add", "VIP:VPORT tcp|udp ipport|iponly|rr|wrr.",
-                     "Add virtual service.", 3, 3, vs_add_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH(
+    "vs/add", "VIP:VPORT tcp|udp ipport|iponly|rr|wrr|lc|wlc.",
+    "Add virtual service.", 3, 3, vs_add_cmd_cb);
 
 static int
 vs_del_arg_parse(char *argv[], __attribute((unused)) int argc, uint32_t *vip,
@@ -479,17 +695,15 @@ vs_del_cmd_cb(int fd, char *argv[], int argc) {
             vs_del_all_rs(vs);
             LB_VS_WUNLOCK(vs);
 
-            LB_VS_TBL_WLOCK(lb_vs_tbls[socket_id]);
             vs_tbl_del(lb_vs_tbls[socket_id], vs);
-            LB_VS_TBL_WUNLOCK(lb_vs_tbls[socket_id]);
 
             lb_vs_free(vs);
         }
     }
 }
 
-UNIXCTL_CMD_REGISTER("vs/del", "VIP:VPORT tcp|udp.", "Delete virtual service.",
-                     2, 2, vs_del_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH("vs/del", "VIP:VPORT tcp|udp.",
+                              "Delete virtual service.", 2, 2, vs_del_cmd_cb);
 
 static inline const char *
 l4proto_format(uint8_t l4proto) {
@@ -537,11 +751,11 @@ vs_list_cmd_cb(int fd, char *argv[], int argc) {
     VS_TBL_FOREACH_SOCKET(socket_id) {
         static const char *vs_list_header =
             "IP               Port   Type   Sched       Max_conns   synproxy  "
-            "toa  est_timeout\n";
+            "toa  ops  est_timeout\n";
         t = lb_vs_tbls[socket_id];
 
         unixctl_command_reply(fd, json_fmt ? "[" : vs_list_header);
-        while (rte_hash_iterate(t->vs_htbl, &key, (void **)&vs, &next) >= 0) {
+        while (rte_hash_iterate(VS_HTBL(t), &key, (void **)&vs, &next) >= 0) {
             ipv4_addr_tostring(vs->vip, buf, sizeof(buf));
 
             if (json_fmt) {
@@ -560,15 +774,19 @@ vs_list_cmd_cb(int fd, char *argv[], int argc) {
                                       !!(vs->flags & LB_VS_F_SYNPROXY));
                 unixctl_command_reply(fd, JSON_KV_32_FMT("toa", ","),
                                       !!(vs->flags & LB_VS_F_TOA));
+                unixctl_command_reply(fd, JSON_KV_32_FMT("ops", ","),
+                                      !!(vs->flags & LB_VS_F_OPS));
                 unixctl_command_reply(fd, JSON_KV_32_FMT("est_timeout", "}"),
                                       vs->est_timeout);
             } else {
                 unixctl_command_reply(
-                    fd, "%-15s  %-5u  %-5s  %-10s  %-10d  %-8u  %-3u  %-10u\n",
+                    fd,
+                    "%-15s  %-5u  %-5s  %-10s  %-10d  %-8u  %-3u  %-3u  %-10u\n",
                     buf, rte_be_to_cpu_16(vs->vport), l4proto_format(vs->proto),
                     vs->sched->name, vs->max_conns,
                     !!(vs->flags & LB_VS_F_SYNPROXY),
-                    !!(vs->flags & LB_VS_F_TOA), vs->est_timeout);
+                    !!(vs->flags & LB_VS_F_TOA), !!(vs->flags & LB_VS_F_OPS),
+                    vs->est_timeout);
             }
         }
         if (json_fmt)
@@ -577,8 +795,9 @@ vs_list_cmd_cb(int fd, char *argv[], int argc) {
         break;
     }
 }
-UNIXCTL_CMD_REGISTER("vs/list", "[--json].", "List all virtual services.", 0, 1,
-                     vs_list_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH("vs/list", "[--json].",
+                              "List all virtual services.", 0, 1,
+                              vs_list_cmd_cb);
 
 static int
 vs_synproxy_arg_parse(char *argv[], int argc, uint32_t *vip, uint16_t *vport,
@@ -646,8 +865,9 @@ vs_synproxy_cmd_cb(int fd, char *argv[], int argc) {
     return;
 }
 
-UNIXCTL_CMD_REGISTER("vs/synproxy", "VIP:VPORT tcp [0|1].",
-                     "Show or set synproxy.", 2, 3, vs_synproxy_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH("vs/synproxy", "VIP:VPORT tcp [0|1].",
+                              "Show or set synproxy.", 2, 3,
+                              vs_synproxy_cmd_cb);
 
 static int
 vs_toa_arg_parse(char *argv[], int argc, uint32_t *vip, uint16_t *vport,
@@ -715,8 +935,78 @@ vs_toa_cmd_cb(int fd, char *argv[], int argc) {
     return;
 }
 
-UNIXCTL_CMD_REGISTER("vs/toa", "VIP:VPORT tcp [0|1].", "Show or set toa.", 2, 3,
-                     vs_toa_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH("vs/toa", "VIP:VPORT tcp [0|1].",
+                              "Show or set toa.", 2, 3, vs_toa_cmd_cb);
+
+static int
+vs_ops_arg_parse(char *argv[], int argc, uint32_t *vip, uint16_t *vport,
+                 uint8_t *proto, uint8_t *echo, uint8_t *op) {
+    int rc;
+    int i = 0;
+
+    /* ip:port */
+    rc = parse_ipv4_port(argv[i++], vip, vport);
+    if (rc < 0)
+        return i - 1;
+
+    /*  proto */
+    rc = parse_l4_proto(argv[i++], proto);
+    if (rc < 0 || *proto != IPPROTO_UDP)
+        return i - 1;
+
+    if (i < argc) {
+        *echo = 0;
+        rc = parser_read_uint8(op, argv[i++]);
+        if (rc < 0)
+            return i - 1;
+    } else {
+        *echo = 1;
+    }
+
+    return i;
+}
+
+static void
+vs_ops_cmd_cb(int fd, char *argv[], int argc) {
+    uint32_t vip;
+    uint16_t vport;
+    uint8_t proto;
+    uint8_t echo = 0;
+    uint8_t op;
+    int rc;
+    struct lb_virt_service *vs;
+    uint32_t socket_id;
+
+    rc = vs_ops_arg_parse(argv, argc, &vip, &vport, &proto, &echo, &op);
+    if (rc != argc) {
+        unixctl_command_reply_error(fd, "Invalid parameter: %s.\n", argv[rc]);
+        return;
+    }
+
+    VS_TBL_FOREACH_SOCKET(socket_id) {
+        vs = vs_tbl_find(lb_vs_tbls[socket_id], vip, vport, proto);
+        if (vs == NULL) {
+            unixctl_command_reply_error(fd, "Cannot find virt service.\n");
+            return;
+        }
+        if (echo) {
+            unixctl_command_reply(fd, "%u\n", !!(vs->flags & LB_VS_F_OPS));
+            return;
+        }
+
+        if (op) {
+            vs->flags |= LB_VS_F_OPS;
+        } else {
+            vs->flags &= ~LB_VS_F_OPS;
+        }
+    }
+
+    return;
+}
+
+UNIXCTL_CMD_REGISTER_DATAPATH("vs/ops", "VIP:VPORT udp [0|1].",
+                              "Show or set one packet scheduling.", 2, 3,
+                              vs_ops_cmd_cb);
 
 static int
 vs_max_conn_arg_parse(char *argv[], int argc, uint32_t *vip, uint16_t *vport,
@@ -780,8 +1070,9 @@ vs_max_conn_cmd_cb(int fd, char *argv[], int argc) {
     return;
 }
 
-UNIXCTL_CMD_REGISTER("vs/max_conns", "VIP:VPORT tcp [0|1].",
-                     "Show or set max_conns.", 2, 3, vs_max_conn_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH("vs/max_conns", "VIP:VPORT tcp [0|1].",
+                              "Show or set max_conns.", 2, 3,
+                              vs_max_conn_cmd_cb);
 
 static int
 vs_est_timeout_arg_parse(char *argv[], int argc, uint32_t *vip, uint16_t *vport,
@@ -843,9 +1134,9 @@ vs_est_timeout_cmd_cb(int fd, char *argv[], int argc) {
     }
 }
 
-UNIXCTL_CMD_REGISTER("vs/est_timeout", "VIP:VPORT tcp|udp [SEC].",
-                     "Show or set TCP established timeout.", 2, 3,
-                     vs_est_timeout_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH("vs/est_timeout", "VIP:VPORT tcp|udp [SEC].",
+                              "Show or set TCP established timeout.", 2, 3,
+                              vs_est_timeout_cmd_cb);
 
 static int
 vs_scheduler_arg_parse(char *argv[], int argc, uint32_t *vip, uint16_t *vport,
@@ -877,13 +1168,25 @@ vs_scheduler_arg_parse(char *argv[], int argc, uint32_t *vip, uint16_t *vport,
     return i;
 }
 
+static struct lb_real_service *
+vs_sched_none_dispatch(__attribute__((unused)) struct lb_virt_service *vs,
+                       __attribute__((unused)) uint32_t cip,
+                       __attribute__((unused)) uint16_t cport) {
+    return NULL;
+}
+
+static const struct lb_scheduler vs_sched_none = {
+    .name = "none",
+    .dispatch = vs_sched_none_dispatch,
+};
+
 static void
 vs_scheduler_cmd_cb(int fd, char *argv[], int argc) {
     uint32_t vip;
     uint16_t vport;
     uint8_t proto;
     uint8_t echo = 0;
-    const struct lb_scheduler *sched;
+    const struct lb_scheduler *sched, *old_sched;
     int rc;
     struct lb_virt_service *vs;
     struct lb_real_service *rs;
@@ -910,19 +1213,21 @@ vs_scheduler_cmd_cb(int fd, char *argv[], int argc) {
         if (sched == vs->sched)
             break;
 
+        /* Park the VS on a scheduler that dispatches nothing while the
+         * old scheduler data is freed. */
         LB_VS_WLOCK(vs);
-        LIST_FOREACH(rs, &vs->real_services, next) {
-            if (rs->flags & LB_RS_F_AVAILABLE)
-                vs->sched->del(vs, rs);
-        }
-        if (vs->sched->fini)
-            vs->sched->fini(vs);
+        old_sched = vs->sched;
+        vs->sched = &vs_sched_none;
+        lb_rcu_synchronize();
+        if (old_sched->fini)
+            old_sched->fini(vs);
 
-        vs->sched = sched;
-        if (vs->sched->init && vs->sched->init(vs) < 0) {
+        if (sched->init && sched->init(vs) < 0) {
             LIST_FOREACH(rs, &vs->real_services, next) {
                 rs->flags &= ~LB_RS_F_AVAILABLE;
             }
+            vs->sched_data = NULL;
+            vs->sched = sched;
             LB_VS_WUNLOCK(vs);
             unixctl_command_reply_error(fd, "Cannot init scheduler %s.\n",
                                         sched->name);
@@ -930,17 +1235,19 @@ vs_scheduler_cmd_cb(int fd, char *argv[], int argc) {
         }
 
         LIST_FOREACH(rs, &vs->real_services, next) {
-            if ((rs->flags & LB_RS_F_AVAILABLE) && vs->sched->add(vs, rs) < 0) {
+            if ((rs->flags & LB_RS_F_AVAILABLE) && sched->add(vs, rs) < 0) {
                 rs->flags &= ~LB_RS_F_AVAILABLE;
             }
         }
+        rte_smp_wmb();
+        vs->sched = sched;
         LB_VS_WUNLOCK(vs);
     }
 }
 
-UNIXCTL_CMD_REGISTER("vs/scheduler",
-                     "VIP:VPORT tcp|udp [iponly|ipport|rr|wrr].",
-                     "Show or set scheduler.", 2, 3, vs_scheduler_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH(
+    "vs/scheduler", "VIP:VPORT tcp|udp [iponly|ipport|rr|wrr|lc|wlc].",
+    "Show or set scheduler.", 2, 3, vs_scheduler_cmd_cb);
 
 static int
 vs_stats_arg_parse(char *argv[], int argc, uint32_t *vip, uint16_t *vport,
@@ -979,10 +1286,9 @@ vs_stats_cmd_cb(int fd, char *argv[], int argc) {
     int rc;
     struct lb_virt_service *vs;
     struct lb_real_service *rs;
-    uint32_t socket_id, lcore_id;
-    uint64_t rx_packets[2] = {0}, rx_bytes[2] = {0}, rx_drops[2] = {0};
-    uint64_t tx_packets[2] = {0}, tx_bytes[2] = {0};
-    uint64_t active_conns = 0, history_conns = 0, max_conns = 0;
+    uint32_t socket_id;
+    struct lb_service_stats_sum rx, tx;
+    uint64_t active_conns = 0, max_conns = 0;
 
     rc = vs_stats_arg_parse(argv, argc, &vip, &vport, &proto, &json_fmt);
     if (rc != argc) {
@@ -990,6 +1296,8 @@ vs_stats_cmd_cb(int fd, char *argv[], int argc) {
         return;
     }
 
+    memset(&rx, 0, sizeof(rx));
+    memset(&tx, 0, sizeof(tx));
     VS_TBL_FOREACH_SOCKET(socket_id) {
         vs = vs_tbl_find(lb_vs_tbls[socket_id], vip, vport, proto);
         if (vs == NULL) {
@@ -997,23 +1305,10 @@ vs_stats_cmd_cb(int fd, char *argv[], int argc) {
             return;
         }
 
-        RTE_LCORE_FOREACH_SLAVE(lcore_id) {
-            rx_packets[0] += vs->stats[lcore_id].packets[0];
-            rx_packets[1] += vs->stats[lcore_id].packets[1];
-            rx_bytes[0] += vs->stats[lcore_id].bytes[0];
-            rx_bytes[1] += vs->stats[lcore_id].bytes[1];
-            rx_drops[0] += vs->stats[lcore_id].drops[0];
-            rx_drops[1] += vs->stats[lcore_id].drops[1];
-            history_conns += vs->stats[lcore_id].conns;
-        }
+        lb_service_stats_read(vs->stats, &vs->stats_snap, &rx);
         active_conns += (uint64_t)rte_atomic32_read(&vs->active_conns);
         LIST_FOREACH(rs, &vs->real_services, next) {
-            RTE_LCORE_FOREACH_SLAVE(lcore_id) {
-                tx_packets[0] += rs->stats[lcore_id].packets[0];
-                tx_packets[1] += rs->stats[lcore_id].packets[1];
-                tx_bytes[0] += rs->stats[lcore_id].bytes[0];
-                tx_bytes[1] += rs->stats[lcore_id].bytes[1];
-            }
+            lb_service_stats_read(rs->stats, &rs->stats_snap, &tx);
         }
 
         max_conns = vs->max_conns;
@@ -1033,56 +1328,78 @@ vs_stats_cmd_cb(int fd, char *argv[], int argc) {
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("history-conns", ",")
                                    : NORM_KV_64_FMT("history-conns", "\n"),
-                          history_conns);
+                          rx.conns);
 
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[c2v]packets", ",")
                                    : NORM_KV_64_FMT("[c2v]packets", "\n"),
-                          rx_packets[0]);
+                          rx.packets[0]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[c2v]bytes", ",")
                                    : NORM_KV_64_FMT("[c2v]bytes", "\n"),
-                          rx_bytes[0]);
+                          rx.bytes[0]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[c2v]drops", ",")
                                    : NORM_KV_64_FMT("[c2v]drops", "\n"),
-                          rx_drops[0]);
+                          rx.drops[0]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[r2v]packets", ",")
                                    : NORM_KV_64_FMT("[r2v]packets", "\n"),
-                          rx_packets[1]);
+                          rx.packets[1]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[r2v]bytes", ",")
                                    : NORM_KV_64_FMT("[r2v]bytes", "\n"),
-                          rx_bytes[1]);
+                          rx.bytes[1]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[r2v]drops", ",")
                                    : NORM_KV_64_FMT("[r2v]drops", "\n"),
-                          rx_drops[1]);
+                          rx.drops[1]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[v2r]packets", ",")
                                    : NORM_KV_64_FMT("[v2r]packets", "\n"),
-                          tx_packets[0]);
+                          tx.packets[0]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[v2r]bytes", ",")
                                    : NORM_KV_64_FMT("[v2r]bytes", "\n"),
-                          tx_bytes[0]);
+                          tx.bytes[0]);
     unixctl_command_reply(fd,
                           json_fmt ? JSON_KV_64_FMT("[v2c]packets", ",")
                                    : NORM_KV_64_FMT("[v2c]packets", "\n"),
-                          tx_packets[1]);
+                          tx.packets[1]);
     unixctl_command_reply(fd,
-                          json_fmt ? JSON_KV_64_FMT("[v2c]bytes", "")
+                          json_fmt ? JSON_KV_64_FMT("[v2c]bytes", ",")
                                    : NORM_KV_64_FMT("[v2c]bytes", "\n"),
-                          tx_bytes[1]);
+                          tx.bytes[1]);
+
+    /* Rates over the last second. */
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("cps", ",")
+                                   : NORM_KV_64_FMT("cps", "\n"),
+                          rx.cps);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("[c2v]pps", ",")
+                                   : NORM_KV_64_FMT("[c2v]pps", "\n"),
+                          rx.pps[0]);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("[c2v]bps", ",")
+                                   : NORM_KV_64_FMT("[c2v]bps", "\n"),
+                          rx.bps[0]);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("[r2v]pps", ",")
+                                   : NORM_KV_64_FMT("[r2v]pps", "\n"),
+                          rx.pps[1]);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("[r2v]bps", "")
+                                   : NORM_KV_64_FMT("[r2v]bps", "\n"),
+                          rx.bps[1]);
 
     if (json_fmt)
         unixctl_command_reply(fd, "}\n");
 }
 
-UNIXCTL_CMD_REGISTER("vs/stats", "VIP:VPORT tcp|udp [--json].",
-                     "Show packet statistics of virtual service.", 2, 3,
-                     vs_stats_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH("vs/stats", "VIP:VPORT tcp|udp [--json].",
+                              "Show packet statistics of virtual service.", 2,
+                              3, vs_stats_cmd_cb);
 
 static int
 rs_add_arg_parse(char *argv[], __attribute((unused)) int argc, uint32_t *vip,
@@ -1193,8 +1510,9 @@ free_rss:
     VS_TBL_FOREACH_SOCKET(socket_id) { lb_rs_free(rss[socket_id]); }
 }
 
-UNIXCTL_CMD_REGISTER("rs/add", "VIP:VPORT tcp|udp RIP:RPORT [WEIGHT].",
-                     "Add real service.", 3, 4, rs_add_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH("rs/add",
+                              "VIP:VPORT tcp|udp RIP:RPORT [WEIGHT].",
+                              "Add real service.", 3, 4, rs_add_cmd_cb);
 
 static int
 rs_del_arg_parse(char *argv[], __attribute((unused)) int argc, uint32_t *vip,
@@ -1266,8 +1584,8 @@ rs_del_cmd_cb(int fd, char *argv[], int argc) {
     }
 }
 
-UNIXCTL_CMD_REGISTER("rs/del", "VIP:VPORT tcp|udp RIP:RPORT.",
-                     "Del real service.", 3, 3, rs_del_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH("rs/del", "VIP:VPORT tcp|udp RIP:RPORT.",
+                              "Del real service.", 3, 3, rs_del_cmd_cb);
 
 static int
 rs_list_arg_parse(char *argv[], int argc, uint32_t *vip, uint16_t *vport,
@@ -1355,8 +1673,8 @@ rs_list_cmd_cb(int fd, char *argv[], int argc) {
     }
 }
 
-UNIXCTL_CMD_REGISTER("rs/list", "VIP:VPORT tcp|udp [--json].",
-                     "List all real services.", 2, 3, rs_list_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH("rs/list", "VIP:VPORT tcp|udp [--json].",
+                              "List all real services.", 2, 3, rs_list_cmd_cb);
 
 static int
 rs_status_arg_parse(char *argv[], int argc, uint32_t *vip, uint16_t *vport,
@@ -1471,9 +1789,10 @@ failed:
     }
 }
 
-UNIXCTL_CMD_REGISTER("rs/status", "VIP:VPORT tcp|udp RIP:RPORT [down|up].",
-                     "Show or set the status of real services.", 3, 4,
-                     rs_status_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH("rs/status",
+                              "VIP:VPORT tcp|udp RIP:RPORT [down|up].",
+                              "Show or set the status of real services.", 3,
+                              4, rs_status_cmd_cb);
 
 static int
 rs_weight_arg_parse(char *argv[], int argc, uint32_t *vip, uint16_t *vport,
@@ -1557,9 +1876,10 @@ rs_weight_cmd_cb(int fd, char *argv[], int argc) {
     }
 }
 
-UNIXCTL_CMD_REGISTER("rs/weight", "VIP:VPORT tcp|udp RIP:RPORT [WEIGHT].",
-                     "Show or set the weight of real services.", 3, 4,
-                     rs_weight_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH("rs/weight",
+                              "VIP:VPORT tcp|udp RIP:RPORT [WEIGHT].",
+                              "Show or set the weight of real services.", 3,
+                              4, rs_weight_cmd_cb);
 
 static int
 rs_stats_arg_parse(char *argv[], int argc, uint32_t *vip, uint16_t *vport,
@@ -1609,9 +1929,8 @@ rs_stats_cmd_cb(int fd, char *argv[], int argc) {
     uint32_t socket_id;
     struct lb_virt_service *vs;
     struct lb_real_service *rs;
-    uint32_t lcore_id;
-    uint64_t packets[2] = {0}, bytes[2] = {0};
-    uint64_t active_conns = 0, history_conns = 0;
+    struct lb_service_stats_sum sum;
+    uint64_t active_conns = 0;
 
     rc = rs_stats_arg_parse(argv, argc, &vip, &vport, &proto, &rip, &rport,
                             &json_fmt);
@@ -1620,6 +1939,7 @@ rs_stats_cmd_cb(int fd, char *argv[], int argc) {
         return;
     }
 
+    memset(&sum, 0, sizeof(sum));
     VS_TBL_FOREACH_SOCKET(socket_id) {
         vs = vs_tbl_find(lb_vs_tbls[socket_id], vip, vport, proto);
         if (vs == NULL) {
@@ -1633,46 +1953,62 @@ rs_stats_cmd_cb(int fd, char *argv[], int argc) {
             return;
         }
 
-        RTE_LCORE_FOREACH_SLAVE(lcore_id) {
-            packets[0] += rs->stats[lcore_id].packets[0];
-            packets[1] += rs->stats[lcore_id].packets[1];
-            bytes[0] += rs->stats[lcore_id].bytes[0];
-            bytes[1] += rs->stats[lcore_id].bytes[1];
-            history_conns += rs->stats[lcore_id].conns;
-            active_conns += (uint64_t)rte_atomic32_read(&rs->active_conns);
-        }
+        lb_service_stats_read(rs->stats, &rs->stats_snap, &sum);
+        active_conns += (uint64_t)rte_atomic32_read(&rs->active_conns);
     }
 
     if (json_fmt)
         unixctl_command_reply(fd, "{");
     unixctl_command_reply(fd,
-                          json_fmt ? JSON_KV_32_FMT("active-conns", ",")
-                                   : NORM_KV_32_FMT("active-conns", "\n"),
+                          json_fmt ? JSON_KV_64_FMT("active-conns", ",")
+                                   : NORM_KV_64_FMT("active-conns", "\n"),
                           active_conns);
     unixctl_command_reply(fd,
-                          json_fmt ? JSON_KV_32_FMT("history-conns", ",")
-                                   : NORM_KV_32_FMT("history-conns", "\n"),
-                          history_conns);
+                          json_fmt ? JSON_KV_64_FMT("history-conns", ",")
+                                   : NORM_KV_64_FMT("history-conns", "\n"),
+                          sum.conns);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("[v2r]packets", ",")
+                                   : NORM_KV_64_FMT("[v2r]packets", "\n"),
+                          sum.packets[0]);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("[v2r]bytes", ",")
+                                   : NORM_KV_64_FMT("[v2r]bytes", "\n"),
+                          sum.bytes[0]);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("[r2v]packets", ",")
+                                   : NORM_KV_64_FMT("[r2v]packets", "\n"),
+                          sum.packets[1]);
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("[r2v]bytes", ",")
+                                   : NORM_KV_64_FMT("[r2v]bytes", "\n"),
+                          sum.bytes[1]);
+
+    /* Rates over the last second. */
+    unixctl_command_reply(fd,
+                          json_fmt ? JSON_KV_64_FMT("cps", ",")
+                                   : NORM_KV_64_FMT("cps", "\n"),
+                          sum.cps);
     unixctl_command_reply(fd,
-                          json_fmt ? JSON_KV_32_FMT("[v2r]packets", ",")
-                                   : NORM_KV_32_FMT("[v2r]packets", "\n"),
-                          packets[0]);
+                          json_fmt ? JSON_KV_64_FMT("[v2r]pps", ",")
+                                   : NORM_KV_64_FMT("[v2r]pps", "\n"),
+                          sum.pps[0]);
     unixctl_command_reply(fd,
-                          json_fmt ? JSON_KV_32_FMT("[v2r]bytes", ",")
-                                   : NORM_KV_32_FMT("[v2r]bytes", "\n"),
-                          bytes[0]);
+                          json_fmt ? JSON_KV_64_FMT("[v2r]bps", ",")
+                                   : NORM_KV_64_FMT("[v2r]bps", "\n"),
+                          sum.bps[0]);
     unixctl_command_reply(fd,
-                          json_fmt ? JSON_KV_32_FMT("[r2v]packets", ",")
-                                   : NORM_KV_32_FMT("[r2v]packets", "\n"),
-                          packets[1]);
+                          json_fmt ? JSON_KV_64_FMT("[r2v]pps", ",")
+                                   : NORM_KV_64_FMT("[r2v]pps", "\n"),
+                          sum.pps[1]);
     unixctl_command_reply(fd,
-                          json_fmt ? JSON_KV_32_FMT("[r2v]bytes", "")
-                                   : NORM_KV_32_FMT("[r2v]bytes", "\n"),
-                          bytes[1]);
+                          json_fmt ? JSON_KV_64_FMT("[r2v]bps", "")
+                                   : NORM_KV_64_FMT("[r2v]bps", "\n"),
+                          sum.bps[1]);
     if (json_fmt)
         unixctl_command_reply(fd, "}\n");
 }
 
-UNIXCTL_CMD_REGISTER("rs/stats", "VIP:VPORT tcp|udp RIP:RPORT.",
-                     "Show the packet stats of real services.", 3, 4,
-                     rs_stats_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH("rs/stats", "VIP:VPORT tcp|udp RIP:RPORT.",
+                              "Show the packet stats of real services.", 3, 4,
+                              rs_stats_cmd_cb);
@@ -6,6 +6,7 @@
 #include <sys/queue.h>
 
 #include <rte_atomic.h>
+#include <rte_memory.h>
 #include <rte_rwlock.h>
 
 #include "lb_proto.h"
@@ -16,14 +17,48 @@
 #define LB_VS_F_SYNPROXY (0x01)
 #define LB_VS_F_TOA (0x02)
 #define LB_VS_F_CQL (0x04)
+/* One packet scheduling, every UDP datagram is dispatched on its own. */
+#define LB_VS_F_OPS (0x08)
 
 #define LB_RS_F_AVAILABLE (0x1)
 
+/*
+ * Per-lcore counters of a virt or real service. Every service owns an
+ * arena with one cache line per worker lcore of its socket, see
+ * lb_service_stats_get().
+ */
 struct lb_service_stats {
     uint64_t packets[LB_DIR_MAX];
     uint64_t bytes[LB_DIR_MAX];
     uint64_t drops[LB_DIR_MAX];
     uint64_t conns;
+    /* Real service only, references held by the conns of the lcore. */
+    int64_t refcnt;
+} __rte_cache_aligned;
+
+/* Totals and rates summed over the lcores by lb_service_stats_read(). */
+struct lb_service_stats_sum {
+    uint64_t packets[LB_DIR_MAX];
+    uint64_t bytes[LB_DIR_MAX];
+    uint64_t drops[LB_DIR_MAX];
+    uint64_t conns;
+    uint64_t pps[LB_DIR_MAX];
+    uint64_t bps[LB_DIR_MAX];
+    uint64_t cps;
+};
+
+/*
+ * Totals of an arena at the last sample and the rates over the interval
+ * before it. The master lcore samples every service once a second.
+ */
+struct lb_service_stats_snap {
+    uint64_t cycles;
+    uint64_t packets[LB_DIR_MAX];
+    uint64_t bytes[LB_DIR_MAX];
+    uint64_t conns;
+    uint64_t pps[LB_DIR_MAX];
+    uint64_t bps[LB_DIR_MAX];
+    uint64_t cps;
 };
 
 struct lb_real_service;
@@ -49,11 +84,13 @@ struct lb_virt_service {
 
     LIST_HEAD(, lb_real_service) real_services;
 
-    struct lb_service_stats stats[RTE_MAX_LCORE];
+    struct lb_service_stats *stats;
+    struct lb_service_stats_snap stats_snap;
 };
 
 struct lb_real_service {
     LIST_ENTRY(lb_real_service) next;
+    LIST_ENTRY(lb_real_service) gc_next;
     uint32_t rip;
     uint16_t rport;
     uint8_t proto;
@@ -61,26 +98,44 @@ struct lb_real_service {
     uint32_t flags;
 
     rte_atomic32_t active_conns;
-    rte_atomic32_t refcnt;
 
     int weight;
 
     struct lb_virt_service *virt_service;
     void *sched_node;
 
-    struct lb_service_stats stats[RTE_MAX_LCORE];
+    struct lb_service_stats *stats;
+    struct lb_service_stats_snap stats_snap;
 };
 
+/* Arena slot of each lcore, lcores that are not workers share the last. */
+extern uint16_t lb_service_stats_idx[RTE_MAX_LCORE];
+
+static inline struct lb_service_stats *
+lb_service_stats_get(struct lb_service_stats *stats, uint32_t lcore_id) {
+    return &stats[lb_service_stats_idx[lcore_id]];
+}
+
 int lb_is_vip_exist(uint32_t vip);
 struct lb_virt_service *lb_vs_get(uint32_t vip, uint16_t vport, uint8_t proto);
-void lb_vs_put(struct lb_virt_service *vs);
 struct lb_real_service *lb_vs_get_rs(struct lb_virt_service *vs, uint32_t cip,
                                      uint16_t cport);
 void lb_vs_put_rs(struct lb_real_service *rs);
 void lb_vs_free(struct lb_virt_service *vs);
 void lb_rs_free(struct lb_real_service *rs);
+void lb_service_stats_read(struct lb_service_stats *stats,
+                           const struct lb_service_stats_snap *snap,
+                           struct lb_service_stats_sum *sum);
 int lb_service_init(void);
 
+/*
+ * Virtual services returned by lb_vs_get() stay valid until the worker's
+ * next quiescent state, nothing has to be released.
+ */
+static inline void
+lb_vs_put(__attribute__((unused)) struct lb_virt_service *vs) {
+}
+
 static inline int
 lb_vs_check_max_conn(struct lb_virt_service *vs) {
     return rte_atomic32_read(&vs->active_conns) >= vs->max_conns;
@@ -36,7 +36,7 @@ tcp_conn_set_state(struct lb_conn *conn, uint32_t state) {
     if (timeout == 0)
         timeout = tcp_timeouts[TCP_CONNTRACK_ESTABLISHED];
     conn->state = state;
-    conn->timeout = timeout;
+    lb_conn_set_timeout(conn, timeout);
 }
 
 static const uint16_t msstab[] = {536, 1300, 1440, 1460};
@@ -279,7 +279,9 @@ synproxy_sent_client_synack(struct rte_mbuf *m, struct ipv4_hdr *iph,
     uint16_t pkt_len;
     uint32_t tmpaddr;
     uint16_t tmpport;
+    struct lb_cksum_nat nat;
 
+    lb_cksum_nat_save(&nat, iph, th, TCP_HLEN(th));
     synproxy_parse_set_options(th, &opts);
     isn = synproxy_cookie_ipv4_init_sequence(iph, th, &opts);
 
@@ -292,8 +294,7 @@ synproxy_sent_client_synack(struct rte_mbuf *m, struct ipv4_hdr *iph,
     tmpaddr = iph->src_addr;
     iph->src_addr = iph->dst_addr;
     iph->dst_addr = tmpaddr;
-    iph->hdr_checksum = 0;
-    iph->hdr_checksum = rte_ipv4_cksum(iph);
+    lb_device_ipv4_cksum(m, iph, &nat, dev);
 
     tmpport = th->src_port;
     th->src_port = th->dst_port;
@@ -302,8 +303,7 @@ synproxy_sent_client_synack(struct rte_mbuf *m, struct ipv4_hdr *iph,
     th->sent_seq = rte_cpu_to_be_32(isn);
     th->tcp_flags = TCP_SYN_FLAG | TCP_ACK_FLAG;
     th->tcp_urp = 0;
-    th->cksum = 0;
-    th->cksum = rte_ipv4_udptcp_cksum(iph, th);
+    lb_device_tcp_cksum(m, iph, th, &nat, dev);
 
     lb_device_output(m, iph, dev);
 }
@@ -376,8 +376,7 @@ synproxy_sent_backend_syn(struct rte_mbuf *m, struct ipv4_hdr *iph,
     iph->time_to_live = 63;
     iph->src_addr = conn->lip;
     iph->dst_addr = conn->rip;
-    iph->hdr_checksum = 0;
-    iph->hdr_checksum = rte_ipv4_cksum(iph);
+    lb_device_ipv4_cksum(m, iph, NULL, dev);
 
     nth = (struct tcp_hdr *)(iph + 1);
     nth->src_port = conn->lport;
@@ -391,8 +390,7 @@ synproxy_sent_backend_syn(struct rte_mbuf *m, struct ipv4_hdr *iph,
 
     synproxy_syn_build_options((uint32_t *)(nth + 1), opts);
 
-    nth->cksum = 0;
-    nth->cksum = rte_ipv4_udptcp_cksum(iph, nth);
+    lb_device_tcp_cksum(m, iph, nth, NULL, dev);
 
     conn->proxy.syn_mbuf = rte_pktmbuf_clone(m, m->pool);
 
@@ -439,21 +437,21 @@ synproxy_sent_ack_to_backend(struct rte_mbuf *m, struct lb_conn *conn,
                              struct lb_device *dev) {
     struct ipv4_hdr *iph;
     struct tcp_hdr *th;
+    struct lb_cksum_nat nat;
 
     iph = rte_pktmbuf_mtod_offset(m, struct ipv4_hdr *, ETHER_HDR_LEN);
+    th = TCP_HDR(iph);
+    lb_cksum_nat_save(&nat, iph, th, TCP_HLEN(th));
+
     iph->src_addr = conn->lip;
     iph->dst_addr = conn->rip;
-
-    th = TCP_HDR(iph);
     th->src_port = conn->lport;
     th->dst_port = conn->rport;
     tcp_secret_seq_adjust_client(th, &conn->tseq);
     synproxy_seq_adjust_client(th, &conn->proxy);
-    tcp_opt_add_toa(m, iph, th, conn->cip, conn->cport);
-    iph->hdr_checksum = 0;
-    iph->hdr_checksum = rte_ipv4_cksum(iph);
-    th->cksum = 0;
-    th->cksum = rte_ipv4_udptcp_cksum(iph, th);
+    tcp_opt_add_toa(m, &iph, &th, conn->cip, conn->cport, dev->mtu);
+    lb_device_ipv4_cksum(m, iph, &nat, dev);
+    lb_device_tcp_cksum(m, iph, th, &nat, dev);
 
     lb_device_output(m, iph, dev);
 }
@@ -462,16 +460,17 @@ static void
 synproxy_fwd_synack_to_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
                               struct tcp_hdr *th, struct lb_conn *conn,
                               struct lb_device *dev) {
+    struct lb_cksum_nat nat;
+
+    lb_cksum_nat_save(&nat, iph, th, TCP_HLEN(th));
     iph->src_addr = conn->vip;
     iph->dst_addr = conn->cip;
     th->src_port = conn->vport;
     th->dst_port = conn->cport;
     synproxy_seq_adjust_backend(th, &conn->proxy);
     tcp_secret_seq_adjust_backend(th, &conn->tseq);
-    iph->hdr_checksum = 0;
-    iph->hdr_checksum = rte_ipv4_cksum(iph);
-    th->cksum = 0;
-    th->cksum = rte_ipv4_udptcp_cksum(iph, th);
+    lb_device_ipv4_cksum(m, iph, &nat, dev);
+    lb_device_tcp_cksum(m, iph, th, &nat, dev);
 
     lb_device_output(m, iph, dev);
 }
@@ -480,6 +479,9 @@ static void
 synproxy_fwd_rst_to_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
                            struct tcp_hdr *th, struct lb_conn *conn,
                            struct lb_device *dev) {
+    struct lb_cksum_nat nat;
+
+    lb_cksum_nat_save(&nat, iph, th, TCP_HLEN(th));
     iph->src_addr = conn->vip;
     iph->dst_addr = conn->cip;
     th->src_port = conn->vport;
@@ -487,10 +489,8 @@ synproxy_fwd_rst_to_client(struct rte_mbuf *m, struct ipv4_hdr *iph,
     th->sent_seq = rte_cpu_to_be_32(conn->proxy.isn + 1);
     th->recv_ack = 0;
     th->tcp_flags = TCP_RST_FLAG;
-    iph->hdr_checksum = 0;
-    iph->hdr_checksum = rte_ipv4_cksum(iph);
-    th->cksum = 0;
-    th->cksum = rte_ipv4_udptcp_cksum(iph, th);
+    lb_device_ipv4_cksum(m, iph, &nat, dev);
+    lb_device_tcp_cksum(m, iph, th, &nat, dev);
 
     lb_device_output(m, iph, dev);
 }
@@ -1,5 +1,8 @@
 /* Copyright (c) 2018. TIG developer. */
 
+#include <string.h>
+
+#include <rte_ether.h>
 #include <rte_ip.h>
 #include <rte_mbuf.h>
 #include <rte_tcp.h>
@@ -9,6 +12,8 @@
 #define TCPOPT_ADDR 200
 #define TCPOLEN_ADDR 8 /* |opcode|size|ip+port| = 1 + 1 + 6 */
 
+#define TCP_HDR_MAX_LEN 60
+
 struct tcp_opt_toa {
     uint8_t optcode;
     uint8_t optsize;
@@ -16,29 +21,51 @@ struct tcp_opt_toa {
     uint32_t addr;
 } __attribute__((__packed__));
 
-void
-tcp_opt_add_toa(struct rte_mbuf *m, struct ipv4_hdr *iph, struct tcp_hdr *th,
-                uint32_t sip, uint16_t sport) {
+/*
+ * The option goes at the end of the TCP header. Instead of shifting the
+ * payload back, the headers move forward into the headroom, so the cost
+ * does not depend on the payload and any segment after the first one is
+ * left alone.
+ */
+int
+tcp_opt_add_toa(struct rte_mbuf *m, struct ipv4_hdr **iphp,
+                struct tcp_hdr **thp, uint32_t sip, uint16_t sport,
+                uint16_t mtu) {
+    struct ipv4_hdr *iph = *iphp;
+    struct tcp_hdr *th = *thp;
     struct tcp_opt_toa *toa;
-    uint8_t *p, *q;
-
-    /* tcp header max length */
-    if ((60 - (th->data_off >> 2)) < (int)sizeof(struct tcp_opt_toa))
-        return;
-    p = (uint8_t *)rte_pktmbuf_append(m, sizeof(struct tcp_opt_toa));
-    q = p + sizeof(struct tcp_opt_toa);
-    while (p >= ((uint8_t *)th + (th->data_off >> 2))) {
-        *q = *p;
-        q--;
-        p--;
-    }
-    toa = (struct tcp_opt_toa *)((uint8_t *)th + (th->data_off >> 2));
+    uint16_t iph_len, th_len, hdr_len, total_len;
+    char *p;
+
+    iph_len = (iph->version_ihl & IPV4_HDR_IHL_MASK) * IPV4_IHL_MULTIPLIER;
+    th_len = th->data_off >> 2;
+    hdr_len = ETHER_HDR_LEN + iph_len + th_len;
+    total_len = rte_be_to_cpu_16(iph->total_length);
+
+    if (th_len + sizeof(struct tcp_opt_toa) > TCP_HDR_MAX_LEN)
+        return -1;
+    if (total_len + sizeof(struct tcp_opt_toa) > mtu)
+        return -1;
+    if (rte_pktmbuf_data_len(m) < hdr_len)
+        return -1;
+
+    p = rte_pktmbuf_prepend(m, sizeof(struct tcp_opt_toa));
+    if (p == NULL)
+        return -1;
+    memmove(p, p + sizeof(struct tcp_opt_toa), hdr_len);
+
+    iph = (struct ipv4_hdr *)(p + ETHER_HDR_LEN);
+    th = (struct tcp_hdr *)((char *)iph + iph_len);
+    toa = (struct tcp_opt_toa *)((char *)th + th_len);
     toa->optcode = TCPOPT_ADDR;
     toa->optsize = TCPOLEN_ADDR;
     toa->port = sport;
     toa->addr = sip;
     th->data_off += (sizeof(struct tcp_opt_toa) / 4) << 4;
-    iph->total_length = rte_cpu_to_be_16(rte_be_to_cpu_16(iph->total_length) +
-                                         sizeof(struct tcp_opt_toa));
-}
+    iph->total_length =
+        rte_cpu_to_be_16(total_len + sizeof(struct tcp_opt_toa));
 
+    *iphp = iph;
+    *thp = th;
+    return 0;
+}
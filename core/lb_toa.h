@@ -3,8 +3,13 @@
 #ifndef __LB_TOA_H__
 #define __LB_TOA_H__
 
-void tcp_opt_add_toa(struct rte_mbuf *m, struct ipv4_hdr *iph,
-                     struct tcp_hdr *th, uint32_t sip, uint16_t sport);
+/*
+ * Insert the client address option into the TCP header. On success
+ * @iph and @th point to the moved headers. Returns -1 when the option
+ * does not fit the TCP header, the MTU or the headroom.
+ */
+int tcp_opt_add_toa(struct rte_mbuf *m, struct ipv4_hdr **iph,
+                    struct tcp_hdr **th, uint32_t sip, uint16_t sport,
+                    uint16_t mtu);
 
 #endif
-
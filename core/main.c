@@ -1,5 +1,8 @@
 /* Copyright (c) 2018. TIG developer. */
 
+#define _GNU_SOURCE
+
+#include <pthread.h>
 #include <stdio.h>
 #include <sys/file.h>
 #include <unistd.h>
@@ -8,49 +11,62 @@
 #include <rte_ethdev.h>
 #include <rte_ether.h>
 #include <rte_ip.h>
+#include <rte_lcore.h>
 #include <rte_malloc.h>
 #include <rte_pdump.h>
+#include <rte_ring.h>
 #include <rte_timer.h>
 
 #include <unixctl_command.h>
 
 #include "lb_arp.h"
+#ifdef LB_BENCH
+#include "lb_bench.h"
+#endif
+#include "lb_classify.h"
 #include "lb_clock.h"
 #include "lb_config.h"
 #include "lb_device.h"
 #include "lb_format.h"
+#include "lb_frag.h"
+#include "lb_lcore.h"
+#ifdef LB_MICROBENCH
+#include "lb_microbench.h"
+#endif
 #include "lb_parser.h"
+#include "lb_power.h"
 #include "lb_proto.h"
+#include "lb_rcu.h"
+#include "lb_route.h"
 #include "lb_service.h"
 
 #define VERSION "0.1"
 
-#ifndef IPPROTO_OSPFIGP
-#define IPPROTO_OSPFIGP 89
-#endif
-
-#define RUN_ONCE_N_MS(f, n)                                                    \
-    do {                                                                       \
-        static uint64_t last_tsc = 0;                                          \
-        uint64_t curr_tsc;                                                     \
-                                                                               \
-        curr_tsc = rte_rdtsc();                                                \
-        if (curr_tsc - last_tsc >= MS_TO_CYCLES(n)) {                          \
-            f();                                                               \
-            last_tsc = curr_tsc;                                               \
-        }                                                                      \
-    } while (0)
+/*
+ * Periods of the lcore jobs. Polling jobs aim at half full bursts, their
+ * period shrinks under load and grows up to the max while idle.
+ */
+#define RX_JOB_MAX_US 20
+#define TX_JOB_MAX_US 100
+#define KNI_JOB_MAX_US 100
+#define TIMER_JOB_US 1000
+#define UNIXCTL_JOB_US 1000
 
 /* unixctl command */
-static int unixctl_fd;
-static struct rte_timer unixctl_timer;
+#define UNIXCTL_RING_SIZE 16
+static struct rte_ring *unixctl_ring;
 
 /* clock */
 rte_atomic32_t lb_clock;
 static struct rte_timer lb_clock_timer;
 
+#ifdef LB_BENCH
+#define SOCK_FILEPATH "/var/run/jupiter-bench.sock"
+#define PID_FILEPATH "/var/run/jupiter-bench.pid"
+#else
 #define SOCK_FILEPATH "/var/run/jupiter.sock"
 #define PID_FILEPATH "/var/run/jupiter.pid"
+#endif
 #define DEFAULT_CONF_FILEPATH "/etc/jupiter/jupiter.cfg"
 
 static const char *lb_cfgfile = DEFAULT_CONF_FILEPATH;
@@ -79,70 +95,164 @@ lb_clock_timer_init(void) {
                            &lb_clock);
 }
 
+/* Called on the unixctl thread. */
+static int
+unixctl_defer(struct unixctl_cmd_request *req) {
+    return rte_ring_sp_enqueue(unixctl_ring, req);
+}
+
+/* Keeps the unixctl thread off the lcores when there are CPUs left. */
 static void
-unixctl_server_timer_cb(__attribute__((unused)) struct rte_timer *t,
-                        __attribute__((unused)) void *arg) {
-    unixctl_server_run_once(unixctl_fd);
+unixctl_thread_affinity(pthread_t tid) {
+    rte_cpuset_t cpuset;
+    uint32_t lcore_id;
+    long cpu, nb_cpus;
+
+    CPU_ZERO(&cpuset);
+    nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (cpu = 0; cpu < nb_cpus && cpu < CPU_SETSIZE; cpu++) {
+        CPU_SET(cpu, &cpuset);
+        RTE_LCORE_FOREACH(lcore_id) {
+            if (CPU_ISSET(cpu, &lcore_config[lcore_id].cpuset))
+                CPU_CLR(cpu, &cpuset);
+        }
+    }
+    if (CPU_COUNT(&cpuset) == 0 ||
+        pthread_setaffinity_np(tid, sizeof(cpuset), &cpuset) != 0) {
+        RTE_LOG(WARNING, USER1,
+                "%s(): unixctl thread shares the master lcore.\n", __func__);
+    }
+    rte_thread_setname(tid, "unixctl");
 }
 
 static int
 unixctl_server_init(const char *path) {
-    unixctl_fd = unixctl_server_create(path);
-    if (unixctl_fd < 0) {
-        RTE_LOG(ERR, USER1, "%s(): unixctl_server_create failed, path = %s.\n",
+    pthread_t tid;
+
+    unixctl_ring = rte_ring_create("unixctl", UNIXCTL_RING_SIZE, SOCKET_ID_ANY,
+                                   RING_F_SP_ENQ | RING_F_SC_DEQ);
+    if (unixctl_ring == NULL) {
+        RTE_LOG(ERR, USER1, "%s(): Create unixctl ring failed.\n", __func__);
+        return -1;
+    }
+    if (unixctl_server_start(path, unixctl_defer, &tid) < 0) {
+        RTE_LOG(ERR, USER1, "%s(): unixctl_server_start failed, path = %s.\n",
                 __func__, path);
         return -1;
     }
-    rte_timer_init(&unixctl_timer);
-    return rte_timer_reset(&unixctl_timer, MS_TO_CYCLES(5), PERIODICAL,
-                           rte_get_master_lcore(), unixctl_server_timer_cb,
-                           NULL);
+    unixctl_thread_affinity(tid);
+    return 0;
+}
+
+/* Hands packets over to the lcores owning their local address. */
+static void
+redirect_packets(struct rte_mbuf **pkts, uint32_t *owners, uint16_t n,
+                 struct lb_device *dev) {
+    struct rte_mbuf *batch[PKT_MAX_BURST];
+    uint32_t lcore_id = rte_lcore_id();
+    uint32_t owner;
+    uint16_t i, j, nb, nb_tx;
+
+    for (i = 0; i < n; i++) {
+        if (pkts[i] == NULL)
+            continue;
+        owner = owners[i];
+        nb = 0;
+        for (j = i; j < n; j++) {
+            if (pkts[j] != NULL && owners[j] == owner) {
+                batch[nb++] = pkts[j];
+                pkts[j] = NULL;
+            }
+        }
+        nb_tx = rte_ring_sp_enqueue_burst(
+            lb_device_redirect_ring(dev, lcore_id, owner), (void **)batch, nb,
+            NULL);
+        dev->lcore_stats[lcore_id].redirect_tx += nb_tx;
+        if (unlikely(nb_tx < nb)) {
+            dev->lcore_stats[lcore_id].redirect_drop += nb - nb_tx;
+            for (j = nb_tx; j < nb; j++)
+                rte_pktmbuf_free(batch[j]);
+        }
+    }
 }
 
 static void
 handle_packets(struct rte_mbuf **pkts, uint16_t n, struct lb_device *dev) {
+    struct rte_mbuf *batch[LB_IPPROTO_MAX][PKT_MAX_BURST];
+    uint16_t nb_batch[LB_IPPROTO_MAX] = {0};
+    struct rte_mbuf *redirect[PKT_MAX_BURST];
+    uint32_t owners[PKT_MAX_BURST];
+    uint16_t nb_redirect = 0;
+    uint16_t nb_frag = 0;
+    uint8_t classes[PKT_MAX_BURST];
+    uint32_t owner;
     uint16_t i;
     struct rte_mbuf *m;
-    struct ether_hdr *eth;
     struct ipv4_hdr *iph;
-    struct lb_proto *p;
+    uint8_t c;
+    uint32_t lcore_id = rte_lcore_id();
 
+    /* Split the burst by class so each handler gets a whole batch. */
+    lb_classify_burst(pkts, n, dev->ipv4, classes);
     for (i = 0; i < n; i++) {
         m = pkts[i];
+        c = classes[i];
 
-        eth = rte_pktmbuf_mtod_offset(m, struct ether_hdr *, 0);
-        switch (rte_be_to_cpu_16(eth->ether_type)) {
-        case ETHER_TYPE_ARP:
-            if (rte_ring_enqueue(dev->ring, m) < 0) {
+        if (c == LB_PKT_KNI) {
+            if (rte_ring_enqueue(dev->ring, m) < 0)
                 rte_pktmbuf_free(m);
+            continue;
+        }
+        if (c == LB_PKT_DROP) {
+            rte_pktmbuf_free(m);
+            continue;
+        }
+        if (unlikely(lb_device_rx_cksum_bad(m))) {
+            dev->lcore_stats[lcore_id].rx_cksum_bad++;
+            rte_pktmbuf_free(m);
+            continue;
+        }
+
+        iph = rte_pktmbuf_mtod_offset(m, struct ipv4_hdr *, ETHER_HDR_LEN);
+        if (dev->sw_redirect ||
+            (c == LB_PKT_FRAG && dev->redirect != NULL)) {
+            owner = lb_laddr_owner(dev, iph->dst_addr);
+            if (owner != RTE_MAX_LCORE && owner != lcore_id) {
+                redirect[nb_redirect] = m;
+                owners[nb_redirect++] = owner;
+                continue;
             }
-            break;
-        case ETHER_TYPE_IPv4:
+        }
+
+        if (c == LB_PKT_FRAG) {
+            nb_frag++;
+            m = lb_frag_reassemble(m, iph);
+            if (m == NULL)
+                continue;
             iph = rte_pktmbuf_mtod_offset(m, struct ipv4_hdr *, ETHER_HDR_LEN);
-            if ((iph->dst_addr == dev->ipv4) ||
-                (iph->next_proto_id == IPPROTO_OSPFIGP)) {
-                if (rte_ring_enqueue(dev->ring, m) < 0) {
-                    rte_pktmbuf_free(m);
-                }
-            } else {
-                p = lb_proto_get(iph->next_proto_id);
-                if (p != NULL) {
-                    p->fullnat_handle(m, iph, dev);
-                } else {
-                    rte_pktmbuf_free(m);
-                }
+            c = lb_classify_proto(iph->next_proto_id);
+            if (c == LB_PKT_DROP) {
+                rte_pktmbuf_free(m);
+                continue;
             }
-            break;
-        default:
-            rte_pktmbuf_free(m);
         }
+        batch[c][nb_batch[c]++] = m;
     }
+
+    if (nb_frag != 0)
+        lb_frag_death_row_free();
+    if (nb_redirect != 0)
+        redirect_packets(redirect, owners, nb_redirect, dev);
+    lb_lcore_stage(LB_STAGE_CLASSIFY);
+
+    for (c = 0; c < LB_IPPROTO_MAX; c++) {
+        if (nb_batch[c] != 0)
+            lb_protos[c]->fullnat_handle_burst(batch[c], nb_batch[c], dev);
+    }
+    lb_lcore_stage(LB_STAGE_NAT);
 }
 
-static int
-master_loop(__attribute__((unused)) void *arg) {
-    uint32_t lcore_id;
-    uint16_t i, j;
+struct master_conf {
     uint16_t nb_ctx;
     struct {
         uint16_t port_id;
@@ -152,121 +262,278 @@ master_loop(__attribute__((unused)) void *arg) {
         struct rte_ring *ring;
         struct lb_device *dev;
     } ctx[RTE_MAX_ETHPORTS];
-    uint16_t devid;
-    struct lb_device *dev;
+};
+
+struct worker_conf {
+    uint16_t nb_ctx;
+    uint32_t nb_redirect;
+    struct {
+        uint16_t port_id;
+        uint16_t rxq_id, txq_id;
+        struct lb_device *dev;
+        struct rte_eth_dev_tx_buffer *tx_buffer;
+        struct rte_mbuf *rx_pkts[PKT_MAX_BURST];
+        uint32_t n;
+        /* Redirected by the other lcores. */
+        struct rte_ring *redirect[RTE_MAX_LCORE];
+        uint32_t nb_redirect;
+    } ctx[RTE_MAX_ETHPORTS];
+};
+
+static int64_t
+timer_job(__attribute__((unused)) void *arg) {
+    rte_timer_manage();
+    lb_lcore_stage(LB_STAGE_TIMER);
+    return 0;
+}
+
+/* Only the workers are accounted, see lb_lcore.h. */
+static int64_t
+master_timer_job(__attribute__((unused)) void *arg) {
+    rte_timer_manage();
+    return 0;
+}
+
+/* Runs the commands changing datapath state on the master lcore. */
+static int64_t
+unixctl_job(__attribute__((unused)) void *arg) {
+    void *req;
+
+    if (rte_ring_sc_dequeue(unixctl_ring, &req) == 0)
+        unixctl_cmd_request_run(req);
+    return 0;
+}
+
+#ifndef LB_BENCH
+static int64_t
+kni_job(void *arg) {
+    struct master_conf *conf = arg;
     struct rte_mbuf *pkts[PKT_MAX_BURST];
-    uint32_t n, nb_tx;
     struct ether_hdr *ethh;
+    uint32_t n, nb_tx;
+    int64_t nb = 0;
+    uint16_t i, j;
 
-    lcore_id = rte_lcore_id();
-    nb_ctx = 0;
-    LB_DEVICE_FOREACH(devid, dev) {
-        ctx[nb_ctx].port_id = dev->port_id;
-        ctx[nb_ctx].txq_id = dev->lcore_conf[lcore_id].txq_id;
-        ctx[nb_ctx].tx_buffer = dev->tx_buffer[lcore_id];
-        ctx[nb_ctx].kni = dev->kni;
-        ctx[nb_ctx].ring = dev->ring;
-        ctx[nb_ctx].dev = dev;
-        nb_ctx++;
-    }
+    for (i = 0; i < conf->nb_ctx; i++) {
+        rte_kni_handle_request(conf->ctx[i].kni);
 
-    if (nb_ctx == 0) {
-        RTE_LOG(INFO, USER1, "%s(): master thread exit early.\n", __func__);
-        return 0;
-    }
+        n = rte_kni_rx_burst(conf->ctx[i].kni, pkts, PKT_MAX_BURST);
+        nb += n;
 
-    RTE_LOG(INFO, USER1, "%s(): master thread started.\n", __func__);
-
-    while (lb_loop) {
-        for (i = 0; i < nb_ctx; i++) {
-            rte_kni_handle_request(ctx[i].kni);
+        for (j = 0; j < n; j++) {
+            rte_eth_tx_buffer(conf->ctx[i].port_id, conf->ctx[i].txq_id,
+                              conf->ctx[i].tx_buffer, pkts[j]);
+        }
 
-            n = rte_kni_rx_burst(ctx[i].kni, pkts, PKT_MAX_BURST);
+        rte_eth_tx_buffer_flush(conf->ctx[i].port_id, conf->ctx[i].txq_id,
+                                conf->ctx[i].tx_buffer);
 
-            for (j = 0; j < n; j++) {
-                rte_eth_tx_buffer(ctx[i].port_id, ctx[i].txq_id,
-                                  ctx[i].tx_buffer, pkts[j]);
+        n = rte_ring_dequeue_burst(conf->ctx[i].ring, (void **)pkts,
+                                   PKT_MAX_BURST, NULL);
+        nb += n;
+        for (j = 0; j < n; j++) {
+            ethh = rte_pktmbuf_mtod_offset(pkts[j], struct ether_hdr *, 0);
+            if (ethh->ether_type == rte_be_to_cpu_16(ETHER_TYPE_ARP)) {
+                lb_arp_input(pkts[j], conf->ctx[i].dev);
             }
+        }
+        nb_tx = rte_kni_tx_burst(conf->ctx[i].kni, pkts, n);
+        for (j = nb_tx; j < n; j++) {
+            rte_pktmbuf_free(pkts[j]);
+        }
+    }
+    return nb;
+}
+#endif
 
-            rte_eth_tx_buffer_flush(ctx[i].port_id, ctx[i].txq_id,
-                                    ctx[i].tx_buffer);
+static int64_t
+worker_rx_job(void *arg) {
+    struct worker_conf *conf = arg;
+    int64_t nb_rx = 0;
+    uint16_t i;
 
-            n = rte_ring_dequeue_burst(ctx[i].ring, (void **)pkts,
-                                       PKT_MAX_BURST, NULL);
-            for (j = 0; j < n; j++) {
-                ethh = rte_pktmbuf_mtod_offset(pkts[j], struct ether_hdr *, 0);
-                if (ethh->ether_type == rte_be_to_cpu_16(ETHER_TYPE_ARP)) {
-                    lb_arp_input(pkts[j], ctx[i].dev);
-                }
-            }
-            nb_tx = rte_kni_tx_burst(ctx[i].kni, pkts, n);
-            for (j = nb_tx; j < n; j++) {
-                rte_pktmbuf_free(pkts[j]);
-            }
+    for (i = 0; i < conf->nb_ctx; i++) {
+        conf->ctx[i].n =
+            rte_eth_rx_burst(conf->ctx[i].port_id, conf->ctx[i].rxq_id,
+                             conf->ctx[i].rx_pkts, PKT_MAX_BURST);
+        nb_rx += conf->ctx[i].n;
+    }
+    lb_lcore_stage_rx(nb_rx);
+    if (lb_power_adaptive)
+        lb_power_rx(nb_rx);
+
+    for (i = 0; i < conf->nb_ctx; i++) {
+        if (conf->ctx[i].n != 0)
+            handle_packets(conf->ctx[i].rx_pkts, conf->ctx[i].n,
+                           conf->ctx[i].dev);
+    }
+    lb_rcu_quiescent(rte_lcore_id());
+    if (nb_rx != 0)
+        lb_lcore_burst_end();
+    return nb_rx;
+}
+
+static int64_t
+worker_redirect_job(void *arg) {
+    struct worker_conf *conf = arg;
+    uint32_t lcore_id = rte_lcore_id();
+    int64_t nb = 0;
+    uint32_t i, j, n;
+
+    for (i = 0; i < conf->nb_ctx; i++) {
+        for (j = 0; j < conf->ctx[i].nb_redirect; j++) {
+            n = rte_ring_sc_dequeue_burst(conf->ctx[i].redirect[j],
+                                          (void **)conf->ctx[i].rx_pkts,
+                                          PKT_MAX_BURST, NULL);
+            if (n == 0)
+                continue;
+            if (nb == 0)
+                lb_lcore_burst_start();
+            nb += n;
+            conf->ctx[i].dev->lcore_stats[lcore_id].redirect_rx += n;
+            handle_packets(conf->ctx[i].rx_pkts, n, conf->ctx[i].dev);
         }
+    }
+    if (nb != 0)
+        lb_lcore_burst_end();
+    if (lb_power_adaptive && nb != 0)
+        lb_power_rx(nb);
+    return nb;
+}
+
+static int64_t
+worker_tx_job(void *arg) {
+    struct worker_conf *conf = arg;
+    int64_t nb_tx = 0;
+    uint16_t i;
+
+    for (i = 0; i < conf->nb_ctx; i++) {
+        nb_tx += rte_eth_tx_buffer_flush(
+            conf->ctx[i].port_id, conf->ctx[i].txq_id, conf->ctx[i].tx_buffer);
+    }
+    lb_lcore_stage(LB_STAGE_TX);
+    return nb_tx;
+}
+
+static int
+master_loop(__attribute__((unused)) void *arg) {
+    uint32_t lcore_id;
+    struct master_conf conf;
+    uint16_t devid;
+    struct lb_device *dev;
+    int rc = 0;
+
+    lcore_id = rte_lcore_id();
+    conf.nb_ctx = 0;
+    LB_DEVICE_FOREACH(devid, dev) {
+        conf.ctx[conf.nb_ctx].port_id = dev->port_id;
+        conf.ctx[conf.nb_ctx].txq_id = dev->lcore_conf[lcore_id].txq_id;
+        conf.ctx[conf.nb_ctx].tx_buffer = dev->tx_buffer[lcore_id];
+        conf.ctx[conf.nb_ctx].kni = dev->kni;
+        conf.ctx[conf.nb_ctx].ring = dev->ring;
+        conf.ctx[conf.nb_ctx].dev = dev;
+        conf.nb_ctx++;
+    }
 
-        RUN_ONCE_N_MS(rte_timer_manage, 1);
+    if (conf.nb_ctx == 0) {
+        RTE_LOG(INFO, USER1, "%s(): master thread exit early.\n", __func__);
+        return 0;
     }
 
+#ifdef LB_BENCH
+    rc |= lb_lcore_job_add("bench", lb_bench_job, NULL, 0,
+                           US_TO_CYCLES(RX_JOB_MAX_US), PKT_MAX_BURST / 2, 0);
+#else
+    rc |= lb_lcore_job_add("kni", kni_job, &conf, 0,
+                           US_TO_CYCLES(KNI_JOB_MAX_US), PKT_MAX_BURST / 2, 0);
+#endif
+    rc |= lb_lcore_job_add("unixctl", unixctl_job, NULL,
+                           US_TO_CYCLES(UNIXCTL_JOB_US),
+                           US_TO_CYCLES(UNIXCTL_JOB_US), 0, 0);
+    rc |= lb_lcore_job_add("timer", master_timer_job, NULL,
+                           US_TO_CYCLES(TIMER_JOB_US),
+                           US_TO_CYCLES(TIMER_JOB_US), 0, 0);
+    if (rc < 0)
+        return -1;
+
+    RTE_LOG(INFO, USER1, "%s(): master thread started.\n", __func__);
+
+    lb_lcore_loop_run(&lb_loop);
+
     return 0;
 }
 
 static int
 worker_loop(__attribute__((unused)) void *arg) {
     uint32_t lcore_id;
-    uint16_t i;
-    uint16_t nb_ctx;
-    struct {
-        uint16_t port_id;
-        uint16_t rxq_id, txq_id;
-        struct lb_device *dev;
-        struct rte_eth_dev_tx_buffer *tx_buffer;
-        struct rte_mbuf *rx_pkts[PKT_MAX_BURST];
-        uint32_t n;
-    } ctx[RTE_MAX_ETHPORTS];
+    struct worker_conf conf;
     uint16_t devid;
     struct lb_device *dev;
+    uint32_t src, n;
+    uint16_t i;
+    int rc = 0;
 
     lcore_id = rte_lcore_id();
-    nb_ctx = 0;
+    conf.nb_ctx = 0;
+    conf.nb_redirect = 0;
     LB_DEVICE_FOREACH(devid, dev) {
         if (!dev->lcore_conf[lcore_id].rxq_enable)
             continue;
-        ctx[nb_ctx].port_id = dev->port_id;
-        ctx[nb_ctx].rxq_id = dev->lcore_conf[lcore_id].rxq_id;
-        ctx[nb_ctx].txq_id = dev->lcore_conf[lcore_id].txq_id;
-        ctx[nb_ctx].tx_buffer = dev->tx_buffer[lcore_id];
-        ctx[nb_ctx].dev = dev;
-        nb_ctx++;
+        n = conf.nb_ctx;
+        conf.ctx[n].port_id = dev->port_id;
+        conf.ctx[n].rxq_id = dev->lcore_conf[lcore_id].rxq_id;
+        conf.ctx[n].txq_id = dev->lcore_conf[lcore_id].txq_id;
+        conf.ctx[n].tx_buffer = dev->tx_buffer[lcore_id];
+        conf.ctx[n].dev = dev;
+        conf.ctx[n].nb_redirect = 0;
+        RTE_LCORE_FOREACH_SLAVE(src) {
+            if (dev->redirect != NULL && src != lcore_id &&
+                dev->lcore_conf[src].rxq_enable) {
+                conf.ctx[n].redirect[conf.ctx[n].nb_redirect++] =
+                    lb_device_redirect_ring(dev, src, lcore_id);
+            }
+        }
+        conf.nb_redirect += conf.ctx[n].nb_redirect;
+        conf.nb_ctx++;
     }
 
-    if (nb_ctx == 0) {
+    if (conf.nb_ctx == 0) {
         RTE_LOG(INFO, USER1, "%s(): worker%u thread exit early.\n", __func__,
                 lcore_id);
         return 0;
     }
 
+    rc |= lb_lcore_job_add("rx", worker_rx_job, &conf, 0,
+                           US_TO_CYCLES(RX_JOB_MAX_US), PKT_MAX_BURST / 2,
+                           LB_LCORE_JOB_F_RX);
+    if (conf.nb_redirect != 0) {
+        rc |= lb_lcore_job_add("redirect", worker_redirect_job, &conf, 0,
+                               US_TO_CYCLES(RX_JOB_MAX_US), PKT_MAX_BURST / 2,
+                               LB_LCORE_JOB_F_RX);
+    }
+    rc |= lb_lcore_job_add("tx", worker_tx_job, &conf, 0,
+                           US_TO_CYCLES(TX_JOB_MAX_US), 1, LB_LCORE_JOB_F_RX);
+    rc |= lb_lcore_job_add("timer", timer_job, NULL,
+                           US_TO_CYCLES(TIMER_JOB_US),
+                           US_TO_CYCLES(TIMER_JOB_US), 0, 0);
+    if (rc < 0)
+        return -1;
+
     RTE_LOG(INFO, USER1, "%s(): worker%u thread started.\n", __func__,
             lcore_id);
 
-    while (lb_loop) {
-        for (i = 0; i < nb_ctx; i++) {
-            rte_eth_tx_buffer_flush(ctx[i].port_id, ctx[i].txq_id,
-                                    ctx[i].tx_buffer);
-        }
-
-        for (i = 0; i < nb_ctx; i++) {
-            ctx[i].n = rte_eth_rx_burst(ctx[i].port_id, ctx[i].rxq_id,
-                                        ctx[i].rx_pkts, PKT_MAX_BURST);
-        }
-
-        for (i = 0; i < nb_ctx; i++) {
-            handle_packets(ctx[i].rx_pkts, ctx[i].n, ctx[i].dev);
-        }
-
-        RUN_ONCE_N_MS(rte_timer_manage, 1);
+    if (lb_power_adaptive && lb_power_lcore_init() == 0) {
+        for (i = 0; i < conf.nb_ctx; i++)
+            lb_power_rxq_add(conf.ctx[i].port_id, conf.ctx[i].rxq_id);
+        lb_power_polled_add(conf.nb_redirect);
+        lb_lcore_loop_set_idle(lb_power_idle);
     }
 
+    lb_rcu_online(lcore_id);
+    lb_lcore_loop_run(&lb_loop);
+    lb_rcu_offline(lcore_id);
+    lb_power_lcore_exit();
+
     return 0;
 }
 
@@ -371,27 +638,47 @@ main(int argc, char **argv) {
     rte_timer_subsystem_init();
     rte_pdump_init(NULL);
 
+    rc = lb_power_init(&lb_cfg->power);
+    if (rc < 0) {
+        RTE_LOG(ERR, USER1, "%s(): lb_power_init failed.\n", __func__);
+        return rc;
+    }
+
+#ifdef LB_BENCH
+    rc = lb_bench_init(lb_cfg->devices, lb_cfg->nb_decices);
+    if (rc < 0) {
+        RTE_LOG(ERR, USER1, "%s(): lb_bench_init failed.\n", __func__);
+        return rc;
+    }
+#endif
+
     rc = lb_device_init(lb_cfg->devices, lb_cfg->nb_decices);
     if (rc < 0) {
         RTE_LOG(ERR, USER1, "%s(): lb_device_init failed.\n", __func__);
         return rc;
     }
 
-    rc = lb_arp_init();
+    rc = lb_route_init(lb_cfg->devices);
     if (rc < 0) {
-        RTE_LOG(ERR, USER1, "%s(): lb_arp_init failed.\n", __func__);
+        RTE_LOG(ERR, USER1, "%s(): lb_route_init failed.\n", __func__);
         return rc;
     }
 
-    rc = lb_clock_timer_init();
+    rc = lb_frag_init();
     if (rc < 0) {
-        RTE_LOG(ERR, USER1, "%s(): lb_clock_timer_init failed.\n", __func__);
+        RTE_LOG(ERR, USER1, "%s(): lb_frag_init failed.\n", __func__);
         return rc;
     }
 
-    rc = unixctl_server_init(SOCK_FILEPATH);
+    rc = lb_arp_init();
     if (rc < 0) {
-        RTE_LOG(ERR, USER1, "%s(): unixctl_server_init failed.\n", __func__);
+        RTE_LOG(ERR, USER1, "%s(): lb_arp_init failed.\n", __func__);
+        return rc;
+    }
+
+    rc = lb_clock_timer_init();
+    if (rc < 0) {
+        RTE_LOG(ERR, USER1, "%s(): lb_clock_timer_init failed.\n", __func__);
         return rc;
     }
 
@@ -407,12 +694,25 @@ main(int argc, char **argv) {
         return rc;
     }
 
+    lb_classify_init();
+
+#ifdef LB_MICROBENCH
+    return lb_microbench_run();
+#endif
+
+    rc = unixctl_server_init(SOCK_FILEPATH);
+    if (rc < 0) {
+        RTE_LOG(ERR, USER1, "%s(): unixctl_server_init failed.\n", __func__);
+        return rc;
+    }
+
     rc = rte_eal_mp_remote_launch(main_loop, NULL, CALL_MASTER);
     if (rc < 0) {
         RTE_LOG(ERR, USER1, "%s(): Launch remote thread failed.\n", __func__);
         return rc;
     }
 
+    unixctl_server_stop();
     return 0;
 }
 
@@ -423,7 +723,7 @@ exit_cmd_cb(__attribute__((unused)) int fd,
     lb_loop = 0;
 }
 
-UNIXCTL_CMD_REGISTER("exit", "", "", 0, 0, exit_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH("exit", "", "", 0, 0, exit_cmd_cb);
 
 static void
 quit_cmd_cb(__attribute__((unused)) int fd,
@@ -432,7 +732,7 @@ quit_cmd_cb(__attribute__((unused)) int fd,
     lb_loop = 0;
 }
 
-UNIXCTL_CMD_REGISTER("quit", "", "", 0, 0, quit_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH("quit", "", "", 0, 0, quit_cmd_cb);
 
 static void
 stop_cmd_cb(__attribute__((unused)) int fd,
@@ -441,7 +741,7 @@ stop_cmd_cb(__attribute__((unused)) int fd,
     lb_loop = 0;
 }
 
-UNIXCTL_CMD_REGISTER("stop", "", "", 0, 0, stop_cmd_cb);
+UNIXCTL_CMD_REGISTER_DATAPATH("stop", "", "", 0, 0, stop_cmd_cb);
 
 static void
 version_cmd_cb(__attribute__((unused)) int fd,
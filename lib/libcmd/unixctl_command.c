@@ -2,11 +2,14 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/queue.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -43,8 +46,51 @@ struct unixctl_cmd_message {
     char data[CMDMSG_DATA_SIZE];
 } __attribute((packed));
 
+/* The client prints the data as a string, leave room for the NUL. */
+#define CMDMSG_CHUNK_SIZE (CMDMSG_DATA_SIZE - 1)
+
 #define CMD_MAX_OPTIONS 32
 
+#define SERVER_MAX_EVENTS 32
+#define REQ_OUTBUF_SIZE 4096
+/* A stream command gives up on a client not reading for that long. */
+#define REQ_STREAM_TIMEOUT_MS 5000
+
+struct unixctl_cmd_request {
+    TAILQ_ENTRY(unixctl_cmd_request) next;
+    int fd;
+    uint32_t events;
+    struct unixctl_cmd_message in;
+    size_t in_len;
+    char line[CMDMSG_DATA_SIZE + 1];
+    char *tokens[CMD_MAX_OPTIONS];
+    uint32_t n_tokens;
+    struct unixctl_cmd_entry *entry;
+    /* Reply messages, the last one is filled up before a new one. */
+    char *out;
+    size_t out_len, out_size, out_off;
+    size_t out_last;
+};
+
+TAILQ_HEAD(unixctl_cmd_request_head, unixctl_cmd_request);
+
+static struct {
+    int fd;
+    int epfd;
+    /* Written by the datapath once the request in flight is done. */
+    int done_fd;
+    int stop_fd;
+    const char *path;
+    pthread_t tid;
+    unixctl_cmd_defer_func *defer;
+    struct unixctl_cmd_request *inflight;
+    /* Waiting for the request in flight. */
+    struct unixctl_cmd_request_head pending;
+} server = {.fd = -1};
+
+/* The request whose command runs on this thread. */
+static __thread struct unixctl_cmd_request *current_req;
+
 struct unixctl_cmd_head unixctl_cmd_entries =
     TAILQ_HEAD_INITIALIZER(unixctl_cmd_entries);
 
@@ -59,13 +105,14 @@ read_cmd_message(int fd, struct unixctl_cmd_message *cmdmsg) {
     iov.iov_len = CMDMSG_HDR_SIZE;
     msgh.msg_iov = &iov;
     msgh.msg_iovlen = 1;
-    ret = recvmsg(fd, &msgh, 0);
+    /* Replies are streamed, a message may arrive in pieces. */
+    ret = recvmsg(fd, &msgh, MSG_WAITALL);
     if (ret <= 0)
         return ret;
     if (msgh.msg_flags & MSG_TRUNC)
         return -1;
     if (cmdmsg->data_size > 0) {
-        ret = read(fd, cmdmsg->data, cmdmsg->data_size);
+        ret = recv(fd, cmdmsg->data, cmdmsg->data_size, MSG_WAITALL);
         if (ret != (int)cmdmsg->data_size)
             return -1;
     }
@@ -107,32 +154,91 @@ __unixctl_command_reply(int fd, int err, const char *buf, size_t buf_len) {
     return 0;
 }
 
-int
-unixctl_command_reply(int fd, const char *format, ...) {
+static int
+request_outbuf_reserve(struct unixctl_cmd_request *req, size_t len) {
+    size_t size;
+    char *out;
+
+    if (req->out_len + len <= req->out_size)
+        return 0;
+    size = req->out_size ? req->out_size : REQ_OUTBUF_SIZE;
+    while (size < req->out_len + len)
+        size *= 2;
+    out = realloc(req->out, size);
+    if (out == NULL)
+        return -1;
+    req->out = out;
+    req->out_size = size;
+    return 0;
+}
+
+static int
+request_reply(struct unixctl_cmd_request *req, int err, const char *buf,
+              size_t buf_len) {
+    struct unixctl_cmd_message *cmdmsg = NULL;
+    uint8_t status = err ? CMDMSG_S_FAIL : CMDMSG_S_SUCCESS;
+    size_t wlen;
+
+    while (buf_len > 0) {
+        if (req->out_len != 0)
+            cmdmsg = (struct unixctl_cmd_message *)(req->out + req->out_last);
+        if (cmdmsg == NULL || cmdmsg->status != status ||
+            cmdmsg->data_size == CMDMSG_CHUNK_SIZE) {
+            /* Reserve a whole chunk, it is filled up in place. */
+            if (request_outbuf_reserve(req, CMDMSG_HDR_SIZE +
+                                                CMDMSG_CHUNK_SIZE) < 0)
+                return -1;
+            req->out_last = req->out_len;
+            cmdmsg = (struct unixctl_cmd_message *)(req->out + req->out_last);
+            cmdmsg->type = CMDMSG_T_REPLY;
+            cmdmsg->status = status;
+            cmdmsg->data_size = 0;
+            req->out_len += CMDMSG_HDR_SIZE;
+        }
+        wlen = MIN(buf_len, (size_t)(CMDMSG_CHUNK_SIZE - cmdmsg->data_size));
+        memcpy(cmdmsg->data + cmdmsg->data_size, buf, wlen);
+        cmdmsg->data_size += wlen;
+        req->out_len += wlen;
+        buf += wlen;
+        buf_len -= wlen;
+    }
+    return 0;
+}
+
+static int
+unixctl_command_vreply(int fd, int err, const char *format, va_list ap) {
     char buf[CMDMSG_DATA_SIZE];
-    va_list ap;
     int buf_len;
 
-    va_start(ap, format);
     buf_len = vsnprintf(buf, CMDMSG_DATA_SIZE, format, ap);
-    va_end(ap);
     if (buf_len < 0)
         return -1;
-    return __unixctl_command_reply(fd, FALSE, buf, buf_len);
+    buf_len = MIN(buf_len, CMDMSG_DATA_SIZE - 1);
+    if (current_req != NULL && current_req->fd == fd)
+        return request_reply(current_req, err, buf, buf_len);
+    return __unixctl_command_reply(fd, err, buf, buf_len);
+}
+
+int
+unixctl_command_reply(int fd, const char *format, ...) {
+    va_list ap;
+    int rc;
+
+    va_start(ap, format);
+    rc = unixctl_command_vreply(fd, FALSE, format, ap);
+    va_end(ap);
+    return rc;
 }
 
 int
 unixctl_command_reply_error(int fd, const char *format, ...) {
-    char buf[CMDMSG_DATA_SIZE];
     va_list ap;
-    int buf_len;
+    int rc;
 
     va_start(ap, format);
-    buf_len = vsnprintf(buf, CMDMSG_DATA_SIZE, format, ap);
+    rc = unixctl_command_vreply(fd, TRUE, format, ap);
     va_end(ap);
-    if (buf_len < 0)
-        return -1;
-    return __unixctl_command_reply(fd, TRUE, buf, buf_len);
+    return rc;
 }
 
 static void
@@ -180,52 +286,342 @@ parse_tokenize_string(char *string, char *tokens[], uint32_t *n_tokens) {
     return 0;
 }
 
-void
-unixctl_server_run_once(int unixctl_server_fd) {
-    struct unixctl_cmd_message cmdmsg;
-    int cfd;
-    char *tokens[CMD_MAX_OPTIONS];
-    uint32_t n_tokens = CMD_MAX_OPTIONS;
+/* Returns the command to run, NULL if the reply is already made. */
+static struct unixctl_cmd_entry *
+request_parse(struct unixctl_cmd_request *req) {
     struct unixctl_cmd_entry *entry;
+    int fd = req->fd;
 
-    cfd = accept(unixctl_server_fd, NULL, NULL);
-    if (cfd < 0)
-        return;
-    if (read_cmd_message(cfd, &cmdmsg) <= 0)
-        goto end;
-    if (parse_tokenize_string(cmdmsg.data, tokens, &n_tokens) < 0) {
-        unixctl_command_reply_error(cfd,
+    memcpy(req->line, req->in.data, req->in.data_size);
+    req->line[req->in.data_size] = '\0';
+    req->n_tokens = CMD_MAX_OPTIONS;
+    if (parse_tokenize_string(req->line, req->tokens, &req->n_tokens) < 0) {
+        unixctl_command_reply_error(fd,
                                     "Unixctl_cmd: Cannot process command with "
                                     "more than %u parameters.\n",
-                                    n_tokens);
-        goto end;
+                                    req->n_tokens);
+        return NULL;
     }
-    if (n_tokens == 0) {
-        unixctl_list_command_cb(cfd, NULL, 0);
-        goto end;
+    if (req->n_tokens == 0) {
+        unixctl_list_command_cb(fd, NULL, 0);
+        return NULL;
     }
-    entry = unixctl_cmd_lookup_by_name(tokens[0]);
+    entry = unixctl_cmd_lookup_by_name(req->tokens[0]);
     if (!entry) {
-        unixctl_command_reply_error(cfd, "Unixctl_cmd: Unknow command %s.\n",
-                                    tokens[0]);
-        goto end;
+        unixctl_command_reply_error(fd, "Unixctl_cmd: Unknow command %s.\n",
+                                    req->tokens[0]);
+        return NULL;
     }
-    if (entry->min_argc > n_tokens - 1) {
+    if (entry->min_argc > req->n_tokens - 1) {
         unixctl_command_reply_error(
-            cfd, "Unixctl_cmd: Too few parameters for command %s.\n",
+            fd, "Unixctl_cmd: Too few parameters for command %s.\n",
             entry->name);
-        goto end;
+        return NULL;
     }
-    if (entry->max_argc < n_tokens - 1) {
+    if (entry->max_argc < req->n_tokens - 1) {
         unixctl_command_reply_error(
-            cfd, "Unixctl_cmd: Too many parameters for command %s.\n",
+            fd, "Unixctl_cmd: Too many parameters for command %s.\n",
             entry->name);
-        goto end;
+        return NULL;
     }
-    if (entry->cb)
-        entry->cb(cfd, tokens + 1, n_tokens - 1);
-end:
-    close(cfd);
+    if (!entry->cb)
+        return NULL;
+    return entry;
+}
+
+static void
+request_free(struct unixctl_cmd_request *req) {
+    if (req->events != 0)
+        epoll_ctl(server.epfd, EPOLL_CTL_DEL, req->fd, NULL);
+    close(req->fd);
+    free(req->out);
+    free(req);
+}
+
+static int
+request_watch(struct unixctl_cmd_request *req, uint32_t events) {
+    struct epoll_event ev = {0};
+    int op;
+
+    if (req->events == events)
+        return 0;
+    if (events == 0) {
+        op = EPOLL_CTL_DEL;
+    } else {
+        op = req->events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        ev.events = events;
+        ev.data.ptr = req;
+    }
+    if (epoll_ctl(server.epfd, op, req->fd, &ev) < 0)
+        return -1;
+    req->events = events;
+    return 0;
+}
+
+/* Writes what the socket takes, the rest once it is writable again. */
+static void
+request_flush(struct unixctl_cmd_request *req) {
+    ssize_t n;
+
+    while (req->out_off < req->out_len) {
+        n = send(req->fd, req->out + req->out_off, req->out_len - req->out_off,
+                 MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN && request_watch(req, EPOLLOUT) == 0)
+                return;
+            break;
+        }
+        req->out_off += n;
+    }
+    request_free(req);
+}
+
+static void
+request_execute(struct unixctl_cmd_request *req) {
+    current_req = req;
+    req->entry->cb(req->fd, req->tokens + 1, req->n_tokens - 1);
+    current_req = NULL;
+}
+
+/* Writes the reply so far, waiting for the client to read it. */
+static int
+request_stream_flush(struct unixctl_cmd_request *req) {
+    struct pollfd pfd = {.fd = req->fd, .events = POLLOUT};
+    ssize_t n;
+    int rc = 0;
+
+    while (req->out_off < req->out_len) {
+        n = send(req->fd, req->out + req->out_off, req->out_len - req->out_off,
+                 MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR ||
+                (errno == EAGAIN && poll(&pfd, 1, REQ_STREAM_TIMEOUT_MS) > 0))
+                continue;
+            rc = -1;
+            break;
+        }
+        req->out_off += n;
+    }
+    req->out_len = 0;
+    req->out_off = 0;
+    return rc;
+}
+
+int
+unixctl_command_flush(int fd) {
+    struct unixctl_cmd_request *req = current_req;
+
+    if (req == NULL || req->fd != fd ||
+        !(req->entry->flags & UNIXCTL_CMD_F_STREAM))
+        return 0;
+    return request_stream_flush(req);
+}
+
+static void *
+request_stream_thread(void *arg) {
+    struct unixctl_cmd_request *req = arg;
+
+    request_execute(req);
+    request_stream_flush(req);
+    request_free(req);
+    return NULL;
+}
+
+static void
+request_dispatch(struct unixctl_cmd_request *req) {
+    pthread_t tid;
+
+    if (req->entry->flags & UNIXCTL_CMD_F_STREAM) {
+        if (pthread_create(&tid, NULL, request_stream_thread, req) == 0) {
+            pthread_detach(tid);
+            return;
+        }
+        current_req = req;
+        unixctl_command_reply_error(req->fd, "Unixctl_cmd: Server busy.\n");
+        current_req = NULL;
+        request_flush(req);
+        return;
+    }
+    if (server.inflight != NULL) {
+        TAILQ_INSERT_TAIL(&server.pending, req, next);
+        return;
+    }
+    if ((req->entry->flags & UNIXCTL_CMD_F_DATAPATH) && server.defer) {
+        server.inflight = req;
+        if (server.defer(req) == 0)
+            return;
+        server.inflight = NULL;
+        current_req = req;
+        unixctl_command_reply_error(req->fd, "Unixctl_cmd: Datapath busy.\n");
+        current_req = NULL;
+    } else {
+        request_execute(req);
+    }
+    request_flush(req);
+}
+
+void
+unixctl_cmd_request_run(struct unixctl_cmd_request *req) {
+    uint64_t v = 1;
+
+    request_execute(req);
+    if (write(server.done_fd, &v, sizeof(v)) < 0)
+        return;
+}
+
+static void
+server_request_done(void) {
+    struct unixctl_cmd_request *req;
+    uint64_t v;
+
+    if (read(server.done_fd, &v, sizeof(v)) < 0 || server.inflight == NULL)
+        return;
+    req = server.inflight;
+    server.inflight = NULL;
+    request_flush(req);
+    while (server.inflight == NULL &&
+           (req = TAILQ_FIRST(&server.pending)) != NULL) {
+        TAILQ_REMOVE(&server.pending, req, next);
+        request_dispatch(req);
+    }
+}
+
+static void
+server_accept(void) {
+    struct unixctl_cmd_request *req;
+    int cfd;
+
+    while ((cfd = accept(server.fd, NULL, NULL)) >= 0) {
+        req = calloc(1, sizeof(*req));
+        if (req == NULL || fcntl(cfd, F_SETFL, O_NONBLOCK) < 0) {
+            free(req);
+            close(cfd);
+            continue;
+        }
+        req->fd = cfd;
+        if (request_watch(req, EPOLLIN) < 0)
+            request_free(req);
+    }
+}
+
+static void
+request_read(struct unixctl_cmd_request *req) {
+    size_t want;
+    ssize_t n;
+
+    for (;;) {
+        want = CMDMSG_HDR_SIZE;
+        if (req->in_len >= CMDMSG_HDR_SIZE)
+            want += req->in.data_size;
+        if (req->in_len == want)
+            break;
+        n = read(req->fd, (char *)&req->in + req->in_len, want - req->in_len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN)
+            return;
+        if (n <= 0) {
+            request_free(req);
+            return;
+        }
+        req->in_len += n;
+        if (req->in_len == CMDMSG_HDR_SIZE &&
+            req->in.data_size > CMDMSG_DATA_SIZE) {
+            request_free(req);
+            return;
+        }
+    }
+
+    /* One request per connection, the reply is all that is left. */
+    if (request_watch(req, 0) < 0) {
+        request_free(req);
+        return;
+    }
+    current_req = req;
+    req->entry = request_parse(req);
+    current_req = NULL;
+    if (req->entry == NULL)
+        request_flush(req);
+    else
+        request_dispatch(req);
+}
+
+static void *
+server_thread(__attribute__((unused)) void *arg) {
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    struct unixctl_cmd_request *req;
+    int i, n;
+
+    for (;;) {
+        n = epoll_wait(server.epfd, events, SERVER_MAX_EVENTS, -1);
+        if (n < 0 && errno != EINTR)
+            break;
+        for (i = 0; i < n; i++) {
+            if (events[i].data.ptr == &server.stop_fd)
+                return NULL;
+            if (events[i].data.ptr == &server.fd) {
+                server_accept();
+            } else if (events[i].data.ptr == &server.done_fd) {
+                server_request_done();
+            } else {
+                req = events[i].data.ptr;
+                if (req->events & EPOLLIN)
+                    request_read(req);
+                else
+                    request_flush(req);
+            }
+        }
+    }
+    return NULL;
+}
+
+static int
+server_watch(int *fdp) {
+    struct epoll_event ev = {0};
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = fdp;
+    return epoll_ctl(server.epfd, EPOLL_CTL_ADD, *fdp, &ev);
+}
+
+int
+unixctl_server_start(const char *path, unixctl_cmd_defer_func *defer,
+                     pthread_t *tid) {
+    server.fd = unixctl_server_create(path);
+    if (server.fd < 0)
+        return -1;
+    server.path = path;
+    server.defer = defer;
+    TAILQ_INIT(&server.pending);
+
+    server.epfd = epoll_create1(EPOLL_CLOEXEC);
+    server.done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server.stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server.epfd < 0 || server.done_fd < 0 || server.stop_fd < 0)
+        return -1;
+    if (server_watch(&server.fd) < 0 || server_watch(&server.done_fd) < 0 ||
+        server_watch(&server.stop_fd) < 0)
+        return -1;
+
+    if (pthread_create(&server.tid, NULL, server_thread, NULL) != 0)
+        return -1;
+    if (tid != NULL)
+        *tid = server.tid;
+    return 0;
+}
+
+void
+unixctl_server_stop(void) {
+    uint64_t v = 1;
+
+    if (server.fd < 0)
+        return;
+    if (write(server.stop_fd, &v, sizeof(v)) == sizeof(v))
+        pthread_join(server.tid, NULL);
+    unixctl_server_destory(server.fd, server.path);
+    server.fd = -1;
 }
 
 int
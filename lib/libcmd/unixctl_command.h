@@ -3,18 +3,28 @@
 #ifndef __UNIXCTL_COMMAND_H__
 #define __UNIXCTL_COMMAND_H__
 
+#include <pthread.h>
 #include <stdint.h>
 
 #include <sys/queue.h>
 
 typedef void unixctl_command_cb_func(int, char **, int);
 
+/* The command changes datapath state, it runs on the datapath. */
+#define UNIXCTL_CMD_F_DATAPATH 0x1
+/*
+ * The command may reply at length, it runs on a thread of its own and
+ * sends its reply on every unixctl_command_flush().
+ */
+#define UNIXCTL_CMD_F_STREAM 0x2
+
 struct unixctl_cmd_entry {
     TAILQ_ENTRY(unixctl_cmd_entry) next;
     const char *name;
     const char *usage;
     const char *summary;
     uint16_t min_argc, max_argc;
+    uint32_t flags;
     unixctl_command_cb_func *cb;
 };
 
@@ -22,25 +32,59 @@ TAILQ_HEAD(unixctl_cmd_head, unixctl_cmd_entry);
 
 extern struct unixctl_cmd_head unixctl_cmd_entries;
 
-#define UNIXCTL_CMD_REGISTER(n, u, s, min, max, f)                             \
+#define UNIXCTL_CMD_REGISTER_FLAGS(n, u, s, min, max, f, fl)                   \
     struct unixctl_cmd_entry cmd_##f = {                                       \
         .name = n,                                                             \
         .usage = u,                                                            \
         .summary = s,                                                          \
         .min_argc = min,                                                       \
         .max_argc = max,                                                       \
+        .flags = fl,                                                           \
         .cb = f,                                                               \
     };                                                                         \
     __attribute__((constructor)) static void unixctl_cmd_register_##f(void) {  \
         TAILQ_INSERT_TAIL(&unixctl_cmd_entries, &cmd_##f, next);               \
     }
 
+#define UNIXCTL_CMD_REGISTER(n, u, s, min, max, f)                             \
+    UNIXCTL_CMD_REGISTER_FLAGS(n, u, s, min, max, f, 0)
+
+#define UNIXCTL_CMD_REGISTER_DATAPATH(n, u, s, min, max, f)                    \
+    UNIXCTL_CMD_REGISTER_FLAGS(n, u, s, min, max, f, UNIXCTL_CMD_F_DATAPATH)
+
+#define UNIXCTL_CMD_REGISTER_STREAM(n, u, s, min, max, f)                      \
+    UNIXCTL_CMD_REGISTER_FLAGS(n, u, s, min, max, f, UNIXCTL_CMD_F_STREAM)
+
+/* A command being served, owned by the server thread. */
+struct unixctl_cmd_request;
+
+/*
+ * Hands a UNIXCTL_CMD_F_DATAPATH request over to the datapath, which calls
+ * unixctl_cmd_request_run() on it. Returns 0 on success.
+ */
+typedef int unixctl_cmd_defer_func(struct unixctl_cmd_request *);
+
 int unixctl_command_reply(int fd, const char *format, ...);
 int unixctl_command_reply_error(int fd, const char *format, ...);
+/*
+ * Sends the reply so far of a UNIXCTL_CMD_F_STREAM command, a no-op for
+ * the others. Returns -1 once the client is gone.
+ */
+int unixctl_command_flush(int fd);
 
 int unixctl_server_create(const char *path);
 void unixctl_server_destory(int fd, const char *path);
-void unixctl_server_run_once(int unixctl_server_fd);
+
+/*
+ * Serves clients on a thread of its own. Stream commands get a thread
+ * each, the other commands run on that thread one at a time and never
+ * while a datapath command is running. Their replies are buffered and
+ * streamed to the client once the command returns.
+ */
+int unixctl_server_start(const char *path, unixctl_cmd_defer_func *defer,
+                         pthread_t *tid);
+void unixctl_server_stop(void);
+void unixctl_cmd_request_run(struct unixctl_cmd_request *req);
 
 int unixctl_client_create(const char *path);
 void unixctl_client_destory(int fd, const char *path);